@@ -0,0 +1,511 @@
+/**
+ * @file main.cpp
+ * @author Mattheas Jamieson (mattheas@ualberta.ca)
+ * @brief Benchmark firmware, measures SD card throughput/ latency and file system operation times
+ * on the target and reports the results over XPD
+ * @version 0.1
+ * @date 2024-03-03
+ *
+ * @details Built as the benchmark target (SD_FS_BENCHMARK CMake option). The card must hold a
+ * FAT32 file system with room for a 128 KB scratch file, everything the benchmark creates is
+ * deleted again at the end. Raw block transfers only ever touch the clusters of the scratch file
+ * (BEN00.BIN), so the rest of the card is left as it was.
+ *
+ * Every result is reported as raw values, "name: blocks 0xXXXXXXXX ticks 0xXXXXXXXX", so MB/s
+ * (blocks * 512 / seconds), IOPS and hit ratios are worked out on the host (the XInC2 has no
+ * divide). Ticks come from benchmark_read_ticks(), see below.
+ */
+
+#include <SystemClock.h>
+#include <XPD.h>
+
+#include "../../inc/SDCard.h"
+#include "../../inc/FileSystem.h"
+
+using namespace sd_driver;
+using namespace file_system;
+
+/**
+ * @brief Free running tick counter the results are timed with, provided by the board
+ *
+ * @details libspine has no readable system clock counter, so a board that has one (e.g., a
+ * hardware timer clocked from sys_clock) overrides this weak definition. Only differences between
+ * two reads are used, so it may wrap, but one block transfer must take less than 65536 ticks.
+ * Without an override every tick total is 0 and only the counts are meaningful.
+ */
+uint16_t __attribute__((weak)) benchmark_read_ticks()
+{
+    return 0U;
+}
+
+namespace
+{
+/**
+ * @brief Size of BEN00.BIN in blocks, the raw transfer tests run over the first power of two
+ * blocks of its first extent
+ */
+constexpr uint16_t scratch_blocks = 256U;
+
+/**
+ * @brief Blocks per multi block transfer, transfer_buffer holds this many blocks
+ */
+constexpr uint16_t blocks_per_transfer = 4U;
+
+/**
+ * @brief Times each sequential test goes over the scratch blocks
+ */
+constexpr uint16_t sequential_passes = 4U;
+
+/**
+ * @brief Random single block reads/ writes per test
+ */
+constexpr uint16_t random_operations = 256U;
+
+/**
+ * @brief Files created in the root directory for the mount test, the entry table has room
+ * for FileSystem::total_directory_entries entries in total
+ */
+constexpr uint16_t mount_test_files = 32U;
+
+/**
+ * @brief Lengths (in clusters) of the files deleted in the delete test
+ */
+const uint16_t delete_test_clusters[] = {1U, 8U, 64U, 512U};
+constexpr uint16_t number_of_delete_tests = sizeof(delete_test_clusters) / sizeof(delete_test_clusters[0]);
+
+const uint16_t no_enclosing_directories[10][11] = {};
+
+uint16_t transfer_buffer[blocks_per_transfer * PackedSector::words_per_sector];
+
+/**
+ * @brief Block cache and sector buffer of every FileSystem the tests mount (one at a time)
+ */
+MountManager mount_manager;
+
+PackedSector transfer_sector;
+
+struct BenchmarkResult
+{
+    Address32 blocks;
+
+    Address32 ticks;
+};
+
+/**
+ * @brief Adds the time since start_ticks and number_of_blocks blocks to result
+ */
+void record(BenchmarkResult &result, const uint16_t start_ticks, const uint16_t number_of_blocks)
+{
+    const uint16_t elapsed_ticks = benchmark_read_ticks() - start_ticks;
+
+    result.blocks += Address32(0x0, number_of_blocks);
+    result.ticks += Address32(0x0, elapsed_ticks);
+}
+
+void report(const char *name, const BenchmarkResult &result)
+{
+    OperationStatistics operation;
+    operation.count = result.blocks;
+    operation.ticks = result.ticks;
+
+    // printed as "name: count (blocks) ticks"
+    xpd_echo_operation_statistics(name, operation);
+}
+
+/**
+ * @brief 16 bit xorshift, a repeatable sequence of random block offsets
+ */
+uint16_t next_random(uint16_t &state)
+{
+    state ^= state << 7;
+    state ^= state >> 9;
+    state ^= state << 8;
+    return state;
+}
+
+/**
+ * @brief Fills a name in 8.3 format, prefix is 3 characters and number (0-255) becomes 2 hex digits
+ */
+void make_name(const char *prefix, const uint16_t number, uint16_t (&name)[11])
+{
+    constexpr char hex_digits[] = "0123456789ABCDEF";
+    const char extension[] = "BIN";
+
+    for (uint16_t i = 0; i < 3U; i++)
+    {
+        name[i] = prefix[i];
+        name[8U + i] = extension[i];
+    }
+
+    name[3] = hex_digits[(number >> 4) & 0xF];
+    name[4] = hex_digits[number & 0xF];
+    name[5] = ' ';
+    name[6] = ' ';
+    name[7] = ' ';
+}
+
+/**
+ * @brief Appends num_blocks blocks of transfer_buffer to file, the clusters are preallocated first
+ * so the file is as contiguous as the free space allows (close() releases preallocated clusters
+ * past the end of the file, so the data has to be written)
+ */
+bool fill_file(FileSystem &file_system, FileSystem::File &file, const Address32 &num_blocks)
+{
+    constexpr uint16_t bytes_per_transfer = blocks_per_transfer * PackedSector::bytes_per_sector;
+
+    if (file_system.preallocate(file, num_blocks << 9) == false)
+    {
+        return false;
+    }
+
+    for (Address32 block; block < num_blocks; block += Address32(0x0, blocks_per_transfer))
+    {
+        if (file_system.append(file, transfer_buffer, bytes_per_transfer) == false)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Sector address of a cluster, from the public MBR/ volume id of a mounted file system
+ */
+Address32 cluster_to_sector_address(const FileSystem &file_system, const Address32 &cluster_number)
+{
+    const FileSystem::FAT32MasterBootRecord master_boot_record = file_system.get_fat_32_master_boot_record();
+    const FileSystem::FAT32VolumeID volume_id = file_system.get_fat_32_volume_id();
+
+    const Address32 cluster_begin_lba = master_boot_record.primary_partitions[0].lba_begin +
+        Address32(0x0, volume_id.size_of_reserved_area_sectors) + volume_id.sectors_per_fat.multiply(volume_id.number_of_fats);
+
+    return cluster_begin_lba + ((cluster_number - Address32(0x0, 2U)) << Address32::log2(volume_id.sectors_per_cluster));
+}
+
+/**
+ * @brief Creates BEN00.BIN (scratch_blocks blocks) and finds the blocks the raw tests may use
+ *
+ * @param first_block returned sector address of the first scratch block
+ * @param number_of_blocks returned number of scratch blocks, a power of two (0 on failure)
+ */
+void create_scratch_file(FileSystem &file_system, Address32 &first_block, uint16_t &number_of_blocks)
+{
+    uint16_t name[11];
+    make_name("BEN", 0U, name);
+
+    number_of_blocks = 0U;
+
+    // left over from an earlier run that was cut short
+    file_system.delete_file(name, 0U, no_enclosing_directories);
+
+    FileSystem::File file;
+    if (file_system.create(name, 0U, no_enclosing_directories, file) == false)
+    {
+        return;
+    }
+
+    const bool filled = fill_file(file_system, file, Address32(0x0, scratch_blocks));
+    file_system.close(file);
+
+    // reopened for reading so the chain is resolved into extents
+    if (filled == false || file_system.open(name, 0U, no_enclosing_directories, file) == false)
+    {
+        return;
+    }
+
+    if (file.number_of_extents == 0U)
+    {
+        file_system.close(file);
+        return;
+    }
+
+    const FileSystem::FileExtent &extent = file.extents[0];
+    const Address32 extent_blocks = extent.number_of_clusters << Address32::log2(file_system.get_fat_32_volume_id().sectors_per_cluster);
+
+    first_block = cluster_to_sector_address(file_system, extent.first_cluster);
+
+    // largest power of two that fits in both, so random offsets are a mask
+    number_of_blocks = scratch_blocks;
+    while (number_of_blocks > 0U && Address32(0x0, number_of_blocks) > extent_blocks)
+    {
+        number_of_blocks >>= 1;
+    }
+
+    file_system.close(file);
+}
+
+void run_sequential_tests(SDCard &sd_card, const Address32 &first_block, const uint16_t &number_of_blocks)
+{
+    BenchmarkResult single_block_writes;
+    BenchmarkResult multiple_block_writes;
+    BenchmarkResult single_block_reads;
+    BenchmarkResult multiple_block_reads;
+
+    for (uint16_t i = 0; i < PackedSector::words_per_sector; i++)
+    {
+        transfer_sector.words[i] = i;
+    }
+    for (uint16_t i = 0; i < blocks_per_transfer * PackedSector::words_per_sector; i++)
+    {
+        transfer_buffer[i] = i;
+    }
+
+    for (uint16_t pass = 0; pass < sequential_passes; pass++)
+    {
+        for (uint16_t block = 0; block < number_of_blocks; block++)
+        {
+            const uint16_t start_ticks = benchmark_read_ticks();
+            sd_card.write_block(transfer_sector, first_block + Address32(0x0, block));
+            record(single_block_writes, start_ticks, 1U);
+        }
+
+        // the last write is only complete once the card has programmed it
+        const uint16_t start_ticks = benchmark_read_ticks();
+        sd_card.flush();
+        record(single_block_writes, start_ticks, 0U);
+    }
+
+    for (uint16_t pass = 0; pass < sequential_passes; pass++)
+    {
+        for (uint16_t block = 0; block < number_of_blocks; block += blocks_per_transfer)
+        {
+            const uint16_t start_ticks = benchmark_read_ticks();
+            sd_card.write_contiguous_blocks(transfer_buffer, first_block + Address32(0x0, block), blocks_per_transfer);
+            record(multiple_block_writes, start_ticks, blocks_per_transfer);
+        }
+
+        const uint16_t start_ticks = benchmark_read_ticks();
+        sd_card.flush();
+        record(multiple_block_writes, start_ticks, 0U);
+    }
+
+    for (uint16_t pass = 0; pass < sequential_passes; pass++)
+    {
+        for (uint16_t block = 0; block < number_of_blocks; block++)
+        {
+            const uint16_t start_ticks = benchmark_read_ticks();
+            sd_card.read_block(transfer_sector, first_block + Address32(0x0, block));
+            record(single_block_reads, start_ticks, 1U);
+        }
+    }
+
+    for (uint16_t pass = 0; pass < sequential_passes; pass++)
+    {
+        for (uint16_t block = 0; block < number_of_blocks; block += blocks_per_transfer)
+        {
+            const uint16_t start_ticks = benchmark_read_ticks();
+            sd_card.read_contiguous_blocks(transfer_buffer, first_block + Address32(0x0, block), blocks_per_transfer);
+            record(multiple_block_reads, start_ticks, blocks_per_transfer);
+        }
+    }
+
+    report("sequential write single block", single_block_writes);
+    report("sequential write multiple block", multiple_block_writes);
+    report("sequential read single block", single_block_reads);
+    report("sequential read multiple block", multiple_block_reads);
+}
+
+void run_random_tests(SDCard &sd_card, const Address32 &first_block, const uint16_t &number_of_blocks)
+{
+    BenchmarkResult random_reads;
+    BenchmarkResult random_writes;
+
+    const uint16_t block_mask = number_of_blocks - 1U;
+
+    // same seed for both so the runs are repeatable
+    uint16_t random_state = 0xACE1;
+    for (uint16_t i = 0; i < random_operations; i++)
+    {
+        const Address32 block_address = first_block + Address32(0x0, next_random(random_state) & block_mask);
+
+        const uint16_t start_ticks = benchmark_read_ticks();
+        sd_card.read_block(transfer_sector, block_address);
+        record(random_reads, start_ticks, 1U);
+    }
+
+    random_state = 0xACE1;
+    for (uint16_t i = 0; i < random_operations; i++)
+    {
+        const Address32 block_address = first_block + Address32(0x0, next_random(random_state) & block_mask);
+
+        const uint16_t start_ticks = benchmark_read_ticks();
+        sd_card.write_block(transfer_sector, block_address);
+        record(random_writes, start_ticks, 1U);
+    }
+
+    const uint16_t start_ticks = benchmark_read_ticks();
+    sd_card.flush();
+    record(random_writes, start_ticks, 0U);
+
+    report("random read", random_reads);
+    report("random write", random_writes);
+}
+
+/**
+ * @brief Time to mount (construct a FileSystem, FAT32 with the full directory scan)
+ */
+void time_mount(SDCard &sd_card, const char *name)
+{
+    BenchmarkResult mount;
+
+    const uint16_t start_ticks = benchmark_read_ticks();
+    {
+        FileSystem file_system(mount_manager, sd_card, FileSystem::file_system_t::FAT32);
+        record(mount, start_ticks, 0U);
+    }
+
+    report(name, mount);
+}
+
+void run_mount_test(SDCard &sd_card)
+{
+    time_mount(sd_card, "mount before");
+
+    uint16_t files_created = 0U;
+    {
+        FileSystem file_system(mount_manager, sd_card, FileSystem::file_system_t::FAT32);
+
+        for (; files_created < mount_test_files; files_created++)
+        {
+            uint16_t name[11];
+            make_name("MNT", files_created, name);
+
+            FileSystem::File file;
+            if (file_system.create(name, 0U, no_enclosing_directories, file) == false)
+            {
+                break;
+            }
+
+            file_system.append(file, transfer_buffer, 16U);
+            file_system.close(file);
+        }
+
+        file_system.unmount();
+    }
+
+    xpd_echo_statistic("mount files created", Address32(0x0, files_created));
+    time_mount(sd_card, "mount after");
+
+    FileSystem file_system(mount_manager, sd_card, FileSystem::file_system_t::FAT32);
+    for (uint16_t i = 0; i < files_created; i++)
+    {
+        uint16_t name[11];
+        make_name("MNT", i, name);
+        file_system.delete_file(name, 0U, no_enclosing_directories);
+    }
+    file_system.unmount();
+}
+
+void run_delete_test(FileSystem &file_system)
+{
+    const uint16_t sectors_per_cluster_shift = Address32::log2(file_system.get_fat_32_volume_id().sectors_per_cluster);
+
+    for (uint16_t i = 0; i < number_of_delete_tests; i++)
+    {
+        uint16_t name[11];
+        make_name("DEL", i, name);
+
+        FileSystem::File file;
+        if (file_system.create(name, 0U, no_enclosing_directories, file) == false)
+        {
+            break;
+        }
+
+        const bool filled = fill_file(file_system, file, Address32(0x0, delete_test_clusters[i]) << sectors_per_cluster_shift);
+        file_system.close(file);
+
+        if (filled == false)
+        {
+            xpd_puts("no room for the delete test\n");
+            file_system.delete_file(name, 0U, no_enclosing_directories);
+            break;
+        }
+        file_system.unmount();
+
+        // FATCache counters of the delete alone
+        file_system.reset_statistics();
+
+        BenchmarkResult delete_file;
+        const uint16_t start_ticks = benchmark_read_ticks();
+        file_system.delete_file(name, 0U, no_enclosing_directories);
+        file_system.unmount();
+        record(delete_file, start_ticks, delete_test_clusters[i]);
+
+        // blocks is the number of clusters of the deleted file
+        report("delete clusters", delete_file);
+
+        const FATCache::FATCacheStatistics fat_cache_statistics = file_system.get_fat_cache_statistics();
+        xpd_echo_statistic("delete fat cache hits", fat_cache_statistics.hits);
+        xpd_echo_statistic("delete fat cache misses", fat_cache_statistics.misses);
+    }
+}
+} // namespace
+
+// main() runs in thread 0
+int main(void)
+{
+    SDCard sd_card(true);
+
+    // the board only has SPI_set_config_optimal(), the data clock is still set (and reported) through the ramp
+    SDCard::OptimalSPIClock optimal_spi_clock;
+    sd_card.set_spi_clock_callback(SDCard::optimal_spi_clock_callback, &optimal_spi_clock);
+
+    xpd_puts("\nsd benchmark\n");
+    if (sd_card.initialize_sd_card() != SDCard::initialization_result_t::INIT_SUCCESS)
+    {
+        xpd_puts("initialization failed\n");
+        while (true) { continue; }
+    }
+
+    const SDCard::SDCardInformation information = sd_card.get_sd_card_information();
+    xpd_echo_statistic("spi clock khz", Address32(0x0, information.spi_clock_khz));
+    xpd_echo_statistic("maximum clock khz", Address32(0x0, information.maximum_clock_khz));
+    xpd_echo_statistic("read access bytes", Address32(0x0, information.read_access_bytes));
+    xpd_echo_statistic("busy poll limit", Address32(0x0, information.busy_poll_limit));
+
+    StatisticsClock::set_tick_source(benchmark_read_ticks);
+
+    Address32 first_block;
+    uint16_t number_of_blocks = 0U;
+    {
+        FileSystem file_system(mount_manager, sd_card, FileSystem::file_system_t::FAT32);
+        create_scratch_file(file_system, first_block, number_of_blocks);
+        file_system.unmount();
+    }
+
+    if (number_of_blocks < blocks_per_transfer)
+    {
+        xpd_puts("no room for BEN00.BIN\n");
+        while (true) { continue; }
+    }
+
+    xpd_echo_statistic("scratch blocks", Address32(0x0, number_of_blocks));
+
+    sd_card.reset_statistics();
+    run_sequential_tests(sd_card, first_block, number_of_blocks);
+    run_random_tests(sd_card, first_block, number_of_blocks);
+
+    run_mount_test(sd_card);
+
+    {
+        FileSystem file_system(mount_manager, sd_card, FileSystem::file_system_t::FAT32);
+        run_delete_test(file_system);
+
+        uint16_t name[11];
+        make_name("BEN", 0U, name);
+        file_system.delete_file(name, 0U, no_enclosing_directories);
+        file_system.unmount();
+
+        // counters of the whole run, only collected when built with SD_FS_STATISTICS
+        xpd_puts("sd card statistics\n");
+        sd_card.dump_statistics();
+        xpd_puts("file system statistics\n");
+        file_system.dump_statistics();
+    }
+
+    xpd_puts("sd benchmark done\n");
+    while (true) { continue; }
+
+    return 0;
+}
@@ -0,0 +1,254 @@
+/**
+ * @file ImageBlockDevice.h
+ * @author Mattheas Jamieson (mattheas@ualberta.ca)
+ * @brief Declaration of host block device backed by a card image file, with an SPI cost model
+ * @version 0.1
+ * @date 2024-03-03
+ */
+
+#ifndef _IMAGEBLOCKDEVICE_H_
+#define _IMAGEBLOCKDEVICE_H_
+
+#include "../../inc/BlockDevice.h"
+#include <stdint.h>
+#include <stdio.h>
+
+namespace sd_driver
+{
+
+/**
+ * @brief BlockDevice over a raw image of an SD card (e.g., made with dd or host/mkimage.py), so
+ * FileSystem can be run, profiled and regression tested on a PC. Only used by the host build.
+ *
+ * @details Every call is charged what SDCard would clock over SPI1 for it: the CS preamble, the 6
+ * byte command and its R1 response, the start block token wait, 512 data bytes and 2 CRC bytes per
+ * block, CMD12/ stop tran tokens and the CMD55 + ACMD23 pre-erase hint of a multiple block write.
+ * The time the card spends programming is added as simulated busy time. The counts are exact for
+ * the driver, the byte/ time figures are only as good as SPICostModel (the defaults are for a
+ * typical card, set clock_khz to the SDCardInformation::spi_clock_khz the board ends up at).
+ *
+ * A power cut can be simulated with cut_power_after(), every block written after it still
+ * succeeds but never reaches the image (as if the card lost power mid transfer), so what mount
+ * recovers from a brown-out at any write can be checked.
+ */
+class ImageBlockDevice : public BlockDevice
+{
+  public:
+    struct SPICostModel
+    {
+        /**
+         * @brief SPI clock, a byte takes 8000 / clock_khz microseconds
+         */
+        uint32_t clock_khz = 12000U;
+
+        /**
+         * @brief 0xFF bytes sent after CS is asserted (SDCardInformation::command_preamble_bytes)
+         */
+        uint32_t command_preamble_bytes = 20U;
+
+        /**
+         * @brief Bytes read until the R1 response arrives (Ncr, 1-8)
+         */
+        uint32_t command_response_bytes = 2U;
+
+        /**
+         * @brief Bytes read until the start block token of every block read arrives (Nac)
+         */
+        uint32_t read_access_bytes = 100U;
+
+        /**
+         * @brief Card busy time after a single block write (CMD24)
+         */
+        uint32_t single_block_busy_us = 700U;
+
+        /**
+         * @brief Card busy time after each block of a multiple block write (CMD25), lower than for
+         * CMD24 since the blocks were pre-erased
+         */
+        uint32_t multiple_block_busy_us = 250U;
+
+        /**
+         * @brief Card busy time after the stop tran token that ends a multiple block write
+         */
+        uint32_t stop_transmission_busy_us = 500U;
+
+        /**
+         * @brief Allocation unit reported by get_allocation_unit_blocks()
+         * (SDCardInformation::allocation_unit_blocks), 0 for a card that reports none
+         */
+        uint32_t allocation_unit_blocks = 0U;
+    };
+
+    struct SPICostStatistics
+    {
+        /**
+         * @brief Every command sent, including CMD12, CMD55 and ACMD23
+         */
+        uint64_t commands = 0U;
+
+        uint64_t cmd17_commands = 0U;
+        uint64_t cmd18_commands = 0U;
+        uint64_t cmd24_commands = 0U;
+        uint64_t cmd25_commands = 0U;
+
+        uint64_t blocks_read = 0U;
+        uint64_t blocks_written = 0U;
+
+        /**
+         * @brief Bytes clocked over SPI, not counting the polls made while the card is busy
+         */
+        uint64_t spi_bytes = 0U;
+
+        /**
+         * @brief Simulated time the card was busy programming
+         */
+        uint64_t busy_us = 0U;
+
+        /**
+         * @brief Multiple block writes that went past the end of an allocation unit into the next
+         */
+        uint64_t allocation_unit_crossings = 0U;
+    };
+
+    /**
+     * @brief Constructs a new ImageBlockDevice object with the default SPICostModel
+     */
+    ImageBlockDevice();
+
+    ImageBlockDevice(const SPICostModel &_cost_model);
+
+    ~ImageBlockDevice();
+
+    /**
+     * @brief Opens an image for reading and writing, the device is as large as the image (whole
+     * blocks only)
+     *
+     * @return true image was opened
+     * @return false image could not be opened or is smaller than a block
+     */
+    bool open(const char *image_path);
+
+    void close();
+
+    uint32_t get_number_of_blocks() const;
+
+    bool read_block(PackedSector &block, const Address32 &block_address) override;
+
+    bool write_block(const PackedSector &block, const Address32 &block_address) override;
+
+    bool read_blocks(PackedSector &block, const Address32 &block_address, const uint16_t &num_blocks,
+                        block_read_callback_t block_callback, void *context) override;
+
+    bool write_blocks(PackedSector &block, const Address32 &block_address, const uint16_t &num_blocks,
+                        block_write_callback_t block_callback, void *context) override;
+
+    bool read_contiguous_blocks(uint16_t *words, const Address32 &block_address, const uint16_t &num_blocks) override;
+
+    bool write_contiguous_blocks(const uint16_t *words, const Address32 &block_address, const uint16_t &num_blocks) override;
+
+    /**
+     * @brief Flushes the image file
+     */
+    bool flush() override;
+
+    /**
+     * @brief SPICostModel::allocation_unit_blocks
+     */
+    Address32 get_allocation_unit_blocks() const override;
+
+    SPICostStatistics get_statistics() const;
+
+    void reset_statistics();
+
+    /**
+     * @brief Cuts the power once another num_blocks blocks have been written, later writes are
+     * dropped until restore_power()
+     */
+    void cut_power_after(const uint32_t &num_blocks);
+
+    void restore_power();
+
+    /**
+     * @brief True if a write was dropped since cut_power_after()
+     */
+    bool is_power_cut() const;
+
+    /**
+     * @brief Simulated time of everything since the last reset_statistics(), SPI transfers plus
+     * busy time
+     */
+    uint64_t get_simulated_us() const;
+
+    /**
+     * @brief Prints the statistics as one line, "name: commands X ... simulated_us X"
+     */
+    void print_statistics(const char *name) const;
+
+  private:
+    /**
+     * @brief Charges the preamble, one command and its response
+     */
+    void charge_command();
+
+    /**
+     * @brief Charges the CMD12 that ends a multiple block read
+     */
+    void charge_stop_transmission();
+
+    /**
+     * @brief Charges the stop tran token that ends a multiple block write and the busy time after it
+     */
+    void charge_stop_tran_token();
+
+    /**
+     * @brief Charges the byte clocked after CS is de-asserted at the end of a transfer
+     */
+    void charge_end_of_transfer();
+
+    /**
+     * @brief Charges the start block token wait, the token, data and CRC of one block read
+     */
+    void charge_block_read();
+
+    /**
+     * @brief Charges the start block token, data, CRC and data response of one block written
+     */
+    void charge_block_write();
+
+    /**
+     * @brief Counts a multiple block write of num_blocks blocks from block_address that spans two
+     * allocation units
+     */
+    void count_allocation_unit_crossing(const Address32 &block_address, const uint16_t &num_blocks);
+
+    /**
+     * @brief True if the num_blocks blocks from block_address are all on the image
+     */
+    bool is_in_range(const Address32 &block_address, const uint16_t &num_blocks) const;
+
+    bool read_image_block(uint16_t *words, const uint32_t &block_number);
+
+    bool write_image_block(const uint16_t *words, const uint32_t &block_number);
+
+    static uint32_t to_uint32(const Address32 &value);
+
+    const SPICostModel cost_model;
+
+    FILE *image = nullptr;
+
+    uint32_t number_of_blocks = 0U;
+
+    SPICostStatistics statistics;
+
+    /**
+     * @brief Blocks still written to the image before the power is cut, see cut_power_after()
+     */
+    uint32_t blocks_until_power_cut = 0U;
+
+    bool power_cut_pending = false;
+
+    bool power_cut = false;
+};
+} // namespace sd_driver
+
+#endif // _IMAGEBLOCKDEVICE_H_
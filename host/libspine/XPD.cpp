@@ -0,0 +1,27 @@
+/**
+ * @file XPD.cpp
+ * @author Mattheas Jamieson (mattheas@ualberta.ca)
+ * @brief Host stand-in for the libspine XPD console functions, prints to stdout
+ * @version 0.1
+ * @date 2024-03-03
+ */
+
+#include "XPD.h"
+#include <stdio.h>
+
+void xpd_putc(const uint16_t character)
+{
+    putchar(character & 0xFF);
+}
+
+void xpd_puts(const char *string)
+{
+    fputs(string, stdout);
+}
+
+void xpd_echo_int(const uint16_t value, const uint16_t flags)
+{
+    (void)flags;
+
+    printf("%u", static_cast<unsigned>(value));
+}
@@ -0,0 +1,27 @@
+/**
+ * @file XPD.h
+ * @author Mattheas Jamieson (mattheas@ualberta.ca)
+ * @brief Host stand-in for the libspine XPD console functions the file system sources use
+ * @version 0.1
+ * @date 2024-03-03
+ *
+ * @details Only used by the host build (host/CMakeLists.txt), everything printed goes to stdout
+ */
+
+#ifndef _HOST_XPD_H_
+#define _HOST_XPD_H_
+
+#include <stdint.h>
+
+enum xpd_flags_t
+{
+    XPD_Flag_UnsignedDecimal = 0x0
+};
+
+void xpd_putc(const uint16_t character);
+
+void xpd_puts(const char *string);
+
+void xpd_echo_int(const uint16_t value, const uint16_t flags);
+
+#endif // _HOST_XPD_H_
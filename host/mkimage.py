@@ -0,0 +1,305 @@
+#!/usr/bin/env python3
+"""Builds a synthetic FAT32 card image and its manifest for the host harness (sd_fs_host).
+
+The image has an MBR with one FAT32 partition, both FATs, an FSInfo sector and a directory tree of
+--directories sub directories of the root holding --files files between them (round robin). With
+--fragment every file gets one cluster per allocation round, so every cluster chain is fragmented
+into single cluster extents. Each file holds a repeatable pattern, byte i is (i * 31 + seed) & 0xFF.
+--reserved-sectors sets the size of the reserved area (SD Formatter leaves thousands of sectors
+there to align the FATs), the driver keeps its intent record and directory snapshot in it.
+--align-sectors N grows the reserved area so the first cluster starts on an N sector boundary, like
+SD Formatter does for the allocation unit of the card (e.g. 8192 for 4 MB).
+--long-names gives every 7th file a long file name (LFN entries before its short entry) and adds to
+the first directory an orphaned long name (LFN entries whose checksum matches no short entry) right
+before a file without one, and two files for the harness to delete: one whose LFN entries are split
+across a sector boundary and one whose LFN entries share the sector of its short entry.
+--partitions N splits the card into N FAT32 partitions of the same size, each built like the one
+above with its own file sizes and patterns.
+
+The manifest has one line per file, "PATH SIZE SEED", e.g. "D003/F0042.BIN 5000 42". Files with a
+long name have it after the seed (the rest of the line, it may hold spaces). A file the harness
+deletes has its path prefixed with '-', and an orphaned long name is "!DIRECTORY LONG NAME".
+The lines of any partition but the first start with its number, e.g. "2:D003/F0042.BIN 5000 127".
+
+usage: mkimage.py IMAGE MANIFEST [--size-mb N] [--sectors-per-cluster N] [--reserved-sectors N] [--align-sectors N]
+                  [--files N] [--directories N] [--min-file-size N] [--max-file-size N] [--fragment] [--long-names]
+                  [--seed N] [--partitions N]
+"""
+import argparse
+import random
+import struct
+
+BYTES_PER_SECTOR = 512
+PARTITION_LBA = 2048
+NUMBER_OF_FATS = 2
+END_OF_CHAIN = 0x0FFFFFFF
+DIRECTORY_ENTRY_BYTES = 32
+ENTRIES_PER_SECTOR = BYTES_PER_SECTOR // DIRECTORY_ENTRY_BYTES
+LONG_NAME_CHARACTERS_PER_ENTRY = 13
+
+
+def short_name(name):
+    if name in ('.', '..'):
+        return name.ljust(11).encode('ascii')
+    base, _, extension = name.partition('.')
+    return (base.ljust(8)[:8] + extension.ljust(3)[:3]).upper().encode('ascii')
+
+
+def directory_entry(name, attribute, first_cluster, size):
+    return (name + bytes([attribute, 0, 0]) + bytes(6) + struct.pack('<H', first_cluster >> 16) + bytes(4) +
+            struct.pack('<HI', first_cluster & 0xFFFF, size))
+
+
+def short_name_checksum(name):
+    checksum = 0
+    for byte in name:
+        checksum = (((checksum & 1) << 7) + (checksum >> 1) + byte) & 0xFF
+    return checksum
+
+
+def long_name_entry_count(long_name):
+    return (len(long_name) + LONG_NAME_CHARACTERS_PER_ENTRY - 1) // LONG_NAME_CHARACTERS_PER_ENTRY
+
+
+def long_name_entries(long_name, checksum):
+    """LFN entries of long_name in the order they are stored, last part first"""
+    characters = [ord(c) for c in long_name] + [0x0000]
+    count = long_name_entry_count(long_name)
+    characters += [0xFFFF] * (count * LONG_NAME_CHARACTERS_PER_ENTRY - len(characters))
+    entries = []
+    for sequence in range(count, 0, -1):
+        part = characters[(sequence - 1) * LONG_NAME_CHARACTERS_PER_ENTRY:sequence * LONG_NAME_CHARACTERS_PER_ENTRY]
+        entry = bytearray(DIRECTORY_ENTRY_BYTES)
+        entry[0] = sequence | (0x40 if sequence == count else 0)
+        struct.pack_into('<5H', entry, 1, *part[0:5])
+        entry[11] = 0x0F
+        entry[13] = checksum
+        struct.pack_into('<6H', entry, 14, *part[5:11])
+        struct.pack_into('<2H', entry, 28, *part[11:13])
+        entries.append(bytes(entry))
+    return entries
+
+
+def deleted_entry():
+    return b'\xE5' + bytes(DIRECTORY_ENTRY_BYTES - 1)
+
+
+def file_pattern(size, seed):
+    return bytes((i * 31 + seed) & 0xFF for i in range(size))
+
+
+def build_volume(arguments, image, partition_number, partition_lba, partition_sectors):
+    """Writes a FAT32 volume and its files into image at partition_lba, returns the files, the
+    orphaned long names and the directory names for the manifest"""
+    # the files of each partition differ in size and pattern
+    seed_offset = (partition_number - 1) * 0x55
+    random_sizes = random.Random(arguments.seed + partition_number - 1)
+    sectors_per_cluster = arguments.sectors_per_cluster
+    bytes_per_cluster = sectors_per_cluster * BYTES_PER_SECTOR
+    reserved_sectors = arguments.reserved_sectors
+
+    sectors_per_fat = ((partition_sectors // sectors_per_cluster) * 4 + BYTES_PER_SECTOR - 1) // BYTES_PER_SECTOR
+    cluster_begin_lba = partition_lba + reserved_sectors + NUMBER_OF_FATS * sectors_per_fat
+    reserved_sectors += -cluster_begin_lba % arguments.align_sectors
+    cluster_begin_lba = partition_lba + reserved_sectors + NUMBER_OF_FATS * sectors_per_fat
+    number_of_clusters = (partition_lba + partition_sectors - cluster_begin_lba) // sectors_per_cluster
+
+    fat = [0] * (number_of_clusters + 2)
+    fat[0] = 0x0FFFFFF8
+    fat[1] = END_OF_CHAIN
+    next_free_cluster = [2]
+
+    def clusters_for(num_bytes):
+        return (num_bytes + bytes_per_cluster - 1) // bytes_per_cluster
+
+    def link(chain):
+        for cluster, next_cluster in zip(chain, chain[1:]):
+            fat[cluster] = next_cluster
+        if chain:
+            fat[chain[-1]] = END_OF_CHAIN
+
+    def allocate_contiguous(count):
+        chain = list(range(next_free_cluster[0], next_free_cluster[0] + count))
+        next_free_cluster[0] += count
+        if next_free_cluster[0] > number_of_clusters + 2:
+            raise SystemExit('image too small, raise --size-mb')
+        link(chain)
+        return chain
+
+    def write_chain(chain, data):
+        for i, cluster in enumerate(chain):
+            offset = (cluster_begin_lba + (cluster - 2) * sectors_per_cluster) * BYTES_PER_SECTOR
+            part = data[i * bytes_per_cluster:(i + 1) * bytes_per_cluster]
+            image[offset:offset + len(part)] = part
+
+    # files in each directory, the directories are sized for their entries up front
+    files = []
+    for number in range(arguments.files):
+        files.append({'directory': number % arguments.directories, 'name': 'F%04X.BIN' % number, 'seed': (number + seed_offset) & 0xFF,
+                      'size': random_sizes.randint(arguments.min_file_size, arguments.max_file_size), 'long_name': None,
+                      'delete': False})
+        if arguments.long_names and number % 7 == 3:
+            # 1 - 3 LFN entries, mixed case so look ups have to ignore case
+            files[-1]['long_name'] = 'Log %d of%s.dat' % (number, ' Sensor' * (number % 5))
+
+    # the entries of each directory in order, the orphaned long name goes right before a file with none
+    layouts = [[('file', f) for f in files if f['directory'] == number] for number in range(arguments.directories)]
+    orphans = []
+    if arguments.long_names:
+        orphans.append({'directory': 0, 'long_name': 'Orphaned Long Name.txt'})
+        layouts[0].append(('orphan', orphans[-1]))
+        special_files = [('ORPHANED.BIN', None), ('DELSPLIT.BIN', 'Deleted Across A Sector Boundary.bin'),
+                         ('DELSAME.BIN', 'Deleted In One Sector.bin')]
+        for name, long_name in special_files:
+            files.append({'directory': 0, 'name': name, 'seed': (len(files) + seed_offset) & 0xFF, 'size': random_sizes.randint(1, 3000),
+                          'long_name': long_name, 'delete': long_name is not None})
+            layouts[0].append(('file', files[-1]))
+
+    def entry_count(placed):
+        return sum(1 + long_name_entry_count(v['long_name']) if k == 'file' and v['long_name'] else
+                   long_name_entry_count(v['long_name']) if k == 'orphan' else 1 for k, v in placed)
+
+    def place(layout):
+        """The items (a long name and its short entry are one) of a directory from "." and "..", padded
+        with deleted entries so the LFN entries of the first file to delete are split across a sector
+        boundary and those of the second share the sector of its short entry"""
+        placed = [('dot', None), ('dot', None)]
+        deletes_placed = 0
+        for item in layout:
+            kind, value = item
+            if kind == 'file' and value['delete']:
+                lfn_entries = long_name_entry_count(value['long_name'])
+                in_sector = entry_count(placed) % ENTRIES_PER_SECTOR
+                if deletes_placed == 0:
+                    # the last LFN entry (stored first) at the end of one sector, the rest in the next
+                    padding = (ENTRIES_PER_SECTOR - lfn_entries + 1 - in_sector) % ENTRIES_PER_SECTOR
+                else:
+                    padding = 0 if in_sector + lfn_entries < ENTRIES_PER_SECTOR else ENTRIES_PER_SECTOR - in_sector
+                placed += [('deleted', None)] * padding
+                deletes_placed += 1
+            placed.append(item)
+        return placed
+
+    directory_names = ['D%03X' % number for number in range(arguments.directories)]
+    root_chain = allocate_contiguous(max(1, clusters_for((len(directory_names) + 1) * DIRECTORY_ENTRY_BYTES)))
+    directory_chains = []
+    for number in range(arguments.directories):
+        entries = entry_count(place(layouts[number])) + 1
+        directory_chains.append(allocate_contiguous(max(1, clusters_for(entries * DIRECTORY_ENTRY_BYTES))))
+
+    # file clusters, all at once or one per file per round
+    for f in files:
+        f['chain'] = []
+    if arguments.fragment:
+        remaining = [f for f in files if clusters_for(f['size']) > 0]
+        while remaining:
+            for f in remaining:
+                f['chain'] += allocate_contiguous(1)
+            remaining = [f for f in remaining if len(f['chain']) < clusters_for(f['size'])]
+        for f in files:
+            link(f['chain'])
+    else:
+        for f in files:
+            f['chain'] = allocate_contiguous(clusters_for(f['size']))
+
+    for f in files:
+        write_chain(f['chain'], file_pattern(f['size'], f['seed']))
+
+    root_entries = [short_name('SDFSHOST') + bytes([0x08]) + bytes(20)]
+    for number, name in enumerate(directory_names):
+        root_entries.append(directory_entry(short_name(name), 0x10, directory_chains[number][0], 0))
+    write_chain(root_chain, b''.join(root_entries))
+
+    for number, chain in enumerate(directory_chains):
+        # ".." of a directory in the root points at cluster 0
+        entries = [directory_entry(short_name('.'), 0x10, chain[0], 0), directory_entry(short_name('..'), 0x10, 0, 0)]
+        for kind, value in place(layouts[number])[2:]:
+            if kind == 'deleted':
+                entries.append(deleted_entry())
+            elif kind == 'orphan':
+                # checksum of a short name that is not in the directory
+                entries += long_name_entries(value['long_name'], short_name_checksum(short_name('ORPHAN~1.TXT')))
+            else:
+                name = short_name(value['name'])
+                if value['long_name']:
+                    entries += long_name_entries(value['long_name'], short_name_checksum(name))
+                entries.append(directory_entry(name, 0x20, value['chain'][0] if value['chain'] else 0, value['size']))
+        write_chain(chain, b''.join(entries))
+
+    # volume id (and its backup at sector 6), FSInfo at sector 1
+    volume_id = bytearray(BYTES_PER_SECTOR)
+    volume_id[0:11] = b'\xEB\x58\x90MKIMAGE '
+    struct.pack_into('<HBHBHHBHHHII', volume_id, 11, BYTES_PER_SECTOR, sectors_per_cluster, reserved_sectors, NUMBER_OF_FATS,
+                     0, 0, 0xF8, 0, 63, 255, partition_lba, partition_sectors)
+    struct.pack_into('<IHHIHH', volume_id, 36, sectors_per_fat, 0, 0, root_chain[0], 1, 6)
+    volume_id[510:512] = b'\x55\xAA'
+    partition_offset = partition_lba * BYTES_PER_SECTOR
+    image[partition_offset:partition_offset + BYTES_PER_SECTOR] = volume_id
+    image[partition_offset + 6 * BYTES_PER_SECTOR:partition_offset + 7 * BYTES_PER_SECTOR] = volume_id
+
+    free_clusters = sum(1 for cluster in range(2, number_of_clusters + 2) if fat[cluster] == 0)
+    fs_info = bytearray(BYTES_PER_SECTOR)
+    struct.pack_into('<I', fs_info, 0, 0x41615252)
+    struct.pack_into('<III', fs_info, 484, 0x61417272, free_clusters, next_free_cluster[0])
+    struct.pack_into('<I', fs_info, 508, 0xAA550000)
+    image[partition_offset + BYTES_PER_SECTOR:partition_offset + 2 * BYTES_PER_SECTOR] = fs_info
+
+    fat_bytes = b''.join(struct.pack('<I', entry) for entry in fat)
+    for copy in range(NUMBER_OF_FATS):
+        fat_offset = (partition_lba + reserved_sectors + copy * sectors_per_fat) * BYTES_PER_SECTOR
+        image[fat_offset:fat_offset + len(fat_bytes)] = fat_bytes
+
+    return files, orphans, directory_names
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Build a synthetic FAT32 image for sd_fs_host')
+    parser.add_argument('image')
+    parser.add_argument('manifest')
+    parser.add_argument('--size-mb', type=int, default=256)
+    parser.add_argument('--sectors-per-cluster', type=int, default=8, choices=[1, 2, 4, 8, 16, 32, 64, 128])
+    parser.add_argument('--reserved-sectors', type=int, default=32)
+    parser.add_argument('--align-sectors', type=int, default=1)
+    parser.add_argument('--files', type=int, default=2000)
+    parser.add_argument('--directories', type=int, default=16)
+    parser.add_argument('--min-file-size', type=int, default=0)
+    parser.add_argument('--max-file-size', type=int, default=16384)
+    parser.add_argument('--fragment', action='store_true')
+    parser.add_argument('--long-names', action='store_true')
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--partitions', type=int, default=1, choices=[1, 2, 3, 4])
+    arguments = parser.parse_args()
+
+    total_sectors = arguments.size_mb * 2048
+    # every partition starts on a PARTITION_LBA (1 MB) boundary
+    partition_sectors = (total_sectors - PARTITION_LBA) // arguments.partitions // PARTITION_LBA * PARTITION_LBA
+    image = bytearray(total_sectors * BYTES_PER_SECTOR)
+
+    # MBR, one FAT32 (LBA) partition per volume
+    master_boot_record = bytearray(BYTES_PER_SECTOR)
+    volumes = []
+    for partition_index in range(arguments.partitions):
+        partition_lba = PARTITION_LBA + partition_index * partition_sectors
+        entry_offset = 446 + partition_index * 16
+        master_boot_record[entry_offset:entry_offset + 16] = (bytes([0x00, 0, 0, 0, 0x0C, 0, 0, 0]) +
+                                                              struct.pack('<II', partition_lba, partition_sectors))
+        volumes.append(build_volume(arguments, image, partition_index + 1, partition_lba, partition_sectors))
+    master_boot_record[510:512] = b'\x55\xAA'
+    image[0:BYTES_PER_SECTOR] = master_boot_record
+
+    with open(arguments.image, 'wb') as image_file:
+        image_file.write(image)
+
+    with open(arguments.manifest, 'w') as manifest_file:
+        for partition_index, (files, orphans, directory_names) in enumerate(volumes):
+            prefix = '%d:' % (partition_index + 1) if partition_index != 0 else ''
+            for f in files:
+                manifest_file.write('%s%s%s/%s %d %d%s\n' % (prefix, '-' if f['delete'] else '', directory_names[f['directory']],
+                                                            f['name'], f['size'], f['seed'],
+                                                            ' ' + f['long_name'] if f['long_name'] else ''))
+            for orphan in orphans:
+                manifest_file.write('%s!%s %s\n' % (prefix, directory_names[orphan['directory']], orphan['long_name']))
+
+
+if __name__ == '__main__':
+    main()
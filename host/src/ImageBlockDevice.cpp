@@ -0,0 +1,403 @@
+/**
+ * @file ImageBlockDevice.cpp
+ * @author Mattheas Jamieson (mattheas@ualberta.ca)
+ * @brief Implementation of host block device backed by a card image file, with an SPI cost model
+ * @version 0.1
+ * @date 2024-03-03
+ */
+
+#include "../inc/ImageBlockDevice.h"
+
+using namespace sd_driver;
+
+namespace
+{
+constexpr uint32_t command_bytes = 6U;
+
+/**
+ * @brief 512 data bytes and the CRC16
+ */
+constexpr uint32_t data_block_bytes = PackedSector::bytes_per_sector + 2U;
+} // namespace
+
+ImageBlockDevice::ImageBlockDevice() : cost_model() {}
+
+ImageBlockDevice::ImageBlockDevice(const SPICostModel &_cost_model) : cost_model(_cost_model) {}
+
+ImageBlockDevice::~ImageBlockDevice()
+{
+    close();
+}
+
+bool ImageBlockDevice::open(const char *image_path)
+{
+    close();
+
+    image = fopen(image_path, "r+b");
+    if (image == nullptr)
+    {
+        return false;
+    }
+
+    if (fseek(image, 0, SEEK_END) != 0)
+    {
+        close();
+        return false;
+    }
+
+    const long image_bytes = ftell(image);
+    number_of_blocks = (image_bytes > 0) ? static_cast<uint32_t>(image_bytes / PackedSector::bytes_per_sector) : 0U;
+
+    if (number_of_blocks == 0U)
+    {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void ImageBlockDevice::close()
+{
+    if (image != nullptr)
+    {
+        fclose(image);
+        image = nullptr;
+    }
+
+    number_of_blocks = 0U;
+}
+
+uint32_t ImageBlockDevice::get_number_of_blocks() const
+{
+    return number_of_blocks;
+}
+
+bool ImageBlockDevice::read_block(PackedSector &block, const Address32 &block_address)
+{
+    if (is_in_range(block_address, 1U) == false)
+    {
+        return false;
+    }
+
+    // CMD17
+    charge_command();
+    charge_block_read();
+    charge_end_of_transfer();
+    statistics.cmd17_commands++;
+
+    return read_image_block(block.words, to_uint32(block_address));
+}
+
+bool ImageBlockDevice::write_block(const PackedSector &block, const Address32 &block_address)
+{
+    if (is_in_range(block_address, 1U) == false)
+    {
+        return false;
+    }
+
+    // CMD24
+    charge_command();
+    charge_block_write();
+    charge_end_of_transfer();
+    statistics.cmd24_commands++;
+    statistics.busy_us += cost_model.single_block_busy_us;
+
+    return write_image_block(block.words, to_uint32(block_address));
+}
+
+bool ImageBlockDevice::read_blocks(PackedSector &block, const Address32 &block_address, const uint16_t &num_blocks,
+                                    block_read_callback_t block_callback, void *context)
+{
+    if (is_in_range(block_address, num_blocks) == false)
+    {
+        return false;
+    }
+
+    // CMD18, ended by CMD12 (and its stuff byte) once the callback has had enough
+    charge_command();
+    statistics.cmd18_commands++;
+
+    bool blocks_read = true;
+    for (uint16_t block_index = 0; block_index < num_blocks; block_index++)
+    {
+        charge_block_read();
+
+        if (read_image_block(block.words, to_uint32(block_address) + block_index) == false)
+        {
+            blocks_read = false;
+            break;
+        }
+
+        if (block_callback(block, block_index, context) == false)
+        {
+            break;
+        }
+    }
+
+    charge_stop_transmission();
+    charge_end_of_transfer();
+
+    return blocks_read;
+}
+
+bool ImageBlockDevice::write_blocks(PackedSector &block, const Address32 &block_address, const uint16_t &num_blocks,
+                                    block_write_callback_t block_callback, void *context)
+{
+    if (is_in_range(block_address, num_blocks) == false)
+    {
+        return false;
+    }
+
+    // CMD55 + ACMD23 pre-erase hint, then CMD25 ended by the stop tran token and a stuff byte
+    charge_command();
+    charge_command();
+    charge_command();
+    statistics.cmd25_commands++;
+
+    bool blocks_written = true;
+    uint16_t block_index = 0U;
+    for (; block_index < num_blocks; block_index++)
+    {
+        if (block_callback(block, block_index, context) == false)
+        {
+            break;
+        }
+
+        charge_block_write();
+        statistics.busy_us += cost_model.multiple_block_busy_us;
+
+        if (write_image_block(block.words, to_uint32(block_address) + block_index) == false)
+        {
+            blocks_written = false;
+            break;
+        }
+    }
+
+    charge_stop_tran_token();
+    charge_end_of_transfer();
+    count_allocation_unit_crossing(block_address, block_index);
+
+    return blocks_written;
+}
+
+bool ImageBlockDevice::read_contiguous_blocks(uint16_t *words, const Address32 &block_address, const uint16_t &num_blocks)
+{
+    if (is_in_range(block_address, num_blocks) == false)
+    {
+        return false;
+    }
+
+    charge_command();
+    statistics.cmd18_commands++;
+
+    for (uint16_t block_index = 0; block_index < num_blocks; block_index++)
+    {
+        charge_block_read();
+
+        if (read_image_block(words + (block_index << 8), to_uint32(block_address) + block_index) == false)
+        {
+            return false;
+        }
+    }
+
+    charge_stop_transmission();
+    charge_end_of_transfer();
+
+    return true;
+}
+
+bool ImageBlockDevice::write_contiguous_blocks(const uint16_t *words, const Address32 &block_address, const uint16_t &num_blocks)
+{
+    if (is_in_range(block_address, num_blocks) == false)
+    {
+        return false;
+    }
+
+    charge_command();
+    charge_command();
+    charge_command();
+    statistics.cmd25_commands++;
+
+    for (uint16_t block_index = 0; block_index < num_blocks; block_index++)
+    {
+        charge_block_write();
+        statistics.busy_us += cost_model.multiple_block_busy_us;
+
+        if (write_image_block(words + (block_index << 8), to_uint32(block_address) + block_index) == false)
+        {
+            return false;
+        }
+    }
+
+    charge_stop_tran_token();
+    charge_end_of_transfer();
+    count_allocation_unit_crossing(block_address, num_blocks);
+
+    return true;
+}
+
+bool ImageBlockDevice::flush()
+{
+    return image != nullptr && fflush(image) == 0;
+}
+
+Address32 ImageBlockDevice::get_allocation_unit_blocks() const
+{
+    return Address32(static_cast<uint16_t>(cost_model.allocation_unit_blocks >> 16), static_cast<uint16_t>(cost_model.allocation_unit_blocks & 0xFFFF));
+}
+
+void ImageBlockDevice::cut_power_after(const uint32_t &num_blocks)
+{
+    blocks_until_power_cut = num_blocks;
+    power_cut_pending = true;
+    power_cut = false;
+}
+
+void ImageBlockDevice::restore_power()
+{
+    power_cut_pending = false;
+    power_cut = false;
+}
+
+bool ImageBlockDevice::is_power_cut() const
+{
+    return power_cut;
+}
+
+ImageBlockDevice::SPICostStatistics ImageBlockDevice::get_statistics() const
+{
+    return statistics;
+}
+
+void ImageBlockDevice::reset_statistics()
+{
+    statistics = SPICostStatistics();
+}
+
+uint64_t ImageBlockDevice::get_simulated_us() const
+{
+    return (statistics.spi_bytes * 8000U) / cost_model.clock_khz + statistics.busy_us;
+}
+
+void ImageBlockDevice::print_statistics(const char *name) const
+{
+    printf("%s: commands %llu cmd17 %llu cmd18 %llu cmd24 %llu cmd25 %llu blocks_read %llu blocks_written %llu "
+           "spi_bytes %llu busy_us %llu au_crossings %llu simulated_us %llu\n",
+           name, static_cast<unsigned long long>(statistics.commands), static_cast<unsigned long long>(statistics.cmd17_commands),
+           static_cast<unsigned long long>(statistics.cmd18_commands), static_cast<unsigned long long>(statistics.cmd24_commands),
+           static_cast<unsigned long long>(statistics.cmd25_commands), static_cast<unsigned long long>(statistics.blocks_read),
+           static_cast<unsigned long long>(statistics.blocks_written), static_cast<unsigned long long>(statistics.spi_bytes),
+           static_cast<unsigned long long>(statistics.busy_us), static_cast<unsigned long long>(statistics.allocation_unit_crossings),
+           static_cast<unsigned long long>(get_simulated_us()));
+}
+
+void ImageBlockDevice::charge_command()
+{
+    statistics.commands++;
+    statistics.spi_bytes += cost_model.command_preamble_bytes + command_bytes + cost_model.command_response_bytes;
+}
+
+void ImageBlockDevice::charge_stop_transmission()
+{
+    // CMD12 is sent without a preamble, the byte after it is a stuff byte
+    statistics.commands++;
+    statistics.spi_bytes += command_bytes + 1U + cost_model.command_response_bytes;
+}
+
+void ImageBlockDevice::charge_stop_tran_token()
+{
+    // the token and the stuff byte after it, then the card programs the last block
+    statistics.spi_bytes += 2U;
+    statistics.busy_us += cost_model.stop_transmission_busy_us;
+}
+
+void ImageBlockDevice::charge_end_of_transfer()
+{
+    statistics.spi_bytes += 1U;
+}
+
+void ImageBlockDevice::charge_block_read()
+{
+    statistics.blocks_read++;
+    statistics.spi_bytes += cost_model.read_access_bytes + 1U + data_block_bytes;
+}
+
+void ImageBlockDevice::charge_block_write()
+{
+    statistics.blocks_written++;
+    statistics.spi_bytes += 1U + data_block_bytes + 1U;
+}
+
+void ImageBlockDevice::count_allocation_unit_crossing(const Address32 &block_address, const uint16_t &num_blocks)
+{
+    const uint32_t allocation_unit_blocks = cost_model.allocation_unit_blocks;
+    if (allocation_unit_blocks == 0U || num_blocks < 2U)
+    {
+        return;
+    }
+
+    const uint32_t first_block = to_uint32(block_address);
+    if (first_block / allocation_unit_blocks != (first_block + num_blocks - 1U) / allocation_unit_blocks)
+    {
+        statistics.allocation_unit_crossings++;
+    }
+}
+
+bool ImageBlockDevice::is_in_range(const Address32 &block_address, const uint16_t &num_blocks) const
+{
+    const uint64_t end_block = static_cast<uint64_t>(to_uint32(block_address)) + num_blocks;
+
+    return image != nullptr && end_block <= number_of_blocks;
+}
+
+bool ImageBlockDevice::read_image_block(uint16_t *words, const uint32_t &block_number)
+{
+    uint8_t bytes[PackedSector::bytes_per_sector];
+
+    if (fseek(image, static_cast<long>(block_number) * PackedSector::bytes_per_sector, SEEK_SET) != 0 ||
+        fread(bytes, 1U, sizeof(bytes), image) != sizeof(bytes))
+    {
+        return false;
+    }
+
+    // byte 2n in the lower 8 bits of word n, whatever the byte order of the host
+    for (uint16_t i = 0; i < PackedSector::words_per_sector; i++)
+    {
+        words[i] = static_cast<uint16_t>(bytes[i << 1] | (bytes[(i << 1) + 1U] << 8));
+    }
+
+    return true;
+}
+
+bool ImageBlockDevice::write_image_block(const uint16_t *words, const uint32_t &block_number)
+{
+    if (power_cut_pending)
+    {
+        power_cut = (blocks_until_power_cut == 0U);
+        power_cut_pending = (power_cut == false);
+        blocks_until_power_cut--;
+    }
+
+    // the driver sees the write succeed, the card never got it
+    if (power_cut)
+    {
+        return true;
+    }
+
+    uint8_t bytes[PackedSector::bytes_per_sector];
+
+    for (uint16_t i = 0; i < PackedSector::words_per_sector; i++)
+    {
+        bytes[i << 1] = static_cast<uint8_t>(words[i] & 0xFF);
+        bytes[(i << 1) + 1U] = static_cast<uint8_t>(words[i] >> 8);
+    }
+
+    return fseek(image, static_cast<long>(block_number) * PackedSector::bytes_per_sector, SEEK_SET) == 0 &&
+           fwrite(bytes, 1U, sizeof(bytes), image) == sizeof(bytes);
+}
+
+uint32_t ImageBlockDevice::to_uint32(const Address32 &value)
+{
+    return (static_cast<uint32_t>(value.high()) << 16) | value.low();
+}
@@ -0,0 +1,1863 @@
+/**
+ * @file main.cpp
+ * @author Mattheas Jamieson (mattheas@ualberta.ca)
+ * @brief Host regression/ profiling harness, runs FileSystem against a card image file
+ * @version 0.1
+ * @date 2024-03-03
+ *
+ * @details Built by host/CMakeLists.txt for the PC. The image and manifest come from
+ * host/mkimage.py (or any FAT32 image with a manifest in the same format, "PATH SIZE SEED" per
+ * line, "N:PATH SIZE SEED" for a file on partition N other than 1). The harness
+ *      1. mounts the image,
+ *      2. opens and reads every file in the manifest and checks its contents (and its long name,
+ *         looked up both ways, see mkimage.py --long-names),
+ *      3. deletes the files the manifest marks for deletion by their long name, checks their LFN
+ *         entries went with them and remounts (only if the manifest has any),
+ *      4. creates, appends to, re-reads and deletes files in the root directory, then unmounts,
+ *      5. cuts the power after 0, step, 2 step, ... blocks written by a run of creates, appends,
+ *         stages, commits and deletes (--power-loss-step N, 0 to skip), each time remounting and
+ *         checking the volume straight from the image (FAT chains against directory entries,
+ *         FAT #1 against FAT #2 and the FSInfo free count) and the files the run wrote,
+ *      6. runs 4 and 5 again with the file system on a SectorPipeline (--pipeline-sectors N
+ *         sector buffers, 0 to skip) in front of an AsyncBlockDevice, so every write completes
+ *         behind the file system, and checks the pipeline statistics,
+ *      7. mounts partitions 1 and 2 at once with a quota of half the shared block cache each and
+ *         checks, writes, re-reads and deletes files on both in turn, unmounting one while the
+ *         other carries on (only if the manifest lists files on partition 2, see mkimage.py
+ *         --partitions).
+ * Each phase prints what ImageBlockDevice charged for it (commands, blocks, SPI bytes, simulated
+ * time), then the file system statistics are dumped (operation ticks are simulated microseconds).
+ * Exits with 0 only if every check passed.
+ *
+ * The entry table only has room for FileSystem::total_directory_entries entries (configure with
+ * -DSD_FS_DIRECTORY_ENTRIES=N to change it), so with a lazy mount (the default) the image is
+ * remounted every verify_batch_files files, a full scan mount (--full-scan) only works for images
+ * with fewer entries than that.
+ */
+
+#include "../inc/ImageBlockDevice.h"
+#include "../../inc/FileSystem.h"
+#include "../../inc/SectorPipeline.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace sd_driver;
+using namespace file_system;
+
+namespace
+{
+/**
+ * @brief Files checked per mount in lazy mode, every file looked up takes an entry (and so does
+ * its directory)
+ */
+constexpr uint16_t verify_batch_files = 64U;
+
+/**
+ * @brief Bytes per FileSystem::read()/ append() call
+ */
+constexpr uint16_t transfer_bytes = 4096U;
+
+uint16_t transfer_buffer[transfer_bytes >> 1];
+
+/**
+ * @brief Longest long file name, a copy of FileSystem::max_long_name_length that can be passed by
+ * reference (the class constant has no definition to bind to)
+ */
+constexpr uint16_t max_long_name_length = FileSystem::max_long_name_length;
+
+/**
+ * @brief Most sector buffers phase 6 can give the pipeline
+ */
+constexpr uint16_t max_pipeline_sectors = 8U;
+
+/**
+ * @brief Block cache quota of each volume of phase 7, together they hold the whole (default) cache
+ * so each takes slots from the other
+ */
+constexpr uint16_t two_volume_cache_quota = (MountManager::block_cache_blocks > 1U) ? (MountManager::block_cache_blocks >> 1) : 1U;
+
+/**
+ * @brief Every volume of the harness is mounted through it, so phase 7 shares its cache and sector
+ */
+MountManager mount_manager;
+
+/**
+ * @brief Device the operation timing of the file system statistics is taken from
+ */
+const ImageBlockDevice *timed_device = nullptr;
+
+/**
+ * @brief StatisticsClock tick source, one tick per simulated microsecond
+ */
+uint16_t read_simulated_ticks()
+{
+    return static_cast<uint16_t>(timed_device->get_simulated_us() & 0xFFFF);
+}
+
+struct ManifestEntry
+{
+    uint16_t file_name[11];
+
+    uint16_t num_enclosing_directories;
+
+    uint16_t enclosing_directory_names[10][11];
+
+    uint32_t size;
+
+    uint16_t seed;
+
+    /**
+     * @brief Long file name of the file, empty if it has none
+     */
+    char long_name[max_long_name_length + 1U];
+
+    /**
+     * @brief Primary partition the file is on ("N:" before the rest of the line for any but 1)
+     */
+    uint16_t partition_number;
+
+    /**
+     * @brief Deleted by phase 3 ("-PATH" in the manifest)
+     */
+    bool delete_by_long_name;
+
+    /**
+     * @brief Not a file, long_name is an orphaned long name in the enclosing directories that
+     * must not be found ("!DIRECTORY LONG NAME" in the manifest)
+     */
+    bool orphaned_long_name;
+};
+
+struct HarnessOptions
+{
+    const char *image_path = nullptr;
+
+    const char *manifest_path = nullptr;
+
+    FileSystem::mount_mode_t mount_mode = FileSystem::mount_mode_t::LAZY;
+
+    /**
+     * @brief See MountManager::VolumeOptions::directory_snapshot, run twice to mount from the
+     * snapshot the first run saved
+     */
+    bool directory_snapshot = false;
+
+    uint16_t write_files = 32U;
+
+    uint32_t write_file_size = 20000U;
+
+    /**
+     * @brief Blocks written between the power cuts of phase 5, 0 to skip it
+     */
+    uint32_t power_loss_step = 1U;
+
+    /**
+     * @brief Sector buffers of the pipeline phase 6 runs on (2 for ping-pong buffering), 0 to skip
+     * it
+     */
+    uint16_t pipeline_sectors = 2U;
+
+    ImageBlockDevice::SPICostModel cost_model;
+};
+
+/**
+ * @brief Byte n of a manifest file, same pattern as mkimage.py
+ */
+uint16_t pattern_byte(const uint32_t &n, const uint16_t &seed)
+{
+    return static_cast<uint16_t>((n * 31U + seed) & 0xFF);
+}
+
+uint32_t to_uint32(const Address32 &value)
+{
+    return (static_cast<uint32_t>(value.high()) << 16) | value.low();
+}
+
+/**
+ * @brief Appends num_bytes of the pattern of seed to a file opened for writing, carrying on from
+ * the end of the file
+ */
+bool append_pattern(FileSystem &file_system, FileSystem::File &file, const uint16_t &seed, const uint32_t &num_bytes)
+{
+    const uint32_t end = to_uint32(file.size) + num_bytes;
+
+    for (uint32_t position = to_uint32(file.size); position < end; position += transfer_bytes)
+    {
+        const uint16_t chunk_bytes = (end - position < transfer_bytes) ? static_cast<uint16_t>(end - position) : transfer_bytes;
+
+        for (uint16_t i = 0; i < chunk_bytes; i += 2U)
+        {
+            transfer_buffer[i >> 1] = pattern_byte(position + i, seed) | (pattern_byte(position + i + 1U, seed) << 8);
+        }
+
+        if (file_system.append(file, transfer_buffer, chunk_bytes) == false)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Converts one path component ("F0042.BIN") to the 8.3 format FileSystem takes
+ */
+bool to_short_name(const char *component, const size_t &length, uint16_t (&name)[11])
+{
+    for (uint16_t i = 0; i < 11U; i++)
+    {
+        name[i] = ' ';
+    }
+
+    size_t base_length = 0U;
+    while (base_length < length && component[base_length] != '.')
+    {
+        base_length++;
+    }
+
+    const size_t extension_length = (base_length < length) ? length - base_length - 1U : 0U;
+    if (base_length == 0U || base_length > 8U || extension_length > 3U)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < base_length; i++)
+    {
+        name[i] = static_cast<uint16_t>(toupper(component[i]));
+    }
+    for (size_t i = 0; i < extension_length; i++)
+    {
+        name[8U + i] = static_cast<uint16_t>(toupper(component[base_length + 1U + i]));
+    }
+
+    return true;
+}
+
+/**
+ * @brief Splits "DIR/SUB/FILE.EXT" into the file name and its enclosing directories, innermost
+ * directory first (see FileSystem::delete_file())
+ */
+bool parse_path(const char *path, ManifestEntry &entry)
+{
+    const char *components[11];
+    size_t lengths[11];
+    uint16_t number_of_components = 0U;
+
+    for (const char *component = path; *component != '\0';)
+    {
+        const char *separator = strchr(component, '/');
+        const size_t length = (separator != nullptr) ? static_cast<size_t>(separator - component) : strlen(component);
+
+        if (length > 0U)
+        {
+            if (number_of_components == 11U)
+            {
+                return false;
+            }
+
+            components[number_of_components] = component;
+            lengths[number_of_components] = length;
+            number_of_components++;
+        }
+
+        component += length + ((separator != nullptr) ? 1U : 0U);
+    }
+
+    if (number_of_components == 0U)
+    {
+        return false;
+    }
+
+    entry.num_enclosing_directories = number_of_components - 1U;
+    for (uint16_t depth = 0; depth < entry.num_enclosing_directories; depth++)
+    {
+        const uint16_t component = entry.num_enclosing_directories - 1U - depth;
+
+        if (to_short_name(components[component], lengths[component], entry.enclosing_directory_names[depth]) == false)
+        {
+            return false;
+        }
+    }
+
+    return to_short_name(components[number_of_components - 1U], lengths[number_of_components - 1U], entry.file_name);
+}
+
+/**
+ * @brief Parses one manifest line, "[N:]PATH SIZE SEED [LONG NAME]" or "[N:]!DIRECTORY LONG NAME"
+ */
+bool parse_manifest_line(const char *line, ManifestEntry &entry)
+{
+    char path[256];
+    int consumed = 0;
+    if (sscanf(line, "%255s%n", path, &consumed) != 1)
+    {
+        return false;
+    }
+    const char *rest = line + consumed;
+
+    const bool has_partition_number = path[0] >= '1' && path[0] <= '4' && path[1] == ':';
+    entry.partition_number = has_partition_number ? static_cast<uint16_t>(path[0] - '0') : 1U;
+    const char *marked_path = has_partition_number ? path + 2 : path;
+
+    entry.delete_by_long_name = (marked_path[0] == '-');
+    entry.orphaned_long_name = (marked_path[0] == '!');
+    const char *file_path = (entry.delete_by_long_name || entry.orphaned_long_name) ? marked_path + 1 : marked_path;
+
+    if (parse_path(file_path, entry) == false)
+    {
+        return false;
+    }
+
+    if (entry.orphaned_long_name)
+    {
+        // the path is the directory the long name is in, innermost first
+        if (entry.num_enclosing_directories == 10U)
+        {
+            return false;
+        }
+
+        for (uint16_t depth = entry.num_enclosing_directories; depth > 0U; depth--)
+        {
+            memcpy(entry.enclosing_directory_names[depth], entry.enclosing_directory_names[depth - 1U], sizeof(entry.file_name));
+        }
+        memcpy(entry.enclosing_directory_names[0], entry.file_name, sizeof(entry.file_name));
+        entry.num_enclosing_directories++;
+
+        entry.size = 0U;
+        entry.seed = 0U;
+    }
+    else
+    {
+        unsigned long size;
+        unsigned seed;
+        if (sscanf(rest, "%lu %u%n", &size, &seed, &consumed) != 2)
+        {
+            return false;
+        }
+        rest += consumed;
+
+        entry.size = static_cast<uint32_t>(size);
+        entry.seed = static_cast<uint16_t>(seed);
+    }
+
+    // the rest of the line, it may hold spaces
+    while (*rest == ' ' || *rest == '\t')
+    {
+        rest++;
+    }
+
+    size_t length = strcspn(rest, "\r\n");
+    if (length > max_long_name_length)
+    {
+        return false;
+    }
+    memcpy(entry.long_name, rest, length);
+    entry.long_name[length] = '\0';
+
+    return (entry.orphaned_long_name == false && entry.delete_by_long_name == false) || length != 0U;
+}
+
+/**
+ * @brief Reads the manifest entries of one partition
+ */
+ManifestEntry *read_manifest(const char *manifest_path, const uint16_t &partition_number, uint32_t &number_of_entries)
+{
+    FILE *manifest = fopen(manifest_path, "r");
+    if (manifest == nullptr)
+    {
+        return nullptr;
+    }
+
+    uint32_t capacity = 1024U;
+    ManifestEntry *entries = static_cast<ManifestEntry *>(malloc(capacity * sizeof(ManifestEntry)));
+    number_of_entries = 0U;
+
+    char line[512];
+    while (entries != nullptr && fgets(line, sizeof(line), manifest) != nullptr)
+    {
+        if (strspn(line, " \t\r\n") == strlen(line))
+        {
+            continue;
+        }
+
+        if (number_of_entries == capacity)
+        {
+            capacity <<= 1;
+            entries = static_cast<ManifestEntry *>(realloc(entries, capacity * sizeof(ManifestEntry)));
+            if (entries == nullptr)
+            {
+                break;
+            }
+        }
+
+        ManifestEntry &entry = entries[number_of_entries];
+        if (parse_manifest_line(line, entry) == false)
+        {
+            printf("manifest: bad line %s", line);
+            continue;
+        }
+
+        if (entry.partition_number == partition_number)
+        {
+            number_of_entries++;
+        }
+    }
+
+    fclose(manifest);
+    return entries;
+}
+
+/**
+ * @brief Mounts a volume through mount_manager
+ *
+ * @param volume_options partition and cache quota, directory_snapshot is taken from options
+ * @return FileSystem* nullptr if the volume could not be mounted
+ */
+FileSystem *mount(BlockDevice &block_device, const HarnessOptions &options,
+                    MountManager::VolumeOptions volume_options = MountManager::VolumeOptions())
+{
+    // FileSystem keeps a reference to its type
+    static const FileSystem::file_system_t file_system_type = FileSystem::file_system_t::FAT32;
+
+    volume_options.directory_snapshot = options.directory_snapshot;
+
+    FileSystem *file_system = new FileSystem(mount_manager, block_device, file_system_type, options.mount_mode, volume_options);
+
+    // no MBR/ volume id was found (or no such partition)
+    if (file_system->is_mounted() == false)
+    {
+        delete file_system;
+        return nullptr;
+    }
+
+    return file_system;
+}
+
+/**
+ * @brief Checks find_short_name() finds the 8.3 name of the manifest entry from long_name
+ */
+bool find_by_long_name(FileSystem &file_system, const ManifestEntry &entry, const char *long_name)
+{
+    uint16_t short_name[11];
+    if (file_system.find_short_name(long_name, entry.num_enclosing_directories, entry.enclosing_directory_names, short_name) == false)
+    {
+        return false;
+    }
+
+    return memcmp(short_name, entry.file_name, sizeof(short_name)) == 0;
+}
+
+/**
+ * @brief Checks the long name of a file both ways: finding the 8.3 name from the long name (before
+ * the file is opened, so a lazy mount reads the directory for it, and again in upper case once it
+ * is loaded) and the long name of the entry found by its 8.3 name. A file without a long name must
+ * not have one, e.g., the file after an orphaned long name
+ */
+bool verify_long_name(FileSystem &file_system, const ManifestEntry &entry, const bool &opened)
+{
+    if (entry.long_name[0] != '\0' && opened == false)
+    {
+        return find_by_long_name(file_system, entry, entry.long_name);
+    }
+
+    if (opened == false)
+    {
+        return true;
+    }
+
+    FileSystem::FAT32FileSystemEntry file_entry;
+    if (file_system.stat(entry.file_name, entry.num_enclosing_directories, entry.enclosing_directory_names, file_entry) == false)
+    {
+        return false;
+    }
+
+    char long_name[max_long_name_length + 1U];
+    const uint16_t length = file_system.get_long_name(file_entry, long_name, max_long_name_length);
+    if (entry.long_name[0] == '\0')
+    {
+        return length == 0U;
+    }
+
+    // FAT compares long names ignoring case
+    char upper_case_long_name[max_long_name_length + 1U];
+    const size_t manifest_length = strlen(entry.long_name);
+    for (size_t i = 0; i <= manifest_length; i++)
+    {
+        upper_case_long_name[i] = static_cast<char>(toupper(entry.long_name[i]));
+    }
+
+    return strcmp(long_name, entry.long_name) == 0 && find_by_long_name(file_system, entry, upper_case_long_name);
+}
+
+/**
+ * @brief Reads a whole file and compares it against the manifest
+ */
+bool verify_file(FileSystem &file_system, const ManifestEntry &entry)
+{
+    if (verify_long_name(file_system, entry, false) == false)
+    {
+        return false;
+    }
+
+    FileSystem::File file;
+    if (file_system.open(entry.file_name, entry.num_enclosing_directories, entry.enclosing_directory_names, file) == false)
+    {
+        return false;
+    }
+
+    bool contents_match = (file.size.high() == (entry.size >> 16) && file.size.low() == (entry.size & 0xFFFF));
+    uint32_t position = 0U;
+
+    while (contents_match)
+    {
+        uint16_t bytes_read = 0U;
+        if (file_system.read(file, transfer_buffer, transfer_bytes, bytes_read) == false)
+        {
+            contents_match = false;
+            break;
+        }
+
+        if (bytes_read == 0U)
+        {
+            break;
+        }
+
+        for (uint16_t i = 0; i < bytes_read; i++)
+        {
+            const uint16_t byte = (i & 1U) ? (transfer_buffer[i >> 1] >> 8) : (transfer_buffer[i >> 1] & 0xFF);
+            if (byte != pattern_byte(position + i, entry.seed))
+            {
+                contents_match = false;
+                break;
+            }
+        }
+
+        position += bytes_read;
+    }
+
+    file_system.close(file);
+    return contents_match && position == entry.size && verify_long_name(file_system, entry, true);
+}
+
+/**
+ * @brief True if neither the 8.3 name nor the long name of the manifest entry is found
+ */
+bool is_deleted(FileSystem &file_system, const ManifestEntry &entry)
+{
+    FileSystem::FAT32FileSystemEntry file_entry;
+    uint16_t short_name[11];
+
+    return file_system.stat(entry.file_name, entry.num_enclosing_directories, entry.enclosing_directory_names, file_entry) == false &&
+           file_system.find_short_name(entry.long_name, entry.num_enclosing_directories, entry.enclosing_directory_names, short_name) == false;
+}
+
+/**
+ * @brief Checks a file of the manifest, a file to delete is already gone if an earlier run got to
+ * phase 3
+ */
+bool verify_manifest_file(FileSystem &file_system, const ManifestEntry &entry)
+{
+    return verify_file(file_system, entry) || (entry.delete_by_long_name && is_deleted(file_system, entry));
+}
+
+/**
+ * @brief Phase 2, every file in the manifest
+ */
+uint32_t run_verify_phase(FileSystem *&file_system, ImageBlockDevice &image_device, const HarnessOptions &options,
+                            const ManifestEntry *entries, const uint32_t &number_of_entries)
+{
+    uint32_t failures = 0U;
+
+    for (uint32_t i = 0; i < number_of_entries && file_system != nullptr; i++)
+    {
+        if (options.mount_mode == FileSystem::mount_mode_t::LAZY && i != 0U && (i % verify_batch_files) == 0U)
+        {
+            delete file_system;
+            file_system = mount(image_device, options);
+
+            if (file_system == nullptr)
+            {
+                printf("verify: remount failed\n");
+                return failures + 1U;
+            }
+        }
+
+        if (entries[i].orphaned_long_name)
+        {
+            uint16_t short_name[11];
+            if (file_system->find_short_name(entries[i].long_name, entries[i].num_enclosing_directories, entries[i].enclosing_directory_names, short_name))
+            {
+                printf("verify: orphaned long name %s was found\n", entries[i].long_name);
+                failures++;
+            }
+            continue;
+        }
+
+        if (verify_manifest_file(*file_system, entries[i]) == false)
+        {
+            printf("verify: entry %lu (size %lu) does not match\n", static_cast<unsigned long>(i), static_cast<unsigned long>(entries[i].size));
+            failures++;
+        }
+    }
+
+    return failures;
+}
+
+/**
+ * @brief Checksum of an 8.3 name every LFN entry of its long name carries
+ */
+uint16_t short_name_checksum(const uint16_t (&name)[11])
+{
+    uint16_t checksum = 0U;
+    for (uint16_t i = 0; i < 11U; i++)
+    {
+        checksum = ((((checksum & 1U) << 7) + (checksum >> 1)) + (name[i] & 0xFF)) & 0xFF;
+    }
+
+    return checksum;
+}
+
+/**
+ * @brief Reads the first cluster of the directory of a deleted manifest file straight from the
+ * image and checks its short entry is marked deleted and no LFN entry of its long name is left in
+ * the same sector (those in an earlier sector are left as orphans, see FileSystem::delete_file())
+ */
+bool long_name_entries_deleted(FileSystem &file_system, ImageBlockDevice &image_device, const ManifestEntry &entry)
+{
+    const FileSystem::FAT32VolumeID volume_id = file_system.get_fat_32_volume_id();
+    Address32 directory_first_cluster = volume_id.root_directory_first_cluster;
+
+    if (entry.num_enclosing_directories != 0U)
+    {
+        // the innermost enclosing directory, its parents are the rest of the list
+        uint16_t parent_directory_names[10][11];
+        memcpy(parent_directory_names, entry.enclosing_directory_names[1], sizeof(entry.file_name) * 9U);
+
+        FileSystem::FAT32FileSystemEntry directory_entry;
+        if (file_system.stat(entry.enclosing_directory_names[0], entry.num_enclosing_directories - 1U, parent_directory_names, directory_entry) == false)
+        {
+            return false;
+        }
+        directory_first_cluster = directory_entry.starting_cluster_address;
+    }
+
+    Address32 cluster_begin_lba = file_system.get_fat_32_master_boot_record().primary_partitions[0].lba_begin +
+                                  Address32(0x0, volume_id.size_of_reserved_area_sectors);
+    for (uint16_t fat = 0; fat < volume_id.number_of_fats; fat++)
+    {
+        cluster_begin_lba += volume_id.sectors_per_fat;
+    }
+    const Address32 directory_lba = cluster_begin_lba +
+                                    ((directory_first_cluster - Address32(0x0, 0x2)) << Address32::log2(volume_id.sectors_per_cluster));
+
+    const uint16_t checksum = short_name_checksum(entry.file_name);
+
+    for (uint16_t sector = 0; sector < volume_id.sectors_per_cluster; sector++)
+    {
+        PackedSector directory_sector;
+        if (image_device.read_block(directory_sector, directory_lba + Address32(0x0, sector)) == false)
+        {
+            return false;
+        }
+
+        bool long_name_entry_left = false;
+        for (uint16_t offset = 0; offset < PackedSector::bytes_per_sector; offset += 32U)
+        {
+            const uint16_t first_byte = directory_sector.get_byte(offset);
+            const uint16_t attribute = directory_sector.get_byte(offset + 11U);
+
+            if (attribute == 0x0F)
+            {
+                // a live LFN entry of the deleted long name, unless a later entry of the sector ends it
+                long_name_entry_left = (first_byte != 0xE5 && first_byte != 0x00 && directory_sector.get_byte(offset + 13U) == checksum);
+                continue;
+            }
+
+            // deleting only replaces the first character of the name with 0xE5
+            bool name_matches = (first_byte == 0xE5);
+            for (uint16_t i = 1; i < 11U && name_matches; i++)
+            {
+                name_matches = directory_sector.get_byte(offset + i) == (entry.file_name[i] & 0xFF);
+            }
+
+            if (name_matches)
+            {
+                return long_name_entry_left == false;
+            }
+
+            long_name_entry_left = false;
+        }
+    }
+
+    // the deleted short entry was not found
+    return false;
+}
+
+/**
+ * @brief Phase 3, deletes the files the manifest marks for deletion (each is found by its long
+ * name first), checks their LFN entries were deleted with them and that neither name is found
+ * once the image is remounted. Files an earlier run deleted are skipped
+ */
+uint32_t run_long_name_phase(FileSystem *&file_system, ImageBlockDevice &image_device, const HarnessOptions &options,
+                                const ManifestEntry *entries, const uint32_t &number_of_entries)
+{
+    uint32_t failures = 0U;
+
+    for (uint32_t i = 0; i < number_of_entries; i++)
+    {
+        const ManifestEntry &entry = entries[i];
+        if (entry.delete_by_long_name == false || is_deleted(*file_system, entry))
+        {
+            continue;
+        }
+
+        if (find_by_long_name(*file_system, entry, entry.long_name) == false ||
+            file_system->delete_file(entry.file_name, entry.num_enclosing_directories, entry.enclosing_directory_names) == false)
+        {
+            printf("long names: delete of %s failed\n", entry.long_name);
+            failures++;
+            continue;
+        }
+
+        if (is_deleted(*file_system, entry) == false || long_name_entries_deleted(*file_system, image_device, entry) == false)
+        {
+            printf("long names: %s is left after its delete\n", entry.long_name);
+            failures++;
+        }
+    }
+
+    // the deletes must have reached the card, the directories are read again
+    delete file_system;
+    file_system = mount(image_device, options);
+    if (file_system == nullptr)
+    {
+        printf("long names: remount failed\n");
+        return failures + 1U;
+    }
+
+    for (uint32_t i = 0; i < number_of_entries; i++)
+    {
+        if (entries[i].delete_by_long_name && is_deleted(*file_system, entries[i]) == false)
+        {
+            printf("long names: %s is back after a remount\n", entries[i].long_name);
+            failures++;
+        }
+    }
+
+    return failures;
+}
+
+void make_write_name(const char *prefix, const uint16_t &number, ManifestEntry &entry)
+{
+    char path[16];
+    snprintf(path, sizeof(path), "%s%04X.BIN", prefix, number);
+
+    parse_path(path, entry);
+    entry.seed = number & 0xFF;
+    entry.long_name[0] = '\0';
+    entry.delete_by_long_name = false;
+    entry.orphaned_long_name = false;
+}
+
+/**
+ * @brief Phase 4, creates/ appends, re-reads and deletes options.write_files files in the root
+ */
+uint32_t run_write_phase(FileSystem &file_system, const HarnessOptions &options)
+{
+    uint32_t failures = 0U;
+
+    for (uint16_t number = 0; number < options.write_files; number++)
+    {
+        ManifestEntry entry;
+        make_write_name("HST", number, entry);
+        entry.size = options.write_file_size;
+
+        // left over from a run that was cut short
+        file_system.delete_file(entry.file_name, 0U, entry.enclosing_directory_names);
+
+        FileSystem::File file;
+        if (file_system.create(entry.file_name, 0U, entry.enclosing_directory_names, file) == false)
+        {
+            printf("write: create %u failed\n", number);
+            failures++;
+            continue;
+        }
+
+        const bool appended = append_pattern(file_system, file, entry.seed, entry.size);
+
+        if (file_system.close(file) == false || appended == false)
+        {
+            printf("write: append %u failed\n", number);
+            failures++;
+        }
+    }
+
+    for (uint16_t number = 0; number < options.write_files; number++)
+    {
+        ManifestEntry entry;
+        make_write_name("HST", number, entry);
+        entry.size = options.write_file_size;
+
+        if (verify_file(file_system, entry) == false)
+        {
+            printf("write: file %u does not read back\n", number);
+            failures++;
+        }
+    }
+
+    for (uint16_t number = 0; number < options.write_files; number++)
+    {
+        ManifestEntry entry;
+        make_write_name("HST", number, entry);
+
+        if (file_system.delete_file(entry.file_name, 0U, entry.enclosing_directory_names) == false)
+        {
+            printf("write: delete %u failed\n", number);
+            failures++;
+        }
+    }
+
+    if (file_system.unmount() == false)
+    {
+        printf("write: unmount failed\n");
+        failures++;
+    }
+
+    return failures;
+}
+
+/**
+ * @brief Marks the cluster chain from first_cluster as in use (check_volume())
+ *
+ * @return uint32_t length of the chain in clusters, 0 (printed) if it is broken, loops or runs
+ * into a cluster already in a chain
+ */
+uint32_t mark_chain(const uint32_t *fat, uint8_t *in_chain, const uint32_t &end_cluster, const uint32_t &first_cluster)
+{
+    uint32_t length = 0U;
+
+    for (uint32_t cluster = first_cluster;; cluster = fat[cluster])
+    {
+        if (cluster < 2U || cluster >= end_cluster)
+        {
+            printf("check: chain from cluster %lu is broken at cluster %lu\n", static_cast<unsigned long>(first_cluster),
+                   static_cast<unsigned long>(cluster));
+            return 0U;
+        }
+
+        if (in_chain[cluster] != 0U)
+        {
+            printf("check: chain from cluster %lu runs into cluster %lu of another chain\n", static_cast<unsigned long>(first_cluster),
+                   static_cast<unsigned long>(cluster));
+            return 0U;
+        }
+
+        in_chain[cluster] = 1U;
+        length++;
+
+        if (fat[cluster] >= 0x0FFFFFF8U)
+        {
+            return length;
+        }
+    }
+}
+
+/**
+ * @brief Checks the volume straight from the image like fsck would: FAT #1 is the same as FAT #2,
+ * the chain of every directory entry is allocated, ends and holds its size, no cluster is in two
+ * chains or allocated and in none (lost) and the FSInfo free count is right (or unknown)
+ *
+ * @param partition_number primary partition the volume is on (1-4)
+ * @return uint32_t problems found, each is printed
+ */
+uint32_t check_volume(const FileSystem::FAT32MasterBootRecord &master_boot_record, const FileSystem::FAT32VolumeID &volume_id,
+                        ImageBlockDevice &image_device, const uint16_t &partition_number)
+{
+    const uint32_t volume_lba = to_uint32(master_boot_record.primary_partitions[partition_number - 1U].lba_begin);
+    const uint32_t fat_lba = volume_lba + volume_id.size_of_reserved_area_sectors;
+    const uint32_t sectors_per_fat = to_uint32(volume_id.sectors_per_fat);
+    const uint32_t cluster_lba = fat_lba + volume_id.number_of_fats * sectors_per_fat;
+    const uint32_t volume_sectors = (volume_id.number_of_sectors_in_file_system != 0U) ? volume_id.number_of_sectors_in_file_system :
+                                    to_uint32(volume_id.num_of_sectors_in_file_system_extended);
+    const uint32_t cluster_bytes = static_cast<uint32_t>(volume_id.sectors_per_cluster) << 9;
+
+    uint32_t end_cluster = (volume_sectors - (cluster_lba - volume_lba)) / volume_id.sectors_per_cluster + 2U;
+    if (end_cluster > (sectors_per_fat << 7))
+    {
+        end_cluster = sectors_per_fat << 7;
+    }
+
+    uint32_t *fat = static_cast<uint32_t *>(malloc(end_cluster * sizeof(uint32_t)));
+    uint8_t *in_chain = static_cast<uint8_t *>(calloc(end_cluster, 1U));
+    // first clusters of the directories still to look through, each directory is in it once
+    uint32_t *directories = static_cast<uint32_t *>(malloc(end_cluster * sizeof(uint32_t)));
+    uint32_t problems = 0U;
+
+    if (fat == nullptr || in_chain == nullptr || directories == nullptr)
+    {
+        printf("check: out of memory\n");
+        problems++;
+    }
+
+    // FAT #1, compared against FAT #2 a sector at a time
+    for (uint32_t sector = 0; problems == 0U && sector < ((end_cluster + 127U) >> 7); sector++)
+    {
+        PackedSector fat_sector;
+        PackedSector second_fat_sector;
+
+        if (image_device.read_block(fat_sector, Address32(static_cast<uint16_t>((fat_lba + sector) >> 16), static_cast<uint16_t>(fat_lba + sector))) == false)
+        {
+            printf("check: FAT sector %lu could not be read\n", static_cast<unsigned long>(sector));
+            problems++;
+            break;
+        }
+
+        for (uint16_t i = 0; i < 128U && (sector << 7) + i < end_cluster; i++)
+        {
+            fat[(sector << 7) + i] = to_uint32(fat_sector.get_le32(i << 2)) & 0x0FFFFFFFU;
+        }
+
+        const uint32_t second_fat_lba = fat_lba + sectors_per_fat + sector;
+        if (volume_id.number_of_fats > 1U &&
+            (image_device.read_block(second_fat_sector, Address32(static_cast<uint16_t>(second_fat_lba >> 16), static_cast<uint16_t>(second_fat_lba))) == false ||
+             memcmp(fat_sector.words, second_fat_sector.words, sizeof(fat_sector.words)) != 0))
+        {
+            printf("check: FAT #2 differs from FAT #1 at sector %lu\n", static_cast<unsigned long>(sector));
+            problems++;
+        }
+    }
+
+    uint32_t number_of_directories = 0U;
+    if (problems == 0U)
+    {
+        const uint32_t root_directory_first_cluster = to_uint32(volume_id.root_directory_first_cluster);
+        if (mark_chain(fat, in_chain, end_cluster, root_directory_first_cluster) == 0U)
+        {
+            problems++;
+        }
+        else
+        {
+            directories[number_of_directories++] = root_directory_first_cluster;
+        }
+    }
+
+    while (number_of_directories > 0U)
+    {
+        bool end_of_directory = false;
+
+        // the chain was checked when the directory was found
+        for (uint32_t cluster = directories[--number_of_directories]; end_of_directory == false; cluster = fat[cluster])
+        {
+            for (uint16_t sector = 0; sector < volume_id.sectors_per_cluster && end_of_directory == false; sector++)
+            {
+                const uint32_t sector_lba = cluster_lba + (cluster - 2U) * volume_id.sectors_per_cluster + sector;
+                PackedSector directory_sector;
+
+                if (image_device.read_block(directory_sector, Address32(static_cast<uint16_t>(sector_lba >> 16), static_cast<uint16_t>(sector_lba))) == false)
+                {
+                    printf("check: directory sector %lu could not be read\n", static_cast<unsigned long>(sector_lba));
+                    problems++;
+                    end_of_directory = true;
+                    break;
+                }
+
+                for (uint16_t offset = 0; offset < PackedSector::bytes_per_sector; offset += 32U)
+                {
+                    const uint16_t first_byte = directory_sector.get_byte(offset);
+                    const uint16_t attribute = directory_sector.get_byte(offset + 11U);
+
+                    if (first_byte == 0x00)
+                    {
+                        end_of_directory = true;
+                        break;
+                    }
+
+                    // deleted, LFN, volume label and the . and .. entries
+                    if (first_byte == 0xE5 || attribute == 0x0F || (attribute & 0x08) != 0U || first_byte == '.')
+                    {
+                        continue;
+                    }
+
+                    char name[12];
+                    for (uint16_t i = 0; i < 11U; i++)
+                    {
+                        name[i] = static_cast<char>(directory_sector.get_byte(offset + i));
+                    }
+                    name[11] = '\0';
+
+                    const uint32_t first_cluster = (static_cast<uint32_t>(directory_sector.get_le16(offset + 20U)) << 16) | directory_sector.get_le16(offset + 26U);
+                    const uint32_t size = to_uint32(directory_sector.get_le32(offset + 28U));
+
+                    if (first_cluster == 0U)
+                    {
+                        if (size != 0U || (attribute & 0x10) != 0U)
+                        {
+                            printf("check: %s has no clusters\n", name);
+                            problems++;
+                        }
+                        continue;
+                    }
+
+                    const uint32_t length = mark_chain(fat, in_chain, end_cluster, first_cluster);
+                    if (length == 0U)
+                    {
+                        printf("check: the chain of %s is broken\n", name);
+                        problems++;
+                    }
+                    else if ((attribute & 0x10) != 0U)
+                    {
+                        directories[number_of_directories++] = first_cluster;
+                    }
+                    else if (length < (size + cluster_bytes - 1U) / cluster_bytes)
+                    {
+                        printf("check: %s holds %lu bytes in %lu clusters\n", name, static_cast<unsigned long>(size), static_cast<unsigned long>(length));
+                        problems++;
+                    }
+                }
+            }
+
+            end_of_directory = end_of_directory || fat[cluster] >= 0x0FFFFFF8U;
+        }
+    }
+
+    uint32_t free_clusters = 0U;
+    uint32_t lost_clusters = 0U;
+    for (uint32_t cluster = 2U; problems == 0U && cluster < end_cluster; cluster++)
+    {
+        free_clusters += (fat[cluster] == 0U) ? 1U : 0U;
+        lost_clusters += (fat[cluster] != 0U && in_chain[cluster] == 0U) ? 1U : 0U;
+    }
+
+    if (lost_clusters != 0U)
+    {
+        printf("check: %lu lost clusters\n", static_cast<unsigned long>(lost_clusters));
+        problems++;
+    }
+
+    const uint32_t fs_info_lba = volume_lba + volume_id.fs_info_sector;
+    PackedSector fs_info_sector;
+    if (problems == 0U &&
+        image_device.read_block(fs_info_sector, Address32(static_cast<uint16_t>(fs_info_lba >> 16), static_cast<uint16_t>(fs_info_lba))))
+    {
+        const uint32_t free_count = to_uint32(fs_info_sector.get_le32(488U));
+        if (free_count != 0xFFFFFFFFU && free_count != free_clusters)
+        {
+            printf("check: FSInfo has %lu free clusters, the FAT %lu\n", static_cast<unsigned long>(free_count), static_cast<unsigned long>(free_clusters));
+            problems++;
+        }
+    }
+
+    free(directories);
+    free(in_chain);
+    free(fat);
+    return problems;
+}
+
+/**
+ * @brief Size of PWR0000.BIN when a power loss run starts
+ */
+uint32_t power_loss_base_size(const uint32_t &cluster_bytes)
+{
+    return (cluster_bytes << 1) + 700U;
+}
+
+/**
+ * @brief Files of a power loss run and every size the card may be left with for each
+ */
+struct PowerLossFile
+{
+    ManifestEntry entry;
+
+    /**
+     * @brief no_power_loss_file if the entry may be missing, 0 for one created and not yet committed
+     */
+    uint32_t sizes[3];
+};
+
+constexpr uint16_t power_loss_files = 4U;
+
+constexpr uint32_t no_power_loss_file = 0xFFFFFFFFU;
+
+void make_power_loss_files(const uint32_t &cluster_bytes, PowerLossFile (&files)[power_loss_files])
+{
+    const uint32_t base_size = power_loss_base_size(cluster_bytes);
+    const uint32_t sizes[power_loss_files][3] = {
+        { base_size, base_size + cluster_bytes + 300U, base_size + (cluster_bytes << 1) + 300U },
+        { no_power_loss_file, 0U, (cluster_bytes << 1) + 100U },
+        { no_power_loss_file, 0U, (cluster_bytes >> 1) + 100U },
+        { no_power_loss_file, 0U, 0U },
+    };
+
+    for (uint16_t i = 0; i < power_loss_files; i++)
+    {
+        make_write_name("PWR", i, files[i].entry);
+        memcpy(files[i].sizes, sizes[i], sizeof(files[i].sizes));
+    }
+}
+
+/**
+ * @brief The run phase 5 cuts the power in, from PWR0000.BIN of power_loss_base_size() bytes and
+ * no other PWR file
+ *
+ * @return true every call returned true
+ */
+bool run_power_loss_workload(FileSystem &file_system, const uint32_t &cluster_bytes)
+{
+    PowerLossFile files[power_loss_files];
+    make_power_loss_files(cluster_bytes, files);
+    const ManifestEntry &pwr0 = files[0].entry;
+    const ManifestEntry &pwr1 = files[1].entry;
+    const ManifestEntry &pwr2 = files[2].entry;
+    const ManifestEntry &pwr3 = files[3].entry;
+
+    FileSystem::File file_0;
+    FileSystem::File file_1;
+    FileSystem::File file_2;
+    FileSystem::File file_3;
+    FileSystem::File second_handle;
+
+    // a committed file appended to and a new one staged for one commit (rolled forward if the
+    // power goes while it is applied), then a committed file deleted (its chain is freed again if
+    // the delete is rolled back)
+    return file_system.open(pwr0.file_name, 0U, pwr0.enclosing_directory_names, file_0, FileSystem::open_mode_t::APPEND) &&
+           append_pattern(file_system, file_0, pwr0.seed, cluster_bytes + 300U) && file_system.stage(file_0) &&
+           file_system.create(pwr1.file_name, 0U, pwr1.enclosing_directory_names, file_1) &&
+           append_pattern(file_system, file_1, pwr1.seed, (cluster_bytes << 1) + 100U) && file_system.stage(file_1) &&
+           file_system.commit() &&
+           append_pattern(file_system, file_0, pwr0.seed, cluster_bytes) && file_system.close(file_0) &&
+           file_system.delete_file(pwr1.file_name, 0U, pwr1.enclosing_directory_names) &&
+           // files only staged, the card has no clusters for them yet
+           file_system.create(pwr2.file_name, 0U, pwr2.enclosing_directory_names, file_2) &&
+           append_pattern(file_system, file_2, pwr2.seed, cluster_bytes >> 1) && file_system.stage(file_2) &&
+           file_system.open(pwr2.file_name, 0U, pwr2.enclosing_directory_names, second_handle, FileSystem::open_mode_t::APPEND) &&
+           append_pattern(file_system, second_handle, pwr2.seed, 100U) && file_system.close(second_handle) &&
+           file_system.create(pwr3.file_name, 0U, pwr3.enclosing_directory_names, file_3) &&
+           append_pattern(file_system, file_3, pwr3.seed, cluster_bytes) && file_system.stage(file_3) &&
+           file_system.delete_file(pwr3.file_name, 0U, pwr3.enclosing_directory_names) &&
+           file_system.unmount();
+}
+
+/**
+ * @brief Deletes the files a power loss run left and creates PWR0000.BIN again
+ */
+bool reset_power_loss_files(FileSystem &file_system, const uint32_t &cluster_bytes)
+{
+    PowerLossFile files[power_loss_files];
+    make_power_loss_files(cluster_bytes, files);
+
+    for (uint16_t i = 0; i < power_loss_files; i++)
+    {
+        file_system.delete_file(files[i].entry.file_name, 0U, files[i].entry.enclosing_directory_names);
+    }
+
+    FileSystem::File file;
+    return file_system.create(files[0].entry.file_name, 0U, files[0].entry.enclosing_directory_names, file) &&
+           append_pattern(file_system, file, files[0].entry.seed, power_loss_base_size(cluster_bytes)) && file_system.close(file);
+}
+
+/**
+ * @brief Checks every file of the power loss run has one of the sizes it may have and reads back
+ *
+ * @return uint32_t files that do not, each is printed
+ */
+uint32_t check_power_loss_files(FileSystem &file_system, const uint32_t &cluster_bytes)
+{
+    PowerLossFile files[power_loss_files];
+    make_power_loss_files(cluster_bytes, files);
+    uint32_t problems = 0U;
+
+    for (uint16_t i = 0; i < power_loss_files; i++)
+    {
+        ManifestEntry &entry = files[i].entry;
+        FileSystem::FAT32FileSystemEntry file_entry;
+
+        entry.size = file_system.stat(entry.file_name, 0U, entry.enclosing_directory_names, file_entry) ?
+                     to_uint32(file_entry.size_of_entry_in_bytes) : no_power_loss_file;
+
+        bool size_expected = false;
+        for (uint16_t j = 0; j < 3U; j++)
+        {
+            size_expected = size_expected || entry.size == files[i].sizes[j];
+        }
+
+        if (size_expected == false || (entry.size != no_power_loss_file && verify_file(file_system, entry) == false))
+        {
+            printf("check: PWR%04X.BIN (size %lu) does not match\n", i, static_cast<unsigned long>(entry.size));
+            problems++;
+        }
+    }
+
+    return problems;
+}
+
+/**
+ * @brief Phase 5, runs run_power_loss_workload() with the power cut after 0, step, 2 step, ...
+ * blocks until the run completes, each time remounting (which recovers from the intent record)
+ * and checking the volume and the files of the run. The state of the record checks each recovery
+ * path was taken at least once
+ *
+ * @param block_device device the file system is mounted on, image_device or a pipeline in front of
+ * it
+ */
+uint32_t run_power_loss_phase(BlockDevice &block_device, ImageBlockDevice &image_device, const HarnessOptions &options)
+{
+    FileSystem *file_system = mount(block_device, options);
+    if (file_system == nullptr)
+    {
+        printf("power loss: mount failed\n");
+        return 1U;
+    }
+
+    const FileSystem::FAT32MasterBootRecord master_boot_record = file_system->get_fat_32_master_boot_record();
+    const FileSystem::FAT32VolumeID volume_id = file_system->get_fat_32_volume_id();
+    const uint32_t cluster_bytes = static_cast<uint32_t>(volume_id.sectors_per_cluster) << 9;
+
+    uint32_t failures = 0U;
+    uint32_t power_cuts = 0U;
+    uint32_t roll_backs = 0U;
+    uint32_t freed_chain_roll_backs = 0U;
+    uint32_t roll_forwards = 0U;
+
+    for (uint32_t blocks_written = 0U; file_system != nullptr; blocks_written += options.power_loss_step)
+    {
+        // the same run from the same files every time
+        if (reset_power_loss_files(*file_system, cluster_bytes) == false || file_system->unmount() == false)
+        {
+            printf("power loss: the files could not be reset\n");
+            failures++;
+            break;
+        }
+
+        delete file_system;
+        file_system = mount(block_device, options);
+        if (file_system == nullptr)
+        {
+            printf("power loss: remount failed\n");
+            failures++;
+            break;
+        }
+
+        image_device.cut_power_after(blocks_written);
+        const bool completed = run_power_loss_workload(*file_system, cluster_bytes);
+
+        // a run cut short may leave writes queued, they reach the image (or are dropped) first
+        block_device.flush();
+        const bool power_cut = image_device.is_power_cut();
+
+        // nothing in RAM survives the power cut
+        delete file_system;
+        image_device.restore_power();
+
+        if (completed == false && power_cut == false)
+        {
+            printf("power loss: the run failed with the power on\n");
+            failures++;
+        }
+
+        // the record the card was left with, the next mount recovers from it
+        IntentLog intent_log(image_device);
+        intent_log.configure(master_boot_record.primary_partitions[0].lba_begin, volume_id.size_of_reserved_area_sectors,
+                             volume_id.fs_info_sector, volume_id.backup_boot_sector, volume_id.number_of_fats);
+
+        if (intent_log.get_state() == IntentLog::record_state_t::OPEN)
+        {
+            roll_backs++;
+            freed_chain_roll_backs += (intent_log.get_number_of_freed_chains() != 0U) ? 1U : 0U;
+        }
+        else if (intent_log.get_state() == IntentLog::record_state_t::COMMITTING)
+        {
+            roll_forwards++;
+        }
+
+        file_system = mount(block_device, options);
+        if (file_system == nullptr)
+        {
+            printf("power loss: mount after a cut at block %lu failed\n", static_cast<unsigned long>(blocks_written));
+            failures++;
+            break;
+        }
+
+        // the recovery is read back from the image, not from the queue
+        block_device.flush();
+        const uint32_t problems = check_volume(master_boot_record, volume_id, image_device, 1U) + check_power_loss_files(*file_system, cluster_bytes);
+        if (problems != 0U)
+        {
+            printf("power loss: cut at block %lu left %lu problems\n", static_cast<unsigned long>(blocks_written), static_cast<unsigned long>(problems));
+            failures += problems;
+        }
+
+        // every block of the run was written, nothing left to cut
+        if (power_cut == false)
+        {
+            break;
+        }
+        power_cuts++;
+    }
+
+    if (file_system != nullptr)
+    {
+        PowerLossFile files[power_loss_files];
+        make_power_loss_files(cluster_bytes, files);
+
+        for (uint16_t i = 0; i < power_loss_files; i++)
+        {
+            file_system->delete_file(files[i].entry.file_name, 0U, files[i].entry.enclosing_directory_names);
+        }
+
+        if (file_system->unmount() == false)
+        {
+            printf("power loss: unmount failed\n");
+            failures++;
+        }
+        delete file_system;
+    }
+
+    printf("power loss: cuts %lu roll_backs %lu freed_chain_roll_backs %lu roll_forwards %lu\n", static_cast<unsigned long>(power_cuts),
+           static_cast<unsigned long>(roll_backs), static_cast<unsigned long>(freed_chain_roll_backs), static_cast<unsigned long>(roll_forwards));
+
+    // a cut at every block reaches every recovery path
+    if (options.power_loss_step == 1U && (roll_backs == 0U || freed_chain_roll_backs == 0U || roll_forwards == 0U))
+    {
+        printf("power loss: a recovery path was never taken\n");
+        failures++;
+    }
+
+    return failures;
+}
+
+/**
+ * @brief Phase 6, phases 4 and 5 with the file system on a SectorPipeline of
+ * options.pipeline_sectors sector buffers in front of an AsyncBlockDevice that the pipeline polls
+ * itself (single threaded, as on a board without an I/O thread). The files must read back, the
+ * volume must check out, no write may fail and every block queued must reach the image
+ */
+uint32_t run_pipeline_phase(ImageBlockDevice &image_device, const HarnessOptions &options)
+{
+    // declared before the pipeline, which flushes them when it goes
+    SectorPipeline::PipelineSector sectors[max_pipeline_sectors];
+    AsyncBlockDevice io_worker(image_device);
+    SectorPipeline pipeline(io_worker, sectors, options.pipeline_sectors, true);
+
+    const uint64_t image_blocks_written = image_device.get_statistics().blocks_written;
+
+    FileSystem *file_system = mount(pipeline, options);
+    if (file_system == nullptr)
+    {
+        printf("pipeline: mount failed\n");
+        return 1U;
+    }
+
+    const FileSystem::FAT32MasterBootRecord master_boot_record = file_system->get_fat_32_master_boot_record();
+    const FileSystem::FAT32VolumeID volume_id = file_system->get_fat_32_volume_id();
+
+    uint32_t failures = run_write_phase(*file_system, options);
+    delete file_system;
+
+    // run_write_phase() unmounted, so the queue is empty and the image is up to date
+    failures += check_volume(master_boot_record, volume_id, image_device, 1U);
+
+    const SectorPipeline::PipelineStatistics statistics = pipeline.get_statistics();
+    const uint64_t blocks_written = image_device.get_statistics().blocks_written - image_blocks_written;
+
+    printf("pipeline: sectors %u blocks_written %lu producer_stalls %lu stall_polls %lu failed_writes %lu max_requests_in_flight %u\n",
+           options.pipeline_sectors, static_cast<unsigned long>(to_uint32(statistics.blocks_written)),
+           static_cast<unsigned long>(to_uint32(statistics.producer_stalls)), static_cast<unsigned long>(to_uint32(statistics.stall_polls)),
+           static_cast<unsigned long>(to_uint32(statistics.failed_writes)), statistics.max_requests_in_flight);
+
+    if (statistics.failed_writes.is_zero() == false)
+    {
+        printf("pipeline: a write failed\n");
+        failures++;
+    }
+
+    if (to_uint32(statistics.blocks_written) != blocks_written)
+    {
+        printf("pipeline: %lu blocks were queued but %lu written\n", static_cast<unsigned long>(to_uint32(statistics.blocks_written)),
+               static_cast<unsigned long>(blocks_written));
+        failures++;
+    }
+
+    // nothing runs the worker between writes, so a file of more blocks than buffers must have waited
+    if (options.write_files != 0U && (options.write_file_size >> 9) > options.pipeline_sectors && statistics.producer_stalls.is_zero())
+    {
+        printf("pipeline: the producer never waited for a sector buffer\n");
+        failures++;
+    }
+
+    if (options.power_loss_step != 0U)
+    {
+        pipeline.reset_statistics();
+        failures += run_power_loss_phase(pipeline, image_device, options);
+
+        // the blocks written after a cut are dropped by the image, the device still reports success
+        if (pipeline.get_statistics().failed_writes.is_zero() == false)
+        {
+            printf("pipeline: a write failed during the power loss runs\n");
+            failures++;
+        }
+    }
+
+    return failures;
+}
+
+/**
+ * @brief Name, size and seed of file number of phase 7 on volume_index, the same names on both
+ * volumes with a different pattern
+ */
+void make_two_volume_name(const uint16_t &volume_index, const uint16_t &number, const HarnessOptions &options, ManifestEntry &entry)
+{
+    make_write_name("TWO", number, entry);
+    entry.size = options.write_file_size;
+    entry.seed = (number + volume_index * 0x55U) & 0xFF;
+}
+
+/**
+ * @brief Phase 7, mounts partitions 1 and 2 through mount_manager at once with a quota of
+ * two_volume_cache_quota blocks each. Checks their manifest files in turn (each volume is
+ * remounted on its own in lazy mode, so it detaches and attaches again while the other holds
+ * blocks of the shared cache), appends to a file on each a transfer at a time, re-reads them,
+ * then unmounts partition 1 and checks partition 2 still reads back before deleting its files.
+ * Partitions 0 and 5 must not mount, both volumes must check out straight from the image
+ */
+uint32_t run_two_volume_phase(ImageBlockDevice &image_device, const HarnessOptions &options, const ManifestEntry *const (&entries)[2],
+                                const uint32_t (&number_of_entries)[2])
+{
+    uint32_t failures = 0U;
+
+    // partition_index() would wrap them to partitions 4 and 1
+    const uint16_t bad_partition_numbers[2] = {0U, 5U};
+    for (uint16_t i = 0; i < 2U; i++)
+    {
+        MountManager::VolumeOptions volume_options;
+        volume_options.partition_number = bad_partition_numbers[i];
+
+        FileSystem *file_system = mount(image_device, options, volume_options);
+        if (file_system != nullptr)
+        {
+            printf("two volumes: partition %u was mounted\n", bad_partition_numbers[i]);
+            failures++;
+            delete file_system;
+        }
+    }
+
+    MountManager::VolumeOptions volume_options[2];
+    FileSystem *volumes[2] = {nullptr, nullptr};
+    for (uint16_t v = 0; v < 2U; v++)
+    {
+        volume_options[v].partition_number = v + 1U;
+        volume_options[v].block_cache_quota = two_volume_cache_quota;
+        volumes[v] = mount(image_device, options, volume_options[v]);
+    }
+
+    if (volumes[0] == nullptr || volumes[1] == nullptr || mount_manager.get_number_of_volumes() != 2U)
+    {
+        printf("two volumes: mount failed\n");
+        delete volumes[0];
+        delete volumes[1];
+        return failures + 1U;
+    }
+
+    const FileSystem::FAT32MasterBootRecord master_boot_record = volumes[0]->get_fat_32_master_boot_record();
+    const FileSystem::FAT32VolumeID volume_ids[2] = {volumes[0]->get_fat_32_volume_id(), volumes[1]->get_fat_32_volume_id()};
+
+    const uint32_t most_entries = (number_of_entries[0] > number_of_entries[1]) ? number_of_entries[0] : number_of_entries[1];
+    for (uint32_t i = 0; i < most_entries && volumes[0] != nullptr && volumes[1] != nullptr; i++)
+    {
+        for (uint16_t v = 0; v < 2U && volumes[v] != nullptr; v++)
+        {
+            if (i >= number_of_entries[v])
+            {
+                continue;
+            }
+
+            if (options.mount_mode == FileSystem::mount_mode_t::LAZY && i != 0U && (i % verify_batch_files) == 0U)
+            {
+                delete volumes[v];
+                volumes[v] = mount(image_device, options, volume_options[v]);
+
+                if (volumes[v] == nullptr)
+                {
+                    printf("two volumes: remount of partition %u failed\n", v + 1U);
+                    failures++;
+                    break;
+                }
+            }
+
+            // phase 2 looks for the orphaned long names
+            if (entries[v][i].orphaned_long_name == false && verify_manifest_file(*volumes[v], entries[v][i]) == false)
+            {
+                printf("two volumes: partition %u entry %lu (size %lu) does not match\n", v + 1U, static_cast<unsigned long>(i),
+                       static_cast<unsigned long>(entries[v][i].size));
+                failures++;
+            }
+        }
+    }
+
+    // fresh mounts leave the entry table to the files written
+    for (uint16_t v = 0; v < 2U; v++)
+    {
+        if (options.mount_mode == FileSystem::mount_mode_t::LAZY || volumes[v] == nullptr)
+        {
+            delete volumes[v];
+            volumes[v] = mount(image_device, options, volume_options[v]);
+        }
+    }
+
+    if (volumes[0] == nullptr || volumes[1] == nullptr)
+    {
+        printf("two volumes: remount failed\n");
+        delete volumes[0];
+        delete volumes[1];
+        return failures + 1U;
+    }
+
+    for (uint16_t number = 0; number < options.write_files; number++)
+    {
+        ManifestEntry file_entries[2];
+        FileSystem::File files[2];
+        bool created[2] = {false, false};
+
+        for (uint16_t v = 0; v < 2U; v++)
+        {
+            make_two_volume_name(v, number, options, file_entries[v]);
+
+            // left over from a run that was cut short
+            volumes[v]->delete_file(file_entries[v].file_name, 0U, file_entries[v].enclosing_directory_names);
+            created[v] = volumes[v]->create(file_entries[v].file_name, 0U, file_entries[v].enclosing_directory_names, files[v]);
+        }
+
+        if (created[0] == false || created[1] == false)
+        {
+            printf("two volumes: create %u failed\n", number);
+            failures++;
+            continue;
+        }
+
+        // both volumes work in the shared sector buffer in turn
+        bool appended = true;
+        for (uint32_t position = 0U; position < options.write_file_size; position += transfer_bytes)
+        {
+            const uint32_t chunk_bytes = (options.write_file_size - position < transfer_bytes) ? options.write_file_size - position : transfer_bytes;
+
+            for (uint16_t v = 0; v < 2U; v++)
+            {
+                appended = append_pattern(*volumes[v], files[v], file_entries[v].seed, chunk_bytes) && appended;
+            }
+        }
+
+        const bool closed = volumes[0]->close(files[0]) && volumes[1]->close(files[1]);
+        if (appended == false || closed == false)
+        {
+            printf("two volumes: append %u failed\n", number);
+            failures++;
+        }
+    }
+
+    for (uint16_t number = 0; number < options.write_files; number++)
+    {
+        for (uint16_t v = 0; v < 2U; v++)
+        {
+            ManifestEntry entry;
+            make_two_volume_name(v, number, options, entry);
+
+            if (verify_file(*volumes[v], entry) == false)
+            {
+                printf("two volumes: file %u of partition %u does not read back\n", number, v + 1U);
+                failures++;
+            }
+        }
+    }
+
+    for (uint16_t v = 0; v < 2U; v++)
+    {
+        const sd_driver::BlockCache::BlockCacheStatistics cache_statistics = volumes[v]->get_block_cache_statistics();
+        printf("two volumes: partition %u quota %u cache hits %lu misses %lu\n", v + 1U, two_volume_cache_quota,
+               static_cast<unsigned long>(to_uint32(cache_statistics.hits)), static_cast<unsigned long>(to_uint32(cache_statistics.misses)));
+    }
+
+    // partition 1 goes first, its blocks leave the cache to partition 2
+    for (uint16_t v = 0; v < 2U; v++)
+    {
+        for (uint16_t number = 0; number < options.write_files; number++)
+        {
+            ManifestEntry entry;
+            make_two_volume_name(v, number, options, entry);
+
+            if (v == 1U && verify_file(*volumes[v], entry) == false)
+            {
+                printf("two volumes: file %u of partition 2 does not read back after partition 1 was unmounted\n", number);
+                failures++;
+            }
+
+            if (volumes[v]->delete_file(entry.file_name, 0U, entry.enclosing_directory_names) == false)
+            {
+                printf("two volumes: delete %u of partition %u failed\n", number, v + 1U);
+                failures++;
+            }
+        }
+
+        if (volumes[v]->unmount() == false)
+        {
+            printf("two volumes: unmount of partition %u failed\n", v + 1U);
+            failures++;
+        }
+
+        delete volumes[v];
+        volumes[v] = nullptr;
+
+        if (mount_manager.get_number_of_volumes() != 1U - v)
+        {
+            printf("two volumes: partition %u is still attached\n", v + 1U);
+            failures++;
+        }
+    }
+
+    for (uint16_t v = 0; v < 2U; v++)
+    {
+        failures += check_volume(master_boot_record, volume_ids[v], image_device, v + 1U);
+    }
+
+    return failures;
+}
+
+/**
+ * @brief Prints where the volume is against the allocation units of the (simulated) card
+ */
+void print_volume_alignment(const FileSystem &file_system)
+{
+    const FileSystem::VolumeAlignment alignment = file_system.get_volume_alignment();
+    if (alignment.allocation_unit_sectors.is_zero())
+    {
+        return;
+    }
+
+    const unsigned long allocation_unit_sectors = (static_cast<unsigned long>(alignment.allocation_unit_sectors.high()) << 16) |
+                                                  alignment.allocation_unit_sectors.low();
+    const unsigned long clusters_per_allocation_unit = (static_cast<unsigned long>(alignment.clusters_per_allocation_unit.high()) << 16) |
+                                                       alignment.clusters_per_allocation_unit.low();
+
+    printf("alignment: au_sectors %lu partition_aligned %d clusters_aligned %d clusters_per_au %lu\n", allocation_unit_sectors,
+           alignment.partition_aligned ? 1 : 0, alignment.clusters_aligned ? 1 : 0, clusters_per_allocation_unit);
+
+    if (alignment.partition_aligned == false || alignment.clusters_aligned == false)
+    {
+        printf("alignment: volume is not aligned to the allocation unit, writes will be slower\n");
+    }
+}
+
+void print_usage()
+{
+    printf("usage: sd_fs_host IMAGE MANIFEST [--full-scan] [--directory-snapshot] [--write-files N] [--write-file-size N]\n"
+           "                  [--power-loss-step N] [--pipeline-sectors N] [--clock-khz N] [--preamble-bytes N] [--access-bytes N]\n"
+           "                  [--single-block-busy-us N] [--multiple-block-busy-us N] [--au-blocks N]\n");
+}
+
+bool parse_options(const int argc, char **argv, HarnessOptions &options)
+{
+    if (argc < 3)
+    {
+        return false;
+    }
+
+    options.image_path = argv[1];
+    options.manifest_path = argv[2];
+
+    for (int i = 3; i < argc; i++)
+    {
+        const char *option = argv[i];
+        const bool has_value = (i + 1) < argc;
+        const unsigned long value = has_value ? strtoul(argv[i + 1], nullptr, 0) : 0U;
+
+        if (strcmp(option, "--full-scan") == 0)
+        {
+            options.mount_mode = FileSystem::mount_mode_t::FULL_SCAN;
+            continue;
+        }
+
+        if (strcmp(option, "--directory-snapshot") == 0)
+        {
+            options.directory_snapshot = true;
+            continue;
+        }
+
+        if (has_value == false)
+        {
+            return false;
+        }
+        i++;
+
+        if (strcmp(option, "--write-files") == 0)
+        {
+            options.write_files = static_cast<uint16_t>(value);
+        }
+        else if (strcmp(option, "--write-file-size") == 0)
+        {
+            options.write_file_size = static_cast<uint32_t>(value);
+        }
+        else if (strcmp(option, "--power-loss-step") == 0)
+        {
+            options.power_loss_step = static_cast<uint32_t>(value);
+        }
+        else if (strcmp(option, "--pipeline-sectors") == 0 && value <= max_pipeline_sectors)
+        {
+            options.pipeline_sectors = static_cast<uint16_t>(value);
+        }
+        else if (strcmp(option, "--clock-khz") == 0 && value != 0U)
+        {
+            options.cost_model.clock_khz = static_cast<uint32_t>(value);
+        }
+        else if (strcmp(option, "--preamble-bytes") == 0)
+        {
+            options.cost_model.command_preamble_bytes = static_cast<uint32_t>(value);
+        }
+        else if (strcmp(option, "--access-bytes") == 0)
+        {
+            options.cost_model.read_access_bytes = static_cast<uint32_t>(value);
+        }
+        else if (strcmp(option, "--single-block-busy-us") == 0)
+        {
+            options.cost_model.single_block_busy_us = static_cast<uint32_t>(value);
+        }
+        else if (strcmp(option, "--multiple-block-busy-us") == 0)
+        {
+            options.cost_model.multiple_block_busy_us = static_cast<uint32_t>(value);
+        }
+        else if (strcmp(option, "--au-blocks") == 0)
+        {
+            options.cost_model.allocation_unit_blocks = static_cast<uint32_t>(value);
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    HarnessOptions options;
+    if (parse_options(argc, argv, options) == false)
+    {
+        print_usage();
+        return 2;
+    }
+
+    uint32_t number_of_entries = 0U;
+    ManifestEntry *entries = read_manifest(options.manifest_path, 1U, number_of_entries);
+    uint32_t number_of_second_entries = 0U;
+    ManifestEntry *second_entries = read_manifest(options.manifest_path, 2U, number_of_second_entries);
+    if (entries == nullptr || second_entries == nullptr)
+    {
+        printf("could not read manifest %s\n", options.manifest_path);
+        free(entries);
+        free(second_entries);
+        return 2;
+    }
+
+    ImageBlockDevice image_device(options.cost_model);
+    if (image_device.open(options.image_path) == false)
+    {
+        printf("could not open image %s\n", options.image_path);
+        free(entries);
+        free(second_entries);
+        return 2;
+    }
+
+    // the operation ticks in the statistics dump are simulated microseconds, every single
+    // operation takes well under the 65536 a tick difference can hold
+    timed_device = &image_device;
+    StatisticsClock::set_tick_source(read_simulated_ticks);
+
+    printf("image: %lu blocks, manifest: %lu files\n", static_cast<unsigned long>(image_device.get_number_of_blocks()),
+           static_cast<unsigned long>(number_of_entries));
+    if (number_of_second_entries != 0U)
+    {
+        printf("manifest: %lu files on partition 2\n", static_cast<unsigned long>(number_of_second_entries));
+    }
+
+    uint32_t failures = 0U;
+
+    FileSystem *file_system = mount(image_device, options);
+    image_device.print_statistics("mount");
+    image_device.reset_statistics();
+
+    if (file_system == nullptr)
+    {
+        printf("mount failed\n");
+        failures++;
+    }
+    else
+    {
+        print_volume_alignment(*file_system);
+
+        failures += run_verify_phase(file_system, image_device, options, entries, number_of_entries);
+        image_device.print_statistics("verify");
+        image_device.reset_statistics();
+    }
+
+    bool has_files_to_delete = false;
+    for (uint32_t i = 0; i < number_of_entries; i++)
+    {
+        has_files_to_delete = has_files_to_delete || entries[i].delete_by_long_name;
+    }
+
+    if (file_system != nullptr && has_files_to_delete)
+    {
+        failures += run_long_name_phase(file_system, image_device, options, entries, number_of_entries);
+        image_device.print_statistics("long names");
+        image_device.reset_statistics();
+    }
+
+    // a fresh mount so the entries the verify phase loaded leave the entry table to the write phase
+    if (file_system != nullptr && options.mount_mode == FileSystem::mount_mode_t::LAZY)
+    {
+        delete file_system;
+        file_system = mount(image_device, options);
+    }
+
+    if (file_system != nullptr)
+    {
+        failures += run_write_phase(*file_system, options);
+        image_device.print_statistics("write");
+        image_device.reset_statistics();
+
+        file_system->dump_statistics();
+        delete file_system;
+
+        if (options.power_loss_step != 0U)
+        {
+            failures += run_power_loss_phase(image_device, image_device, options);
+            image_device.print_statistics("power loss");
+            image_device.reset_statistics();
+        }
+
+        if (options.pipeline_sectors != 0U)
+        {
+            failures += run_pipeline_phase(image_device, options);
+            image_device.print_statistics("pipeline");
+            image_device.reset_statistics();
+        }
+
+        if (number_of_second_entries != 0U)
+        {
+            const ManifestEntry *const volume_entries[2] = {entries, second_entries};
+            const uint32_t volume_number_of_entries[2] = {number_of_entries, number_of_second_entries};
+
+            failures += run_two_volume_phase(image_device, options, volume_entries, volume_number_of_entries);
+            image_device.print_statistics("two volumes");
+            image_device.reset_statistics();
+        }
+    }
+
+    image_device.close();
+    free(entries);
+    free(second_entries);
+
+    printf("%s (%lu failures)\n", (failures == 0U) ? "PASS" : "FAIL", static_cast<unsigned long>(failures));
+    return (failures == 0U) ? 0 : 1;
+}
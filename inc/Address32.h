@@ -0,0 +1,215 @@
+/**
+ * @file Address32.h
+ * @author Mattheas Jamieson (mattheas@ualberta.ca)
+ * @brief Declaration of 32 bit address/ cluster number type
+ * @version 0.1
+ * @date 2024-03-01
+ */
+
+#ifndef _ADDRESS32_H_
+#define _ADDRESS32_H_
+
+#include <stdint.h>
+
+namespace sd_driver
+{
+
+/**
+ * @brief Unsigned 32 bit value (sector address, cluster number, byte count) made up of two 16 bit
+ * words, the XInC2 is a 16 bit machine so this keeps every operation to a couple of native word
+ * operations.
+ *
+ * @details All arithmetic wraps modulo 2^32. Multiplication and division are only provided by
+ * powers of two (shifts) since software division is disabled for the firmware
+ * (__DISABLE_SOFTWARE_DIVIDE__), which covers every FAT32 calculation as sectors per cluster is
+ * always a power of two and there are 128 entries per FAT sector.
+ */
+class Address32
+{
+  public:
+    /**
+     * @brief Constructs a value of zero
+     */
+    constexpr Address32() : high_word(0U), low_word(0U) {}
+
+    /**
+     * @brief Constructs a value from its two 16 bit halves
+     *
+     * @param _high_word bits 31-16
+     * @param _low_word bits 15-0
+     */
+    constexpr Address32(const uint16_t _high_word, const uint16_t _low_word) : high_word(_high_word), low_word(_low_word) {}
+
+    /**
+     * @brief Constructs a value from 4 bytes given MSB first, any bits above the lower 8 bits of
+     * each byte are ignored
+     */
+    constexpr static Address32 from_bytes(const uint16_t byte_3, const uint16_t byte_2, const uint16_t byte_1, const uint16_t byte_0)
+    {
+        return Address32(static_cast<uint16_t>(((byte_3 & 0xFF) << 8) | (byte_2 & 0xFF)),
+                         static_cast<uint16_t>(((byte_1 & 0xFF) << 8) | (byte_0 & 0xFF)));
+    }
+
+    /**
+     * @brief Constructs a value from 4 bytes stored in Little Endian format (LSB first) as they
+     * are on the SD card, e.g., from a sector read into a uint16_t[512] where every uint16_t is a byte
+     *
+     * @param bytes pointer to the LSB
+     */
+    constexpr static Address32 from_little_endian(const uint16_t *bytes)
+    {
+        return from_bytes(bytes[3], bytes[2], bytes[1], bytes[0]);
+    }
+
+    /**
+     * @brief Constructs a value from 4 bytes stored in Big Endian format (MSB at index 0)
+     */
+    constexpr static Address32 from_big_endian(const uint16_t (&bytes)[4])
+    {
+        return from_bytes(bytes[0], bytes[1], bytes[2], bytes[3]);
+    }
+
+    /**
+     * @brief Splits the value into 4 bytes in Big Endian format, MSB at index 0, this is the
+     * order addresses are sent in SD card commands
+     */
+    void to_big_endian(uint16_t (&bytes)[4]) const
+    {
+        bytes[0] = high_word >> 8;
+        bytes[1] = high_word & 0xFF;
+        bytes[2] = low_word >> 8;
+        bytes[3] = low_word & 0xFF;
+    }
+
+    /**
+     * @brief Writes the value as 4 bytes in Little Endian format (LSB first) as they are stored
+     * on the SD card
+     *
+     * @param bytes pointer to where the LSB is written
+     */
+    void to_little_endian(uint16_t *bytes) const
+    {
+        bytes[0] = low_word & 0xFF;
+        bytes[1] = low_word >> 8;
+        bytes[2] = high_word & 0xFF;
+        bytes[3] = high_word >> 8;
+    }
+
+    /**
+     * @brief bits 31-16
+     */
+    constexpr uint16_t high() const { return high_word; }
+
+    /**
+     * @brief bits 15-0
+     */
+    constexpr uint16_t low() const { return low_word; }
+
+    constexpr bool is_zero() const { return high_word == 0U && low_word == 0U; }
+
+    /**
+     * @brief Returns the lower num_bits bits (at most 16), i.e., the remainder of a division by
+     * 2^num_bits
+     */
+    constexpr uint16_t low_bits(const uint16_t num_bits) const
+    {
+        return num_bits >= 16U ? low_word : static_cast<uint16_t>(low_word & ((1U << num_bits) - 1U));
+    }
+
+    constexpr Address32 operator+(const Address32 &other) const
+    {
+        return Address32(static_cast<uint16_t>(high_word + other.high_word + (static_cast<uint16_t>(low_word + other.low_word) < low_word ? 1U : 0U)),
+                         static_cast<uint16_t>(low_word + other.low_word));
+    }
+
+    constexpr Address32 operator-(const Address32 &other) const
+    {
+        return Address32(static_cast<uint16_t>(high_word - other.high_word - (other.low_word > low_word ? 1U : 0U)),
+                         static_cast<uint16_t>(low_word - other.low_word));
+    }
+
+    /**
+     * @brief Multiplication by 2^shift
+     */
+    constexpr Address32 operator<<(const uint16_t shift) const
+    {
+        return shift == 0U ? *this :
+               shift < 16U ? Address32(static_cast<uint16_t>((high_word << shift) | (low_word >> (16U - shift))), static_cast<uint16_t>(low_word << shift)) :
+               shift < 32U ? Address32(static_cast<uint16_t>(low_word << (shift - 16U)), 0U) :
+               Address32();
+    }
+
+    /**
+     * @brief Division by 2^shift
+     */
+    constexpr Address32 operator>>(const uint16_t shift) const
+    {
+        return shift == 0U ? *this :
+               shift < 16U ? Address32(static_cast<uint16_t>(high_word >> shift), static_cast<uint16_t>((low_word >> shift) | (high_word << (16U - shift)))) :
+               shift < 32U ? Address32(0U, static_cast<uint16_t>(high_word >> (shift - 16U))) :
+               Address32();
+    }
+
+    constexpr Address32 operator&(const Address32 &other) const
+    {
+        return Address32(high_word & other.high_word, low_word & other.low_word);
+    }
+
+    constexpr Address32 operator|(const Address32 &other) const
+    {
+        return Address32(high_word | other.high_word, low_word | other.low_word);
+    }
+
+    constexpr bool operator==(const Address32 &other) const { return high_word == other.high_word && low_word == other.low_word; }
+    constexpr bool operator!=(const Address32 &other) const { return !(*this == other); }
+    constexpr bool operator<(const Address32 &other) const
+    {
+        return high_word < other.high_word || (high_word == other.high_word && low_word < other.low_word);
+    }
+    constexpr bool operator>(const Address32 &other) const { return other < *this; }
+    constexpr bool operator<=(const Address32 &other) const { return !(other < *this); }
+    constexpr bool operator>=(const Address32 &other) const { return !(*this < other); }
+
+    Address32 &operator+=(const Address32 &other) { *this = *this + other; return *this; }
+    Address32 &operator-=(const Address32 &other) { *this = *this - other; return *this; }
+    Address32 &operator<<=(const uint16_t shift) { *this = *this << shift; return *this; }
+    Address32 &operator>>=(const uint16_t shift) { *this = *this >> shift; return *this; }
+
+    /**
+     * @brief Multiplication by a 16 bit factor using shift and add, at most 16 iterations no
+     * matter how large the value is
+     */
+    Address32 multiply(const uint16_t factor) const
+    {
+        Address32 result;
+        Address32 shifted = *this;
+        for (uint16_t remaining = factor; remaining != 0U; remaining >>= 1)
+        {
+            if (remaining & 0x1)
+            {
+                result += shifted;
+            }
+            shifted <<= 1;
+        }
+        return result;
+    }
+
+    /**
+     * @brief Returns n where 2^n == power_of_two, or 0xFFFF if power_of_two is not a power of two
+     */
+    constexpr static uint16_t log2(const uint16_t power_of_two, const uint16_t n = 0U)
+    {
+        return power_of_two == 0U ? 0xFFFF :
+               power_of_two == 1U ? n :
+               (power_of_two & 0x1) ? 0xFFFF :
+               log2(static_cast<uint16_t>(power_of_two >> 1), static_cast<uint16_t>(n + 1U));
+    }
+
+  private:
+    uint16_t high_word;
+    uint16_t low_word;
+};
+
+} // namespace sd_driver
+
+#endif // _ADDRESS32_H_
@@ -0,0 +1,176 @@
+/**
+ * @file AsyncBlockDevice.h
+ * @author Mattheas Jamieson (mattheas@ualberta.ca)
+ * @brief Declaration of asynchronous block request queue/ I/O worker
+ * @version 0.1
+ * @date 2024-03-03
+ */
+
+#ifndef _ASYNCBLOCKDEVICE_H_
+#define _ASYNCBLOCKDEVICE_H_
+
+#include "../inc/BlockDevice.h"
+
+namespace sd_driver
+{
+
+enum class block_request_type_t
+{
+    READ = 0, /**< read num_blocks blocks into read_words */
+    WRITE     /**< write num_blocks blocks from write_words */
+};
+
+enum class block_request_status_t
+{
+    PENDING = 0, /**< queued or being carried out by the I/O worker */
+    DONE,        /**< every block was read/ written */
+    FAILED       /**< the device reported an error */
+};
+
+/**
+ * @brief A read or write of contiguous blocks handed to the I/O worker. The request (and the
+ * buffer it points to) must stay valid and untouched until status is no longer PENDING
+ */
+struct BlockRequest
+{
+    /**
+     * @brief Callback invoked by the I/O worker once a request has completed, it runs on the
+     * thread that owns the device (i.e., in run()/ poll()) so it should be short. request is a
+     * copy taken as the request completed, the producer may already be reusing the original
+     */
+    typedef void (*request_completed_callback_t)(BlockRequest &request, void *context);
+
+    block_request_type_t type = block_request_type_t::READ;
+
+    /**
+     * @brief Destination of a read, num_blocks * 256 words (same layout as PackedSector::words)
+     */
+    uint16_t *read_words = nullptr;
+
+    /**
+     * @brief Source of a write, num_blocks * 256 words (same layout as PackedSector::words)
+     */
+    const uint16_t *write_words = nullptr;
+
+    Address32 block_address;
+
+    uint16_t num_blocks = 0U;
+
+    /**
+     * @brief Only written by the I/O worker once the request has been submitted, a producer can
+     * spin on it (or use AsyncBlockDevice::wait()) instead of a completion callback
+     */
+    volatile block_request_status_t status = block_request_status_t::DONE;
+
+    request_completed_callback_t completed_callback = nullptr;
+
+    void *context = nullptr;
+};
+
+/**
+ * @brief Lets one thread queue block reads/ writes that are carried out by the thread that owns
+ * the block device (e.g., an SDCard), so the producer is not stalled while the card transfers
+ * data or programs flash.
+ *
+ * @details Requests are passed through a lock free single producer/ single consumer ring of
+ * request pointers: only the producer thread calls submit(), and only the thread that owns the
+ * device calls poll()/ run(). Each ring index is written by a single thread so no lock is needed
+ * (the XInC2 threads share memory with no data cache). The indices and ring slots are volatile so
+ * the compiler does not cache them, and a compiler barrier keeps the plain stores filling in a
+ * request (or reading it back) on the right side of the index that hands it over. The owning
+ * thread either runs run() as its entry point, or a single threaded application can call poll()
+ * from its main loop. Nothing else may use the block device while requests are in flight.
+ */
+class AsyncBlockDevice
+{
+  public:
+    /**
+     * @brief Number of requests that can be queued at once, must be a power of 2
+     */
+    constexpr static uint16_t queue_length = 8U;
+
+    /**
+     * @brief Constructs a new AsyncBlockDevice object with an empty queue
+     *
+     * @param _block_device device the requests are carried out on, owned by the thread calling
+     * poll()/ run() from now on
+     */
+    AsyncBlockDevice(BlockDevice &_block_device);
+
+    ~AsyncBlockDevice();
+
+    /**
+     * @brief Queues a request (producer thread only), request.status is set to PENDING
+     *
+     * @return true request was queued
+     * @return false queue is full (or the request is empty), request is not touched
+     */
+    bool submit(BlockRequest &request);
+
+    /**
+     * @brief Fills in and queues a read of num_blocks blocks into words, see submit()
+     */
+    bool submit_read(BlockRequest &request, uint16_t *words, const Address32 &block_address, const uint16_t &num_blocks);
+
+    /**
+     * @brief Fills in and queues a write of num_blocks blocks from words, see submit()
+     */
+    bool submit_write(BlockRequest &request, const uint16_t *words, const Address32 &block_address, const uint16_t &num_blocks);
+
+    /**
+     * @brief Spins until request is no longer PENDING (producer thread only)
+     *
+     * @return true request completed successfully
+     * @return false request failed
+     */
+    bool wait(const BlockRequest &request) const;
+
+    /**
+     * @brief Carries out the oldest queued request, if any (owning thread only)
+     *
+     * @return true a request was carried out
+     * @return false the queue was empty
+     */
+    bool poll();
+
+    /**
+     * @brief Entry point of the I/O thread, polls the queue forever
+     */
+    void run();
+
+    /**
+     * @brief Number of requests queued or being carried out
+     */
+    uint16_t get_number_of_pending_requests() const;
+
+    bool is_full() const;
+
+    bool is_idle() const;
+
+    /**
+     * @brief Allocation unit of the device (see BlockDevice::get_allocation_unit_blocks()), it is
+     * fixed once the device is initialized so any thread may call this
+     */
+    Address32 get_allocation_unit_blocks() const;
+
+  private:
+    constexpr static uint16_t queue_index_mask = queue_length - 1U;
+
+    BlockDevice &block_device;
+
+    BlockRequest *volatile queue[queue_length];
+
+    /**
+     * @brief Number of requests ever submitted, only written by the producer. The slot the next
+     * request goes in is head & queue_index_mask (the counters are free running and wrap)
+     */
+    volatile uint16_t head = 0U;
+
+    /**
+     * @brief Number of requests ever completed, only written by the owning thread
+     */
+    volatile uint16_t tail = 0U;
+};
+} // namespace sd_driver
+
+#endif // _ASYNCBLOCKDEVICE_H_
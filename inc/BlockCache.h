@@ -0,0 +1,284 @@
+/**
+ * @file BlockCache.h
+ * @author Mattheas Jamieson (mattheas@ualberta.ca)
+ * @brief Declaration of block (sector) cache
+ * @version 0.1
+ * @date 2024-03-03
+ */
+
+#ifndef _BLOCKCACHE_H_
+#define _BLOCKCACHE_H_
+
+#include "../inc/BlockDevice.h"
+
+namespace sd_driver
+{
+
+/**
+ * @brief Write-through cache of blocks that sits in front of another BlockDevice (e.g., an SDCard).
+ * Reads of cached blocks cost no SPI transactions, writes always go to the device and update the
+ * cached copy.
+ *
+ * @details Blocks are replaced with the clock (second chance) algorithm: a hit sets the blocks
+ * referenced bit, and when a slot is needed the clock hand skips (and clears) referenced blocks
+ * so recently used blocks survive a scan. Pinned blocks are never replaced. The cache does not
+ * own its storage, the owner passes an array of CachedBlock so the capacity is chosen by the
+ * owner at compile time.
+ *
+ * Several caches (e.g., one per volume, each on its own device) can share one BlockPool of slots,
+ * a cache only finds its own blocks but replaces whichever block the clock hand picks while it
+ * holds fewer than its quota. At its quota it only replaces its own blocks. Every cached block is
+ * clean (the cache is write-through) so one cache taking a slot from another costs nothing.
+ */
+class BlockCache : public BlockDevice
+{
+  public:
+    struct CachedBlock
+    {
+        /**
+         * @brief Set once data holds a block read from/ written to the device
+         */
+        bool valid = false;
+
+        /**
+         * @brief Pinned blocks are never replaced, see pin()
+         */
+        bool pinned = false;
+
+        /**
+         * @brief Set on every hit, cleared when the clock hand passes over the block
+         */
+        bool referenced = false;
+
+        /**
+         * @brief Cache holding the block while valid, see BlockPool
+         */
+        BlockCache *owner = nullptr;
+
+        Address32 block_address;
+
+        PackedSector data;
+    };
+
+    /**
+     * @brief Slots shared by every BlockCache constructed on it, with the clock hand that sweeps
+     * over all of them
+     */
+    struct BlockPool
+    {
+        /**
+         * @param _cached_blocks storage for the cached blocks, must outlive every cache on the pool
+         * @param _number_of_cached_blocks number of elements in _cached_blocks
+         */
+        BlockPool(CachedBlock *_cached_blocks, const uint16_t _number_of_cached_blocks);
+
+        CachedBlock *const cached_blocks;
+
+        const uint16_t number_of_cached_blocks;
+
+        /**
+         * @brief Index of the next slot the clock algorithm considers for replacement
+         */
+        uint16_t clock_hand = 0U;
+    };
+
+    struct BlockCacheStatistics
+    {
+        /**
+         * @brief Blocks served from the cache
+         */
+        Address32 hits;
+
+        /**
+         * @brief Blocks that had to be read from the device
+         */
+        Address32 misses;
+    };
+
+    /**
+     * @brief Constructs a new BlockCache object, every slot of _cached_blocks is marked empty
+     *
+     * @param _block_device device being cached
+     * @param _cached_blocks storage for the cached blocks, must outlive the cache
+     * @param _number_of_cached_blocks number of elements in _cached_blocks (the capacity)
+     */
+    BlockCache(BlockDevice &_block_device, CachedBlock *_cached_blocks, const uint16_t _number_of_cached_blocks);
+
+    /**
+     * @brief Constructs a new BlockCache object that shares the slots of a pool with other caches
+     *
+     * @param _block_device device being cached
+     * @param _block_pool slots shared with the other caches, must outlive the cache
+     * @param _quota most blocks this cache holds at once, 0 (or more than the pool) for the whole pool
+     */
+    BlockCache(BlockDevice &_block_device, BlockPool &_block_pool, const uint16_t _quota);
+
+    /**
+     * @brief Gives back every slot the cache holds to the pool
+     */
+    ~BlockCache();
+
+    bool read_block(PackedSector &block, const Address32 &block_address) override;
+
+    bool write_block(const PackedSector &block, const Address32 &block_address) override;
+
+    /**
+     * @brief Cached blocks are handed to block_callback straight from the cache, each run of
+     * consecutive uncached blocks is read from the device in a single transfer and the blocks
+     * are cached as they stream past. As with the device, block holds the last block handed to
+     * block_callback once this returns
+     */
+    bool read_blocks(PackedSector &block, const Address32 &block_address, const uint16_t &num_blocks,
+                        block_read_callback_t block_callback, void *context) override;
+
+    /**
+     * @brief Blocks are written to the device in a single transfer, cached copies of the
+     * written blocks are updated (blocks that are not cached are NOT added to the cache)
+     */
+    bool write_blocks(PackedSector &block, const Address32 &block_address, const uint16_t &num_blocks,
+                        block_write_callback_t block_callback, void *context) override;
+
+    /**
+     * @brief Cached blocks are copied out of the cache, each run of uncached blocks is read from
+     * the device straight into words. Blocks read this way (bulk file data) are NOT added to the
+     * cache so they do not push out metadata
+     */
+    bool read_contiguous_blocks(uint16_t *words, const Address32 &block_address, const uint16_t &num_blocks) override;
+
+    /**
+     * @brief Blocks are written to the device in a single transfer, cached copies of the written
+     * blocks are updated (blocks that are not cached are NOT added to the cache)
+     */
+    bool write_contiguous_blocks(const uint16_t *words, const Address32 &block_address, const uint16_t &num_blocks) override;
+
+    /**
+     * @brief Nothing is held back by the cache (it's write-through), flushes the device
+     */
+    bool flush() override;
+
+    /**
+     * @brief Allocation unit of the device
+     */
+    Address32 get_allocation_unit_blocks() const override;
+
+    /**
+     * @brief Reads a block into the cache (if it's not already) and pins it so it is never
+     * replaced, intended for metadata that is read over and over (e.g., the root directory)
+     *
+     * @return true block is cached and pinned
+     * @return false block could not be read or every slot is already pinned
+     */
+    bool pin(const Address32 &block_address);
+
+    /**
+     * @brief Allows a pinned block to be replaced again, it stays cached until it is
+     */
+    void unpin(const Address32 &block_address);
+
+    /**
+     * @brief Discards every block this cache holds, including pinned ones
+     */
+    void invalidate();
+
+    /**
+     * @brief Number of slots of the pool holding blocks of this cache
+     */
+    uint16_t get_number_of_cached_blocks() const;
+
+    BlockCacheStatistics get_statistics() const;
+
+    void reset_statistics();
+
+  private:
+    /**
+     * @brief State shared with read_through_callback() while a run of uncached blocks is read
+     * from the device
+     */
+    struct ReadThroughContext
+    {
+        BlockCache *block_cache = nullptr;
+        Address32 first_block_address;
+        uint16_t first_block_index = 0U;
+        block_read_callback_t block_callback = nullptr;
+        void *context = nullptr;
+        bool stopped = false;
+    };
+
+    /**
+     * @brief State shared with write_through_callback() while blocks are written to the device
+     */
+    struct WriteThroughContext
+    {
+        BlockCache *block_cache = nullptr;
+        Address32 first_block_address;
+        block_write_callback_t block_callback = nullptr;
+        void *context = nullptr;
+    };
+
+    /**
+     * @brief Caches a block read from the device and forwards it to the callers callback
+     */
+    static bool read_through_callback(const PackedSector &block, const uint16_t &block_index, void *context);
+
+    /**
+     * @brief Has the callers callback produce a block and updates the cached copy of it
+     */
+    static bool write_through_callback(PackedSector &block, const uint16_t &block_index, void *context);
+
+    /**
+     * @brief Returns the slot holding block_address or nullptr if it is not cached
+     */
+    CachedBlock *find(const Address32 &block_address);
+
+    /**
+     * @brief Stores a copy of block in the cache, replacing a block picked by the clock hand
+     *
+     * @return CachedBlock* slot the block was stored in, nullptr if every slot is pinned
+     */
+    CachedBlock *insert(const PackedSector &block, const Address32 &block_address);
+
+    /**
+     * @brief Advances the clock hand to the first slot that is empty or neither pinned nor
+     * referenced, clearing the referenced bit of every slot it passes over
+     *
+     * @return CachedBlock* slot to replace, nullptr if every slot is pinned
+     */
+    CachedBlock *select_replacement();
+
+    /**
+     * @brief Drops block_address from the cache (even if pinned), used when a write fails and
+     * the contents of the block on the device are unknown
+     */
+    void invalidate(const Address32 &block_address);
+
+    /**
+     * @brief Empties a slot, the cache that held it (if any) holds one block less
+     */
+    static void release(CachedBlock &cached_block);
+
+    /**
+     * @brief Marks a slot returned by select_replacement() as holding block_address for this cache
+     */
+    void claim(CachedBlock &cached_block, const Address32 &block_address);
+
+    BlockDevice &block_device;
+
+    /**
+     * @brief Pool of a cache constructed on its own storage, not used by a cache on a shared pool
+     */
+    BlockPool own_pool;
+
+    BlockPool &block_pool;
+
+    const uint16_t quota;
+
+    /**
+     * @brief Slots of block_pool holding blocks of this cache
+     */
+    uint16_t blocks_held = 0U;
+
+    BlockCacheStatistics statistics;
+};
+} // namespace sd_driver
+
+#endif // _BLOCKCACHE_H_
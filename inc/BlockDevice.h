@@ -0,0 +1,139 @@
+/**
+ * @file BlockDevice.h
+ * @author Mattheas Jamieson (mattheas@ualberta.ca)
+ * @brief Declaration of block device interface
+ * @version 0.1
+ * @date 2024-03-01
+ */
+
+#ifndef _BLOCKDEVICE_H_
+#define _BLOCKDEVICE_H_
+
+#include "../inc/Address32.h"
+#include "../inc/PackedSector.h"
+
+namespace sd_driver
+{
+
+/**
+ * @brief Interface to a device that is read and written in 512 byte blocks (sectors), such as an
+ * SD card. Blocks are held in a PackedSector (two bytes per uint16_t).
+ */
+class BlockDevice
+{
+  public:
+    virtual ~BlockDevice() {}
+
+    /**
+     * @brief Callback invoked by read_blocks() once for every block read from the device.
+     *
+     * @details block is only valid for the duration of the call, it is overwritten by the next
+     * block of the transfer. block_index is the position of the block in the transfer, i.e., 0
+     * for the block at the starting address, 1 for the next, etc. context is passed through
+     * unchanged from read_blocks()
+     *
+     * @return true to continue streaming blocks
+     * @return false to stop the transfer early (the remaining blocks are not read)
+     */
+    typedef bool (*block_read_callback_t)(const PackedSector &block, const uint16_t &block_index, void *context);
+
+    /**
+     * @brief Callback invoked by write_blocks() once for every block to be written to the device.
+     *
+     * @details The callback fills block with the data to be written, it is written as soon as
+     * the callback returns. block_index is the position of the block in the transfer, i.e., 0
+     * for the block at the starting address, 1 for the next, etc. context is passed through
+     * unchanged from write_blocks()
+     *
+     * @return true if block has been filled and should be written
+     * @return false if there is no more data, block is NOT written and the transfer is ended
+     */
+    typedef bool (*block_write_callback_t)(PackedSector &block, const uint16_t &block_index, void *context);
+
+    /**
+     * @brief Reads a single block
+     *
+     * @param block returned contents of the block
+     * @param block_address block number (i.e., sector address)
+     * @return true block was read
+     * @return false read failed
+     */
+    virtual bool read_block(PackedSector &block, const Address32 &block_address) = 0;
+
+    /**
+     * @brief Writes a single block
+     *
+     * @param block contents of the block
+     * @param block_address block number (i.e., sector address)
+     * @return true block was written
+     * @return false write failed
+     */
+    virtual bool write_block(const PackedSector &block, const Address32 &block_address) = 0;
+
+    /**
+     * @brief Reads num_blocks contiguous blocks, each is read into block and handed to
+     * block_callback before the next is read
+     *
+     * @return true every requested block was read (or the callback stopped the transfer)
+     * @return false read failed
+     */
+    virtual bool read_blocks(PackedSector &block, const Address32 &block_address, const uint16_t &num_blocks,
+                                block_read_callback_t block_callback, void *context) = 0;
+
+    /**
+     * @brief Writes up to num_blocks contiguous blocks, each is produced into block by
+     * block_callback just before it is written
+     *
+     * @return true every produced block was written
+     * @return false write failed
+     */
+    virtual bool write_blocks(PackedSector &block, const Address32 &block_address, const uint16_t &num_blocks,
+                                block_write_callback_t block_callback, void *context) = 0;
+
+    /**
+     * @brief Reads num_blocks contiguous blocks straight into words, block n goes into words
+     * [n * 256, n * 256 + 255] packed two bytes per uint16_t (same layout as PackedSector::words)
+     *
+     * @param words buffer of at least num_blocks * 256 words
+     * @return true every block was read
+     * @return false read failed
+     */
+    virtual bool read_contiguous_blocks(uint16_t *words, const Address32 &block_address, const uint16_t &num_blocks) = 0;
+
+    /**
+     * @brief Writes num_blocks contiguous blocks straight from words, block n is words
+     * [n * 256, n * 256 + 255] packed two bytes per uint16_t (same layout as PackedSector::words)
+     *
+     * @param words buffer of at least num_blocks * 256 words
+     * @return true every block was written
+     * @return false write failed
+     */
+    virtual bool write_contiguous_blocks(const uint16_t *words, const Address32 &block_address, const uint16_t &num_blocks) = 0;
+
+    /**
+     * @brief Waits for every write made so far to be on the device, only devices that queue
+     * writes (e.g., a SectorPipeline) need to override this
+     *
+     * @return true every write made so far succeeded
+     * @return false a queued write failed
+     */
+    virtual bool flush()
+    {
+        return true;
+    }
+
+    /**
+     * @brief Size in blocks of the unit the device erases/ programs flash in (e.g., the AU of an
+     * SD card), sequential writes that start on a boundary of it and stay within it are the
+     * fastest. Fixed once the device is initialized
+     *
+     * @return Address32 blocks per allocation unit, 0 if it is unknown
+     */
+    virtual Address32 get_allocation_unit_blocks() const
+    {
+        return Address32();
+    }
+};
+} // namespace sd_driver
+
+#endif // _BLOCKDEVICE_H_
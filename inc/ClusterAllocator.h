@@ -0,0 +1,221 @@
+/**
+ * @file ClusterAllocator.h
+ * @author Mattheas Jamieson (mattheas@ualberta.ca)
+ * @brief Declaration of FAT32 free cluster allocator
+ * @version 0.1
+ * @date 2024-03-03
+ */
+
+#ifndef _CLUSTERALLOCATOR_H_
+#define _CLUSTERALLOCATOR_H_
+
+#include "../inc/FATCache.h"
+
+namespace file_system
+{
+
+/**
+ * @brief Allocates and releases clusters in the FAT, keeping the free cluster count and next free
+ * cluster of the FSInfo sector up to date.
+ *
+ * @details Rather than scanning the FAT for free entries on every allocation the allocator keeps a
+ * small summary of free extents (runs of contiguous free clusters). The summary is built lazily,
+ * every FAT sector that is read into the FAT cache for any reason (following a chain, a scan, ...)
+ * is checked for free runs, and clusters are added back as they are released. An allocation that
+ * fits an extent in the summary takes no FAT scan at all, only when the summary has no suitable
+ * extent is the FAT scanned from the next free cluster. Each cluster taken from the summary is
+ * still checked to be free in the FAT before it is used, so a stale summary can only cost time.
+ *
+ * With set_allocation_unit() an allocation can ask for its run to start at the beginning of an
+ * allocation unit (AU) of the card, so a file written sequentially fills whole AUs rather than
+ * the ends of AUs that already hold other data (which makes the card copy them). The run after
+ * the preferred cluster is still taken first, so a file keeps growing into the next AU.
+ */
+class ClusterAllocator
+{
+  public:
+    /**
+     * @brief Number of free extents kept in the summary, when it's full the smallest extent is
+     * dropped for a larger one
+     */
+    constexpr static uint16_t free_extents_summarized = 8U;
+
+    struct FreeExtent
+    {
+        Address32 first_cluster;
+
+        Address32 number_of_clusters;
+    };
+
+    /**
+     * @brief Constructs a new ClusterAllocator object, configure() must be called before any
+     * clusters are allocated. The allocator registers itself as the sector loaded callback of
+     * _fat_cache
+     *
+     * @param _fat_cache FAT the clusters are allocated in
+     */
+    ClusterAllocator(FATCache &_fat_cache);
+
+    ~ClusterAllocator();
+
+    /**
+     * @brief Sets the size of the file system and the FSInfo values, the summary is emptied
+     *
+     * @param _number_of_clusters number of data clusters in the file system
+     * @param _free_cluster_count free cluster count from FSInfo, unknown_count if unknown
+     * @param _next_free_cluster next free cluster hint from FSInfo, anything out of range is ignored
+     */
+    void configure(const Address32 &_number_of_clusters, const Address32 &_free_cluster_count, const Address32 &_next_free_cluster);
+
+    /**
+     * @brief Sets where the allocation units of the card are in clusters, allocations made with
+     * align_to_allocation_unit are then placed at the start of one
+     *
+     * @param _clusters_per_allocation_unit clusters per AU, a power of two, 0 (or 1) turns it off
+     * @param _first_aligned_cluster first cluster that starts an AU
+     */
+    void set_allocation_unit(const Address32 &_clusters_per_allocation_unit, const Address32 &_first_aligned_cluster);
+
+    /**
+     * @brief Finds free clusters and links them into a chain that ends with an end of chain marker
+     *
+     * @param preferred_cluster used first if it's free, e.g., the cluster after the end of a file
+     * @param max_clusters maximum number of clusters to allocate
+     * @param whole_run if set a contiguous run of max_clusters is looked for (the longest run found
+     * is used if there is none), otherwise the first free run is used
+     * @param first_cluster returned first cluster of the chain
+     * @param allocated_clusters returned number of clusters in the chain (1 to max_clusters)
+     * @param align_to_allocation_unit unless the preferred cluster is free, start the chain at the
+     * beginning of a free allocation unit (at least max_clusters, or the whole AU, free from there).
+     * Once there is none the clusters are allocated as without it until clusters are released
+     * @return true clusters were allocated
+     * @return false there are no free clusters or the FAT could not be read
+     */
+    bool allocate(const Address32 &preferred_cluster, const Address32 &max_clusters, const bool &whole_run,
+                    Address32 &first_cluster, Address32 &allocated_clusters, const bool &align_to_allocation_unit = false);
+
+    /**
+     * @brief Records that run_length clusters starting at first_cluster have been freed (their FAT
+     * entries set to 0 by the caller)
+     */
+    void release(const Address32 &first_cluster, const Address32 &run_length);
+
+    /**
+     * @brief Free cluster count for FSInfo, unknown_count if it was unknown at mount
+     */
+    Address32 get_free_cluster_count() const;
+
+    /**
+     * @brief Next free cluster hint for FSInfo
+     */
+    Address32 get_next_free_cluster() const;
+
+    /**
+     * @brief 0xFFFFFFFF, the FSInfo value for an unknown count/ hint
+     */
+    constexpr static Address32 unknown_count()
+    {
+        return Address32(0xFFFF, 0xFFFF);
+    }
+
+  private:
+    /**
+     * @brief FATCache::sector_loaded_callback_t, adds the free runs of a sector to the summary
+     */
+    static void sector_loaded_callback(const Address32 &first_cluster, const PackedSector &sector, void *context);
+
+    /**
+     * @brief Adds a free run to the summary, merging it with the extents it overlaps/ touches
+     */
+    void add_free_extent(const Address32 &first_cluster, const Address32 &run_length);
+
+    /**
+     * @brief Removes clusters that are no longer free from the summary, an extent containing them
+     * is trimmed (or split if there is room)
+     */
+    void remove_free_clusters(const Address32 &first_cluster, const Address32 &run_length);
+
+    /**
+     * @brief Picks a run from the summary, see allocate()
+     *
+     * @return true a run was picked, it has max_clusters clusters if whole_run is set
+     * @return false no extent in the summary, or none large enough for whole_run (or none with
+     * aligned_run_length() clusters from the start of an AU if aligned)
+     */
+    bool pick_free_extent(const Address32 &preferred_cluster, const Address32 &max_clusters, const bool &whole_run, const bool &aligned,
+                            Address32 &first_cluster, Address32 &run_length) const;
+
+    /**
+     * @brief Scans the FAT for a free run, see allocate()
+     */
+    bool scan_for_free_run(const Address32 &start_cluster, const Address32 &max_clusters, const bool &whole_run,
+                            Address32 &first_cluster, Address32 &run_length);
+
+    /**
+     * @brief Scans the FAT for a free run that starts at the preferred cluster or at the beginning
+     * of an AU and has at least aligned_run_length() clusters. Only the first cluster of an AU that
+     * is in use is read, the rest of it is skipped
+     *
+     * @return true a run was found, at most max_clusters
+     * @return false there is no such run (or the FAT could not be read)
+     */
+    bool scan_for_aligned_run(const Address32 &start_cluster, const Address32 &preferred_cluster, const Address32 &max_clusters,
+                                const bool &whole_run, Address32 &first_cluster, Address32 &run_length);
+
+    /**
+     * @brief Clusters an aligned run needs to be worth starting an AU for, max_clusters for a
+     * whole_run and otherwise max_clusters or the whole AU if that is smaller
+     */
+    Address32 aligned_run_length(const Address32 &max_clusters, const bool &whole_run) const;
+
+    bool is_allocation_unit_start(const Address32 &cluster) const;
+
+    /**
+     * @brief First cluster at or after cluster that starts an AU
+     */
+    Address32 next_allocation_unit_start(const Address32 &cluster) const;
+
+    /**
+     * @brief Links up to run_length clusters starting at first_cluster into a chain,
+     * stopping at the first cluster that is not free
+     *
+     * @param linked_clusters returned number of clusters in the chain, 0 if first_cluster is not free
+     * @return false the FAT could not be read/ written
+     */
+    bool link_free_run(const Address32 &first_cluster, const Address32 &run_length, Address32 &linked_clusters);
+
+    /**
+     * @brief Checks if a FAT entry marks a free cluster, the upper 4 bits are reserved and ignored
+     */
+    constexpr static bool is_free_cluster(const Address32 &fat_entry)
+    {
+        return (fat_entry.high() & 0x0FFF) == 0x0 && fat_entry.low() == 0x0;
+    }
+
+    FATCache &fat_cache;
+
+    Address32 number_of_clusters;
+
+    Address32 free_cluster_count;
+
+    Address32 next_free_cluster;
+
+    FreeExtent free_extents[free_extents_summarized];
+
+    uint16_t number_of_free_extents = 0U;
+
+    /**
+     * @brief See set_allocation_unit(), clusters_per_allocation_unit is 0 while it is off
+     */
+    Address32 clusters_per_allocation_unit;
+    Address32 first_aligned_cluster;
+
+    /**
+     * @brief Set when an aligned allocation found no free AU, so every allocation after it does
+     * not scan the FAT for one again. Cleared when clusters that start an AU are released
+     */
+    bool aligned_runs_exhausted = false;
+};
+} // namespace file_system
+
+#endif // _CLUSTERALLOCATOR_H_
@@ -0,0 +1,95 @@
+/**
+ * @file ClusterChainIterator.h
+ * @author Mattheas Jamieson (mattheas@ualberta.ca)
+ * @brief Declaration of FAT32 cluster chain iterator
+ * @version 0.1
+ * @date 2024-03-03
+ */
+
+#ifndef _CLUSTERCHAINITERATOR_H_
+#define _CLUSTERCHAINITERATOR_H_
+
+#include "../inc/FATCache.h"
+
+namespace file_system
+{
+
+/**
+ * @brief Walks the chain of clusters of a file/ directory through the FAT cache, so the clusters
+ * do not have to be contiguous on the card.
+ *
+ * @details The iterator is valid while the current cluster is a data cluster (2 up to the last
+ * cluster of the file system). The end of chain marker, free/ bad cluster markers and out of range
+ * values all end the iteration. The number of steps is limited to the number of clusters in the
+ * file system, so a corrupt FAT that links a chain back on itself can not loop forever.
+ *
+ * E.g., reading every cluster of a chain
+ *
+ *  for (ClusterChainIterator it(fat_cache, first_cluster, number_of_clusters); it.is_valid(); it.next())
+ *  {
+ *      // it.get_cluster()
+ *  }
+ */
+class ClusterChainIterator
+{
+  public:
+    /**
+     * @brief Constructs a new ClusterChainIterator object positioned at first_cluster
+     *
+     * @param _fat_cache FAT the chain is stored in
+     * @param first_cluster first cluster of the chain (the starting cluster of a directory entry)
+     * @param _number_of_clusters number of data clusters in the file system
+     */
+    ClusterChainIterator(FATCache &_fat_cache, const Address32 &first_cluster, const Address32 &_number_of_clusters);
+
+    ~ClusterChainIterator();
+
+    /**
+     * @brief true while get_cluster() is a cluster of the chain
+     */
+    bool is_valid() const;
+
+    /**
+     * @brief Current cluster, only meaningful while is_valid()
+     */
+    Address32 get_cluster() const;
+
+    /**
+     * @brief Moves to the next cluster of the chain by reading the FAT entry of the current one
+     *
+     * @return true the iterator is still valid
+     * @return false the end of the chain was reached, the FAT could not be read or the chain is
+     * longer than the file system (see fat_read_failed())
+     */
+    bool next();
+
+    /**
+     * @brief true if the iteration ended because a FAT sector could not be read, rather than at
+     * the end of the chain
+     */
+    bool fat_read_failed() const;
+
+  private:
+    FATCache &fat_cache;
+
+    Address32 cluster;
+
+    /**
+     * @brief One past the last valid cluster number (clusters are numbered from 2)
+     */
+    const Address32 end_cluster;
+
+    /**
+     * @brief Number of clusters visited so far, a chain can not be longer than the file system
+     */
+    Address32 steps;
+
+    const Address32 number_of_clusters;
+
+    bool valid = false;
+
+    bool read_failed = false;
+};
+} // namespace file_system
+
+#endif // _CLUSTERCHAINITERATOR_H_
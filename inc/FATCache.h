@@ -0,0 +1,275 @@
+/**
+ * @file FATCache.h
+ * @author Mattheas Jamieson (mattheas@ualberta.ca)
+ * @brief Declaration of FAT sector cache
+ * @version 0.1
+ * @date 2024-03-03
+ */
+
+#ifndef _FATCACHE_H_
+#define _FATCACHE_H_
+
+#include "../inc/BlockDevice.h"
+#include "../inc/PackedSector.h"
+#include "../inc/Statistics.h"
+
+namespace file_system
+{
+
+using sd_driver::Address32;
+using sd_driver::PackedSector;
+
+/**
+ * @brief Write-back cache of FAT sectors. Reading/ writing FAT entries that fall into a sector
+ * that is already cached costs no device transactions, modified sectors are only written back
+ * when they are evicted or flush() is called, and then to every copy of the FAT.
+ */
+class FATCache
+{
+  public:
+    /**
+     * @brief Constructs a new FATCache object, configure() must be called before any entries
+     * are read or written
+     *
+     * @param _block_device device (e.g., SD card) the FAT is stored on
+     */
+    FATCache(sd_driver::BlockDevice &_block_device);
+
+    ~FATCache();
+
+    /**
+     * @brief Callback invoked every time a FAT sector is read from the SD card into the cache
+     *
+     * @details first_cluster is the cluster number of the first of the 128 entries in sector,
+     * sector is only valid for the duration of the call. context is passed through unchanged
+     * from set_sector_loaded_callback()
+     */
+    typedef void (*sector_loaded_callback_t)(const Address32 &first_cluster, const PackedSector &sector, void *context);
+
+    /**
+     * @brief Callback invoked by free_chain() for every run of contiguous clusters it has freed
+     */
+    typedef void (*run_freed_callback_t)(const Address32 &first_cluster, const Address32 &run_length, void *context);
+
+    /**
+     * @brief Copies of the FAT a dirty sector is written back to, see write_back_callback_t
+     */
+    enum class write_back_target_t
+    {
+        EVERY_FAT = 0, /**< every copy as usual */
+        FAT_1_ONLY,    /**< FAT #1 only, the other copies are brought up to date later with mirror_sector() */
+        FAILED         /**< none, the sector stays dirty and the write back fails */
+    };
+
+    /**
+     * @brief Callback invoked before a dirty sector is written back, returns which copies of the
+     * FAT it is written to
+     */
+    typedef write_back_target_t (*write_back_callback_t)(const Address32 &fat_sector_offset, void *context);
+
+    /**
+     * @brief Number of FAT sectors (512 bytes each) held by the cache
+     */
+    constexpr static uint16_t number_of_cached_sectors = 2U;
+
+    /**
+     * @brief Only updated when compiled with SD_FS_STATISTICS (see Statistics.h)
+     */
+    struct FATCacheStatistics
+    {
+        /**
+         * @brief Sector look ups served from the cache
+         */
+        Address32 hits;
+
+        /**
+         * @brief Sectors that had to be read from the device
+         */
+        Address32 misses;
+
+        /**
+         * @brief Dirty sectors written back (to every copy of the FAT, or FAT #1 only)
+         */
+        Address32 write_backs;
+    };
+
+    /**
+     * @brief Sets the location and layout of the FATs, any cached sectors are discarded (NOT
+     * written back)
+     *
+     * @param _fat_begin_lba sector address of the first sector of FAT #1
+     * @param _sectors_per_fat size of each FAT in sectors
+     * @param _number_of_fats number of copies of the FAT (usually 2), all are kept identical
+     */
+    void configure(const Address32 &_fat_begin_lba, const Address32 &_sectors_per_fat, const uint16_t &_number_of_fats);
+
+    /**
+     * @brief Reads the FAT entry of a cluster, i.e., the next cluster in the chain or an end of
+     * chain/ free marker. The reserved upper 4 bits are masked off.
+     *
+     * @param cluster_number cluster whose FAT entry is read
+     * @param entry_value returned value of the entry
+     * @return true entry was read
+     * @return false FAT sector could not be read from the SD card
+     */
+    bool read_entry(const Address32 &cluster_number, Address32 &entry_value);
+
+    /**
+     * @brief Writes the FAT entry of a cluster in the cache, the sector is marked dirty and only
+     * written back to the SD card on eviction or flush(). The reserved upper 4 bits of the entry
+     * on the card are preserved.
+     *
+     * @param cluster_number cluster whose FAT entry is written
+     * @param entry_value new value of the entry, e.g., 0x0 to free the cluster
+     * @return true entry was written to the cache
+     * @return false FAT sector could not be read from the SD card
+     */
+    bool write_entry(const Address32 &cluster_number, const Address32 &entry_value);
+
+    /**
+     * @brief Writes every dirty sector back to each copy of the FAT
+     *
+     * @return true every dirty sector was written succesfully
+     * @return false at least one write failed (the sector stays dirty)
+     */
+    bool flush();
+
+    /**
+     * @brief Frees every cluster of the chain starting at first_cluster (sets their entries to 0)
+     *
+     * @details The chain is freed a FAT sector at a time, every link of the chain that stays in
+     * the current sector is decoded and zeroed in the cached sector directly, so the cost is one
+     * cache look up (and at most one read and one write back per FAT copy) per FAT sector the
+     * chain passes through rather than per cluster. A mostly contiguous chain touches every FAT
+     * sector once. Sectors are written back when evicted or on flush()
+     *
+     * @param first_cluster first cluster of the chain, clusters below 2 are an empty chain
+     * @param number_of_clusters number of data clusters in the file system, the chain ends at the
+     * first link out of range and can not be longer than this
+     * @param run_freed_callback called for every run of contiguous clusters freed (nullptr for none)
+     * @param context passed through to run_freed_callback
+     * @return true chain was freed
+     * @return false a FAT sector could not be read/ written back
+     */
+    bool free_chain(const Address32 &first_cluster, const Address32 &number_of_clusters, run_freed_callback_t run_freed_callback, void *context);
+
+    /**
+     * @brief Copies a sector of FAT #1 to every other copy of the FAT (from the cache if it holds
+     * the sector, so it must not be dirty)
+     *
+     * @param fat_sector_offset offset (in sectors) of the sector from the beginning of the FAT
+     * @param sector buffer the sector is read into if it is not cached
+     * @return true sector was copied
+     * @return false sector could not be read/ written
+     */
+    bool mirror_sector(const Address32 &fat_sector_offset, PackedSector &sector);
+
+    /**
+     * @brief Overwrites a sector of FAT #1 with the same sector of FAT #2, a cached copy of the
+     * sector is discarded (NOT written back)
+     *
+     * @param fat_sector_offset offset (in sectors) of the sector from the beginning of the FAT
+     * @param sector buffer the sector is read into
+     * @return true sector was restored
+     * @return false there is no FAT #2, or the sector could not be read/ written
+     */
+    bool restore_sector(const Address32 &fat_sector_offset, PackedSector &sector);
+
+    /**
+     * @brief Sets the callback invoked before every write back (nullptr for none, every copy is
+     * written), e.g., so FAT #2 can be held at the last commit
+     */
+    void set_write_back_callback(write_back_callback_t callback, void *context);
+
+    /**
+     * @brief Sets the callback invoked whenever a FAT sector is read into the cache (nullptr for none),
+     * e.g., so free clusters can be noted without reading the FAT a second time
+     */
+    void set_sector_loaded_callback(sector_loaded_callback_t callback, void *context);
+
+    FATCacheStatistics get_statistics() const;
+
+    void reset_statistics();
+
+  private:
+    struct CachedFATSector
+    {
+        /**
+         * @brief Set once data holds a sector read from the SD card
+         */
+        bool valid = false;
+
+        /**
+         * @brief Set when data has been modified and not yet written back
+         */
+        bool dirty = false;
+
+        /**
+         * @brief Offset (in sectors) of the cached sector from the beginning of the FAT
+         */
+        Address32 fat_sector_offset;
+
+        /**
+         * @brief Value of access_counter when the sector was last used, the least recently used
+         * sector is evicted first
+         */
+        uint16_t last_access = 0U;
+
+        PackedSector data;
+    };
+
+    /**
+     * @brief Returns the cached sector at fat_sector_offset, reading it from the SD card (and
+     * evicting the least recently used sector) if it is not cached yet
+     *
+     * @return CachedFATSector* cached sector or nullptr if it could not be read
+     */
+    CachedFATSector *get_sector(const Address32 &fat_sector_offset);
+
+    /**
+     * @brief Writes a dirty sector to every copy of the FAT (or FAT #1 only, see
+     * write_back_callback_t) and clears its dirty flag
+     *
+     * @return false the sector could not be written or the callback returned FAILED, it is still dirty
+     */
+    bool write_back(CachedFATSector &cached_sector);
+
+    /**
+     * @brief Splits a cluster number into the offset of its FAT sector and the byte offset of
+     * its 4 byte entry within that sector
+     */
+    static void locate_entry(const Address32 &cluster_number, Address32 &fat_sector_offset, uint16_t &index);
+
+    /**
+     * @brief With a 512 byte sector, there are 128 (2^7) cluster number entrys per FAT sector
+     */
+    constexpr static uint16_t fat_entrys_per_sector_shift = 7U;
+
+    sd_driver::BlockDevice &block_device;
+
+    CachedFATSector cached_sectors[number_of_cached_sectors];
+
+    Address32 fat_begin_lba;
+
+    Address32 sectors_per_fat;
+
+    uint16_t number_of_fats = 0U;
+
+    /**
+     * @brief Incremented on every access, used to find the least recently used sector
+     */
+    uint16_t access_counter = 0U;
+
+    sector_loaded_callback_t sector_loaded_callback = nullptr;
+
+    void *sector_loaded_context = nullptr;
+
+    write_back_callback_t write_back_callback = nullptr;
+
+    void *write_back_context = nullptr;
+
+    FATCacheStatistics statistics;
+};
+} // namespace file_system
+
+#endif // _FATCACHE_H_
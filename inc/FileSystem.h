@@ -9,11 +9,34 @@
 #ifndef _FILESYSTEM_H_
 #define _FILESYSTEM_H_
 
-#include "../inc/SDCard.h"
+#include "../inc/BlockDevice.h"
+#include "../inc/BlockCache.h"
+#include "../inc/FATCache.h"
+#include "../inc/IntentLog.h"
+#include "../inc/ClusterAllocator.h"
+#include "../inc/MountManager.h"
+
+/**
+ * @brief Number of entries the file system can hold in RAM (see FileSystem::total_directory_entries),
+ * set per product with -DSD_FS_DIRECTORY_ENTRIES=N. Every entry takes 14 words of the entry table
+ * plus 2-4 words of path index slots
+ */
+#ifndef SD_FS_DIRECTORY_ENTRIES
+#define SD_FS_DIRECTORY_ENTRIES 128
+#endif
 
 namespace file_system
 {
 
+/**
+ * @brief Smallest power of two (at least slots) that is twice or more num_entries, the number of
+ * path index slots needed for num_entries entries
+ */
+constexpr uint16_t path_index_slots_for(const uint16_t num_entries, const uint16_t slots = 1U)
+{
+    return (slots >= (num_entries << 1)) ? slots : path_index_slots_for(num_entries, slots << 1);
+}
+
 /**
  * @brief File System class, provides high level API for interacting
  * with formatted a SD card
@@ -22,8 +45,26 @@ class FileSystem
 {
   public:
     enum class file_system_t; // Forward declaration
+    enum class mount_mode_t; // Forward declaration
+    enum class open_mode_t; // Forward declaration
 
-    FileSystem(sd_driver::SDCard &_sd_card, const file_system_t &_file_system_type);
+    /**
+     * @brief Constructs a new FileSystem object (a volume) and mounts it through _mount_manager,
+     * reads the MBR and Volume ID of the selected partition and (unless mounted lazily) the rest
+     * of the file system into entry_table. Sectors are cached in, and operations work in, the block
+     * cache/ sector buffer of _mount_manager, so it must outlive the volume (see is_mounted()).
+     * With VolumeOptions::directory_snapshot the directories are not read if the snapshot saved by
+     * the last unmount() is still current
+     *
+     * @param _mount_manager shares its block cache and sector buffer with the other volumes it mounts
+     * @param _block_device device (e.g., an initialized sd_driver::SDCard) the file system is on
+     * @param _file_system_type only FAT32 is supported
+     * @param _mount_mode when directories are read, see mount_mode_t
+     * @param _volume_options partition of the device and block cache quota of the volume
+     */
+    FileSystem(MountManager &_mount_manager, sd_driver::BlockDevice &_block_device, const file_system_t &_file_system_type,
+                const mount_mode_t &_mount_mode = mount_mode_t::FULL_SCAN,
+                const MountManager::VolumeOptions &_volume_options = MountManager::VolumeOptions());
 
     ~FileSystem();
 
@@ -34,6 +75,28 @@ class FileSystem
         FAT32      /**< supported */
     };
 
+    enum class mount_mode_t
+    {
+        /**
+         * @brief Every directory is read into entry_table when mounting, mount time grows
+         * with the number of entries on the card
+         */
+        FULL_SCAN = 0,
+
+        /**
+         * @brief Only the MBR and Volume ID are read when mounting. Paths are resolved when they are
+         * used by reading just the directories along the path, and only the entries on the path are
+         * stored in entry_table
+         */
+        LAZY
+    };
+
+    enum class open_mode_t
+    {
+        READ = 0, /**< read()/ seek() only */
+        APPEND    /**< read()/ seek() and append() to the end of the file */
+    };
+
     enum class media_type_t
     {
         REMOVABLE_DISK = 0xF0,
@@ -51,17 +114,41 @@ class FileSystem
 
     /**
      * @brief A static constexpr evaluated at compile time to be used for declaring the
-     * length of the file_system_entrys[] which is where directory entries (files, folders 
-     * and volume label are stored)
+     * length of the arrays of entry_table which is where directory entries (files, folders
+     * and volume label are stored), see SD_FS_DIRECTORY_ENTRIES
+     */
+    constexpr static uint16_t total_directory_entries = SD_FS_DIRECTORY_ENTRIES;
+
+    static_assert(total_directory_entries > 0U && total_directory_entries < 0x4000,
+                    "SD_FS_DIRECTORY_ENTRIES must be between 1 and 16383 so path_index_slots fits in 16 bits");
+
+    /**
+     * @brief Parent index of an entry in the root directory, the root directory itself has no entry
+     */
+    constexpr static uint16_t root_directory_index = 0xFFFF;
+
+    /**
+     * @brief Size of long_name_pool[], every long file name stored takes one word per two
+     * characters (e.g., 1024 characters fit in 512 words)
+     */
+    constexpr static uint16_t long_name_pool_words = 512U;
+
+    /**
+     * @brief Longest long file name FAT32 allows, 20 LFN entries of 13 characters (255 + terminator)
+     */
+    constexpr static uint16_t max_long_name_length = 255U;
+
+    /**
+     * @brief Number of primary partitions in the MBR
      */
-    constexpr static uint16_t total_directory_entries = 100U;
+    constexpr static uint16_t number_of_primary_partitions = 4U;
 
     /**
      * @brief Primary Partition stores a primary partition from the Master Boot Sector (MBR)
      * 
-     * @details For simplicity every byte is stored in its own uint16_t, while not efficient
-     * it's more readable. NOTE: all addresses (or multi byte values) are stored in Big Endian
-     * format where the MSB is stored at index 0 and so forth.
+     * @details For simplicity every single byte is stored in its own uint16_t, while not efficient
+     * it's more readable. Multi byte values are decoded from Little Endian (how they are stored on
+     * the SD card) into an Address32 so they can be used directly in address calculations.
      */
     struct FAT32PrimaryPartition
     {
@@ -72,55 +159,47 @@ class FileSystem
 
         /**
          * @brief 4 byte address of the Volume ID of the FAT32 file system.
-         * 
-         * @details Multi byte values (such as this address) are stored in Little Endian 
-         * format on SD cards, meaning the LSB comes first. However when passing an address
-         * to the SD card via a command it should be passed in Big Endian format. THEREFORE,
-         * when reading in Little Endian values I convert them to Big Endian
          */
-        uint16_t lba_begin[4]; // adress of start of FAT32 file system, i.e., VolumeID
-        uint16_t number_of_sectors[4]; // ignore
+        Address32 lba_begin; // adress of start of FAT32 file system, i.e., VolumeID
+        Address32 number_of_sectors; // ignore
     };
 
     struct FAT32MasterBootRecord
     {
         // 446 bytes of Boot Code ignored
 
-        // TODO make an array of partitions, also read them all in read_fat32_master_boot_record()
-        FAT32PrimaryPartition primary_partition_1;
-        FAT32PrimaryPartition primary_partition_2;
-        FAT32PrimaryPartition primary_partition_3;
-        FAT32PrimaryPartition primary_partition_4;
+        // partition 1 is primary_partitions[0]
+        FAT32PrimaryPartition primary_partitions[number_of_primary_partitions];
         uint16_t mbr_signature[2]; // should be 0x55AA, always check this
     };
 
     /**
      * @brief Volume ID that stores information about the FAT32 file system
      * 
-     * @details For simplicity every byte is stored in its own uint16_t, while not efficient
-     * it's more readable. SD cards send multi-byte data in Little Endian format. HOWEVER, 
-     * since SD cards expect commands in Big Endian format (and b/c Big Endian reads left to
-     * right like you'd normally read a number) I convert all these Little Endian multi-byte
-     * values into Big Endian
+     * @details For simplicity every single byte is stored in its own uint16_t, while not efficient
+     * it's more readable. SD cards send multi-byte data in Little Endian format, 2 byte values are
+     * decoded into a uint16_t and 4 byte values into an Address32.
      */
     struct FAT32VolumeID
     {
         uint16_t jmp_to_boot_code[3];
         uint16_t oem_name_ascii[8];
-        uint16_t bytes_per_sector[2]; // always 512 in FAT32?
+        uint16_t bytes_per_sector; // always 512 in FAT32?
         uint16_t sectors_per_cluster;
-        uint16_t size_of_reserved_area_sectors[2];
+        uint16_t size_of_reserved_area_sectors;
         uint16_t number_of_fats; // usually 2
-        uint16_t max_num_files_in_root_dir[2]; // 0 for FAT32
-        uint16_t number_of_sectors_in_file_system[2]; // if 0 then see 4 bytes in bytes 32-25
+        uint16_t max_num_files_in_root_dir; // 0 for FAT32
+        uint16_t number_of_sectors_in_file_system; // if 0 then see 4 bytes in bytes 32-25
         media_type_t media_type;
-        uint16_t size_of_each_fat_in_sectors[2]; // 0 for FAT32?
-        uint16_t sectors_per_track_in_storage_device[2];
-        uint16_t num_heads_in_storage_device[2];
-        uint16_t num_of_sectors_before_start_partition[4];
-        uint16_t num_of_sectors_in_file_system_extended[4]; // 0 if 2B filed above is non zero
-        uint16_t sectors_per_fat[4];
-        uint16_t root_directory_first_cluster[4]; // usually 2
+        uint16_t size_of_each_fat_in_sectors; // 0 for FAT32?
+        uint16_t sectors_per_track_in_storage_device;
+        uint16_t num_heads_in_storage_device;
+        Address32 num_of_sectors_before_start_partition;
+        Address32 num_of_sectors_in_file_system_extended; // 0 if 2B filed above is non zero
+        Address32 sectors_per_fat;
+        Address32 root_directory_first_cluster; // usually 2
+        uint16_t fs_info_sector; // sector number of FSInfo from the start of the file system, usually 1
+        uint16_t backup_boot_sector; // sector number of the backup boot sectors, usually 6 (0 or 0xFFFF if none)
 
         uint16_t volume_id_signature[2]; // should be 0x55AA or 0xAA55
     };
@@ -148,30 +227,29 @@ class FileSystem
      * [LFN Entry]              \
      * [LFN Entry]               | -> Together form a single long file entry
      * [Short Entry]            /  -> Alternatively the S.E contains all the data w/ shortened name
+     *
+     * LFN entries are not stored on their own, the long name they hold is assembled (its checksum
+     * checked against the short name) and kept in long_name_pool[], the short entry that follows
+     * them only holds where it is
+     *
+     * The file system keeps its entries in entry_table (a structure of arrays), this is the copy
+     * of one of them stat() returns
      */
     struct FAT32FileSystemEntry
     {
         /**
          * @brief Only if an entry is in use should this flag be set, it indicates that this
-         * entry is used to store a short entry or LFN. If this flag is set the parent_directory
-         * pointer should be set (and if its not the entry is then the root directory)
+         * entry is used to store a short entry
          */
         bool entry_in_use = false;
 
         /**
-         * @brief Any entry in the file system must have a parent directory, except the root
-         * directory which has no parent (therefore nullptr). This is used for storing and 
-         * keeping the traversability of the tree like structure of a file system into a 
-         * linear data structure (i.e, array)
-         */
-        FAT32FileSystemEntry *parent_directory = nullptr;
-
-        /**
-         * @brief Entrys that are deleted, i.e., the first byte of the entry or 
-         * name_of_entry[0] is 0xE5 and that means they can be overwritten. It ALSO
-         * means that the data contained in the entry is invalid.
+         * @brief Any entry in the file system must have a parent directory, this is the index of
+         * its entry (root_directory_index if the parent is the root directory). This is used for
+         * storing and keeping the traversability of the tree like structure of a file system
+         * into a linear data structure (i.e, array)
          */
-        bool deleted_directory_entry;
+        uint16_t parent_directory = root_directory_index;
 
         /**
          * @brief Contains information about what type of entry, this is boiled down 
@@ -200,55 +278,412 @@ class FileSystem
         char name_of_entry[11];
 
         /**
-         * @brief Address of the first cluster of the entry, stored in Big Endian
+         * @brief Address of the first cluster of the entry
          */
-        uint16_t starting_cluster_address[4];
+        Address32 starting_cluster_address;
 
         /**
-         * @brief Size of entry in bytes, for directories this is 0. Byte order is Big Endian
+         * @brief Size of entry in bytes, for directories this is 0
          */
-        uint16_t size_of_entry_in_bytes[4];
+        Address32 size_of_entry_in_bytes;
         //==============================================================================================================================================
 
-        // Long Directory Entry
+        // Long File Name
         //==============================================================================================================================================
         /**
-         * @brief This byte gives information as to where this LFN belongs in the sequence 
-         * of a long file name. As a note LFN come in a reverse sequence, meaning the last
-         * comes first (think little endian), the last one in the sequence (which is the 
-         * first encountered when reading it from memory) is OR'ed with 0x40. E.g., an 
-         * example where three LFN's come before a short entry. Another worthwhile thing
-         * to mention is the use of 1 based indexing, i.e., the last LFN encountered (
-         * which happens to be the first) has an index of 0x01
-         * 
-         * 0x43 "me.txt"
-         * 0x02 "y long filena"
-         * 0x01 "File with ver"
-         * [Short Entry here with condensed name]
-         * 
+         * @brief Position (in characters) of the long file name of the entry in long_name_pool[]
+         * and its length. A length of 0 means the entry has no long name, i.e., there were no LFN
+         * entries before its short entry, their checksum did not match or the pool was full
+         */
+        uint16_t long_name_offset = 0U;
+        uint16_t long_name_length = 0U;
+        //==============================================================================================================================================
+    };
+
+    /**
+     * @brief Number of extents of a file resolved by open() and kept in File::extents[]
+     */
+    constexpr static uint16_t extents_per_file = 8U;
+
+    /**
+     * @brief Minimum number of clusters append() allocates at a time when a file runs out of
+     * clusters, they are allocated as one contiguous run where possible so a single FAT sector
+     * update covers all of them
+     */
+    constexpr static uint16_t cluster_allocation_batch = 16U;
+
+    /**
+     * @brief A run of clusters of a file that are contiguous on the card, so the whole run is a
+     * single multi block read
+     */
+    struct FileExtent
+    {
+        /**
+         * @brief Position of the first cluster of the extent within the file (0 is the first cluster)
+         */
+        Address32 first_file_cluster;
+
+        /**
+         * @brief Cluster number of the first cluster of the extent
+         */
+        Address32 first_cluster;
+
+        Address32 number_of_clusters;
+    };
+
+    /**
+     * @brief An open file, filled in by open() and only meant to be modified by FileSystem
+     *
+     * @details The cluster chain is resolved into extents once by open(), reads and seeks look the
+     * position up in extents[] rather than walking the chain. A file with more than
+     * extents_per_file extents keeps the extents past the table in window, which is resolved from
+     * the FAT (starting at overflow_cluster, not the start of the chain) when it is needed.
+     *
+     * A file opened for writing holds the partial last sector of the file in tail_sector, it is
+     * written to the card by sync()/ close(). Only one File should be open for writing per file
+     */
+    struct File
+    {
+        bool is_open = false;
+
+        /**
+         * @brief Set for open_mode_t::APPEND and by create()
+         */
+        bool writable = false;
+
+        /**
+         * @brief Index of the files entry in entry_table
+         */
+        int16_t entry_index = -1;
+
+        Address32 size;
+
+        /**
+         * @brief Byte offset of the next read
+         */
+        Address32 position;
+
+        FileExtent extents[extents_per_file];
+
+        uint16_t number_of_extents = 0U;
+
+        /**
+         * @brief Cluster following the last extent in extents[], 0 if extents[] covers the whole chain
+         */
+        Address32 overflow_cluster;
+
+        /**
+         * @brief Extent past extents[] that was used last, empty (number_of_clusters is 0) until needed
+         */
+        FileExtent window;
+
+        /**
+         * @brief Cluster following window, 0 if window is the end of the chain
+         */
+        Address32 window_next_cluster;
+
+        // Only used when writable
+        //==============================================================================================================================================
+        /**
+         * @brief Location of the files 32 byte directory entry, sector address and offset in the sector
+         */
+        Address32 entry_sector_address;
+        uint16_t entry_offset = 0U;
+
+        /**
+         * @brief First cluster of the chain, 0 until the first cluster of an empty file is allocated
+         */
+        Address32 first_cluster;
+
+        Address32 last_cluster;
+
+        /**
+         * @brief Number of clusters in the chain, can be more than the size needs (see preallocate())
+         */
+        Address32 allocated_clusters;
+
+        /**
+         * @brief Size stored in the directory entry on the card
          */
-        uint16_t sequence_order_index_byte;
+        Address32 size_on_card;
 
         /**
-         * @brief Checksum for ??
+         * @brief append() calls sync() every time the file has grown by this many bytes since the
+         * directory entry was last updated, 0 (the default) only updates it on sync()/ close()
          */
-        // TODO read into how check sum works for LFN
-        uint16_t checksum;
+        Address32 size_update_interval;
 
         /**
-         * @brief In a LFN entry the characters are encoded in UNICODE, meaning that each 
-         * character corresponds to TWO bytes, in this case each uint16_t stores two bytes.
-         * A value of 0xFFFF indicates that the character is unused, this would typically
-         * be present in the last entry(if there are multiple LFN's that make total entry)
+         * @brief Contents of the sector holding the end of the file while it is not a whole sector
          */
-        uint16_t long_name_of_entry[13];
+        PackedSector tail_sector;
         //==============================================================================================================================================
     };
 
+    /**
+     * @brief Operation timing, only updated when compiled with SD_FS_STATISTICS (see Statistics.h)
+     */
+    struct FileSystemStatistics
+    {
+        /**
+         * @brief The constructor, MBR/ volume id/ FSInfo reads and the directory scan
+         */
+        sd_driver::OperationStatistics mount;
+
+        sd_driver::OperationStatistics open;
+        sd_driver::OperationStatistics create;
+        sd_driver::OperationStatistics read;
+        sd_driver::OperationStatistics append;
+        sd_driver::OperationStatistics sync;
+        sd_driver::OperationStatistics close;
+        sd_driver::OperationStatistics delete_file;
+    };
+
+    /**
+     * @brief How the volume lines up with the allocation units (AU) of the card, see
+     * get_volume_alignment(). AUs that are not a power of two (12 MB, 24 MB) are checked against
+     * the largest power of two they are a multiple of (4 MB, 8 MB)
+     */
+    struct VolumeAlignment
+    {
+        /**
+         * @brief AU of the device in sectors (see sd_driver::BlockDevice::get_allocation_unit_blocks()),
+         * 0 if the device does not report one, everything else is then false/ 0
+         */
+        Address32 allocation_unit_sectors;
+
+        /**
+         * @brief The partition (its Volume ID) starts on an AU boundary
+         */
+        bool partition_aligned = false;
+
+        /**
+         * @brief The first cluster starts on an AU boundary, so the data region is made of whole
+         * AUs. Otherwise a file written to the start of an AU still ends part way into the next
+         */
+        bool clusters_aligned = false;
+
+        /**
+         * @brief Clusters per AU if AU boundaries fall between clusters (they do when
+         * clusters_aligned), append() then starts the clusters of a file at the beginning of a free
+         * AU. 0 if the AU is not larger than a cluster or the boundaries fall inside clusters
+         */
+        Address32 clusters_per_allocation_unit;
+    };
+
+    /**
+     * @brief True if the volume was mounted, i.e., its partition number is 1-4, mount_manager had
+     * room for it, the MBR signature is valid, the selected partition is FAT32 and its Volume ID
+     * signature is valid. Nothing is read from a volume that is not mounted, don't use it
+     */
+    bool is_mounted() const;
+
     FAT32MasterBootRecord get_fat_32_master_boot_record() const;
 
     FAT32VolumeID get_fat_32_volume_id() const;
 
+    /**
+     * @brief Reports how the volume lines up with the AUs of the card. A misaligned volume works
+     * but writes slower (the card copies the part of an AU a write does not cover), formatting the
+     * card with the SD Association formatter aligns it
+     */
+    VolumeAlignment get_volume_alignment() const;
+
+    /**
+     * @brief Looks up a file/ directory given its absolute path, takes O(depth) path index look ups
+     *
+     * @param file_name name of file/ directory, see delete_file()
+     * @param num_enclosing_directories see delete_file()
+     * @param enclosing_directory_names see delete_file()
+     * @param entry returned copy of the entry (type, size, starting cluster, ...)
+     * @return true entry exists
+     * @return false entry does not exist
+     */
+    bool stat(const uint16_t (&file_name)[11], const uint16_t &num_enclosing_directories, const uint16_t (&enclosing_directory_names)[10][11],
+                FAT32FileSystemEntry &entry);
+
+    /**
+     * @brief Finds the 8.3 name of a file/ directory given its long file name, which every other
+     * call takes. ASCII letters are compared ignoring case (like FAT does), in lazy mode the
+     * enclosing directory is read from the SD card until the entry is found
+     *
+     * @param long_name null terminated long file name, e.g., "Sensor Log.csv"
+     * @param num_enclosing_directories see delete_file()
+     * @param enclosing_directory_names see delete_file(), in 8.3 format
+     * @param short_name returned 8.3 name of the entry
+     * @return true entry exists
+     * @return false entry does not exist (or it was not stored since entry_table is full)
+     */
+    bool find_short_name(const char *long_name, const uint16_t &num_enclosing_directories,
+                            const uint16_t (&enclosing_directory_names)[10][11], uint16_t (&short_name)[11]);
+
+    /**
+     * @brief Copies the long file name of an entry (e.g., from stat()) as a null terminated string,
+     * characters outside of ASCII/ Latin-1 are replaced with '_'
+     *
+     * @param long_name buffer of at least max_length + 1 characters
+     * @return uint16_t length of the long file name copied, 0 if the entry has none
+     */
+    uint16_t get_long_name(const FAT32FileSystemEntry &entry, char *long_name, const uint16_t &max_length) const;
+
+    /**
+     * @brief Opens a file for reading given its absolute path, its cluster chain is resolved into
+     * extents (see File)
+     *
+     * @param file_name name of file, see delete_file()
+     * @param num_enclosing_directories see delete_file()
+     * @param enclosing_directory_names see delete_file()
+     * @param file returned open file positioned at the start of the file
+     * @return true file was opened
+     * @return false file does not exist, is a directory or the FAT could not be read
+     */
+    bool open(const uint16_t (&file_name)[11], const uint16_t &num_enclosing_directories, const uint16_t (&enclosing_directory_names)[10][11],
+                File &file, const open_mode_t &open_mode = open_mode_t::READ);
+
+    /**
+     * @brief Creates an empty file and opens it for writing (open_mode_t::APPEND). The enclosing
+     * directory is grown by a cluster if it has no free 32 byte entry, the new cluster (and so the
+     * file) is then only durable at the next commit()
+     *
+     * @param file_name name of file, see delete_file()
+     * @param num_enclosing_directories see delete_file()
+     * @param enclosing_directory_names see delete_file()
+     * @param file returned open file
+     * @return true file was created
+     * @return false the file already exists, the enclosing directory does not, entry_table
+     * is full, the card is full or the card could not be read/ written
+     */
+    bool create(const uint16_t (&file_name)[11], const uint16_t &num_enclosing_directories, const uint16_t (&enclosing_directory_names)[10][11],
+                File &file);
+
+    /**
+     * @brief Appends num_bytes to the end of a file opened for writing (the read position is not used)
+     *
+     * @details buffer is packed two bytes per uint16_t, see read(). Clusters are allocated at least
+     * cluster_allocation_batch at a time, whole sectors are written straight from buffer with one
+     * multi block write per extent and the partial last sector is kept in File::tail_sector. The
+     * directory entry is only updated by stage()/ sync()/ close() (or every File::size_update_interval bytes)
+     *
+     * @return true every byte was appended
+     * @return false file is not open for writing, the card is full or a write failed
+     */
+    bool append(File &file, const uint16_t *buffer, const uint16_t &num_bytes);
+
+    /**
+     * @brief Makes everything appended so far durable, stage() and then commit()
+     */
+    bool sync(File &file);
+
+    /**
+     * @brief Writes the partial last sector of a file and holds its size and first cluster for the
+     * next commit(), so several files (and deletes) share one commit. Nothing is durable before it
+     *
+     * @return true file was staged
+     * @return false file is not open, or the sector/ a commit to make room failed
+     */
+    bool stage(File &file);
+
+    /**
+     * @brief Writes every metadata change since the last commit in an order that survives a
+     * brown-out at any point: the data and FAT #1, the intent record (see IntentLog), the other
+     * FATs and the staged directory entries, then the intent record is cleared. A volume with no
+     * room for the record in its reserved area (or a single FAT) writes every FAT copy before the
+     * directory entries, a brown-out can then leave lost clusters but never a directory entry that
+     * points at clusters that are not allocated to it.
+     *
+     * @details Between commits an application only loses what it appended since the last commit
+     * (mount rolls the FAT back to it), so it can commit once a second rather than on every append
+     *
+     * @return true every change was written
+     * @return false a write failed, the next commit (or mount) retries it
+     */
+    bool commit();
+
+    /**
+     * @brief Allocates clusters up front so the next num_bytes appended need no FAT updates, the
+     * clusters are allocated as a single contiguous run if there is one that is large enough
+     *
+     * @return true clusters were allocated
+     * @return false file is not open for writing or the card is full
+     */
+    bool preallocate(File &file, const Address32 &num_bytes);
+
+    /**
+     * @brief Reads up to num_bytes from the current position of file, stopping at the end of the file
+     *
+     * @details buffer is packed two bytes per uint16_t (like PackedSector::words), byte n of the
+     * read goes in the lower 8 bits of buffer[n / 2] when n is even and the upper 8 bits when odd.
+     * Whole sectors at a sector aligned position (and an even offset in buffer) are read from the
+     * card straight into buffer, one multi block read per extent. Only the partial sectors at the
+     * start/ end of a read go through sector_buffer, so reads in multiples of 512 bytes from a
+     * sector aligned position are never copied
+     *
+     * @param file an open file
+     * @param buffer buffer of at least (num_bytes + 1) / 2 words
+     * @param num_bytes number of bytes to read
+     * @param bytes_read returned number of bytes read, less than num_bytes at the end of the file
+     * @return true read succeeded
+     * @return false file is not open or a sector/ the FAT could not be read
+     */
+    bool read(File &file, uint16_t *buffer, const uint16_t &num_bytes, uint16_t &bytes_read);
+
+    /**
+     * @brief Moves the position of file, constant time, the extent of the new position is looked up
+     * in the files extents by the next read
+     *
+     * @param file an open file
+     * @param position byte offset from the start of the file, at most the size of the file
+     * @return true position was changed
+     * @return false file is not open or position is past the end of the file
+     */
+    bool seek(File &file, const Address32 &position);
+
+    /**
+     * @brief Closes a file, a file opened for writing releases the clusters past the end of the file
+     * (e.g., left over from preallocate()) and is synced
+     *
+     * @return true file was closed (and synced)
+     * @return false sync failed
+     */
+    bool close(File &file);
+
+    /**
+     * @brief Commits (see commit()) and updates the free cluster count & next free cluster in the
+     * FSInfo sector, then saves the directory snapshot (if enabled and not already current). Every
+     * file open for writing must be closed first
+     *
+     * @return true FAT and FSInfo were written
+     * @return false a write failed
+     */
+    bool unmount();
+
+    /**
+     * @brief Number of free clusters, 0xFFFFFFFF if unknown (FSInfo had no valid count at mount)
+     */
+    Address32 get_free_cluster_count() const;
+
+    /**
+     * @brief Hit/ miss counters of the block cache, a miss is a sector read from the device
+     */
+    sd_driver::BlockCache::BlockCacheStatistics get_block_cache_statistics() const;
+
+    /**
+     * @brief Hit/ miss counters of the FAT cache (only updated with SD_FS_STATISTICS)
+     */
+    FATCache::FATCacheStatistics get_fat_cache_statistics() const;
+
+    FileSystemStatistics get_statistics() const;
+
+    /**
+     * @brief Resets the operation timing and the block/ FAT cache counters
+     */
+    void reset_statistics();
+
+    /**
+     * @brief Prints the operation timing and the block/ FAT cache counters over XPD
+     */
+    void dump_statistics() const;
+
     /**
      * @brief Attempts to delete a file with the given name, at the specified absolute file path
      *              
@@ -266,106 +701,886 @@ class FileSystem
      *                            "FOLDERB    " and at index 1 should be "FOLDERA    "
      *                  IMPORTANT: the folders should be in the order from the one that encloses the file back up to the
      *                          folder thats stored in the root directory, so backwards to how its normally seen
+     * @details The chain is added to the intent record, the directory entry is deleted on the card
+     * and then the clusters are freed in the FAT, durable at the next commit() (after a brown-out
+     * before it mount frees them again)
+     *
      * @return true file was succesfully deleted
      * @return false file was not deleted (i.e., operation failed for some reason such as file not existing)
      */
     bool delete_file(const uint16_t (&file_name)[11], const uint16_t &num_enclosing_directories, const uint16_t (&enclosing_directory_names)[10][11]);
 
   private:
-    bool read_fat32_master_boot_record();
+    /**
+     * @brief Words an 8.3 name takes packed two characters per word (character 2n in the lower 8
+     * bits of word n, the upper 8 bits of the last word are 0)
+     */
+    constexpr static uint16_t packed_name_words = 6U;
 
     /**
-     * @brief reads the volume id, which should be the first sector of the file system
-     * 
-     * @details The address should be passed in Big Endian format, i.e., how you would normally
-     * read a number from left to right
-     * 
-     * @param block_address sector address of volume id
-     * @return true if there is a valid signature in the last two bytes of the sector
-     * @return false if there is an invalid signature in the last two bytes of the sector
+     * @brief Set in DirectoryEntryTable::attributes above the attribute byte while the element
+     * holds an entry
      */
-    bool read_fat_32_volume_id(const uint16_t (&block_address)[4]);
+    constexpr static uint16_t entry_in_use_flag = 0x100;
 
     /**
-     * @brief Helper function to add 4 byte numbers. i.e., add together two numbers, each of 4 bytes
-     * 
-     * @details Assumes that every uint16_t can store at most 0xFF, anything greater introduces a carry.
-     * Additionally, any two numbers when added together that produce a carry on the MSB will be discarded.
-     * i.e,. the max number returned is 0x FF FF FF FF
-     * 
-     * Numbers are expected to be in Big Endian format where byte 1 is the MSB
+     * @brief Every entry loaded from the SD card, laid out as a structure of arrays (element i of
+     * each array is entry i) so a scan only touches the arrays it looks at, e.g., a path index
+     * probe compares parents[] and names[] and nothing else. 14 words per entry
      */
-    void add_4_byte_numbers(const uint16_t (&number_1)[4], const uint16_t (&number_2)[4], uint16_t (&result)[4]);
+    struct DirectoryEntryTable
+    {
+        /**
+         * @brief 8.3 names in the format of the 32 byte entry, see packed_name_words
+         */
+        uint16_t names[total_directory_entries][packed_name_words];
+
+        /**
+         * @brief Index of the directory each entry is in, root_directory_index for the root
+         */
+        uint16_t parents[total_directory_entries];
+
+        /**
+         * @brief Attribute byte in the lower 8 bits, entry_in_use_flag above it
+         */
+        uint16_t attributes[total_directory_entries];
+
+        Address32 first_clusters[total_directory_entries];
+
+        /**
+         * @brief Size in bytes, for directories this is 0
+         */
+        Address32 sizes[total_directory_entries];
+
+        /**
+         * @brief See FAT32FileSystemEntry::long_name_offset/ long_name_length
+         */
+        uint16_t long_name_offsets[total_directory_entries];
+        uint16_t long_name_lengths[total_directory_entries];
+    };
 
     /**
-     * @brief Helper function to subtract 4 byte numbers. i.e., subtract two numbers, each of 4 bytes
-     * 
-     * @details Assumes that num1 > num2
-     * 
-     * @param number_1 minuend of the expression
-     * @param number_2 subtrahend of the expression
-     * @param result of subtraction operation
+     * @brief Finds the entry of a file/ directory given its name and the names of its enclosing
+     * directories (same format as delete_file()) with one path index look up per path component,
+     * i.e., O(depth). In lazy mode entries that are not loaded yet are looked up on the SD card
+     *
+     * @return int16_t index of the entry in entry_table, -1 if it does not exist
      */
-    void subtract_4_byte_numbers(const uint16_t (&number_1)[4], const uint16_t (&number_2)[4], uint16_t (&result)[4]);
+    int16_t find_entry(const uint16_t (&file_name)[11], const uint16_t &num_enclosing_directories, const uint16_t (&enclosing_directory_names)[10][11]);
 
     /**
-     * @brief Recursively explores a directory and stores its contents (if a valid file/ directory) 
-     * in file_system_entrys[]
-     * 
-     * @param directory_begin_sector_addr sector address of directory in big endian format
-     * @param parent_directory reference/ pointer to parent directory (nullptr is root)
-     * 
-     * @return true indicates that recursive read operation was succesful 
-     * @return false indicates that recursive read operation was unsuccesful 
-     * b/c it was stopped due to excessive recursion
+     * @brief Walks down enclosing_directory_names (same format as delete_file()) from the root
+     *
+     * @param directory returned index of the innermost directory (root_directory_index is root)
+     * @return true every directory on the path exists
+     * @return false a directory on the path does not exist
      */
-    bool read_directory_recursive(const uint16_t (&directory_begin_sector_addr)[4], FAT32FileSystemEntry *parent_directory);
+    bool find_directory(const uint16_t &num_enclosing_directories, const uint16_t (&enclosing_directory_names)[10][11],
+                        uint16_t &directory);
 
     /**
-     * @brief Given a 4-byte cluster number in Big Endian format calculate the sector address it corresponds to 
-     * in Big Endian format
-     * 
-     * @param cluster_number 
-     * @param resulting_sector_address 
+     * @brief Returns the entry named entry_name in parent_directory, if it's not in
+     * entry_table yet the directory is read from the SD card until it is found and only
+     * that entry is stored
+     *
+     * @param parent_directory index of the directory to search (root_directory_index is root)
+     * @param entry_name name of entry in 8.3 format (see delete_file())
+     * @return int16_t index of the entry in entry_table, -1 if it does not exist or entry_table is full
      */
-    void calculate_sector_address_from_cluster_number(const uint16_t (&cluster_number)[4], uint16_t (&resulting_sector_address)[4]);
+    int16_t look_up_entry(const uint16_t &parent_directory, const uint16_t (&entry_name)[11]);
 
     /**
-     * @brief Given a 4-byte cluster number in Big Endian format calculate the offset (in sectors) from the beginning of a FAT table
-     * where the cluster information about the next cluster in the chain is stored
-     * 
-     * @param cluster_number The cluster number we wish to find FAT table
-     * @param fat_sector_offset This is a returned value that contains which sector of the FAT table the cluster number is in
-     * @param index This is a returned value that contains the index of the cluster number within the sector, technically this 
-     * should be the cluster number % 128 
+     * @brief Packs a name in 8.3 format (see delete_file()) two characters per word, the way
+     * DirectoryEntryTable::names holds it
      */
-    void calculate_fat_sector_offset_from_cluster_number(const uint16_t(&cluster_number)[4], uint16_t (&fat_sector_offset)[4], uint16_t &index);
+    static void pack_entry_name(const uint16_t (&entry_name)[11], uint16_t (&packed_name)[packed_name_words]);
 
-    sd_driver::SDCard &sd_card;
+    /**
+     * @brief Character position (0-10) of the 8.3 name of a stored entry
+     */
+    uint16_t get_entry_name_character(const uint16_t &entry_index, const uint16_t &position) const;
 
-    const file_system_t &file_system_type;
+    /**
+     * @brief Compares the name of a stored entry to a packed name (see pack_entry_name())
+     */
+    bool entry_name_matches(const uint16_t &entry_index, const uint16_t (&packed_name)[packed_name_words]) const;
 
-    FAT32MasterBootRecord fat_32_master_boot_record;
+    /**
+     * @brief Hash of a path index key, i.e., (parent directory, packed 8.3 name)
+     */
+    static uint16_t path_index_hash(const uint16_t &parent_directory, const uint16_t (&packed_name)[packed_name_words]);
 
-    FAT32VolumeID fat_32_volume_id;
+    /**
+     * @brief Adds entry entry_index of entry_table to the path index
+     */
+    void path_index_insert(const uint16_t &entry_index);
 
-    FAT32FileSystemEntry file_system_entrys[total_directory_entries];
+    /**
+     * @brief Removes entry entry_index of entry_table from the path index
+     */
+    void path_index_remove(const uint16_t &entry_index);
 
-    // tracks where we are in the file systems entry array
-    uint16_t file_systems_entry_index = 0U;
+    /**
+     * @brief Finds the entry named entry_name in parent_directory in entry_table
+     *
+     * @param parent_directory index of the directory the entry is in (root_directory_index is root)
+     * @param entry_name name of entry in 8.3 format (see delete_file())
+     * @return int16_t index of the entry in entry_table, -1 if it's not loaded
+     */
+    int16_t path_index_look_up(const uint16_t &parent_directory, const uint16_t (&entry_name)[11]) const;
 
     /**
-     * @brief The sector address (lba) of the first cluster of the data region, normally the 
-     * root directory starts here but not guaranteed
-     * 
-     * @details Calculated using:
-     * 
-     * cluster_begin_lba = Partition_LBA_Begin + Number_of_Reserved_Sectors + (Number_of_FATs * Sectors_Per_FAT);
-     * 
+     * @brief Type of an entry given its attribute byte
+     */
+    static directory_entry_t get_entry_type(const uint16_t &attribute_byte);
+
+    /**
+     * @brief True if entry entry_index of entry_table is a directory
+     */
+    bool is_directory(const uint16_t &entry_index) const;
+
+    /**
+     * @brief Reads all four primary partitions of the MBR, the selected one (partition_index) must
+     * be FAT32 (type code 0x0B or 0x0C)
+     *
+     * @return true MBR signature is valid and the selected partition is FAT32
+     * @return false MBR could not be read, or either check failed
      */
-    uint16_t cluster_begin_lba[4] = {0x00, 0x00, 0x00, 0x00};
+    bool read_fat32_master_boot_record();
+
+    /**
+     * @brief Decodes the 16 byte primary partition entry at partition_offset of the MBR
+     */
+    static void read_primary_partition(const PackedSector &mbr_sector, const uint16_t &partition_offset,
+                                        FAT32PrimaryPartition &partition);
 
-    uint16_t fat_begin_lba[4] = {0x00, 0x00, 0x00, 0x00};
+    /**
+     * @brief reads the volume id, which should be the first sector of the file system
+     * 
+     * @param block_address sector address of volume id
+     * @return true if there is a valid signature in the last two bytes of the sector
+     * @return false if there is an invalid signature in the last two bytes of the sector
+     */
+    bool read_fat_32_volume_id(const Address32 &block_address);
+
+    /**
+     * @brief Reads the free cluster count and next free cluster of the FSInfo sector into the
+     * cluster allocator, if FSInfo is not valid both are unknown
+     */
+    void read_fs_info();
+
+    /**
+     * @brief Fills in volume_alignment from the AU of the device and has the cluster allocator
+     * place file data at AU boundaries where clusters line up with them
+     */
+    void configure_allocation_units();
+
+    /**
+     * @brief Constants that identify the FSInfo sector and its fields
+     */
+    constexpr static uint16_t fs_info_free_count_offset = 488U;
+    constexpr static uint16_t fs_info_next_free_offset = 492U;
+
+    /**
+     * @brief Explores every directory reachable from the root directory (breadth first, without
+     * recursion) and stores their contents (if a valid file/ directory) in entry_table
+     *
+     * @return true every directory was read
+     * @return false at least one directory could not be read from the SD card
+     */
+    bool read_directory_tree();
+
+    /**
+     * @brief Stores the contents of a single directory (if a valid file/ directory) in
+     * entry_table, sub directories are NOT explored
+     *
+     * @param parent_directory index of the directory to read (root_directory_index is root)
+     * @return true directory was read until its end (or entry_table is full)
+     * @return false directory could not be read from the SD card
+     */
+    bool read_directory(const uint16_t &parent_directory);
+
+    /**
+     * @brief Streams the sectors of a directory to block_callback following its cluster chain
+     * through the FAT cache, one multi block read per cluster. Stops once block_callback returns
+     * false or the chain ends
+     *
+     * @param first_cluster first cluster of the directory
+     * @param block_callback called once for every sector of the directory, context is passed through
+     * @param last_sector_address returned sector address of the last sector handed to block_callback
+     * @return true directory was read until block_callback stopped it or the chain ended
+     * @return false a sector or the FAT could not be read from the SD card
+     */
+    bool read_directory_clusters(const Address32 &first_cluster, sd_driver::BlockDevice::block_read_callback_t block_callback,
+                                    void *context, Address32 &last_sector_address);
+
+    /**
+     * @brief Reads the run of contiguous clusters of a chain that starts at first_cluster
+     *
+     * @param first_cluster first cluster of the extent
+     * @param first_file_cluster position of first_cluster within the file
+     * @param extent returned extent
+     * @param next_cluster returned cluster following the extent, 0 at the end of the chain
+     * @return true extent was resolved
+     * @return false first_cluster is not a data cluster or the FAT could not be read
+     */
+    bool resolve_extent(const Address32 &first_cluster, const Address32 &first_file_cluster, FileExtent &extent, Address32 &next_cluster);
+
+    /**
+     * @brief Finds the extent of file that holds file_cluster (position of a cluster within the
+     * file), extents past File::extents[] are resolved into File::window
+     *
+     * @return const FileExtent* extent, nullptr if the chain ends before file_cluster or the FAT
+     * could not be read
+     */
+    const FileExtent *find_extent(File &file, const Address32 &file_cluster);
+
+    /**
+     * @brief Finds the sector holding byte position of file
+     *
+     * @param sector_address returned sector address of the sector holding position
+     * @param sectors_left_in_extent returned number of sectors from that sector to the end of its
+     * extent (including the sector), i.e., how many sectors can be transferred in one go
+     * @return true position is inside a cluster of the file
+     * @return false the chain ends before position or the FAT could not be read
+     */
+    bool locate_file_sector(File &file, const Address32 &position, Address32 &sector_address, Address32 &sectors_left_in_extent);
+
+    /**
+     * @brief Allocates up to max_clusters clusters and links them onto the end of file, at the
+     * start of a free AU if the end of the file can not be continued
+     */
+    bool allocate_file_clusters(File &file, const Address32 &max_clusters, const bool &whole_run);
+
+    /**
+     * @brief Marks every cluster of the chain starting at first_cluster as free in the FAT cache, a
+     * FAT sector at a time (see FATCache::free_chain()), and hands the freed runs to the allocator
+     */
+    bool free_cluster_chain(const Address32 &first_cluster);
+
+    /**
+     * @brief FATCache::run_freed_callback_t used by free_cluster_chain(), context is the FileSystem
+     */
+    static void cluster_run_freed_callback(const Address32 &first_cluster, const Address32 &run_length, void *context);
+
+    /**
+     * @brief Grows a directory by a zeroed cluster
+     *
+     * @param last_sector_address address of the last sector of the directory
+     * @param new_sector_address returned address of the first sector of the new cluster
+     * @return true directory was grown, sector_buffer holds its (zeroed) first new sector
+     * @return false the card is full or could not be written
+     */
+    bool extend_directory(const Address32 &last_sector_address, Address32 &new_sector_address);
+
+    /**
+     * @brief First cluster of a directory, the root directory (root_directory_index) is found in
+     * the Volume ID
+     */
+    Address32 get_directory_first_cluster(const uint16_t &directory) const;
+
+    /**
+     * @brief Constants that identify information about 32 byte directory entries
+     */
+    constexpr static uint16_t bytes_per_entry = 32U;
+    constexpr static uint16_t attribute_byte_offset = 11U;
+    constexpr static uint16_t long_name_checksum_offset = 13U;
+    constexpr static uint16_t file_size_offset = 28U;
+    // TODO assumes sector size of 512 bytes, update to be sector size/ bytes per entry
+    constexpr static uint16_t directory_entrys_per_sector = 16U;
+
+    /**
+     * @brief State shared with read_directory_sector_callback() while a directory is streamed
+     * in with a multi block read
+     */
+    struct DirectoryReadContext
+    {
+        FileSystem *file_system = nullptr;
+        uint16_t parent_directory = root_directory_index;
+        bool end_of_directory_found = false;
+    };
+
+    /**
+     * @brief State shared with find_directory_entry_callback() while a directory is streamed in.
+     * Once entry_found is set entry_offset is the offset of its 32 byte entry within the sector
+     * it was found in
+     */
+    struct DirectoryEntrySearchContext
+    {
+        FileSystem *file_system = nullptr;
+
+        /**
+         * @brief Index of the entry in entry_table whose 32 byte entry is searched for
+         */
+        uint16_t entry_to_find = 0U;
+
+        bool end_of_directory_found = false;
+        bool entry_found = false;
+        uint16_t entry_offset = 0U;
+
+        /**
+         * @brief Offset of the first of the LFN entries right before entry_offset in the same
+         * sector, entry_offset if there are none
+         */
+        uint16_t long_name_entry_offset = 0U;
+    };
+
+    /**
+     * @brief State shared with directory_cluster_callback() while a cluster of a directory is
+     * streamed in by read_directory_clusters()
+     */
+    struct DirectoryClusterReadContext
+    {
+        sd_driver::BlockDevice::block_read_callback_t block_callback = nullptr;
+        void *context = nullptr;
+        Address32 cluster_sector_address;
+        Address32 last_sector_address;
+        bool stopped = false;
+    };
+
+    /**
+     * @brief State shared with look_up_entry_callback() while a directory is streamed in with a
+     * multi block read
+     */
+    struct DirectoryLookupContext
+    {
+        FileSystem *file_system = nullptr;
+        uint16_t parent_directory = root_directory_index;
+        const uint16_t (*entry_name)[11] = nullptr;
+
+        /**
+         * @brief Set to look the entry up by its long file name instead of entry_name
+         */
+        const char *long_name = nullptr;
+
+        bool end_of_directory_found = false;
+
+        /**
+         * @brief Index of the entry in entry_table, -1 until it's found
+         */
+        int16_t entry_found = -1;
+    };
+
+    /**
+     * @brief Stores every valid entry (see is_valid_directory_entry()) of a single directory sector
+     * in entry_table. Sub directories are NOT explored.
+     *
+     * @param directory_sector sector of a directory
+     * @param parent_directory index of the parent directory (root_directory_index is root)
+     * @return true if the end of the directory was found in this sector (or entry_table is full)
+     * @return false if the directory may continue in the next sector
+     */
+    bool parse_directory_sector(const PackedSector &directory_sector, const uint16_t &parent_directory);
+
+    /**
+     * @brief Copies a single valid 32 byte entry into the next free element of entry_table
+     *
+     * @param directory_sector sector of a directory
+     * @param entry_offset offset of the first byte of the 32 byte entry in directory_sector
+     * @param parent_directory index of the parent directory (root_directory_index is root)
+     * @return int16_t index of the stored entry, -1 if entry_table is full
+     */
+    int16_t store_directory_entry(const PackedSector &directory_sector, const uint16_t &entry_offset,
+                                    const uint16_t &parent_directory);
+
+    /**
+     * @brief Checks if the 32 byte entry at entry_offset is a file, directory or volume label that
+     * should be stored. Deleted, LFN, hidden and system entries as well as "." and ".." are not.
+     *
+     * @param directory_sector sector of a directory
+     * @param entry_offset offset of the first byte of the 32 byte entry in directory_sector
+     * @return true entry is valid
+     * @return false entry should be ignored
+     */
+    bool is_valid_directory_entry(const PackedSector &directory_sector, const uint16_t &entry_offset) const;
+
+    /**
+     * @brief sd_driver::BlockDevice::block_read_callback_t used by read_directory_clusters(), context
+     * is a DirectoryClusterReadContext. Tracks the sector address of each sector and forwards it to
+     * the callers callback
+     */
+    static bool directory_cluster_callback(const PackedSector &block, const uint16_t &block_index, void *context);
+
+    /**
+     * @brief sd_driver::BlockDevice::block_read_callback_t used when reading a directory into
+     * entry_table, context is a DirectoryReadContext. Stops the transfer once the end of
+     * directory is found
+     */
+    static bool read_directory_sector_callback(const PackedSector &block, const uint16_t &block_index, void *context);
+
+    /**
+     * @brief sd_driver::BlockDevice::block_read_callback_t used when searching a directory for the on
+     * card entry of an entry in entry_table, context is a DirectoryEntrySearchContext. Stops the
+     * transfer once the entry or the end of directory is found
+     */
+    static bool find_directory_entry_callback(const PackedSector &block, const uint16_t &block_index, void *context);
+
+    /**
+     * @brief sd_driver::BlockDevice::block_read_callback_t used by look_up_entry(), context is a
+     * DirectoryLookupContext. Stores the entry and stops the transfer once the entry (or the end of
+     * directory) is found
+     */
+    static bool look_up_entry_callback(const PackedSector &block, const uint16_t &block_index, void *context);
+
+    /**
+     * @brief sd_driver::BlockDevice::block_read_callback_t used by create(), context is a
+     * DirectoryEntrySearchContext (entry_to_find is not used). Stops the transfer once a free
+     * (deleted or end of directory) 32 byte entry is found
+     */
+    static bool find_free_directory_entry_callback(const PackedSector &block, const uint16_t &block_index, void *context);
+
+    /**
+     * @brief sd_driver::BlockDevice::block_write_callback_t that produces zeroed sectors
+     */
+    static bool zero_sector_callback(PackedSector &block, const uint16_t &block_index, void *context);
+
+    /**
+     * @brief Long file name being assembled from the LFN entries before a short entry. The
+     * characters go straight into the free end of long_name_pool[] and are only kept once the
+     * short entry they belong to is stored (see store_directory_entry())
+     */
+    struct LongNameAssembly
+    {
+        /**
+         * @brief Sequence number of the LFN entry expected next, the entries come last first
+         */
+        uint16_t next_sequence_number = 0U;
+
+        /**
+         * @brief Checksum of the short name every LFN entry of the long name carries
+         */
+        uint16_t checksum = 0U;
+
+        /**
+         * @brief Characters reserved at long_name_pool_used, 13 per LFN entry
+         */
+        uint16_t reserved_length = 0U;
+
+        /**
+         * @brief Set once the LFN entry with sequence number 1 has been added
+         */
+        bool complete = false;
+    };
+
+    /**
+     * @brief Adds an LFN entry to long_name_assembly, any other (or a deleted) entry discards the
+     * long name being assembled since a long name only belongs to the short entry right after it.
+     * Called for every entry of a directory that is not stored
+     *
+     * @param directory_sector sector of a directory
+     * @param entry_offset offset of the first byte of the 32 byte entry in directory_sector
+     */
+    void assemble_long_name(const PackedSector &directory_sector, const uint16_t &entry_offset);
+
+    /**
+     * @brief True if long_name_assembly holds a whole long name whose checksum matches the short
+     * entry at entry_offset
+     */
+    bool is_long_name_assembled_for(const PackedSector &directory_sector, const uint16_t &entry_offset) const;
+
+    /**
+     * @brief Length of the long name in long_name_assembly, up to its null terminator/ padding
+     */
+    uint16_t get_assembled_long_name_length() const;
+
+    /**
+     * @brief Compares length characters of long_name_pool[] from offset to a null terminated long
+     * name, ASCII letters are compared ignoring case
+     */
+    bool long_name_matches(const uint16_t &offset, const uint16_t &length, const char *long_name) const;
+
+    /**
+     * @brief Checksum of an 8.3 name stored in every LFN entry of its long name
+     */
+    static uint16_t short_name_checksum(const PackedSector &directory_sector, const uint16_t &entry_offset);
+
+    /**
+     * @brief Character at position of long_name_pool[], two 8 bit characters per word
+     */
+    uint16_t get_long_name_character(const uint16_t &position) const;
+
+    void set_long_name_character(const uint16_t &position, const uint16_t &character);
+
+    /**
+     * @brief Given a cluster number calculate the sector address of the first sector of the cluster,
+     * constant time since sectors per cluster is a power of two
+     * 
+     * @param cluster_number cluster number, must be >= 2
+     * @return Address32 sector address (lba) of the cluster
+     */
+    Address32 calculate_sector_address_from_cluster_number(const Address32 &cluster_number) const;
+
+    /**
+     * @brief Checks if a FAT entry marks the end of a cluster chain (0x?FFFFFF8 - 0x?FFFFFFF), the
+     * upper 4 bits of a FAT32 entry are reserved and ignored
+     */
+    constexpr static bool is_end_of_cluster_chain(const Address32 &fat_entry)
+    {
+        return (fat_entry.high() & 0x0FFF) == 0x0FFF && fat_entry.low() >= 0xFFF8;
+    }
+
+
+    /**
+     * @brief Reads the starting cluster number out of a 32 byte short directory entry, the high
+     * and low 16 bits are stored separately at offsets 0x14 & 0x1A
+     *
+     * @param directory_sector sector of a directory
+     * @param entry_offset offset of the first byte of the 32 byte entry in directory_sector
+     */
+    static Address32 read_starting_cluster_address(const PackedSector &directory_sector, const uint16_t &entry_offset);
+
+    /**
+     * @brief Reads the 8.3 name out of a 32 byte short directory entry packed the way
+     * DirectoryEntryTable::names holds it, the entry is 32 byte aligned so it is a word copy
+     *
+     * @param directory_sector sector of a directory
+     * @param entry_offset offset of the first byte of the 32 byte entry in directory_sector
+     */
+    static void read_packed_entry_name(const PackedSector &directory_sector, const uint16_t &entry_offset,
+                                        uint16_t (&packed_name)[packed_name_words]);
+
+
+
+    MountManager &mount_manager;
+
+    sd_driver::BlockDevice &block_device;
+
+    /**
+     * @brief Write-back cache every FAT entry read/ write goes through, keeps FAT #1 and #2 identical.
+     * It sits directly on block_device (not block_cache) so FAT sectors are never cached twice
+     */
+    FATCache fat_cache;
+
+    /**
+     * @brief Metadata changed since the last commit, FAT sectors written back only go to FAT #1
+     * once they are in its record
+     */
+    IntentLog intent_log;
+
+    /**
+     * @brief Every cluster allocation/ release goes through here, seeded from FSInfo at mount
+     */
+    ClusterAllocator cluster_allocator;
+
+    /**
+     * @brief Cache every non FAT sector read/ write goes through, this volume's share (up to its
+     * quota) of the block cache of mount_manager
+     */
+    sd_driver::BlockCache block_cache;
+
+    /**
+     * @brief The one sector buffer shared by every operation (mount, directory reads, delete_file),
+     * none of them need more than one sector at a time. Belongs to mount_manager, the other
+     * volumes it mounts use it too
+     */
+    PackedSector &sector_buffer;
+
+    /**
+     * @brief Index (0-3) in FAT32MasterBootRecord::primary_partitions of the partition this volume is on
+     */
+    const uint16_t partition_index;
+
+    /**
+     * @brief Sector address of the Volume ID of the selected partition
+     */
+    Address32 partition_lba_begin;
+
+    /**
+     * @brief See is_mounted()
+     */
+    bool mounted = false;
+
+    const file_system_t &file_system_type;
+
+    const mount_mode_t mount_mode;
+
+    FileSystemStatistics statistics;
+
+    FAT32MasterBootRecord fat_32_master_boot_record;
+
+    FAT32VolumeID fat_32_volume_id;
+
+    DirectoryEntryTable entry_table;
+
+    // tracks where we are in the arrays of entry_table
+    uint16_t file_systems_entry_index = 0U;
+
+    /**
+     * @brief Characters of every long file name stored, DirectoryEntryTable::long_name_offsets/
+     * long_name_lengths say which are whose. Like entry_table it is only added to, the
+     * name of a deleted entry is not reused
+     */
+    uint16_t long_name_pool[long_name_pool_words];
+
+    /**
+     * @brief Characters of long_name_pool[] in use
+     */
+    uint16_t long_name_pool_used = 0U;
+
+    LongNameAssembly long_name_assembly;
+
+    /**
+     * @brief Number of slots in path_index[], a power of two larger than total_directory_entries
+     * so at most half the slots are ever used
+     */
+    constexpr static uint16_t path_index_slots = path_index_slots_for(total_directory_entries);
+
+    constexpr static uint16_t path_index_empty_slot = 0xFFFF;
+    constexpr static uint16_t path_index_deleted_slot = 0xFFFE;
+
+    /**
+     * @brief Open addressing hash table (linear probing) of indices into entry_table, keyed
+     * on (parent directory, 8.3 name) so a path component is found without searching every entry
+     */
+    uint16_t path_index[path_index_slots];
+
+    /**
+     * @brief The sector address (lba) of the first cluster of the data region, normally the 
+     * root directory starts here but not guaranteed
+     * 
+     * @details Calculated using:
+     * 
+     * cluster_begin_lba = Partition_LBA_Begin + Number_of_Reserved_Sectors + (Number_of_FATs * Sectors_Per_FAT);
+     * 
+     */
+    Address32 cluster_begin_lba;
+
+    Address32 fat_begin_lba;
+
+    /**
+     * @brief Number of data clusters in the file system, valid cluster numbers are 2 to number_of_clusters + 1
+     */
+    Address32 number_of_clusters;
+
+    /**
+     * @brief log2(sectors_per_cluster), sectors per cluster is always a power of two in FAT32 so
+     * converting between clusters and sectors is a shift
+     */
+    uint16_t sectors_per_cluster_shift = 0U;
+
+    VolumeAlignment volume_alignment;
+
+    /**
+     * @brief Sectors of the (power of two part of the) AU - 1, append() ends a multiple block
+     * write at an AU boundary so each one is pre-erased within a single AU. 0 if there is no AU
+     */
+    Address32 allocation_unit_mask;
+
+    /**
+     * @brief Set if the FSInfo sector had valid signatures at mount, only then is it written back
+     */
+    bool fs_info_valid = false;
+
+    Address32 fs_info_sector_address;
+
+    /**
+     * @brief Set once FSInfo says the free cluster count is unknown, it is until unmount() so a
+     * brown-out never leaves a count that is wrong
+     */
+    bool fs_info_count_unknown = false;
+
+    /**
+     * @brief Writes the free cluster count and next free cluster into FSInfo (read, modify, write)
+     */
+    bool write_fs_info(const Address32 &free_cluster_count, const Address32 &next_free_cluster);
+
+    /**
+     * @brief Rolls the volume back (record OPEN) or forward (record COMMITTING) to its last
+     * commit, before anything else is read at mount
+     */
+    bool recover_intent_log();
+
+    /**
+     * @brief Second half of a commit (and of a roll forward): copies the FAT ranges of the intent
+     * record to the other FATs and writes the staged directory entries
+     */
+    bool apply_intent_record();
+
+    /**
+     * @brief FATCache::write_back_callback_t, logs the sector in the intent record so it only goes
+     * to FAT #1 until the next commit. Every copy is written if there is no record, none if the
+     * record could not be written (FAT #2 must keep the last commit to roll back to)
+     */
+    static FATCache::write_back_target_t fat_write_back_callback(const Address32 &fat_sector_offset, void *context);
+
+    /**
+     * @brief LFN checksum of the short name of entry entry_index of entry_table
+     */
+    uint16_t entry_name_checksum(const uint16_t &entry_index) const;
+
+    /**
+     * @brief Words of one entry_table entry in the directory snapshot, 128 entries take 7 sectors
+     */
+    constexpr static uint16_t directory_snapshot_entry_words = packed_name_words + 8U;
+
+    static_assert(directory_snapshot_entry_words * 128U == 7U * PackedSector::words_per_sector,
+                    "directory_snapshot_sectors assumes 128 entries fill 7 sectors");
+
+    /**
+     * @brief Sectors of the reserved area the directory snapshot may take: the header sector, the
+     * entries and long_name_pool[]
+     */
+    constexpr static uint16_t directory_snapshot_sectors = ((total_directory_entries + 127U) >> 7) * 7U +
+                                                           ((long_name_pool_words + PackedSector::words_per_sector - 1U) >> 8) + 1U;
+
+    /**
+     * @brief "SDDS", marks the header sector of the directory snapshot
+     */
+    constexpr static Address32 directory_snapshot_signature()
+    {
+        return Address32(0x5344, 0x4453);
+    }
+
+    /**
+     * @brief Byte offsets of the fields of the directory snapshot header sector, the payload
+     * starts in the sector after it
+     */
+    constexpr static uint16_t snapshot_signature_offset = 0U;
+    constexpr static uint16_t snapshot_state_offset = 4U; // 0 not current, 1 current
+    constexpr static uint16_t snapshot_total_entries_offset = 6U;
+    constexpr static uint16_t snapshot_long_name_pool_words_offset = 8U;
+    constexpr static uint16_t snapshot_number_of_entries_offset = 10U;
+    constexpr static uint16_t snapshot_long_name_characters_offset = 12U;
+    constexpr static uint16_t snapshot_complete_offset = 14U;
+    constexpr static uint16_t snapshot_generation_offset = 16U;
+    constexpr static uint16_t snapshot_free_cluster_count_offset = 20U;
+    constexpr static uint16_t snapshot_next_free_cluster_offset = 24U;
+    constexpr static uint16_t snapshot_directories_checksum_offset = 28U;
+    constexpr static uint16_t snapshot_payload_checksum_offset = 30U;
+    constexpr static uint16_t snapshot_payload_sectors_offset = 32U;
+
+    /**
+     * @brief DirectorySnapshotContext::section once every word has been streamed
+     */
+    constexpr static uint16_t directory_snapshot_end_section = 8U;
+
+    /**
+     * @brief Where the directory snapshot is streamed to/ from, the entry_table arrays (for the
+     * first number_of_entries entries) one after the other and then long_name_pool[]
+     */
+    struct DirectorySnapshotContext
+    {
+        FileSystem *file_system = nullptr;
+
+        /**
+         * @brief Array (0-6 the entry_table arrays, 7 long_name_pool[], then
+         * directory_snapshot_end_section), element
+         * of it and word of the element the next word of the snapshot is
+         */
+        uint16_t section = 0U;
+        uint16_t element = 0U;
+        uint16_t word = 0U;
+
+        uint16_t number_of_entries = 0U;
+        uint16_t number_of_long_name_words = 0U;
+
+        /**
+         * @brief Sum of every word streamed so far
+         */
+        uint16_t checksum = 0U;
+    };
+
+    /**
+     * @brief Loads entry_table from the directory snapshot if it is still current: its generation
+     * is the sequence number of the intent record (see IntentLog::get_sequence()) and FSInfo and
+     * the first cluster of every directory in it (see read_directories_checksum()) are as they
+     * were when it was saved. A change another host makes past the first cluster of a directory
+     * (e.g., to a directory of more than a cluster of entries) is not seen. The path index is
+     * built again from entry_table rather than saved
+     *
+     * @return true entry_table was loaded
+     * @return false no current snapshot, entry_table is left empty
+     */
+    bool load_directory_snapshot();
+
+    /**
+     * @brief Drops the entries of entry_table that were deleted (and those in deleted directories)
+     * and their long names, so only a mount may call it: the entries left get new indices
+     */
+    void compact_entry_table();
+
+    /**
+     * @brief Saves entry_table as the directory snapshot, payload first and the header last. The
+     * sectors are only used if they are all zero or already hold a snapshot
+     *
+     * @return true snapshot was saved (or there is no room for one)
+     * @return false a read/ write failed
+     */
+    bool save_directory_snapshot();
+
+    /**
+     * @brief Marks the snapshot on the card as no longer current, before the first change to the
+     * directories or FAT after it was loaded/ saved
+     */
+    bool invalidate_directory_snapshot();
+
+    /**
+     * @brief Checksum of the first cluster of the root directory and of every directory among the
+     * first number_of_entries entries of entry_table, read through sector_buffer (one multi block
+     * read per directory)
+     */
+    bool read_directories_checksum(const uint16_t &number_of_entries, uint16_t &checksum);
+
+    /**
+     * @brief BlockDevice::block_read_callback_t, adds a sector to the uint16_t checksum context
+     * points to (see read_directories_checksum())
+     */
+    static bool directory_checksum_callback(const PackedSector &block, const uint16_t &block_index, void *context);
+
+    /**
+     * @brief Word of the snapshot at the position of context, and setting it in entry_table/
+     * long_name_pool[]. Both move context on to the next word
+     */
+    uint16_t next_directory_snapshot_word(DirectorySnapshotContext &context) const;
+    void set_next_directory_snapshot_word(DirectorySnapshotContext &context, const uint16_t &value);
+
+    /**
+     * @brief Moves context on to the next word of the snapshot
+     */
+    static void advance_directory_snapshot_context(DirectorySnapshotContext &context);
+
+    /**
+     * @brief Moves context past arrays it is at the end of (or that are empty)
+     */
+    static void settle_directory_snapshot_context(DirectorySnapshotContext &context);
+
+    /**
+     * @brief BlockDevice::block_write_callback_t, fills a sector of the snapshot
+     */
+    static bool directory_snapshot_write_callback(PackedSector &block, const uint16_t &block_index, void *context);
+
+    /**
+     * @brief BlockDevice::block_read_callback_t, stores a sector of the snapshot
+     */
+    static bool directory_snapshot_read_callback(const PackedSector &block, const uint16_t &block_index, void *context);
+
+    /**
+     * @brief BlockDevice::block_read_callback_t, stops at the first sector that is not all zero
+     * (context is a bool set to false)
+     */
+    static bool zero_sector_check_callback(const PackedSector &block, const uint16_t &block_index, void *context);
+
+    /**
+     * @brief Set by VolumeOptions::directory_snapshot
+     */
+    const bool directory_snapshot_enabled;
+
+    /**
+     * @brief First sector of the directory snapshot, zero if the reserved area has no room for it
+     */
+    Address32 directory_snapshot_address;
+
+    /**
+     * @brief Set while the snapshot on the card matches entry_table, number_of_entries it holds
+     */
+    bool directory_snapshot_current = false;
+    uint16_t directory_snapshot_entries = 0U;
+
+    /**
+     * @brief Set if entry_table holds every entry on the card, by a full scan (or a snapshot of
+     * one), a look up of an entry that is not loaded then does not have to read the directory
+     */
+    bool directory_tree_complete = false;
 };
 } // namespace file_system
 
@@ -0,0 +1,329 @@
+/**
+ * @file IntentLog.h
+ * @author Mattheas Jamieson (mattheas@ualberta.ca)
+ * @brief Declaration of intent log, records uncommitted metadata changes in the reserved area
+ * @version 0.1
+ * @date 2024-03-03
+ */
+
+#ifndef _INTENTLOG_H_
+#define _INTENTLOG_H_
+
+#include "../inc/BlockDevice.h"
+#include "../inc/PackedSector.h"
+
+namespace file_system
+{
+
+using sd_driver::Address32;
+using sd_driver::PackedSector;
+
+/**
+ * @brief Intent record of the metadata changes made since the last commit, kept in two unused
+ * sectors of the reserved area (written alternately, the valid one with the higher sequence
+ * number is current) so a brown-out at any point leaves a record that says how to get back to
+ * a consistent file system.
+ *
+ * @details FAT #2 is kept as the copy of the FAT as of the last commit. Between commits changed
+ * FAT sectors are only written to FAT #1, each one is added to the record (state OPEN) before it
+ * is. At a commit the record lists the directory entry updates (state COMMITTING), then the
+ * sectors are copied to the other FATs and the directory entries written, then the record is
+ * cleared (state CLEAN). Mounting a volume whose record is:
+ * - OPEN rolls back, the listed FAT #1 sectors are restored from FAT #2 and the freed chains
+ *   (files deleted since the commit) are freed again if their directory entry is gone from the card
+ * - COMMITTING rolls forward, the listed sectors are copied to the other FATs and the directory
+ *   entry updates applied again
+ *
+ * The FAT sectors are kept as sorted ranges. Copying a sector that did not change is harmless
+ * (the FATs are identical there), so when every range is in use the two closest are merged
+ * rather than the record overflowing.
+ *
+ * The pending directory entry updates are held here even when there is no room for a record
+ * (is_enabled() is false), they are then written at each commit after every FAT copy.
+ */
+class IntentLog
+{
+  public:
+    /**
+     * @brief Constructs a new IntentLog object, configure() must be called before it is used
+     *
+     * @param _block_device device (e.g., SD card) the file system is on
+     */
+    IntentLog(sd_driver::BlockDevice &_block_device);
+
+    ~IntentLog();
+
+    enum class record_state_t
+    {
+        CLEAN = 0,  /**< nothing changed since the last commit */
+        OPEN,       /**< FAT #1 has (maybe) changed since the last commit, roll back */
+        COMMITTING  /**< FAT #1 is complete, roll forward */
+    };
+
+    /**
+     * @brief Size (and first cluster) of a file to write into its 32 byte directory entry at the
+     * next commit
+     */
+    struct DirectoryUpdate
+    {
+        Address32 entry_sector_address;
+
+        uint16_t entry_offset = 0U;
+
+        /**
+         * @brief LFN checksum of the short name in the entry, an entry that no longer has this
+         * name (e.g., deleted and reused by another OS after a brown-out) is not rolled forward
+         */
+        uint16_t name_checksum = 0U;
+
+        Address32 first_cluster;
+
+        Address32 size;
+    };
+
+    /**
+     * @brief Cluster chain of a file deleted since the last commit and where its 32 byte directory
+     * entry is, the chain is only freed again by a roll back if the entry is no longer on the card
+     */
+    struct FreedChain
+    {
+        Address32 first_cluster;
+
+        Address32 entry_sector_address;
+
+        uint16_t entry_offset = 0U;
+    };
+
+    /**
+     * @brief Most pending directory entry updates, files deleted and FAT ranges in a record
+     */
+    constexpr static uint16_t max_directory_updates = 8U;
+    constexpr static uint16_t max_freed_chains = 8U;
+    constexpr static uint16_t max_fat_ranges = 35U;
+
+    /**
+     * @brief Finds the two sectors for the record in the reserved area of the volume (after the
+     * boot sector, skipping FSInfo, the backup boot sectors and sector 12 that Windows keeps boot
+     * code in) and loads the current record. A sector is only used if it is all zero or already
+     * holds a record, so nothing another tool put in the reserved area is overwritten
+     *
+     * @param partition_lba_begin sector address of the Volume ID
+     * @param reserved_sectors size of the reserved area in sectors
+     * @param fs_info_sector sector of FSInfo within the reserved area
+     * @param backup_boot_sector first sector of the backup boot sectors (0 or 0xFFFF for none)
+     * @param number_of_fats the record is only written if there is a second FAT to roll back from
+     * @return true a record was loaded (or there was none yet), see is_enabled()
+     * @return false no room for a record, the log only holds directory updates
+     */
+    bool configure(const Address32 &partition_lba_begin, const uint16_t &reserved_sectors, const uint16_t &fs_info_sector,
+                    const uint16_t &backup_boot_sector, const uint16_t &number_of_fats);
+
+    /**
+     * @brief True if records are written, i.e., configure() found room for them
+     */
+    bool is_enabled() const;
+
+    /**
+     * @brief Sequence number of the current record, it changes with every record written so it
+     * doubles as a generation number of the FAT and directory updates made through the log
+     */
+    Address32 get_sequence() const;
+
+    /**
+     * @brief Finds number_of_sectors contiguous sectors of the reserved area after the record
+     * sectors that are not used by anything else (by the same rules as the record sectors, their
+     * contents are not checked) e.g., for FileSystem's directory snapshot
+     *
+     * @param first_sector_address returned address of the first of the sectors
+     * @return true sectors were found
+     * @return false the log is not enabled or the reserved area is too small
+     */
+    bool find_free_reserved_sectors(const uint16_t &number_of_sectors, Address32 &first_sector_address) const;
+
+    /**
+     * @brief State of the current record, as loaded by configure() until the first write
+     */
+    record_state_t get_state() const;
+
+    /**
+     * @brief True if nothing changed since the last commit (no FAT sectors, directory updates or
+     * freed chains)
+     */
+    bool is_empty() const;
+
+    /**
+     * @brief Adds a FAT sector to the record before it is written to FAT #1 only, the record is
+     * written (state OPEN) unless the sector is already covered
+     *
+     * @param fat_sector_offset offset (in sectors) of the FAT sector from the beginning of the FAT
+     * @return true the sector is in the record on the card, write it to FAT #1 only
+     * @return false log not enabled (write every FAT copy) or the record could not be written (do
+     * not write the sector at all, see is_enabled())
+     */
+    bool log_fat_sector(const Address32 &fat_sector_offset);
+
+    /**
+     * @brief Adds the chain of a file about to be deleted to the record, which is written (state
+     * OPEN). Must be called before the directory entry is deleted and the chain freed
+     *
+     * @return true chain is in the record on the card (or the log is not enabled)
+     * @return false record is full (commit first) or could not be written
+     */
+    bool log_freed_chain(const FreedChain &freed_chain);
+
+    /**
+     * @brief Holds a directory entry update until the next commit, replaces the pending update of
+     * the same entry. Nothing is written
+     *
+     * @return true update is pending
+     * @return false max_directory_updates are already pending (commit first)
+     */
+    bool add_directory_update(const DirectoryUpdate &directory_update);
+
+    /**
+     * @brief Drops the pending update of an entry (e.g., the file was deleted), if there is one
+     */
+    void remove_directory_update(const Address32 &entry_sector_address, const uint16_t &entry_offset);
+
+    uint16_t get_number_of_directory_updates() const;
+
+    DirectoryUpdate get_directory_update(const uint16_t &update_index) const;
+
+    uint16_t get_number_of_freed_chains() const;
+
+    FreedChain get_freed_chain(const uint16_t &chain_index) const;
+
+    uint16_t get_number_of_fat_ranges() const;
+
+    /**
+     * @brief First FAT sector offset and number of sectors of range range_index
+     */
+    void get_fat_range(const uint16_t &range_index, Address32 &first_fat_sector_offset, Address32 &number_of_sectors) const;
+
+    /**
+     * @brief Writes the record with state COMMITTING (if enabled), FAT #1 and the data must
+     * already be on the card
+     */
+    bool begin_commit();
+
+    /**
+     * @brief Empties the log and writes the record with state CLEAN (if enabled and it was not
+     * already clean)
+     */
+    bool clear();
+
+  private:
+    /**
+     * @brief True if a sector of the reserved area belongs to the file system (FSInfo, the backup
+     * boot sectors or Windows boot code), the boot sector itself is never considered
+     */
+    bool is_used_reserved_sector(const uint16_t &sector) const;
+
+    /**
+     * @brief Fills in the header and checksum of record, writes it to the other sector and flushes
+     */
+    bool write_record(const record_state_t &state);
+
+    /**
+     * @brief Reads a record sector into record
+     *
+     * @return true sector holds a valid record (signature and checksum)
+     */
+    bool read_record(const Address32 &sector_address);
+
+    /**
+     * @brief True if record holds a valid record (signature, checksum and counts in range)
+     */
+    bool is_valid_record() const;
+
+    /**
+     * @brief Sum of every word of record but the checksum
+     */
+    uint16_t record_checksum() const;
+
+    /**
+     * @brief Merges the two ranges with the fewest sectors between them
+     */
+    void merge_closest_fat_ranges();
+
+    void set_fat_range(const uint16_t &range_index, const Address32 &first_fat_sector_offset, const Address32 &number_of_sectors);
+
+    /**
+     * @brief Moves ranges range_index and up one place up (insert) or down (remove)
+     */
+    void insert_fat_range(const uint16_t &range_index);
+    void remove_fat_range(const uint16_t &range_index);
+
+    /**
+     * @brief Byte offsets of the header and tables in the record sector
+     */
+    constexpr static uint16_t signature_offset = 0U;
+    constexpr static uint16_t state_offset = 4U;
+    constexpr static uint16_t sequence_offset = 6U;
+    constexpr static uint16_t number_of_fat_ranges_offset = 10U;
+    constexpr static uint16_t number_of_directory_updates_offset = 12U;
+    constexpr static uint16_t number_of_freed_chains_offset = 14U;
+    constexpr static uint16_t checksum_offset = 16U;
+    constexpr static uint16_t directory_updates_offset = 20U;
+    constexpr static uint16_t bytes_per_directory_update = 16U;
+    constexpr static uint16_t freed_chains_offset = directory_updates_offset + max_directory_updates * bytes_per_directory_update;
+    constexpr static uint16_t bytes_per_freed_chain = 10U;
+    constexpr static uint16_t fat_ranges_offset = freed_chains_offset + max_freed_chains * bytes_per_freed_chain;
+    constexpr static uint16_t bytes_per_fat_range = 8U;
+
+    static_assert(fat_ranges_offset + max_fat_ranges * bytes_per_fat_range <= 510U, "intent record does not fit in a sector");
+
+    /**
+     * @brief "SDIL", marks a sector holding a record
+     */
+    constexpr static Address32 record_signature()
+    {
+        return Address32(0x4C49, 0x4453);
+    }
+
+    sd_driver::BlockDevice &block_device;
+
+    /**
+     * @brief Sector addresses of the two record sectors, the record with sequence number n is
+     * written to record_sector_addresses[n & 1]
+     */
+    Address32 record_sector_addresses[2];
+
+    /**
+     * @brief Layout of the reserved area given to configure(), backup_boot_sector_number is 0 if
+     * there are no backup boot sectors
+     */
+    Address32 reserved_area_begin;
+    uint16_t number_of_reserved_sectors = 0U;
+    uint16_t fs_info_sector_number = 0U;
+    uint16_t backup_boot_sector_number = 0U;
+
+    bool enabled = false;
+
+    /**
+     * @brief False if the last record write failed, the tables hold changes the record on the card
+     * does not (so a sector already in them is not on the card yet)
+     */
+    bool record_on_card = true;
+
+    record_state_t state = record_state_t::CLEAN;
+
+    /**
+     * @brief Sequence number of the last record written (or loaded)
+     */
+    Address32 sequence;
+
+    /**
+     * @brief The record, the tables are kept in place so writing it is a single sector write
+     */
+    PackedSector record;
+
+    uint16_t number_of_fat_ranges = 0U;
+
+    uint16_t number_of_directory_updates = 0U;
+
+    uint16_t number_of_freed_chains = 0U;
+};
+} // namespace file_system
+
+#endif // _INTENTLOG_H_
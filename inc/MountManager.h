@@ -0,0 +1,176 @@
+/**
+ * @file MountManager.h
+ * @author Mattheas Jamieson (mattheas@ualberta.ca)
+ * @brief Declaration of mount manager, shares a block cache and I/O worker between volumes
+ * @version 0.1
+ * @date 2024-03-03
+ */
+
+#ifndef _MOUNTMANAGER_H_
+#define _MOUNTMANAGER_H_
+
+#include "../inc/AsyncBlockDevice.h"
+#include "../inc/BlockCache.h"
+#include "../inc/PackedSector.h"
+
+/**
+ * @brief Number of blocks in the block cache shared by every volume of a MountManager (see
+ * MountManager::block_cache_blocks), set per product with -DSD_FS_BLOCK_CACHE_BLOCKS=N. Every
+ * block takes a 256 word sector and a few words of state
+ */
+#ifndef SD_FS_BLOCK_CACHE_BLOCKS
+#define SD_FS_BLOCK_CACHE_BLOCKS 4
+#endif
+
+namespace file_system
+{
+
+using sd_driver::PackedSector;
+
+class FileSystem; // Forward declaration
+
+/**
+ * @brief Owns what the FileSystem volumes mounted through it share: the block cache every MBR,
+ * Volume ID and directory sector goes through, the scratch sector operations work in and the
+ * I/O worker loop. A volume is a partition of a card, several partitions of one card and
+ * volumes on different cards (e.g., two card slots, one SDCard each) can be mounted at once
+ * without each needing its own 512 byte buffers.
+ *
+ * @details Each volume has a quota, the most blocks of the cache it may hold at once, so a volume
+ * that scans a large directory can not push every block of the others out (see
+ * sd_driver::BlockCache::BlockPool). Quotas may add up to more than the cache, a volume below its
+ * quota takes free or least recently used slots from the others.
+ *
+ * Volumes of one manager share the scratch sector, so they must all be used from the same thread.
+ * The I/O worker serves the AsyncBlockDevice of every card registered with add_io_queue(), so a
+ * single thread (running run(), or a main loop calling poll()) carries out the queued requests
+ * of every card.
+ */
+class MountManager
+{
+  public:
+    /**
+     * @brief Most volumes (and I/O queues) mounted at once
+     */
+    constexpr static uint16_t max_volumes = 4U;
+
+    /**
+     * @brief Number of sectors held by the shared block cache, see SD_FS_BLOCK_CACHE_BLOCKS
+     */
+    constexpr static uint16_t block_cache_blocks = SD_FS_BLOCK_CACHE_BLOCKS;
+
+    static_assert(block_cache_blocks > 0U, "SD_FS_BLOCK_CACHE_BLOCKS must be at least 1");
+
+    /**
+     * @brief Where a volume is and how much of the shared cache it gets, passed to FileSystem
+     */
+    struct VolumeOptions
+    {
+        /**
+         * @brief Primary partition of the MBR the volume is on (1-4), the volume is not mounted
+         * for any other number
+         */
+        uint16_t partition_number = 1U;
+
+        /**
+         * @brief Most blocks of the shared cache the volume holds at once, 0 for the whole cache.
+         * One of them is pinned to the first sector of its root directory
+         */
+        uint16_t block_cache_quota = 0U;
+
+        /**
+         * @brief Saves entry_table in the reserved area at unmount and loads it at the next mount
+         * instead of reading directories, as long as nothing changed the volume in between (see
+         * FileSystem::load_directory_snapshot()). Off by default and only for cards no other host
+         * writes to: the check catches our own changes, allocations by another host (if it keeps
+         * FSInfo) and changes to the first cluster of any directory loaded, not those further
+         * into a directory of more than a cluster of entries. Saving and loading it reads the
+         * first cluster of every directory loaded
+         */
+        bool directory_snapshot = false;
+    };
+
+    MountManager();
+
+    ~MountManager();
+
+    /**
+     * @brief Adds the request queue of a card to the I/O worker, poll()/ run() carry out the
+     * requests of every queue added
+     *
+     * @return true queue was added
+     * @return false max_volumes queues were already added
+     */
+    bool add_io_queue(sd_driver::AsyncBlockDevice &io_queue);
+
+    /**
+     * @brief Carries out the oldest queued request of every I/O queue, if any (I/O thread only)
+     *
+     * @return true at least one request was carried out
+     * @return false every queue was empty
+     */
+    bool poll();
+
+    /**
+     * @brief Entry point of the shared I/O thread, polls every queue forever
+     */
+    void run();
+
+    /**
+     * @brief Number of volumes mounted, a volume is mounted from its construction until it is
+     * destroyed
+     */
+    uint16_t get_number_of_volumes() const;
+
+    /**
+     * @brief Returns a mounted volume (in the order they were mounted), nullptr if volume_index
+     * is not below get_number_of_volumes()
+     */
+    FileSystem *get_volume(const uint16_t &volume_index) const;
+
+    /**
+     * @brief Calls FileSystem::unmount() on every mounted volume
+     *
+     * @return true every volume wrote back its FAT and FSInfo
+     * @return false at least one volume could not
+     */
+    bool unmount_all();
+
+  private:
+    // FileSystem attaches/ detaches itself and uses the shared cache and sector
+    friend class FileSystem;
+
+    /**
+     * @brief Adds a volume to the volumes mounted
+     *
+     * @return true volume was added
+     * @return false max_volumes volumes are already mounted
+     */
+    bool attach(FileSystem &volume);
+
+    /**
+     * @brief Removes a volume from the volumes mounted
+     */
+    void detach(FileSystem &volume);
+
+    sd_driver::BlockCache::CachedBlock cached_blocks[block_cache_blocks];
+
+    sd_driver::BlockCache::BlockPool block_pool;
+
+    /**
+     * @brief The one sector buffer shared by every operation of every volume, none of them need
+     * more than one sector at a time (see FileSystem::sector_buffer)
+     */
+    PackedSector sector_buffer;
+
+    FileSystem *volumes[max_volumes];
+
+    uint16_t number_of_volumes = 0U;
+
+    sd_driver::AsyncBlockDevice *io_queues[max_volumes];
+
+    uint16_t number_of_io_queues = 0U;
+};
+} // namespace file_system
+
+#endif // _MOUNTMANAGER_H_
@@ -0,0 +1,130 @@
+/**
+ * @file PackedSector.h
+ * @author Mattheas Jamieson (mattheas@ualberta.ca)
+ * @brief Declaration of packed 512 byte sector buffer
+ * @version 0.1
+ * @date 2024-03-03
+ */
+
+#ifndef _PACKEDSECTOR_H_
+#define _PACKEDSECTOR_H_
+
+#include "../inc/Address32.h"
+
+namespace sd_driver
+{
+
+/**
+ * @brief A 512 byte sector stored two bytes per uint16_t, so a sector costs 512 bytes of RAM
+ * rather than the 1 KB of a uint16_t[512] with one byte per word.
+ *
+ * @details Byte 2n is stored in the lower 8 bits of words[n] and byte 2n+1 in the upper 8 bits.
+ * Since the SD card stores multi byte values in Little Endian format an aligned 2 byte field is
+ * a single word and an aligned 4 byte field is two words, which covers almost every FAT32 field.
+ * Offsets passed to the accessors are byte offsets (0-511) into the sector.
+ */
+class PackedSector
+{
+  public:
+    constexpr static uint16_t bytes_per_sector = 512U;
+    constexpr static uint16_t words_per_sector = 256U;
+
+    /**
+     * @brief Reads a single byte
+     */
+    uint16_t get_byte(const uint16_t offset) const
+    {
+        return (offset & 0x1) ? (words[offset >> 1] >> 8) : (words[offset >> 1] & 0xFF);
+    }
+
+    /**
+     * @brief Writes a single byte, any bits above the lower 8 bits of value are ignored
+     */
+    void set_byte(const uint16_t offset, const uint16_t value)
+    {
+        uint16_t &word = words[offset >> 1];
+        word = (offset & 0x1) ? ((word & 0x00FF) | ((value & 0xFF) << 8)) : ((word & 0xFF00) | (value & 0xFF));
+    }
+
+    /**
+     * @brief Reads a 2 byte value stored in Little Endian format (LSB first)
+     */
+    uint16_t get_le16(const uint16_t offset) const
+    {
+        return (offset & 0x1) ? (get_byte(offset) | (get_byte(offset + 1U) << 8)) : words[offset >> 1];
+    }
+
+    /**
+     * @brief Writes a 2 byte value in Little Endian format (LSB first)
+     */
+    void set_le16(const uint16_t offset, const uint16_t value)
+    {
+        if (offset & 0x1)
+        {
+            set_byte(offset, value);
+            set_byte(offset + 1U, value >> 8);
+        }
+        else
+        {
+            words[offset >> 1] = value;
+        }
+    }
+
+    /**
+     * @brief Reads a 4 byte value stored in Little Endian format (LSB first)
+     */
+    Address32 get_le32(const uint16_t offset) const
+    {
+        return Address32(get_le16(offset + 2U), get_le16(offset));
+    }
+
+    /**
+     * @brief Writes a 4 byte value in Little Endian format (LSB first)
+     */
+    void set_le32(const uint16_t offset, const Address32 &value)
+    {
+        set_le16(offset, value.low());
+        set_le16(offset + 2U, value.high());
+    }
+
+    /**
+     * @brief Sets every byte of the sector to value
+     */
+    void fill(const uint16_t value)
+    {
+        const uint16_t word = ((value & 0xFF) << 8) | (value & 0xFF);
+        for (uint16_t i = 0; i < words_per_sector; i++)
+        {
+            words[i] = word;
+        }
+    }
+
+    /**
+     * @brief Packs a sector held one byte per uint16_t
+     */
+    void pack(const uint16_t (&bytes)[512])
+    {
+        for (uint16_t i = 0; i < words_per_sector; i++)
+        {
+            words[i] = (bytes[i << 1] & 0xFF) | ((bytes[(i << 1) + 1U] & 0xFF) << 8);
+        }
+    }
+
+    /**
+     * @brief Unpacks the sector into one byte per uint16_t
+     */
+    void unpack(uint16_t (&bytes)[512]) const
+    {
+        for (uint16_t i = 0; i < words_per_sector; i++)
+        {
+            bytes[i << 1] = words[i] & 0xFF;
+            bytes[(i << 1) + 1U] = words[i] >> 8;
+        }
+    }
+
+    uint16_t words[words_per_sector];
+};
+
+} // namespace sd_driver
+
+#endif // _PACKEDSECTOR_H_
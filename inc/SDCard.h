@@ -11,6 +11,11 @@
 
 #include <SPI.h>
 #include <GPIO.h>
+#include <SystemClock.h>
+
+#include "../inc/Address32.h"
+#include "../inc/BlockDevice.h"
+#include "../inc/Statistics.h"
 
 namespace sd_driver
 {
@@ -20,21 +25,136 @@ namespace sd_driver
  * with an SD card
  */
 
-class SDCard
+class SDCard : public BlockDevice
 {
   public:
     /**
-     * @brief Constructs a new SDCard object
+     * @brief Types of the libspine SPI port (e.g., SPI1) and GPIO port (e.g., GPIO_D) constants
+     */
+    typedef decltype(SPI1) spi_port_t;
+    typedef decltype(GPIO_D) gpio_port_t;
+
+    /**
+     * @brief SPI port and Chip Select pin a card (slot) is wired to, the defaults are the single
+     * slot boards (SPI1, CS on PD3)
+     *
+     * @details CS is driven by writing the whole GPIO port, pins in cs_port_high_mask are kept
+     * high whether CS is asserted or not. Two slots with their CS on the same port each list the
+     * others CS pin there, so selecting one card never selects the other
+     */
+    struct SDCardSlot
+    {
+        spi_port_t spi_port = SPI1;
+
+        gpio_port_t cs_port = GPIO_D;
+
+        /**
+         * @brief CS pin of the card on cs_port, 1 << N for pin N
+         */
+        uint16_t cs_pin_mask = 0x1 << 3;
+
+        /**
+         * @brief Other outputs of cs_port that must stay high (e.g., the CS of another slot)
+         */
+        uint16_t cs_port_high_mask = 0x0;
+
+        /**
+         * @brief Configuration written to cs_port by the constructor, sets the CS pin (and any other
+         * pin in cs_port_high_mask) as an output, see gpio_set_config()
+         */
+        uint16_t cs_port_config = 0x03 << 8;
+    };
+
+    /**
+     * @brief Constructs a new SDCard object in the default slot (SPI1, CS on PD3)
      *
      * @param configure_spi1 configures SPI1 for you if true
      */
     SDCard(const bool &configure_spi1);
 
+    /**
+     * @brief Constructs a new SDCard object for a card in the given slot, e.g., the second slot of
+     * a board with two, each slot needs its own SDCard object
+     *
+     * @param configure_spi configures the SPI port of the slot for you if true
+     */
+    SDCard(const SDCardSlot &_slot, const bool &configure_spi);
+
     /**
      * @brief Destroys SDCard object
      */
     ~SDCard();
 
+    /**
+     * @brief Turns the cards CRC checking on or off (CMD59), it is off after initialize_sd_card().
+     *
+     * @details Commands always carry a valid CRC7. With CRC checking on every data block read is
+     * checked against its CRC16 (computed as the block comes off SPI) and every block written is
+     * sent with its CRC16 so the card checks it. A block that fails either way is read/ written
+     * again, up to NUM_CRC_RETRIES times. Checking costs two table look ups per byte
+     *
+     * @return true card accepted the command
+     * @return false no response, the mode is unchanged
+     */
+    bool set_crc_mode(const bool &enable);
+
+    bool get_crc_mode() const;
+
+    /**
+     * @brief Callback that sets the SPI clock (of the port of the slot) to the fastest rate the board can generate that is
+     * not above clock_khz, and returns the rate it chose in chosen_clock_khz. Setting an arbitrary
+     * SPI clock is board (system clock) specific so it is left to the application, this is the
+     * only place the driver changes the clock
+     *
+     * @return true clock was changed
+     * @return false clock could not be changed, it is left as it was
+     */
+    typedef bool (*spi_clock_callback_t)(const uint16_t &clock_khz, uint16_t &chosen_clock_khz, void *context);
+
+    /**
+     * @brief Clock initialize_sd_card() identifies the card at, cards are only guaranteed to
+     * respond to CMD0 - ACMD41 at up to 400 kHz
+     */
+    constexpr static uint16_t identification_clock_khz = 400U;
+
+    /**
+     * @brief Clock used when the CSD can not be read, every card supports the 25 MHz default speed
+     */
+    constexpr static uint16_t default_speed_clock_khz = 25000U;
+
+    /**
+     * @brief Sets the hook initialize_sd_card() uses to run identification at
+     * identification_clock_khz and then switch to the fastest clock the card supports (CSD
+     * TRAN_SPEED). Without one the clock set by the constructor is used throughout
+     */
+    void set_spi_clock_callback(spi_clock_callback_t _spi_clock_callback, void *_spi_clock_context);
+
+    /**
+     * @brief The one SPI setting libspine offers, SPI_set_config_optimal() for the system clock,
+     * as the context of optimal_spi_clock_callback()
+     */
+    struct OptimalSPIClock
+    {
+        sys_freq_t system_clock = _49_152_MHz;
+
+        spi_port_t spi_port = SPI1;
+
+        /**
+         * @brief Clock SPI_set_config_optimal(system_clock) runs the port at, a quarter of the
+         * 49.152 MHz system clock of the C3 Nio (set it for another board)
+         */
+        uint16_t spi_clock_khz = 12288U;
+    };
+
+    /**
+     * @brief spi_clock_callback_t for a board with no other SPI setting than
+     * SPI_set_config_optimal(), context is an OptimalSPIClock. A clock below its rate (e.g.,
+     * identification_clock_khz) can not be generated and is refused, the port is then left at
+     * the clock the constructor set, so only the switch to the data clock takes effect and
+     * SDCardInformation::spi_clock_khz reports it
+     */
+    static bool optimal_spi_clock_callback(const uint16_t &clock_khz, uint16_t &chosen_clock_khz, void *context);
+
     /**
      * @brief Enumerates the different results of the initialize_sd_card()
      * method. Intended to be informative as to the reason an SD cards
@@ -129,6 +249,111 @@ class SDCard
          * MSB is at index 0, LSB is at index 3.
          */
         uint16_t ocr_register_contents[4] = {0x0, 0x0, 0x0, 0x0};
+
+        /**
+         * @brief Contents of SD card CSD register, MSB is at index 0. All 0x0 if it could not be read
+         */
+        uint16_t csd_register_contents[16] = {0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0};
+
+        /**
+         * @brief Maximum data clock of the card decoded from CSD TRAN_SPEED (saturates at 65535 kHz)
+         */
+        uint16_t maximum_clock_khz = 0U;
+
+        /**
+         * @brief Data clock chosen by the clock callback, 0 if no callback is set (the clock
+         * configured by the constructor is used)
+         */
+        uint16_t spi_clock_khz = 0U;
+
+        /**
+         * @brief Allocation unit (AU) of the card in blocks, decoded from AU_SIZE of the SD Status
+         * (ACMD13), 16 KB - 64 MB. The card erases and programs flash an AU at a time, a write that
+         * starts part way into an AU can make it copy the rest of the AU. 0 if the card did not
+         * report one
+         */
+        Address32 allocation_unit_blocks;
+
+        // Timing, in bytes (SPI reads) at the data clock, measured by initialize_sd_card()
+        //==========================================================================================================
+        /**
+         * @brief Bytes read before the response of a command (Ncr), measured with CMD13
+         */
+        uint16_t command_response_bytes = 0U;
+
+        /**
+         * @brief Bytes read before the start block token of a read (Nac), measured with a read of block 0
+         */
+        uint16_t read_access_bytes = 0U;
+
+        /**
+         * @brief Longest the card has been seen busy programming a write since initialization
+         */
+        uint16_t longest_busy_bytes = 0U;
+
+        /**
+         * @brief 0xFF bytes sent before every read/ write command, a couple more than
+         * command_response_bytes (never more than the 20 sent before it is measured)
+         */
+        uint16_t command_preamble_bytes = 20U;
+
+        /**
+         * @brief Reads allowed before the start block token, 8 times read_access_bytes (never less
+         * than 1000) so a slow card gets time and a card that never answers times out cleanly
+         */
+        uint16_t start_block_token_read_limit = 1000U;
+
+        /**
+         * @brief NUM_BUSY_READS_PER_POLL polls a write may be busy for before the card is assumed
+         * to have failed, twice the write timeout of the card (250 ms, 500 ms for SDXC, less for
+         * an SDSC card with a short R2W_FACTOR x read access time) at the data clock. The fixed
+         * NUM_BUSY_POLLS_LIMIT until the card is initialized
+         */
+        uint16_t busy_poll_limit = 4096U;
+        //==========================================================================================================
+
+        /**
+         * @brief Blocks read/ written again because of a CRC error, see set_crc_mode()
+         */
+        uint16_t crc_retries = 0U;
+    };
+
+    /**
+     * @brief Hot path counters, only updated when compiled with SD_FS_STATISTICS (see Statistics.h)
+     */
+    struct SDCardStatistics
+    {
+        /**
+         * @brief Commands sent, retries included
+         */
+        Address32 cmd17_commands;
+        Address32 cmd18_commands;
+        Address32 cmd24_commands;
+        Address32 cmd25_commands;
+
+        /**
+         * @brief Bytes read while waiting for a start block token
+         */
+        Address32 token_polls;
+
+        /**
+         * @brief Bytes read while the card signalled busy
+         */
+        Address32 busy_spins;
+
+        /**
+         * @brief Waits for a response, start block token or the end of busy that gave up
+         */
+        Address32 timeouts;
+
+        /**
+         * @brief BlockDevice operations (read_block() ... write_contiguous_blocks()), the
+         * contiguous variants are counted with the callback ones
+         */
+        OperationStatistics single_block_reads;
+        OperationStatistics multiple_block_reads;
+        OperationStatistics single_block_writes;
+        OperationStatistics multiple_block_writes;
     };
 
     /**
@@ -147,6 +372,15 @@ class SDCard
      */
     SDCardInformation get_sd_card_information() const;
 
+    SDCardStatistics get_statistics() const;
+
+    void reset_statistics();
+
+    /**
+     * @brief Prints every statistics counter over XPD
+     */
+    void dump_statistics() const;
+
     /**
      * @brief Attmpets initialization of communication with SD card to put it in
      * a state such that its ready to receive commands
@@ -158,41 +392,212 @@ class SDCard
     /**
      * @brief Reads a block of the size selected by SET_BLOCKLEN command, note the data transferred
      * shall not cross a physical block boundary unless READ_BLK_MISALIGN is set in the CSD. block
-     * address is passed in Big Endian form where the MSB is at index 0 of block_address
+     * address is the block number (i.e., sector address), for SDSC cards it is converted to the
+     * byte address the card expects
      * 
      * NOTE: ASSUMES BLOCK LENGTH OF 512 bytes
      * 
      * TODO look into setting READ_BLK_MISALIGN!!!
+     *
+     * The block is read with the PackedSector overload and unpacked
      * 
      * @param block 
-     * @param block_address Array of w/ 32 bit a
+     * @param block_address sector address of block to read
      * @return sd_card_command_response_t 
      */
-    sd_card_command_response_t send_cmd17(uint16_t (&block)[512], const uint16_t (&block_address)[4]) const;
+    sd_card_command_response_t send_cmd17(uint16_t (&block)[512], const Address32 &block_address) const;
 
     /**
-     * @brief Writes a single block (512 bytes normally) to the SD card. block address is passed in Big Endian
-     * format where the MSB at index 0
+     * @brief Writes a single block (512 bytes normally) to the SD card. block address is the block number
+     * (i.e., sector address). The block is packed and written with the PackedSector overload
      * 
      * @param block 
      * @param block_address 
      * @return sd_card_command_response_t 
      */
-    sd_card_command_response_t send_cmd24(const uint16_t (&block)[512], const uint16_t (&block_address)[4]) const;
+    sd_card_command_response_t send_cmd24(const uint16_t (&block)[512], const Address32 &block_address) const;
+
+    /**
+     * @brief Same as send_cmd17() but the block is packed two bytes per uint16_t as it is read
+     * off SPI, so the buffer is 512 bytes rather than 1 KB
+     *
+     * @param sector returned contents of the block
+     * @param block_address sector address of block to read
+     * @return sd_card_command_response_t
+     */
+    sd_card_command_response_t send_cmd17(PackedSector &sector, const Address32 &block_address) const;
+
+    /**
+     * @brief Same as send_cmd24() but the block is unpacked from two bytes per uint16_t as it is
+     * written to SPI
+     *
+     * @param sector contents of the block
+     * @param block_address sector address of block to write
+     * @return sd_card_command_response_t
+     */
+    sd_card_command_response_t send_cmd24(const PackedSector &sector, const Address32 &block_address) const;
+
+    /**
+     * @brief Issue phase of a split write, same as send_cmd24() but returns as soon as the card has
+     * accepted the block rather than waiting the (1-250 ms) it takes to program it. CS is
+     * de-asserted while the card programs (it keeps programming without CS) so other SPI devices
+     * can use the bus. Use poll_write_completion()/ is_busy() to find out when programming has
+     * finished, any other command waits for it first
+     *
+     * @param sector contents of the block
+     * @param block_address sector address of block to write
+     * @return sd_card_command_response_t see send_cmd24()
+     */
+    sd_card_command_response_t issue_cmd24(const PackedSector &sector, const Address32 &block_address) const;
+
+    /**
+     * @brief Poll phase of a split write (issue_cmd24(), or the end of a multiple block write),
+     * reads the busy signal at most poll_budget times. CS is only asserted during the call
+     *
+     * @param poll_budget maximum number of SPI reads
+     * @return true card has finished programming (or no write was in progress)
+     * @return false card is still busy
+     */
+    bool poll_write_completion(const uint16_t &poll_budget) const;
+
+    /**
+     * @brief Checks with a single SPI read if the card is still programming a write
+     */
+    bool is_busy() const;
+
+    /**
+     * @brief Reads num_blocks contiguous blocks (512 bytes each) in a single transaction starting
+     * at block_address. Each block is read into the supplied block buffer and handed to
+     * block_callback before the next block is read, so only a single block of RAM is needed no
+     * matter how many blocks are read. The transfer is ended with CMD12 (STOP_TRANSMISSION).
+     * block address is the block number (i.e., sector address), blocks are packed two bytes
+     * per uint16_t as they are read
+     *
+     * NOTE: ASSUMES BLOCK LENGTH OF 512 bytes
+     *
+     * @param block working buffer that each block is read into before block_callback is called
+     * @param block_address address of first block to read
+     * @param num_blocks number of contiguous blocks to read
+     * @param block_callback called once per block received, can stop the transfer early
+     * @param context passed through to block_callback
+     * @return sd_card_command_response_t SD_CARD_RESPONSE_ACCEPTED if every requested block was
+     * received (or the callback stopped the transfer), SD_CARD_NO_RESPONSE otherwise
+     */
+    sd_card_command_response_t send_cmd18(PackedSector &block, const Address32 &block_address, const uint16_t &num_blocks,
+                                            block_read_callback_t block_callback, void *context) const;
+
+    /**
+     * @brief Same as send_cmd18() but every block is read straight into the next 256 words of
+     * words (packed two bytes per uint16_t), e.g., the callers own buffer, so no sector is copied
+     *
+     * @param words buffer of at least num_blocks * 256 words
+     * @param block_address address of first block to read
+     * @param num_blocks number of contiguous blocks to read
+     * @return sd_card_command_response_t SD_CARD_RESPONSE_ACCEPTED if every block was received,
+     * SD_CARD_NO_RESPONSE otherwise
+     */
+    sd_card_command_response_t send_cmd18(uint16_t *words, const Address32 &block_address, const uint16_t &num_blocks) const;
+
+    /**
+     * @brief Writes num_blocks contiguous blocks (512 bytes each) in a single transaction starting
+     * at block_address. Before the write ACMD23 (SET_WR_BLK_ERASE_COUNT) tells the card how many
+     * blocks are coming so it can pre-erase them. Each block is produced by block_callback into
+     * the supplied block buffer just before it is sent, so only a single block of RAM is needed no
+     * matter how many blocks are written. The transfer is ended with the stop tran token, the card
+     * is left programming the last block (see poll_write_completion()).
+     * block address is the block number (i.e., sector address), blocks are packed two bytes
+     * per uint16_t and unpacked as they are written
+     *
+     * NOTE: ASSUMES BLOCK LENGTH OF 512 bytes
+     *
+     * @param block working buffer that block_callback fills before each block is sent
+     * @param block_address address of first block to write
+     * @param num_blocks number of contiguous blocks to write (also the pre-erase count)
+     * @param block_callback called once per block to produce its data, can end the transfer early
+     * @param context passed through to block_callback
+     * @return sd_card_command_response_t SD_CARD_RESPONSE_ACCEPTED if every produced block was
+     * accepted, SD_CARD_DATA_REJECTED_CRC_ERROR/ SD_CARD_DATA_REJECTED_WRITE_ERROR if the card
+     * rejected a block and SD_CARD_NO_RESPONSE otherwise
+     */
+    sd_card_command_response_t send_cmd25(PackedSector &block, const Address32 &block_address, const uint16_t &num_blocks,
+                                            block_write_callback_t block_callback, void *context) const;
+
+    /**
+     * @brief Same as send_cmd25() but every block is written straight from the next 256 words of
+     * words (packed two bytes per uint16_t), e.g., the callers own buffer, so no sector is copied
+     *
+     * @param words buffer of at least num_blocks * 256 words
+     * @param block_address address of first block to write
+     * @param num_blocks number of contiguous blocks to write (also the pre-erase count)
+     * @return sd_card_command_response_t see send_cmd25()
+     */
+    sd_card_command_response_t send_cmd25(const uint16_t *words, const Address32 &block_address, const uint16_t &num_blocks) const;
+
+    /**
+     * @brief BlockDevice implementation, CMD17
+     */
+    bool read_block(PackedSector &block, const Address32 &block_address) override;
+
+    /**
+     * @brief BlockDevice implementation, CMD24 without waiting for the card to program the block
+     * (see issue_cmd24())
+     */
+    bool write_block(const PackedSector &block, const Address32 &block_address) override;
+
+    /**
+     * @brief BlockDevice implementation, CMD18
+     */
+    bool read_blocks(PackedSector &block, const Address32 &block_address, const uint16_t &num_blocks,
+                        block_read_callback_t block_callback, void *context) override;
+
+    /**
+     * @brief BlockDevice implementation, ACMD23 + CMD25
+     */
+    bool write_blocks(PackedSector &block, const Address32 &block_address, const uint16_t &num_blocks,
+                        block_write_callback_t block_callback, void *context) override;
+
+    /**
+     * @brief BlockDevice implementation, CMD18 straight into words
+     */
+    bool read_contiguous_blocks(uint16_t *words, const Address32 &block_address, const uint16_t &num_blocks) override;
+
+    /**
+     * @brief BlockDevice implementation, CMD25 straight from words
+     */
+    bool write_contiguous_blocks(const uint16_t *words, const Address32 &block_address, const uint16_t &num_blocks) override;
+
+    /**
+     * @brief BlockDevice implementation, waits for the card to finish programming the last write
+     */
+    bool flush() override;
+
+    /**
+     * @brief BlockDevice implementation, SDCardInformation::allocation_unit_blocks
+     */
+    Address32 get_allocation_unit_blocks() const override;
 
   private:
     /**
-     * @brief Chip Select (C3) inactive high for pin PD3, this disables 
-     * communication over SPI1 for the SD card. This magic number comes from 
-     * 0x1 << 3, where 3 is the pin number in PD3.
+     * @brief SPI port the card is on, see SDCardSlot
+     */
+    const spi_port_t spi_port;
+
+    /**
+     * @brief GPIO port the Chip Select pin of the card is on, see SDCardSlot
+     */
+    const gpio_port_t cs_port;
+
+    /**
+     * @brief Chip Select inactive high (e.g., 0x1 << 3 for pin PD3), this disables communication
+     * over SPI for the SD card. Written to cs_port with the pins of cs_port_high_mask
      */
-    const uint16_t CS_INACTIVE_HIGH = 0x8;
+    const uint16_t CS_INACTIVE_HIGH;
 
     /**
-     * @brief Chip Select (C3) active low for pin PD3, this enables 
-     * communication over SPI1 for the SD card.
+     * @brief Chip Select active low, this enables communication over SPI for the SD card. Only
+     * the pins of cs_port_high_mask are left high
      */
-    const uint16_t CS_ACTIVE_LOW = 0x0;
+    const uint16_t CS_ACTIVE_LOW;
 
     /**
      * @brief After issuing a command an SD card can take 0-8 bytes to respond, 
@@ -202,6 +607,37 @@ class SDCard
      */
     const uint16_t NUM_INVALID_RESPONSE_LIMIT_SPI_READ = 10U;
 
+    /**
+     * @brief After issuing a read command the SD card can take a (card dependant) number of
+     * bytes to send the start block token. If the token has not been received within this
+     * many reads the read is assumed to have failed. This is the limit until (and the least
+     * it is set to when) SDCardInformation::start_block_token_read_limit is measured
+     */
+    const uint16_t NUM_INVALID_READS_LIMIT_START_BLOCK_TOKEN = 1000U;
+
+    /**
+     * @brief Number of times a block that failed its CRC check is read/ written again
+     */
+    const uint16_t NUM_CRC_RETRIES = 3U;
+
+    /**
+     * @brief Upper bound of SDCardInformation::command_preamble_bytes
+     */
+    const uint16_t MAX_COMMAND_PREAMBLE_BYTES = 20U;
+
+    /**
+     * @brief Number of NUM_BUSY_READS_PER_POLL polls after which a card that is still busy is
+     * assumed to have failed (over 2M reads, far past the 250 ms a write may take) until
+     * SDCardInformation::busy_poll_limit is sized at initialization
+     */
+    const uint16_t NUM_BUSY_POLLS_LIMIT = 4096U;
+
+    /**
+     * @brief Number of busy signal reads per CS assertion when waiting for the card to finish
+     * programming, CS is released between polls so other SPI devices are not locked out
+     */
+    const uint16_t NUM_BUSY_READS_PER_POLL = 512U;
+
     /**
      * @brief Sends CMD0 to the SD card, after the command is sent it awaits a valid 
      * response for a resposne limit amount of reads. CMD0 or GO_IDLE_STATE resets the 
@@ -249,10 +685,176 @@ class SDCard
      * @brief Writes dummy bytes of 0xFF to the SPI line that the SD card is 
      * connected to. It was determined after experimentation that sending a 
      * few bytes of 0xFF before & after a command was necessary to ensure 
-     * bug free behaviour. 
+     * bug free behaviour. The number of bytes is
+     * SDCardInformation::command_preamble_bytes
      */
     void send_dummy_spi_bytes() const;
 
+    /**
+     * @brief Sends a 6 byte command, the command byte (0x40 | index), the 4 argument bytes (MSB at
+     * index 0) and the CRC7 computed over them. CS is expected to be asserted already.
+     */
+    void send_command(const uint16_t &command, const uint16_t (&command_argument)[4]) const;
+
+    /**
+     * @brief Reads the 512 data bytes and the CRC16 of a block that follow the start block token
+     * into 256 words. CS is expected to be asserted already.
+     *
+     * @return true block is valid (always without CRC checking)
+     * @return false CRC16 mismatch
+     */
+    bool read_data_block(uint16_t *words) const;
+
+    /**
+     * @brief Writes the 512 data bytes of a block (after the start block token has been sent) from
+     * 256 words followed by its CRC16 (0xFFFF without CRC checking). CS is expected to be asserted already.
+     */
+    void write_data_block(const uint16_t *words) const;
+
+    /**
+     * @brief read_packed_data_block() computing the CRC16 of the block as it is read
+     */
+    uint16_t read_packed_data_block_with_crc(uint16_t *words) const;
+
+    /**
+     * @brief write_packed_data_block() computing the CRC16 of the block as it is written
+     */
+    uint16_t write_packed_data_block_with_crc(const uint16_t *words) const;
+
+    /**
+     * @brief Converts a block number into the address argument of a read/ write command in Big
+     * Endian format (MSB at index 0). SDHC/ SDXC cards are block addressed, while SDSC cards are
+     * byte addressed so the block number is multiplied by the block length (512) for them.
+     *
+     * @param block_address block number (i.e., sector address)
+     * @param command_argument 4 byte command argument, MSB at index 0
+     */
+    void block_address_to_command_argument(const Address32 &block_address, uint16_t (&command_argument)[4]) const;
+
+    /**
+     * @brief Sends CMD12 (STOP_TRANSMISSION) to the SD card to end a multiple block transfer
+     * started by CMD18, then waits for the R1 response and for the card to stop signalling busy.
+     * CS is expected to be asserted already.
+     *
+     * @return sd_card_command_response_t SD cards response to the command
+     */
+    sd_card_command_response_t send_cmd12() const;
+
+    /**
+     * @brief Polls the SD card until the start block token (0xFE) that precedes a data block is
+     * read. CS is expected to be asserted already.
+     *
+     * @return true if the start block token was read, the next byte is the start of the block
+     * @return false if the card did not send the token within the invalid read limit
+     */
+    bool wait_for_start_block_token() const;
+
+    /**
+     * @brief Sends ACMD23 (SET_WR_BLK_ERASE_COUNT) to the SD card, this sets the number of
+     * blocks to be pre-erased before the next multiple block write (CMD25). CMD55 is sent
+     * first. CS is expected to be asserted already. Pre-erasing is only a hint to the card,
+     * the write still succeeds if fewer/ more blocks are written.
+     *
+     * @param num_blocks number of blocks to pre-erase
+     * @return sd_card_command_response_t SD cards response to the command
+     */
+    sd_card_command_response_t send_acmd23(const uint16_t &num_blocks) const;
+
+    /**
+     * @brief Reads the data response token the SD card sends after receiving a data block
+     * and decodes it. CS is expected to be asserted already.
+     *
+     * @return sd_card_command_response_t SD_CARD_RESPONSE_ACCEPTED, SD_CARD_DATA_REJECTED_CRC_ERROR,
+     * SD_CARD_DATA_REJECTED_WRITE_ERROR or SD_CARD_NO_RESPONSE if no token was received
+     */
+    sd_card_command_response_t read_data_response_token() const;
+
+    /**
+     * @brief Waits until the card has finished programming a write whose busy signal was not
+     * waited for (write_in_progress), asserts/ de-asserts CS itself. Every command that starts a
+     * transaction calls this first
+     *
+     * @return true card is ready
+     * @return false card was still busy after SDCardInformation::busy_poll_limit polls, it is no longer waited for
+     */
+    bool wait_until_ready() const;
+
+    /**
+     * @brief Sends CMD9 (SEND_CSD) and reads the 16 byte CSD register into
+     * sd_card_information.csd_register_contents. CS is asserted/ de-asserted here
+     *
+     * @return sd_card_command_response_t SD_CARD_RESPONSE_ACCEPTED if the register was read
+     */
+    sd_card_command_response_t send_cmd9();
+
+    /**
+     * @brief Sends ACMD13 (SD_STATUS), CMD55 is sent first, and decodes the allocation unit size
+     * of the 64 byte SD Status into sd_card_information.allocation_unit_blocks. CS is asserted/
+     * de-asserted here
+     *
+     * @return sd_card_command_response_t SD_CARD_RESPONSE_ACCEPTED if the SD Status was read
+     */
+    sd_card_command_response_t send_acmd13();
+
+    /**
+     * @brief Decodes the AU_SIZE field of the SD Status (4 bits) into blocks, 0 if it is not defined
+     */
+    static Address32 au_size_to_blocks(const uint16_t &au_size);
+
+    /**
+     * @brief Decodes the maximum data clock in kHz from the TRAN_SPEED byte of the CSD
+     * (bits 2-0 rate unit, bits 6-3 time value), saturating at 65535 kHz. 0 if it is invalid
+     */
+    static uint16_t tran_speed_to_khz(const uint16_t &tran_speed);
+
+    /**
+     * @brief Sets the SPI clock through the clock callback (if any), the chosen rate is stored in
+     * sd_card_information.spi_clock_khz
+     */
+    void set_spi_clock(const uint16_t clock_khz);
+
+    /**
+     * @brief Measures the command response (CMD13) and read access (CMD17 of block 0) latencies
+     * of a freshly initialized card and sizes the command preamble and start block token limit
+     * from them, see SDCardInformation. The defaults are kept if either command fails
+     */
+    void measure_card_timing();
+
+    /**
+     * @brief Sizes sd_card_information.busy_poll_limit from the write timeout of the card at the
+     * data clock (after measure_card_timing(), an SDSC card's timeout is derived from the measured
+     * read access time)
+     */
+    void size_busy_poll_limit();
+
+    /**
+     * @brief Shared implementation of both send_cmd18() variants. With a callback_block every block
+     * is read into callback_block (words is callback_block->words) and handed to block_callback,
+     * without one every block is read into the next 256 words of words.
+     */
+    sd_card_command_response_t read_multiple_blocks(uint16_t *words, PackedSector *callback_block, const Address32 &block_address,
+                                                    const uint16_t &num_blocks, block_read_callback_t block_callback, void *context) const;
+
+    /**
+     * @brief Reads the 512 data bytes of a block that follow the start block token into 256
+     * words, packing them two bytes per uint16_t. CS is expected to be asserted already.
+     */
+    void read_packed_data_block(uint16_t *words) const;
+
+    /**
+     * @brief Shared implementation of both send_cmd25() variants. With a callback_block every block
+     * is produced into callback_block (words is callback_block->words) by block_callback, without
+     * one every block is written from the next 256 words of words.
+     */
+    sd_card_command_response_t write_multiple_blocks(const uint16_t *words, PackedSector *callback_block, const Address32 &block_address,
+                                                        const uint16_t &num_blocks, block_write_callback_t block_callback, void *context) const;
+
+    /**
+     * @brief Writes the 512 data bytes of a block (after the start block token has been sent) from
+     * 256 words, unpacking them from two bytes per uint16_t. CS is expected to be asserted already.
+     */
+    void write_packed_data_block(const uint16_t *words) const;
+
     /**
      * @brief Stores the result of the initialize_sd_card() method, initial
      * value before method is called is INIT_RESULT_NA indicating the result is
@@ -267,6 +869,35 @@ class SDCard
      */
     SDCardInformation sd_card_information;
 
+    /**
+     * @brief Set when a write has been accepted but the card was left programming it (with CS
+     * de-asserted), cleared once its busy signal is released. Mutable as the command methods are
+     * const
+     */
+    mutable bool write_in_progress = false;
+
+    /**
+     * @brief Set by set_crc_mode()
+     */
+    bool crc_mode = false;
+
+    /**
+     * @brief Reported as SDCardInformation::crc_retries
+     */
+    mutable uint16_t crc_retries = 0U;
+
+    spi_clock_callback_t spi_clock_callback = nullptr;
+
+    void *spi_clock_context = nullptr;
+
+    /**
+     * @brief Busy reads of the write in progress so far, and the longest of any write (reported
+     * as SDCardInformation::longest_busy_bytes)
+     */
+    mutable uint16_t busy_bytes_of_write = 0U;
+    mutable uint16_t longest_busy_bytes = 0U;
+
+    mutable SDCardStatistics statistics;
 };
 } // namespace sd_driver
 
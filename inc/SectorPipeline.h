@@ -0,0 +1,186 @@
+/**
+ * @file SectorPipeline.h
+ * @author Mattheas Jamieson (mattheas@ualberta.ca)
+ * @brief Declaration of double buffered (ping-pong) sector write pipeline
+ * @version 0.1
+ * @date 2024-03-03
+ */
+
+#ifndef _SECTORPIPELINE_H_
+#define _SECTORPIPELINE_H_
+
+#include "../inc/AsyncBlockDevice.h"
+
+namespace sd_driver
+{
+
+/**
+ * @brief BlockDevice that copies every block written to it into one of N sector buffers and
+ * hands it to an AsyncBlockDevice, so the caller can fill sector N + 1 while sector N is sent to
+ * the card and programmed. With two buffers this is a ping-pong buffer, more buffers absorb
+ * longer card busy times.
+ *
+ * @details Typically placed between a FileSystem and the AsyncBlockDevice that owns the SD card,
+ * every block the file system writes (file data from append(), FAT and directory sectors) then
+ * goes through the pipeline. Requests are carried out in the order they are made so a read
+ * always sees earlier writes, reads wait for the data (read_blocks() keeps up to N reads queued
+ * ahead of the callback). A write only waits when the buffer it needs is still being written,
+ * which is counted as a producer stall (backpressure, the card can not keep up). Write errors are
+ * reported by the next flush(). With _poll_io_worker set the pipeline calls
+ * AsyncBlockDevice::poll() itself while it waits, for single threaded applications.
+ */
+class SectorPipeline : public BlockDevice
+{
+  public:
+    struct PipelineSector
+    {
+        PackedSector data;
+
+        BlockRequest request;
+    };
+
+    struct PipelineStatistics
+    {
+        /**
+         * @brief Blocks handed to the I/O worker to be written
+         */
+        Address32 blocks_written;
+
+        /**
+         * @brief Writes that had to wait for a sector buffer still being written (or a full queue)
+         */
+        Address32 producer_stalls;
+
+        /**
+         * @brief Number of times an unfinished request was polled while stalled, a rough measure of
+         * the time the producer lost
+         */
+        Address32 stall_polls;
+
+        /**
+         * @brief Writes the device reported as failed
+         */
+        Address32 failed_writes;
+
+        /**
+         * @brief Most requests queued at the I/O worker at once
+         */
+        uint16_t max_requests_in_flight = 0U;
+    };
+
+    /**
+     * @brief Constructs a new SectorPipeline object
+     *
+     * @param _io_worker worker that owns the device the blocks are written to
+     * @param _sectors sector buffers, must outlive the pipeline
+     * @param _number_of_sectors number of elements in _sectors (2 for ping-pong buffering)
+     * @param _poll_io_worker call _io_worker.poll() while waiting, set if nothing else runs the worker
+     */
+    SectorPipeline(AsyncBlockDevice &_io_worker, PipelineSector *_sectors, const uint16_t _number_of_sectors,
+                    const bool &_poll_io_worker);
+
+    ~SectorPipeline();
+
+    bool read_block(PackedSector &block, const Address32 &block_address) override;
+
+    /**
+     * @brief Queued once the block has been copied to a sector buffer, see flush()
+     */
+    bool write_block(const PackedSector &block, const Address32 &block_address) override;
+
+    bool read_blocks(PackedSector &block, const Address32 &block_address, const uint16_t &num_blocks,
+                        block_read_callback_t block_callback, void *context) override;
+
+    /**
+     * @brief block_callback fills the sector buffers directly, each block is queued as soon as it
+     * has been produced. block is not used
+     */
+    bool write_blocks(PackedSector &block, const Address32 &block_address, const uint16_t &num_blocks,
+                        block_write_callback_t block_callback, void *context) override;
+
+    bool read_contiguous_blocks(uint16_t *words, const Address32 &block_address, const uint16_t &num_blocks) override;
+
+    /**
+     * @brief Every block is copied to a sector buffer and queued, words can be reused on return
+     */
+    bool write_contiguous_blocks(const uint16_t *words, const Address32 &block_address, const uint16_t &num_blocks) override;
+
+    /**
+     * @brief Waits for every queued write to complete
+     *
+     * @return true every write since the last flush() succeeded
+     * @return false a write failed
+     */
+    bool flush() override;
+
+    /**
+     * @brief Allocation unit of the device behind the I/O worker
+     */
+    Address32 get_allocation_unit_blocks() const override;
+
+    /**
+     * @brief Number of sector buffers that are waiting to be/ being written
+     */
+    uint16_t get_sectors_in_flight() const;
+
+    PipelineStatistics get_statistics() const;
+
+    void reset_statistics();
+
+  private:
+    /**
+     * @brief Returns the next sector buffer in turn, once the request that used it last has
+     * completed (a failed write is recorded)
+     */
+    PipelineSector &acquire_sector();
+
+    /**
+     * @brief Waits for request to complete, polling the worker if _poll_io_worker was set
+     *
+     * @param stalled count the polls as PipelineStatistics::stall_polls
+     */
+    void wait_for(const BlockRequest &request, const bool &stalled);
+
+    /**
+     * @brief Records a failed write of a sector buffer whose request has completed (once)
+     */
+    void check_write_result(PipelineSector &sector);
+
+    /**
+     * @brief Queues request at the worker, waiting while its queue is full
+     */
+    void submit(BlockRequest &request);
+
+    /**
+     * @brief Queues a write of the sector buffer to block_address
+     */
+    void submit_write(PipelineSector &sector, const Address32 &block_address);
+
+    AsyncBlockDevice &io_worker;
+
+    PipelineSector *sectors;
+
+    const uint16_t number_of_sectors;
+
+    const bool poll_io_worker;
+
+    /**
+     * @brief Index of the sector buffer acquire_sector() returns next
+     */
+    uint16_t next_sector = 0U;
+
+    /**
+     * @brief Used by the reads that go straight to the callers buffer
+     */
+    BlockRequest read_request;
+
+    /**
+     * @brief Set when a write failed, cleared by flush()
+     */
+    bool write_failed = false;
+
+    PipelineStatistics statistics;
+};
+} // namespace sd_driver
+
+#endif // _SECTORPIPELINE_H_
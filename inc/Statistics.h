@@ -0,0 +1,113 @@
+/**
+ * @file Statistics.h
+ * @author Mattheas Jamieson (mattheas@ualberta.ca)
+ * @brief Declaration of compile time optional hot path statistics (counters and operation timing)
+ * @version 0.1
+ * @date 2024-03-03
+ */
+
+#ifndef _STATISTICS_H_
+#define _STATISTICS_H_
+
+#include "../inc/Address32.h"
+
+/*
+    The statistics counters of SDCard, FATCache and FileSystem are only updated when the firmware
+    is compiled with SD_FS_STATISTICS defined (the SD_FS_STATISTICS CMake option), otherwise every
+    STATISTICS_* macro expands to nothing so the hot paths cost exactly what they did before. The
+    statistics structs and their accessors always exist, without SD_FS_STATISTICS they stay zero.
+*/
+#ifdef SD_FS_STATISTICS
+#define STATISTICS_COUNT(counter) ((counter) += sd_driver::Address32(0x0, 0x1))
+#define STATISTICS_ADD(counter, amount) ((counter) += sd_driver::Address32(0x0, (amount)))
+#define STATISTICS_TIME_OPERATION(operation) const sd_driver::ScopedOperationTimer operation_timer(operation)
+#else
+#define STATISTICS_COUNT(counter) ((void)0)
+#define STATISTICS_ADD(counter, amount) ((void)0)
+#define STATISTICS_TIME_OPERATION(operation) ((void)0)
+#endif
+
+namespace sd_driver
+{
+
+/**
+ * @brief Set when the firmware was compiled with SD_FS_STATISTICS
+ */
+#ifdef SD_FS_STATISTICS
+constexpr bool statistics_enabled = true;
+#else
+constexpr bool statistics_enabled = false;
+#endif
+
+/**
+ * @brief Number of times an operation was carried out and the sum of the ticks each took
+ */
+struct OperationStatistics
+{
+    Address32 count;
+
+    Address32 ticks;
+
+    /**
+     * @brief Adds one operation that started at start_ticks (a StatisticsClock::read_ticks() value)
+     */
+    void record(const uint16_t &start_ticks);
+};
+
+/**
+ * @brief Source of the ticks operations are timed with
+ *
+ * @details libspine does not expose a free running counter of the system clock, so the
+ * application hands in a function that returns one (e.g., reading a hardware timer run from
+ * sys_clock). Only the difference between two reads is used, so the counter may wrap as long as
+ * no single operation takes 65536 ticks or more. Without a tick source every operation takes 0 ticks
+ * and only the counts are kept.
+ */
+class StatisticsClock
+{
+  public:
+    typedef uint16_t (*tick_source_t)();
+
+    /**
+     * @brief Sets the tick source shared by every statistics block (nullptr for none)
+     */
+    static void set_tick_source(tick_source_t _tick_source);
+
+    static uint16_t read_ticks();
+
+  private:
+    static tick_source_t tick_source;
+};
+
+/**
+ * @brief Records the time from its construction to its destruction in an OperationStatistics,
+ * so every return path of a timed function is covered. Used through STATISTICS_TIME_OPERATION()
+ */
+class ScopedOperationTimer
+{
+  public:
+    ScopedOperationTimer(OperationStatistics &_operation) : operation(_operation), start_ticks(StatisticsClock::read_ticks()) {}
+
+    ~ScopedOperationTimer()
+    {
+        operation.record(start_ticks);
+    }
+
+  private:
+    OperationStatistics &operation;
+
+    const uint16_t start_ticks;
+};
+
+/**
+ * @brief Prints "name: 0xXXXXXXXX\n" over XPD
+ */
+void xpd_echo_statistic(const char *name, const Address32 &value);
+
+/**
+ * @brief Prints "name: count 0xXXXXXXXX ticks 0xXXXXXXXX\n" over XPD
+ */
+void xpd_echo_operation_statistics(const char *name, const OperationStatistics &operation);
+} // namespace sd_driver
+
+#endif // _STATISTICS_H_
@@ -0,0 +1,164 @@
+/**
+ * @file AsyncBlockDevice.cpp
+ * @author Mattheas Jamieson (mattheas@ualberta.ca)
+ * @brief Implementation of asynchronous block request queue/ I/O worker
+ * @version 0.1
+ * @date 2024-03-03
+ */
+
+#include "../inc/AsyncBlockDevice.h"
+
+using namespace sd_driver;
+
+namespace
+{
+/**
+ * @brief Keeps the compiler from moving memory accesses across this point (it emits no
+ * instruction), the request fields are plain memory and are handed between threads by the
+ * volatile head/ tail stores that follow
+ */
+inline void compiler_barrier()
+{
+    __asm__ __volatile__("" ::: "memory");
+}
+} // namespace
+
+AsyncBlockDevice::AsyncBlockDevice(BlockDevice &_block_device) : block_device(_block_device)
+{
+    for (uint16_t i = 0; i < queue_length; i++)
+    {
+        queue[i] = nullptr;
+    }
+}
+
+AsyncBlockDevice::~AsyncBlockDevice()
+{
+}
+
+bool AsyncBlockDevice::submit(BlockRequest &request)
+{
+    if (is_full() || request.num_blocks == 0U)
+    {
+        return false;
+    }
+
+    request.status = block_request_status_t::PENDING;
+
+    // the request and the slot must be filled before head is advanced, the owning thread only reads
+    // slots below head
+    const uint16_t current_head = head;
+    queue[current_head & queue_index_mask] = &request;
+    compiler_barrier();
+    head = current_head + 1U;
+
+    return true;
+}
+
+bool AsyncBlockDevice::submit_read(BlockRequest &request, uint16_t *words, const Address32 &block_address, const uint16_t &num_blocks)
+{
+    if (is_full())
+    {
+        return false;
+    }
+
+    request.type = block_request_type_t::READ;
+    request.read_words = words;
+    request.write_words = nullptr;
+    request.block_address = block_address;
+    request.num_blocks = num_blocks;
+
+    return submit(request);
+}
+
+bool AsyncBlockDevice::submit_write(BlockRequest &request, const uint16_t *words, const Address32 &block_address, const uint16_t &num_blocks)
+{
+    if (is_full())
+    {
+        return false;
+    }
+
+    request.type = block_request_type_t::WRITE;
+    request.read_words = nullptr;
+    request.write_words = words;
+    request.block_address = block_address;
+    request.num_blocks = num_blocks;
+
+    return submit(request);
+}
+
+bool AsyncBlockDevice::wait(const BlockRequest &request) const
+{
+    while (request.status == block_request_status_t::PENDING)
+    {
+        continue;
+    }
+
+    return request.status == block_request_status_t::DONE;
+}
+
+bool AsyncBlockDevice::poll()
+{
+    const uint16_t current_tail = tail;
+
+    if (current_tail == head)
+    {
+        return false;
+    }
+
+    BlockRequest &request = *queue[current_tail & queue_index_mask];
+
+    bool request_succeeded = false;
+    if (request.type == block_request_type_t::READ)
+    {
+        request_succeeded = block_device.read_contiguous_blocks(request.read_words, request.block_address, request.num_blocks);
+    }
+    else
+    {
+        request_succeeded = block_device.write_contiguous_blocks(request.write_words, request.block_address, request.num_blocks);
+    }
+
+    // the producer may reuse (and resubmit) the request as soon as it sees the status change, so
+    // the callback gets a copy taken before the slot is released and the status is published
+    BlockRequest completed_request = request;
+    completed_request.status = request_succeeded ? block_request_status_t::DONE : block_request_status_t::FAILED;
+    compiler_barrier();
+
+    tail = current_tail + 1U;
+
+    request.status = completed_request.status;
+
+    if (completed_request.completed_callback != nullptr)
+    {
+        completed_request.completed_callback(completed_request, completed_request.context);
+    }
+
+    return true;
+}
+
+void AsyncBlockDevice::run()
+{
+    while (true)
+    {
+        poll();
+    }
+}
+
+uint16_t AsyncBlockDevice::get_number_of_pending_requests() const
+{
+    return head - tail;
+}
+
+bool AsyncBlockDevice::is_full() const
+{
+    return get_number_of_pending_requests() >= queue_length;
+}
+
+bool AsyncBlockDevice::is_idle() const
+{
+    return head == tail;
+}
+
+Address32 AsyncBlockDevice::get_allocation_unit_blocks() const
+{
+    return block_device.get_allocation_unit_blocks();
+}
@@ -0,0 +1,470 @@
+/**
+ * @file BlockCache.cpp
+ * @author Mattheas Jamieson (mattheas@ualberta.ca)
+ * @brief Implementation of block (sector) cache
+ * @version 0.1
+ * @date 2024-03-03
+ */
+
+#include "../inc/BlockCache.h"
+
+using namespace sd_driver;
+
+BlockCache::BlockPool::BlockPool(CachedBlock *_cached_blocks, const uint16_t _number_of_cached_blocks)
+    : cached_blocks(_cached_blocks), number_of_cached_blocks(_number_of_cached_blocks)
+{
+    for (uint16_t i = 0; i < number_of_cached_blocks; i++)
+    {
+        cached_blocks[i].valid = false;
+        cached_blocks[i].pinned = false;
+        cached_blocks[i].referenced = false;
+        cached_blocks[i].owner = nullptr;
+    }
+}
+
+BlockCache::BlockCache(BlockDevice &_block_device, CachedBlock *_cached_blocks, const uint16_t _number_of_cached_blocks)
+    : block_device(_block_device), own_pool(_cached_blocks, _number_of_cached_blocks), block_pool(own_pool),
+    quota(_number_of_cached_blocks)
+{
+}
+
+BlockCache::BlockCache(BlockDevice &_block_device, BlockPool &_block_pool, const uint16_t _quota)
+    : block_device(_block_device), own_pool(nullptr, 0U), block_pool(_block_pool),
+    quota((_quota == 0U || _quota > _block_pool.number_of_cached_blocks) ? _block_pool.number_of_cached_blocks : _quota)
+{
+}
+
+BlockCache::~BlockCache()
+{
+    invalidate();
+}
+
+bool BlockCache::read_block(PackedSector &block, const Address32 &block_address)
+{
+    CachedBlock *cached_block = find(block_address);
+
+    if (cached_block != nullptr)
+    {
+        // cache hit, no device transaction needed
+        statistics.hits += Address32(0x0, 0x1);
+        cached_block->referenced = true;
+        block = cached_block->data;
+        return true;
+    }
+
+    statistics.misses += Address32(0x0, 0x1);
+
+    if (block_device.read_block(block, block_address) == false)
+    {
+        return false;
+    }
+
+    insert(block, block_address);
+    return true;
+}
+
+bool BlockCache::write_block(const PackedSector &block, const Address32 &block_address)
+{
+    if (block_device.write_block(block, block_address) == false)
+    {
+        invalidate(block_address);
+        return false;
+    }
+
+    // write-through, keep the cached copy (if any) identical to the device
+    CachedBlock *cached_block = find(block_address);
+    if (cached_block != nullptr)
+    {
+        cached_block->data = block;
+    }
+
+    return true;
+}
+
+bool BlockCache::read_blocks(PackedSector &block, const Address32 &block_address, const uint16_t &num_blocks,
+                                block_read_callback_t block_callback, void *context)
+{
+    uint16_t block_index = 0U;
+
+    while (block_index < num_blocks)
+    {
+        const Address32 current_block_address = block_address + Address32(0x0, block_index);
+        CachedBlock *cached_block = find(current_block_address);
+
+        if (cached_block != nullptr)
+        {
+            statistics.hits += Address32(0x0, 0x1);
+            cached_block->referenced = true;
+            block = cached_block->data;
+
+            if (block_callback(block, block_index, context) == false)
+            {
+                return true;
+            }
+
+            block_index++;
+            continue;
+        }
+
+        // find how many consecutive blocks are not cached so they can be read in one transfer
+        uint16_t run_length = 1U;
+        while (block_index + run_length < num_blocks &&
+                find(block_address + Address32(0x0, block_index + run_length)) == nullptr)
+        {
+            run_length++;
+        }
+
+        if (run_length == 1U)
+        {
+            // a single block read avoids the stop transmission overhead of a multi block read
+            statistics.misses += Address32(0x0, 0x1);
+
+            if (block_device.read_block(block, current_block_address) == false)
+            {
+                return false;
+            }
+
+            insert(block, current_block_address);
+
+            if (block_callback(block, block_index, context) == false)
+            {
+                return true;
+            }
+        }
+        else
+        {
+            ReadThroughContext read_context;
+            read_context.block_cache = this;
+            read_context.first_block_address = current_block_address;
+            read_context.first_block_index = block_index;
+            read_context.block_callback = block_callback;
+            read_context.context = context;
+
+            if (block_device.read_blocks(block, current_block_address, run_length, read_through_callback, &read_context) == false)
+            {
+                return false;
+            }
+
+            if (read_context.stopped)
+            {
+                return true;
+            }
+        }
+
+        block_index += run_length;
+    }
+
+    return true;
+}
+
+bool BlockCache::write_blocks(PackedSector &block, const Address32 &block_address, const uint16_t &num_blocks,
+                                block_write_callback_t block_callback, void *context)
+{
+    WriteThroughContext write_context;
+    write_context.block_cache = this;
+    write_context.first_block_address = block_address;
+    write_context.block_callback = block_callback;
+    write_context.context = context;
+
+    if (block_device.write_blocks(block, block_address, num_blocks, write_through_callback, &write_context) == false)
+    {
+        // unknown how many blocks made it to the device, drop every cached block in the range
+        for (uint16_t i = 0; i < num_blocks; i++)
+        {
+            invalidate(block_address + Address32(0x0, i));
+        }
+        return false;
+    }
+
+    return true;
+}
+
+bool BlockCache::read_contiguous_blocks(uint16_t *words, const Address32 &block_address, const uint16_t &num_blocks)
+{
+    uint16_t block_index = 0U;
+
+    while (block_index < num_blocks)
+    {
+        uint16_t *block_words = words + (block_index << 8);
+        const CachedBlock *cached_block = find(block_address + Address32(0x0, block_index));
+
+        if (cached_block != nullptr)
+        {
+            statistics.hits += Address32(0x0, 0x1);
+
+            for (uint16_t i = 0; i < PackedSector::words_per_sector; i++)
+            {
+                block_words[i] = cached_block->data.words[i];
+            }
+
+            block_index++;
+            continue;
+        }
+
+        // find how many consecutive blocks are not cached so they can be read in one transfer
+        uint16_t run_length = 1U;
+        while (block_index + run_length < num_blocks &&
+                find(block_address + Address32(0x0, block_index + run_length)) == nullptr)
+        {
+            run_length++;
+        }
+
+        statistics.misses += Address32(0x0, run_length);
+
+        if (block_device.read_contiguous_blocks(block_words, block_address + Address32(0x0, block_index), run_length) == false)
+        {
+            return false;
+        }
+
+        block_index += run_length;
+    }
+
+    return true;
+}
+
+bool BlockCache::write_contiguous_blocks(const uint16_t *words, const Address32 &block_address, const uint16_t &num_blocks)
+{
+    const bool blocks_written = block_device.write_contiguous_blocks(words, block_address, num_blocks);
+
+    for (uint16_t block_index = 0; block_index < num_blocks; block_index++)
+    {
+        CachedBlock *cached_block = find(block_address + Address32(0x0, block_index));
+
+        if (cached_block == nullptr)
+        {
+            continue;
+        }
+
+        if (blocks_written == false)
+        {
+            // unknown how many blocks made it to the device
+            invalidate(cached_block->block_address);
+            continue;
+        }
+
+        const uint16_t *block_words = words + (block_index << 8);
+        for (uint16_t i = 0; i < PackedSector::words_per_sector; i++)
+        {
+            cached_block->data.words[i] = block_words[i];
+        }
+    }
+
+    return blocks_written;
+}
+
+bool BlockCache::flush()
+{
+    return block_device.flush();
+}
+
+Address32 BlockCache::get_allocation_unit_blocks() const
+{
+    return block_device.get_allocation_unit_blocks();
+}
+
+bool BlockCache::pin(const Address32 &block_address)
+{
+    CachedBlock *cached_block = find(block_address);
+
+    if (cached_block == nullptr)
+    {
+        statistics.misses += Address32(0x0, 0x1);
+
+        // read straight into the replaced slot rather than through another sector buffer
+        cached_block = select_replacement();
+        if (cached_block == nullptr)
+        {
+            return false;
+        }
+
+        if (block_device.read_block(cached_block->data, block_address) == false)
+        {
+            return false;
+        }
+
+        claim(*cached_block, block_address);
+    }
+
+    cached_block->pinned = true;
+    return true;
+}
+
+void BlockCache::unpin(const Address32 &block_address)
+{
+    CachedBlock *cached_block = find(block_address);
+
+    if (cached_block != nullptr)
+    {
+        cached_block->pinned = false;
+    }
+}
+
+void BlockCache::invalidate()
+{
+    for (uint16_t i = 0; i < block_pool.number_of_cached_blocks; i++)
+    {
+        if (block_pool.cached_blocks[i].valid && block_pool.cached_blocks[i].owner == this)
+        {
+            release(block_pool.cached_blocks[i]);
+        }
+    }
+}
+
+uint16_t BlockCache::get_number_of_cached_blocks() const
+{
+    return blocks_held;
+}
+
+BlockCache::BlockCacheStatistics BlockCache::get_statistics() const
+{
+    return statistics;
+}
+
+void BlockCache::reset_statistics()
+{
+    statistics.hits = Address32();
+    statistics.misses = Address32();
+}
+
+bool BlockCache::read_through_callback(const PackedSector &block, const uint16_t &block_index, void *context)
+{
+    ReadThroughContext *read_context = static_cast<ReadThroughContext *>(context);
+    BlockCache *block_cache = read_context->block_cache;
+
+    block_cache->statistics.misses += Address32(0x0, 0x1);
+    block_cache->insert(block, read_context->first_block_address + Address32(0x0, block_index));
+
+    // the block index the caller sees is relative to the start of its request, not this run
+    if (read_context->block_callback(block, read_context->first_block_index + block_index, read_context->context) == false)
+    {
+        read_context->stopped = true;
+        return false;
+    }
+
+    return true;
+}
+
+bool BlockCache::write_through_callback(PackedSector &block, const uint16_t &block_index, void *context)
+{
+    WriteThroughContext *write_context = static_cast<WriteThroughContext *>(context);
+
+    if (write_context->block_callback(block, block_index, write_context->context) == false)
+    {
+        return false;
+    }
+
+    CachedBlock *cached_block = write_context->block_cache->find(write_context->first_block_address + Address32(0x0, block_index));
+    if (cached_block != nullptr)
+    {
+        cached_block->data = block;
+    }
+
+    return true;
+}
+
+BlockCache::CachedBlock *BlockCache::find(const Address32 &block_address)
+{
+    // other caches on the pool may hold the same block address of a different device
+    for (uint16_t i = 0; i < block_pool.number_of_cached_blocks; i++)
+    {
+        CachedBlock &cached_block = block_pool.cached_blocks[i];
+
+        if (cached_block.valid && cached_block.owner == this && cached_block.block_address == block_address)
+        {
+            return &cached_block;
+        }
+    }
+
+    return nullptr;
+}
+
+BlockCache::CachedBlock *BlockCache::insert(const PackedSector &block, const Address32 &block_address)
+{
+    CachedBlock *replacement = select_replacement();
+
+    if (replacement == nullptr)
+    {
+        // every slot is pinned, the block is simply not cached
+        return nullptr;
+    }
+
+    replacement->data = block;
+    claim(*replacement, block_address);
+    return replacement;
+}
+
+BlockCache::CachedBlock *BlockCache::select_replacement()
+{
+    // at its quota the cache can only replace one of its own blocks
+    const bool at_quota = (blocks_held >= quota);
+
+    // two sweeps of the clock hand are enough, the first clears every referenced bit it passes
+    for (uint16_t step = 0; step < (block_pool.number_of_cached_blocks << 1); step++)
+    {
+        CachedBlock &candidate = block_pool.cached_blocks[block_pool.clock_hand];
+
+        block_pool.clock_hand++;
+        if (block_pool.clock_hand >= block_pool.number_of_cached_blocks)
+        {
+            block_pool.clock_hand = 0U;
+        }
+
+        if (candidate.valid && at_quota && candidate.owner != this)
+        {
+            continue;
+        }
+
+        if (candidate.valid && candidate.pinned)
+        {
+            continue;
+        }
+
+        if (candidate.valid && candidate.referenced)
+        {
+            // second chance
+            candidate.referenced = false;
+            continue;
+        }
+
+        if (candidate.valid)
+        {
+            release(candidate);
+        }
+        return &candidate;
+    }
+
+    return nullptr;
+}
+
+void BlockCache::invalidate(const Address32 &block_address)
+{
+    CachedBlock *cached_block = find(block_address);
+
+    if (cached_block != nullptr)
+    {
+        release(*cached_block);
+    }
+}
+
+void BlockCache::release(CachedBlock &cached_block)
+{
+    if (cached_block.valid && cached_block.owner != nullptr)
+    {
+        cached_block.owner->blocks_held--;
+    }
+
+    cached_block.valid = false;
+    cached_block.pinned = false;
+    cached_block.referenced = false;
+    cached_block.owner = nullptr;
+}
+
+void BlockCache::claim(CachedBlock &cached_block, const Address32 &block_address)
+{
+    cached_block.valid = true;
+    cached_block.pinned = false;
+    cached_block.referenced = false;
+    cached_block.owner = this;
+    cached_block.block_address = block_address;
+    blocks_held++;
+}
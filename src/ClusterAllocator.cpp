@@ -0,0 +1,581 @@
+/**
+ * @file ClusterAllocator.cpp
+ * @author Mattheas Jamieson (mattheas@ualberta.ca)
+ * @brief Implementation of FAT32 free cluster allocator
+ * @version 0.1
+ * @date 2024-03-03
+ */
+
+#include "../inc/ClusterAllocator.h"
+
+using namespace file_system;
+
+ClusterAllocator::ClusterAllocator(FATCache &_fat_cache) : fat_cache(_fat_cache), free_cluster_count(unknown_count()),
+    next_free_cluster(Address32(0x0, 0x2))
+{
+    fat_cache.set_sector_loaded_callback(sector_loaded_callback, this);
+}
+
+ClusterAllocator::~ClusterAllocator()
+{
+    fat_cache.set_sector_loaded_callback(nullptr, nullptr);
+}
+
+void ClusterAllocator::configure(const Address32 &_number_of_clusters, const Address32 &_free_cluster_count, const Address32 &_next_free_cluster)
+{
+    number_of_clusters = _number_of_clusters;
+
+    // FSInfo is only a hint, values that can not be right are treated as unknown
+    free_cluster_count = (_free_cluster_count <= number_of_clusters) ? _free_cluster_count : unknown_count();
+
+    const Address32 end_cluster = number_of_clusters + Address32(0x0, 0x2);
+    next_free_cluster = (_next_free_cluster >= Address32(0x0, 0x2) && _next_free_cluster < end_cluster) ?
+                            _next_free_cluster : Address32(0x0, 0x2);
+
+    number_of_free_extents = 0U;
+    aligned_runs_exhausted = false;
+}
+
+void ClusterAllocator::set_allocation_unit(const Address32 &_clusters_per_allocation_unit, const Address32 &_first_aligned_cluster)
+{
+    // with a single cluster per AU every run starts at an AU anyway
+    clusters_per_allocation_unit = (_clusters_per_allocation_unit > Address32(0x0, 0x1)) ? _clusters_per_allocation_unit : Address32();
+    first_aligned_cluster = _first_aligned_cluster;
+    aligned_runs_exhausted = false;
+}
+
+bool ClusterAllocator::allocate(const Address32 &preferred_cluster, const Address32 &max_clusters, const bool &whole_run,
+                                Address32 &first_cluster, Address32 &allocated_clusters, const bool &align_to_allocation_unit)
+{
+    if (max_clusters.is_zero())
+    {
+        return false;
+    }
+
+    const Address32 end_cluster = number_of_clusters + Address32(0x0, 0x2);
+    const Address32 scan_start_cluster = (preferred_cluster >= Address32(0x0, 0x2) && preferred_cluster < end_cluster) ?
+                                            preferred_cluster : next_free_cluster;
+
+    bool aligned = align_to_allocation_unit && !clusters_per_allocation_unit.is_zero() && aligned_runs_exhausted == false;
+
+    // every stale extent that is picked is removed from the summary, so this ends with a scan at the latest
+    for (uint16_t attempt = 0; attempt <= free_extents_summarized; attempt++)
+    {
+        Address32 run_first_cluster;
+        Address32 run_length;
+
+        // the summary covers the common case, only scan the FAT when it has nothing suitable
+        bool run_found = pick_free_extent(preferred_cluster, max_clusters, whole_run, aligned, run_first_cluster, run_length) ||
+                         (aligned ? scan_for_aligned_run(scan_start_cluster, preferred_cluster, max_clusters, whole_run, run_first_cluster, run_length) :
+                          scan_for_free_run(scan_start_cluster, max_clusters, whole_run, run_first_cluster, run_length));
+
+        if (run_found == false && aligned)
+        {
+            // no free AU left, place the clusters anywhere until some are released
+            aligned_runs_exhausted = true;
+            aligned = false;
+            run_found = pick_free_extent(preferred_cluster, max_clusters, whole_run, false, run_first_cluster, run_length) ||
+                        scan_for_free_run(scan_start_cluster, max_clusters, whole_run, run_first_cluster, run_length);
+        }
+
+        if (run_found == false)
+        {
+            return false;
+        }
+
+        Address32 linked_clusters;
+        if (link_free_run(run_first_cluster, run_length, linked_clusters) == false)
+        {
+            return false;
+        }
+
+        remove_free_clusters(run_first_cluster, linked_clusters);
+
+        if (linked_clusters < run_length)
+        {
+            // the summary was wrong about the cluster that ended the run
+            remove_free_clusters(run_first_cluster + linked_clusters, Address32(0x0, 0x1));
+        }
+
+        if (linked_clusters.is_zero())
+        {
+            continue;
+        }
+
+        if (free_cluster_count != unknown_count())
+        {
+            free_cluster_count = (free_cluster_count >= linked_clusters) ? free_cluster_count - linked_clusters : Address32();
+        }
+
+        next_free_cluster = run_first_cluster + linked_clusters;
+        if (next_free_cluster >= end_cluster)
+        {
+            next_free_cluster = Address32(0x0, 0x2);
+        }
+
+        first_cluster = run_first_cluster;
+        allocated_clusters = linked_clusters;
+        return true;
+    }
+
+    return false;
+}
+
+void ClusterAllocator::release(const Address32 &first_cluster, const Address32 &run_length)
+{
+    if (free_cluster_count != unknown_count())
+    {
+        free_cluster_count += run_length;
+    }
+
+    // a run that starts an AU may have freed a whole one, only then is it worth looking again
+    if (aligned_runs_exhausted && !clusters_per_allocation_unit.is_zero() &&
+        next_allocation_unit_start(first_cluster) < first_cluster + run_length)
+    {
+        aligned_runs_exhausted = false;
+    }
+
+    add_free_extent(first_cluster, run_length);
+}
+
+Address32 ClusterAllocator::get_free_cluster_count() const
+{
+    return free_cluster_count;
+}
+
+Address32 ClusterAllocator::get_next_free_cluster() const
+{
+    return next_free_cluster;
+}
+
+void ClusterAllocator::sector_loaded_callback(const Address32 &first_cluster, const PackedSector &sector, void *context)
+{
+    ClusterAllocator *allocator = static_cast<ClusterAllocator *>(context);
+    const Address32 end_cluster = allocator->number_of_clusters + Address32(0x0, 0x2);
+
+    Address32 run_first_cluster;
+    Address32 run_length;
+
+    // 128 entries of 4 bytes per FAT sector
+    for (uint16_t i = 0; i < 128U; i++)
+    {
+        const Address32 cluster = first_cluster + Address32(0x0, i);
+
+        // clusters 0 & 1 are reserved and the last FAT sector may go past the last cluster
+        const bool free_cluster = cluster >= Address32(0x0, 0x2) && cluster < end_cluster && is_free_cluster(sector.get_le32(i << 2));
+
+        if (free_cluster)
+        {
+            if (run_length.is_zero())
+            {
+                run_first_cluster = cluster;
+            }
+            run_length += Address32(0x0, 0x1);
+        }
+        else if (!run_length.is_zero())
+        {
+            allocator->add_free_extent(run_first_cluster, run_length);
+            run_length = Address32();
+        }
+    }
+
+    if (!run_length.is_zero())
+    {
+        allocator->add_free_extent(run_first_cluster, run_length);
+    }
+}
+
+void ClusterAllocator::add_free_extent(const Address32 &first_cluster, const Address32 &run_length)
+{
+    if (run_length.is_zero())
+    {
+        return;
+    }
+
+    Address32 extent_begin = first_cluster;
+    Address32 extent_end = first_cluster + run_length;
+
+    // absorb every extent that overlaps or touches the new one
+    uint16_t i = 0U;
+    while (i < number_of_free_extents)
+    {
+        const Address32 begin = free_extents[i].first_cluster;
+        const Address32 end = begin + free_extents[i].number_of_clusters;
+
+        if (begin <= extent_end && extent_begin <= end)
+        {
+            extent_begin = (begin < extent_begin) ? begin : extent_begin;
+            extent_end = (end > extent_end) ? end : extent_end;
+
+            // remove it by moving the last extent into its place, then look at that one
+            number_of_free_extents--;
+            free_extents[i] = free_extents[number_of_free_extents];
+            continue;
+        }
+
+        i++;
+    }
+
+    FreeExtent extent;
+    extent.first_cluster = extent_begin;
+    extent.number_of_clusters = extent_end - extent_begin;
+
+    if (number_of_free_extents < free_extents_summarized)
+    {
+        free_extents[number_of_free_extents] = extent;
+        number_of_free_extents++;
+        return;
+    }
+
+    // summary is full, keep the larger extents
+    uint16_t smallest = 0U;
+    for (uint16_t j = 1; j < number_of_free_extents; j++)
+    {
+        if (free_extents[j].number_of_clusters < free_extents[smallest].number_of_clusters)
+        {
+            smallest = j;
+        }
+    }
+
+    if (free_extents[smallest].number_of_clusters < extent.number_of_clusters)
+    {
+        free_extents[smallest] = extent;
+    }
+}
+
+void ClusterAllocator::remove_free_clusters(const Address32 &first_cluster, const Address32 &run_length)
+{
+    if (run_length.is_zero())
+    {
+        return;
+    }
+
+    const Address32 removed_begin = first_cluster;
+    const Address32 removed_end = first_cluster + run_length;
+
+    // at most one extent can be split in two, its right part is added once the loop is done
+    FreeExtent right_part;
+
+    uint16_t i = 0U;
+    while (i < number_of_free_extents)
+    {
+        const Address32 begin = free_extents[i].first_cluster;
+        const Address32 end = begin + free_extents[i].number_of_clusters;
+
+        if (end <= removed_begin || removed_end <= begin)
+        {
+            // no overlap
+            i++;
+            continue;
+        }
+
+        if (removed_end < end)
+        {
+            right_part.first_cluster = removed_end;
+            right_part.number_of_clusters = end - removed_end;
+        }
+
+        if (begin < removed_begin)
+        {
+            // keep the left part in place
+            free_extents[i].number_of_clusters = removed_begin - begin;
+            i++;
+            continue;
+        }
+
+        // remove it by moving the last extent into its place, then look at that one
+        number_of_free_extents--;
+        free_extents[i] = free_extents[number_of_free_extents];
+    }
+
+    add_free_extent(right_part.first_cluster, right_part.number_of_clusters);
+}
+
+bool ClusterAllocator::pick_free_extent(const Address32 &preferred_cluster, const Address32 &max_clusters, const bool &whole_run, const bool &aligned,
+                                        Address32 &first_cluster, Address32 &run_length) const
+{
+    // continuing at the preferred cluster (e.g., the end of a file) keeps the file contiguous
+    for (uint16_t i = 0; i < number_of_free_extents; i++)
+    {
+        const Address32 begin = free_extents[i].first_cluster;
+        const Address32 end = begin + free_extents[i].number_of_clusters;
+
+        if (preferred_cluster >= begin && preferred_cluster < end)
+        {
+            const Address32 available_clusters = end - preferred_cluster;
+
+            if (whole_run && available_clusters < max_clusters)
+            {
+                break;
+            }
+
+            first_cluster = preferred_cluster;
+            run_length = (available_clusters < max_clusters) ? available_clusters : max_clusters;
+            return true;
+        }
+    }
+
+    if (aligned)
+    {
+        // the smallest extent with enough clusters from the start of an AU on
+        const Address32 needed_clusters = aligned_run_length(max_clusters, whole_run);
+        const FreeExtent *best_fit = nullptr;
+        Address32 best_fit_start;
+
+        for (uint16_t i = 0; i < number_of_free_extents; i++)
+        {
+            const FreeExtent &extent = free_extents[i];
+            const Address32 end = extent.first_cluster + extent.number_of_clusters;
+            const Address32 start = next_allocation_unit_start(extent.first_cluster);
+
+            if (start < end && end - start >= needed_clusters &&
+                (best_fit == nullptr || extent.number_of_clusters < best_fit->number_of_clusters))
+            {
+                best_fit = &extent;
+                best_fit_start = start;
+            }
+        }
+
+        if (best_fit == nullptr)
+        {
+            // the FAT is scanned for one
+            return false;
+        }
+
+        const Address32 available_clusters = best_fit->first_cluster + best_fit->number_of_clusters - best_fit_start;
+        first_cluster = best_fit_start;
+        run_length = (available_clusters < max_clusters) ? available_clusters : max_clusters;
+        return true;
+    }
+
+    // otherwise the smallest extent that is large enough, and if there is none the largest extent
+    const FreeExtent *best_fit = nullptr;
+    const FreeExtent *largest = nullptr;
+
+    for (uint16_t i = 0; i < number_of_free_extents; i++)
+    {
+        const FreeExtent &extent = free_extents[i];
+
+        if (extent.number_of_clusters >= max_clusters && (best_fit == nullptr || extent.number_of_clusters < best_fit->number_of_clusters))
+        {
+            best_fit = &extent;
+        }
+
+        if (largest == nullptr || extent.number_of_clusters > largest->number_of_clusters)
+        {
+            largest = &extent;
+        }
+    }
+
+    if (best_fit != nullptr)
+    {
+        first_cluster = best_fit->first_cluster;
+        run_length = max_clusters;
+        return true;
+    }
+
+    if (largest == nullptr || whole_run)
+    {
+        // the summary may not know about a run that is large enough, the FAT has to be scanned
+        return false;
+    }
+
+    first_cluster = largest->first_cluster;
+    run_length = largest->number_of_clusters;
+    return true;
+}
+
+bool ClusterAllocator::scan_for_free_run(const Address32 &start_cluster, const Address32 &max_clusters, const bool &whole_run,
+                                            Address32 &first_cluster, Address32 &run_length)
+{
+    const Address32 end_cluster = number_of_clusters + Address32(0x0, 0x2);
+
+    Address32 cluster = start_cluster;
+    Address32 run_first_cluster;
+    Address32 current_run_length;
+    Address32 best_first_cluster;
+    Address32 best_length;
+
+    // next fit, consecutive entries share a FAT sector so the scan is mostly served by the FAT cache
+    for (Address32 clusters_scanned; clusters_scanned < number_of_clusters; clusters_scanned += Address32(0x0, 0x1))
+    {
+        if (cluster >= end_cluster)
+        {
+            // wrap around, a run can not span the end of the FAT
+            cluster = Address32(0x0, 0x2);
+            current_run_length = Address32();
+        }
+
+        Address32 fat_entry;
+        if (fat_cache.read_entry(cluster, fat_entry) == false)
+        {
+            return false;
+        }
+
+        if (is_free_cluster(fat_entry))
+        {
+            if (current_run_length.is_zero())
+            {
+                run_first_cluster = cluster;
+            }
+            current_run_length += Address32(0x0, 0x1);
+
+            if (current_run_length > best_length)
+            {
+                best_first_cluster = run_first_cluster;
+                best_length = current_run_length;
+            }
+
+            if (current_run_length == max_clusters)
+            {
+                break;
+            }
+        }
+        else
+        {
+            if (whole_run == false && !best_length.is_zero())
+            {
+                // the first free run is good enough
+                break;
+            }
+            current_run_length = Address32();
+        }
+
+        cluster += Address32(0x0, 0x1);
+    }
+
+    if (best_length.is_zero())
+    {
+        // card is full
+        return false;
+    }
+
+    first_cluster = best_first_cluster;
+    run_length = best_length;
+    return true;
+}
+
+bool ClusterAllocator::scan_for_aligned_run(const Address32 &start_cluster, const Address32 &preferred_cluster, const Address32 &max_clusters,
+                                            const bool &whole_run, Address32 &first_cluster, Address32 &run_length)
+{
+    const Address32 end_cluster = number_of_clusters + Address32(0x0, 0x2);
+    const Address32 needed_clusters = aligned_run_length(max_clusters, whole_run);
+
+    Address32 cluster = start_cluster;
+    Address32 run_first_cluster;
+    Address32 current_run_length;
+
+    for (Address32 clusters_scanned; clusters_scanned < number_of_clusters;)
+    {
+        if (cluster >= end_cluster)
+        {
+            // wrap around, a run can not span the end of the FAT
+            if (current_run_length >= needed_clusters)
+            {
+                break;
+            }
+            cluster = Address32(0x0, 0x2);
+            current_run_length = Address32();
+        }
+
+        if (current_run_length.is_zero() && cluster != preferred_cluster && is_allocation_unit_start(cluster) == false)
+        {
+            // a run only starts at an AU, the entries up to the next one are not read
+            const Address32 next_start = next_allocation_unit_start(cluster);
+            clusters_scanned += next_start - cluster;
+            cluster = next_start;
+            continue;
+        }
+
+        Address32 fat_entry;
+        if (fat_cache.read_entry(cluster, fat_entry) == false)
+        {
+            return false;
+        }
+
+        if (is_free_cluster(fat_entry))
+        {
+            if (current_run_length.is_zero())
+            {
+                run_first_cluster = cluster;
+            }
+            current_run_length += Address32(0x0, 0x1);
+
+            if (current_run_length == max_clusters)
+            {
+                break;
+            }
+        }
+        else
+        {
+            // continuing the file at the preferred cluster is worth any number of clusters
+            if (current_run_length >= needed_clusters || (!current_run_length.is_zero() && run_first_cluster == preferred_cluster))
+            {
+                break;
+            }
+            current_run_length = Address32();
+        }
+
+        cluster += Address32(0x0, 0x1);
+        clusters_scanned += Address32(0x0, 0x1);
+    }
+
+    if (current_run_length.is_zero() || (current_run_length < needed_clusters && run_first_cluster != preferred_cluster))
+    {
+        return false;
+    }
+
+    first_cluster = run_first_cluster;
+    run_length = current_run_length;
+    return true;
+}
+
+Address32 ClusterAllocator::aligned_run_length(const Address32 &max_clusters, const bool &whole_run) const
+{
+    return (whole_run || max_clusters < clusters_per_allocation_unit) ? max_clusters : clusters_per_allocation_unit;
+}
+
+bool ClusterAllocator::is_allocation_unit_start(const Address32 &cluster) const
+{
+    // AUs are a power of two clusters, the difference wraps around for clusters before the first one
+    return ((cluster - first_aligned_cluster) & (clusters_per_allocation_unit - Address32(0x0, 0x1))).is_zero();
+}
+
+Address32 ClusterAllocator::next_allocation_unit_start(const Address32 &cluster) const
+{
+    return cluster + ((first_aligned_cluster - cluster) & (clusters_per_allocation_unit - Address32(0x0, 0x1)));
+}
+
+bool ClusterAllocator::link_free_run(const Address32 &first_cluster, const Address32 &run_length, Address32 &linked_clusters)
+{
+    linked_clusters = Address32();
+
+    for (Address32 cluster = first_cluster; linked_clusters < run_length; cluster += Address32(0x0, 0x1))
+    {
+        Address32 fat_entry;
+        if (fat_cache.read_entry(cluster, fat_entry) == false)
+        {
+            return false;
+        }
+
+        if (is_free_cluster(fat_entry) == false)
+        {
+            break;
+        }
+
+        if (!linked_clusters.is_zero() && fat_cache.write_entry(cluster - Address32(0x0, 0x1), cluster) == false)
+        {
+            return false;
+        }
+
+        linked_clusters += Address32(0x0, 0x1);
+    }
+
+    if (linked_clusters.is_zero())
+    {
+        return true;
+    }
+
+    // last cluster of the run ends the chain
+    return fat_cache.write_entry(first_cluster + linked_clusters - Address32(0x0, 0x1), Address32(0x0FFF, 0xFFFF));
+}
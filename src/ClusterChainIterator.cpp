@@ -0,0 +1,62 @@
+/**
+ * @file ClusterChainIterator.cpp
+ * @author Mattheas Jamieson (mattheas@ualberta.ca)
+ * @brief Implementation of FAT32 cluster chain iterator
+ * @version 0.1
+ * @date 2024-03-03
+ */
+
+#include "../inc/ClusterChainIterator.h"
+
+using namespace file_system;
+
+ClusterChainIterator::ClusterChainIterator(FATCache &_fat_cache, const Address32 &first_cluster, const Address32 &_number_of_clusters)
+    : fat_cache(_fat_cache), cluster(first_cluster), end_cluster(_number_of_clusters + Address32(0x0, 0x2)),
+    number_of_clusters(_number_of_clusters)
+{
+    valid = cluster >= Address32(0x0, 0x2) && cluster < end_cluster;
+}
+
+ClusterChainIterator::~ClusterChainIterator()
+{
+}
+
+bool ClusterChainIterator::is_valid() const
+{
+    return valid;
+}
+
+Address32 ClusterChainIterator::get_cluster() const
+{
+    return cluster;
+}
+
+bool ClusterChainIterator::next()
+{
+    if (valid == false)
+    {
+        return false;
+    }
+
+    Address32 next_cluster;
+    if (fat_cache.read_entry(cluster, next_cluster) == false)
+    {
+        read_failed = true;
+        valid = false;
+        return false;
+    }
+
+    steps += Address32(0x0, 0x1);
+
+    // end of chain (0x?FFFFFF8 - 0x?FFFFFFF), free (0x0) and bad (0x?FFFFFF7) markers are all out of
+    // range, as is anything that points past the last cluster
+    cluster = next_cluster;
+    valid = cluster >= Address32(0x0, 0x2) && cluster < end_cluster && steps < number_of_clusters;
+
+    return valid;
+}
+
+bool ClusterChainIterator::fat_read_failed() const
+{
+    return read_failed;
+}
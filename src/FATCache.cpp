@@ -0,0 +1,335 @@
+/**
+ * @file FATCache.cpp
+ * @author Mattheas Jamieson (mattheas@ualberta.ca)
+ * @brief Implementation of FAT sector cache
+ * @version 0.1
+ * @date 2024-03-03
+ */
+
+#include "../inc/FATCache.h"
+
+using namespace file_system;
+
+FATCache::FATCache(sd_driver::BlockDevice &_block_device) : block_device(_block_device)
+{
+}
+
+FATCache::~FATCache()
+{
+}
+
+void FATCache::configure(const Address32 &_fat_begin_lba, const Address32 &_sectors_per_fat, const uint16_t &_number_of_fats)
+{
+    fat_begin_lba = _fat_begin_lba;
+    sectors_per_fat = _sectors_per_fat;
+    number_of_fats = _number_of_fats;
+
+    for (uint16_t i = 0; i < number_of_cached_sectors; i++)
+    {
+        cached_sectors[i].valid = false;
+        cached_sectors[i].dirty = false;
+    }
+}
+
+bool FATCache::read_entry(const Address32 &cluster_number, Address32 &entry_value)
+{
+    Address32 fat_sector_offset;
+    uint16_t index = 0U;
+    locate_entry(cluster_number, fat_sector_offset, index);
+
+    CachedFATSector *cached_sector = get_sector(fat_sector_offset);
+    if (cached_sector == nullptr)
+    {
+        return false;
+    }
+
+    // upper 4 bits of a FAT32 entry are reserved
+    entry_value = cached_sector->data.get_le32(index) & Address32(0x0FFF, 0xFFFF);
+    return true;
+}
+
+bool FATCache::write_entry(const Address32 &cluster_number, const Address32 &entry_value)
+{
+    Address32 fat_sector_offset;
+    uint16_t index = 0U;
+    locate_entry(cluster_number, fat_sector_offset, index);
+
+    CachedFATSector *cached_sector = get_sector(fat_sector_offset);
+    if (cached_sector == nullptr)
+    {
+        return false;
+    }
+
+    // keep the reserved upper 4 bits that are already on the card
+    const Address32 reserved_bits = cached_sector->data.get_le32(index) & Address32(0xF000, 0x0000);
+    cached_sector->data.set_le32(index, reserved_bits | (entry_value & Address32(0x0FFF, 0xFFFF)));
+
+    cached_sector->dirty = true;
+    return true;
+}
+
+bool FATCache::flush()
+{
+    bool all_written = true;
+
+    for (uint16_t i = 0; i < number_of_cached_sectors; i++)
+    {
+        if (cached_sectors[i].valid && cached_sectors[i].dirty)
+        {
+            if (write_back(cached_sectors[i]) == false)
+            {
+                all_written = false;
+            }
+        }
+    }
+
+    return all_written;
+}
+
+bool FATCache::free_chain(const Address32 &first_cluster, const Address32 &number_of_clusters, run_freed_callback_t run_freed_callback, void *context)
+{
+    const Address32 end_cluster = number_of_clusters + Address32(0x0, 0x2);
+
+    Address32 cluster = first_cluster;
+    Address32 run_first_cluster;
+    Address32 run_length;
+    Address32 clusters_freed;
+
+    while (cluster >= Address32(0x0, 0x2) && cluster < end_cluster && clusters_freed < number_of_clusters)
+    {
+        Address32 fat_sector_offset;
+        uint16_t index = 0U;
+        locate_entry(cluster, fat_sector_offset, index);
+
+        CachedFATSector *cached_sector = get_sector(fat_sector_offset);
+        if (cached_sector == nullptr)
+        {
+            return false;
+        }
+
+        cached_sector->dirty = true;
+
+        // free every link of the chain that stays in this sector without going back through the cache
+        bool same_sector = true;
+        while (same_sector)
+        {
+            const Address32 entry = cached_sector->data.get_le32(index);
+
+            // keep the reserved upper 4 bits that are already on the card
+            cached_sector->data.set_le32(index, entry & Address32(0xF000, 0x0000));
+            clusters_freed += Address32(0x0, 0x1);
+
+            if (!run_length.is_zero() && run_first_cluster + run_length == cluster)
+            {
+                run_length += Address32(0x0, 0x1);
+            }
+            else
+            {
+                if (!run_length.is_zero() && run_freed_callback != nullptr)
+                {
+                    run_freed_callback(run_first_cluster, run_length, context);
+                }
+                run_first_cluster = cluster;
+                run_length = Address32(0x0, 0x1);
+            }
+
+            // the end of chain marker (and free/ bad/ reserved values) are all out of range
+            cluster = entry & Address32(0x0FFF, 0xFFFF);
+            same_sector = cluster >= Address32(0x0, 0x2) && cluster < end_cluster && clusters_freed < number_of_clusters &&
+                            (cluster >> fat_entrys_per_sector_shift) == fat_sector_offset;
+            index = cluster.low_bits(fat_entrys_per_sector_shift) << 2;
+        }
+    }
+
+    if (!run_length.is_zero() && run_freed_callback != nullptr)
+    {
+        run_freed_callback(run_first_cluster, run_length, context);
+    }
+
+    return true;
+}
+
+bool FATCache::mirror_sector(const Address32 &fat_sector_offset, PackedSector &sector)
+{
+    const PackedSector *source = nullptr;
+    for (uint16_t i = 0; i < number_of_cached_sectors; i++)
+    {
+        if (cached_sectors[i].valid && cached_sectors[i].fat_sector_offset == fat_sector_offset)
+        {
+            source = &cached_sectors[i].data;
+        }
+    }
+
+    Address32 sector_address = fat_begin_lba + fat_sector_offset;
+
+    if (source == nullptr)
+    {
+        if (block_device.read_block(sector, sector_address) == false)
+        {
+            return false;
+        }
+        source = &sector;
+    }
+
+    for (uint16_t i = 1; i < number_of_fats; i++)
+    {
+        sector_address += sectors_per_fat;
+
+        if (block_device.write_block(*source, sector_address) == false)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool FATCache::restore_sector(const Address32 &fat_sector_offset, PackedSector &sector)
+{
+    if (number_of_fats < 2U)
+    {
+        return false;
+    }
+
+    for (uint16_t i = 0; i < number_of_cached_sectors; i++)
+    {
+        if (cached_sectors[i].valid && cached_sectors[i].fat_sector_offset == fat_sector_offset)
+        {
+            cached_sectors[i].valid = false;
+            cached_sectors[i].dirty = false;
+        }
+    }
+
+    const Address32 sector_address = fat_begin_lba + fat_sector_offset;
+
+    return block_device.read_block(sector, sector_address + sectors_per_fat) &&
+           block_device.write_block(sector, sector_address);
+}
+
+void FATCache::set_write_back_callback(write_back_callback_t callback, void *context)
+{
+    write_back_callback = callback;
+    write_back_context = context;
+}
+
+void FATCache::set_sector_loaded_callback(sector_loaded_callback_t callback, void *context)
+{
+    sector_loaded_callback = callback;
+    sector_loaded_context = context;
+}
+
+FATCache::FATCacheStatistics FATCache::get_statistics() const
+{
+    return statistics;
+}
+
+void FATCache::reset_statistics()
+{
+    statistics = FATCacheStatistics();
+}
+
+FATCache::CachedFATSector *FATCache::get_sector(const Address32 &fat_sector_offset)
+{
+    access_counter++;
+
+    // look for the sector in the cache, while also finding the slot to replace if it's a miss
+    // (an empty slot if there is one, otherwise the least recently used)
+    CachedFATSector *replacement = &cached_sectors[0];
+    uint16_t replacement_age = 0U;
+
+    for (uint16_t i = 0; i < number_of_cached_sectors; i++)
+    {
+        if (cached_sectors[i].valid == false)
+        {
+            replacement = &cached_sectors[i];
+            replacement_age = 0xFFFF;
+            continue;
+        }
+
+        if (cached_sectors[i].fat_sector_offset == fat_sector_offset)
+        {
+            // cache hit, no SD card transaction needed
+            STATISTICS_COUNT(statistics.hits);
+            cached_sectors[i].last_access = access_counter;
+            return &cached_sectors[i];
+        }
+
+        // age is computed with wrap around so the counter overflowing does not matter
+        const uint16_t age = access_counter - cached_sectors[i].last_access;
+        if (age > replacement_age)
+        {
+            replacement = &cached_sectors[i];
+            replacement_age = age;
+        }
+    }
+
+    // cache miss, make room by writing back the replaced sector if it has been modified
+    STATISTICS_COUNT(statistics.misses);
+    if (replacement->valid && replacement->dirty)
+    {
+        if (write_back(*replacement) == false)
+        {
+            return nullptr;
+        }
+    }
+
+    replacement->valid = false;
+
+    // FAT #1 is the copy that is read, the others are only ever written
+    if (block_device.read_block(replacement->data, fat_begin_lba + fat_sector_offset) == false)
+    {
+        return nullptr;
+    }
+
+    replacement->valid = true;
+    replacement->dirty = false;
+    replacement->fat_sector_offset = fat_sector_offset;
+    replacement->last_access = access_counter;
+
+    if (sector_loaded_callback != nullptr)
+    {
+        sector_loaded_callback(fat_sector_offset << fat_entrys_per_sector_shift, replacement->data, sector_loaded_context);
+    }
+
+    return replacement;
+}
+
+bool FATCache::write_back(CachedFATSector &cached_sector)
+{
+    Address32 sector_address = fat_begin_lba + cached_sector.fat_sector_offset;
+
+    STATISTICS_COUNT(statistics.write_backs);
+
+    // FAT #1 only if the other copies are brought up to date later
+    const write_back_target_t target = (write_back_callback != nullptr) ?
+                                       write_back_callback(cached_sector.fat_sector_offset, write_back_context) : write_back_target_t::EVERY_FAT;
+    if (target == write_back_target_t::FAILED)
+    {
+        return false;
+    }
+
+    const uint16_t fats_to_write = (target == write_back_target_t::FAT_1_ONLY) ? 1U : number_of_fats;
+
+    // write the sector to the same offset in every copy of the FAT
+    for (uint16_t i = 0; i < fats_to_write; i++)
+    {
+        if (block_device.write_block(cached_sector.data, sector_address) == false)
+        {
+            return false;
+        }
+
+        sector_address += sectors_per_fat;
+    }
+
+    cached_sector.dirty = false;
+    return true;
+}
+
+void FATCache::locate_entry(const Address32 &cluster_number, Address32 &fat_sector_offset, uint16_t &index)
+{
+    // 128 (2^7) entries per FAT sector, the upper bits select the sector and the lower 7 bits the entry
+    fat_sector_offset = cluster_number >> fat_entrys_per_sector_shift;
+
+    // multiply by 4 since every entry is 4 bytes
+    index = cluster_number.low_bits(fat_entrys_per_sector_shift) << 2;
+}
@@ -7,54 +7,125 @@
  */
 
 #include "../inc/FileSystem.h"
+#include "../inc/ClusterChainIterator.h"
 #include <XPD.h>
 
 using namespace file_system;
 
-FileSystem::FileSystem(sd_driver::SDCard &_sd_card, const file_system_t &_file_system_type) : sd_card(_sd_card), file_system_type(_file_system_type)
+FileSystem::FileSystem(MountManager &_mount_manager, sd_driver::BlockDevice &_block_device, const file_system_t &_file_system_type,
+                        const mount_mode_t &_mount_mode, const MountManager::VolumeOptions &_volume_options)
+    : mount_manager(_mount_manager), block_device(_block_device), fat_cache(_block_device), intent_log(_block_device), cluster_allocator(fat_cache),
+    block_cache(_block_device, _mount_manager.block_pool, _volume_options.block_cache_quota), sector_buffer(_mount_manager.sector_buffer),
+    partition_index((_volume_options.partition_number - 1U) & (number_of_primary_partitions - 1U)),
+    file_system_type(_file_system_type), mount_mode(_mount_mode), directory_snapshot_enabled(_volume_options.directory_snapshot)
 {
+    STATISTICS_TIME_OPERATION(statistics.mount);
+
     // Initialize SD card if its not already initalized??
 
-    // read MBR
-    read_fat32_master_boot_record(); 
+    for (uint16_t i = 0; i < path_index_slots; i++)
+    {
+        path_index[i] = path_index_empty_slot;
+    }
+
+    // partition_index wraps any number into 1-4, another volume must not be mounted in its place
+    if (_volume_options.partition_number < 1U || _volume_options.partition_number > number_of_primary_partitions)
+    {
+        return;
+    }
+
+    // read MBR, then the VolumeID of the selected partition
+    if (mount_manager.attach(*this) == false)
+    {
+        return;
+    }
+
+    mounted = read_fat32_master_boot_record() && read_fat_32_volume_id(partition_lba_begin);
 
-    // read VolumeID
-    read_fat_32_volume_id(fat_32_master_boot_record.primary_partition_1.lba_begin);
+    if (mounted == false)
+    {
+        return;
+    }
 
     // Calculate sector address (lba) of the beginning of FAT table (there should be two FAT tables #1 and #2 fyi)
     //==============================================================================================================================================
     // fat_begin_lba = Partition_LBA_Begin + Number_of_Reserved_Sectors;
-    // fat_begin_lba[4] = {0x00, 0x00, 0x00, 0x00};
-    add_4_byte_numbers(fat_32_master_boot_record.primary_partition_1.lba_begin, {0x00, 0x00, fat_32_volume_id.size_of_reserved_area_sectors[0], fat_32_volume_id.size_of_reserved_area_sectors[1]}, fat_begin_lba);
+    fat_begin_lba = partition_lba_begin + Address32(0x0, fat_32_volume_id.size_of_reserved_area_sectors);
     //==============================================================================================================================================
 
     // Calculate the sector address (lba) of the first cluster
     //==============================================================================================================================================
     // cluster_begin_lba = Partition_LBA_Begin + Number_of_Reserved_Sectors + (Number_of_FATs * Sectors_Per_FAT);
+    cluster_begin_lba = fat_begin_lba + fat_32_volume_id.sectors_per_fat.multiply(fat_32_volume_id.number_of_fats);
+    //==============================================================================================================================================
+
+    fat_cache.configure(fat_begin_lba, fat_32_volume_id.sectors_per_fat, fat_32_volume_id.number_of_fats);
+
+    intent_log.configure(partition_lba_begin, fat_32_volume_id.size_of_reserved_area_sectors, fat_32_volume_id.fs_info_sector,
+                            fat_32_volume_id.backup_boot_sector, fat_32_volume_id.number_of_fats);
+
+    // sectors per cluster is a power of two (1-128) in FAT32, so cluster <-> sector conversions are shifts
+    sectors_per_cluster_shift = Address32::log2(fat_32_volume_id.sectors_per_cluster);
 
-    // multiply number_of_fats by sector_per_fat to get total fat sectors, perform multiplication w/ repeated addition
-    uint16_t total_fat_sectors[4] = {0x00, 0x00, 0x00, 0x00};
-    for (uint16_t i=0; i<fat_32_volume_id.number_of_fats; i++)
+    // the 2 byte sector count is only used by small (FAT12/16) volumes, otherwise it's 0 and the 4 byte count is used
+    const Address32 sectors_in_file_system = (fat_32_volume_id.number_of_sectors_in_file_system != 0U) ?
+        Address32(0x0, fat_32_volume_id.number_of_sectors_in_file_system) : fat_32_volume_id.num_of_sectors_in_file_system_extended;
+
+    // everything after the FATs is the data region
+    number_of_clusters = (sectors_in_file_system - (cluster_begin_lba - partition_lba_begin)) >> sectors_per_cluster_shift;
+
+    // where the AUs of the card are, before the first cluster is allocated
+    configure_allocation_units();
+
+    // the free cluster count and next free cluster hint saved at the last unmount
+    read_fs_info();
+
+    // back to the last commit if the card lost power in the middle of changes, before anything
+    // else is read
+    if (recover_intent_log() == false)
     {
-        add_4_byte_numbers(fat_32_volume_id.sectors_per_fat, total_fat_sectors, total_fat_sectors);
-    }    
+        mounted = false;
+        return;
+    }
 
-    // perform addition and store result in cluster_begin_lba for later use
-    add_4_byte_numbers(fat_begin_lba, total_fat_sectors, cluster_begin_lba);
-    //==============================================================================================================================================
+    // from here on FAT #2 is only written by commit()
+    fat_cache.set_write_back_callback(fat_write_back_callback, this);
 
-    // Recursively read file system into file_system_entrys[]
-    //==============================================================================================================================================
-    uint16_t root_directory_sector_begin_addr[4] = {0x0, 0x0, 0x0, 0x0};
-    calculate_sector_address_from_cluster_number(fat_32_volume_id.root_directory_first_cluster, root_directory_sector_begin_addr);
+    // the directories as the last unmount left them, if nothing changed the volume since
+    const uint16_t snapshot_sectors = directory_snapshot_sectors;
+    const bool snapshot_loaded = directory_snapshot_enabled &&
+                                 intent_log.find_free_reserved_sectors(snapshot_sectors, directory_snapshot_address) &&
+                                 load_directory_snapshot();
+
+    // the first sector of the root directory is searched by every operation on a file in the root (in
+    // lazy mode by every path look up), keep it cached
+    const Address32 root_directory_sector_begin_addr = calculate_sector_address_from_cluster_number(fat_32_volume_id.root_directory_first_cluster);
+    block_cache.pin(root_directory_sector_begin_addr);
 
-    read_directory_recursive(root_directory_sector_begin_addr ,nullptr);
+    // in lazy mode nothing more is read, directories along a path are only read when a path is looked up
+    if (mount_mode == mount_mode_t::LAZY)
+    {
+        return;
+    }
+
+    // Read entire file system into entry_table
+    //==============================================================================================================================================
+    if (snapshot_loaded == false)
+    {
+        directory_tree_complete = read_directory_tree();
+    }
     //==============================================================================================================================================
 
 }
 
 FileSystem::~FileSystem()
 {
+    mount_manager.detach(*this);
+}
+
+bool FileSystem::is_mounted() const
+{
+    return mounted;
 }
 
 FileSystem::FAT32MasterBootRecord FileSystem::get_fat_32_master_boot_record() const
@@ -67,848 +138,2651 @@ FileSystem::FAT32VolumeID FileSystem::get_fat_32_volume_id() const
     return fat_32_volume_id;
 }
 
-bool FileSystem::delete_file(const uint16_t (&file_name)[11], const uint16_t &num_enclosing_directories, const uint16_t (&enclosing_directory_names)[10][11])
+FileSystem::VolumeAlignment FileSystem::get_volume_alignment() const
 {
-    // index of file to be deleted in file_system_entrys[] IF it exists
-    int16_t entry_index = -1;
-
-    // search for file name in file_system_entrys[] for a name that matches
-    for (uint16_t i = 0; i < total_directory_entries; i++)
-    {   
-        // indexing arrays with for loop/ index var produces garbage values, unsure why, so ugly compound condition instead
-        bool entry_name_match = (static_cast<uint16_t>(file_system_entrys[i].name_of_entry[0]) == file_name[0]) && 
-                                (static_cast<uint16_t>(file_system_entrys[i].name_of_entry[1]) == file_name[1]) &&
-                                (static_cast<uint16_t>(file_system_entrys[i].name_of_entry[2]) == file_name[2]) &&
-                                (static_cast<uint16_t>(file_system_entrys[i].name_of_entry[3]) == file_name[3]) &&
-                                (static_cast<uint16_t>(file_system_entrys[i].name_of_entry[4]) == file_name[4]) &&
-                                (static_cast<uint16_t>(file_system_entrys[i].name_of_entry[5]) == file_name[5]) &&
-                                (static_cast<uint16_t>(file_system_entrys[i].name_of_entry[6]) == file_name[6]) &&
-                                (static_cast<uint16_t>(file_system_entrys[i].name_of_entry[7]) == file_name[7]) &&
-                                (static_cast<uint16_t>(file_system_entrys[i].name_of_entry[8]) == file_name[8]) &&
-                                (static_cast<uint16_t>(file_system_entrys[i].name_of_entry[9]) == file_name[9]) &&
-                                (static_cast<uint16_t>(file_system_entrys[i].name_of_entry[10]) == file_name[10]);
+    return volume_alignment;
+}
 
-        if (entry_name_match == false)
-        {
-            // file name does not match so skip rest of iteration
-            continue;
-        }
+bool FileSystem::stat(const uint16_t (&file_name)[11], const uint16_t &num_enclosing_directories, const uint16_t (&enclosing_directory_names)[10][11],
+                        FAT32FileSystemEntry &entry)
+{
+    const int16_t entry_index = find_entry(file_name, num_enclosing_directories, enclosing_directory_names);
+
+    if (entry_index == -1)
+    {
+        return false;
+    }
+
+    // gather the entry from the arrays of entry_table
+    entry.entry_in_use = true;
+    entry.parent_directory = entry_table.parents[entry_index];
+    entry.attribute_byte = entry_table.attributes[entry_index] & 0xFF;
+    entry.entry_type = get_entry_type(entry.attribute_byte);
+    for (uint16_t i = 0; i < 11; i++)
+    {
+        entry.name_of_entry[i] = static_cast<char>(get_entry_name_character(entry_index, i));
+    }
+    entry.starting_cluster_address = entry_table.first_clusters[entry_index];
+    entry.size_of_entry_in_bytes = entry_table.sizes[entry_index];
+    entry.long_name_offset = entry_table.long_name_offsets[entry_index];
+    entry.long_name_length = entry_table.long_name_lengths[entry_index];
 
-        // A FILE NAME MATCH!!, however must check now for the correct absolute path
+    return true;
+}
 
-        // get the parent of the current file system entry
-        FAT32FileSystemEntry *current_parent_directory;
-        current_parent_directory = file_system_entrys[i].parent_directory;
+bool FileSystem::find_short_name(const char *long_name, const uint16_t &num_enclosing_directories,
+                                    const uint16_t (&enclosing_directory_names)[10][11], uint16_t (&short_name)[11])
+{
+    uint16_t directory = root_directory_index;
+    if (find_directory(num_enclosing_directories, enclosing_directory_names, directory) == false)
+    {
+        return false;
+    }
 
-        // check if we are looking for a file that exists in the root directory
-        if (num_enclosing_directories == 0 && current_parent_directory == nullptr)
+    // long names are not in the path index, the loaded entries of the directory are searched
+    int16_t entry_found = -1;
+    for (uint16_t i = 0; i < file_systems_entry_index; i++)
+    {
+        if ((entry_table.attributes[i] & entry_in_use_flag) != 0U && entry_table.parents[i] == directory &&
+            entry_table.long_name_lengths[i] != 0U && long_name_matches(entry_table.long_name_offsets[i], entry_table.long_name_lengths[i], long_name))
         {
-            // simple case, file being searched for is in the root, exit loop with saved index
-            entry_index = i;
+            entry_found = static_cast<int16_t>(i);
             break;
         }
-        else
+    }
+
+    if (entry_found == -1 && mount_mode == mount_mode_t::LAZY && directory_tree_complete == false)
+    {
+        DirectoryLookupContext look_up_context;
+        look_up_context.file_system = this;
+        look_up_context.parent_directory = directory;
+        look_up_context.long_name = long_name;
+
+        Address32 last_sector_address;
+        if (read_directory_clusters(get_directory_first_cluster(directory), look_up_entry_callback,
+                &look_up_context, last_sector_address) == false)
         {
-            // assume that the path's matches, you traverse back up the tree to disprove potentially
-            bool absolute_path_match = true; 
+            return false;
+        }
 
-            // iterate back up absolute path for the num of enclosing directories
-            for (uint16_t j = 0; j < num_enclosing_directories; j++)
-            {
-                if (current_parent_directory != nullptr)
-                {
-                    // indexing arrays with for loop/ index var produces garbage values, unsure why, so ugly compound condition instead
-                    // also a bitwise & is performed as I was having weird cases of the upper 8 bits of the uint16_t having a non zero value
-                    // even when assigning it a value that should be no more than 8 bits
-                    bool directory_name_match = (static_cast<uint16_t>((*current_parent_directory).name_of_entry[0]) == (enclosing_directory_names[j][0] & 0xFF)) && 
-                                                (static_cast<uint16_t>((*current_parent_directory).name_of_entry[1]) == (enclosing_directory_names[j][1] & 0xFF)) &&
-                                                (static_cast<uint16_t>((*current_parent_directory).name_of_entry[2]) == (enclosing_directory_names[j][2] & 0xFF)) &&
-                                                (static_cast<uint16_t>((*current_parent_directory).name_of_entry[3]) == (enclosing_directory_names[j][3] & 0xFF)) &&
-                                                (static_cast<uint16_t>((*current_parent_directory).name_of_entry[4]) == (enclosing_directory_names[j][4] & 0xFF)) &&
-                                                (static_cast<uint16_t>((*current_parent_directory).name_of_entry[5]) == (enclosing_directory_names[j][5] & 0xFF)) &&
-                                                (static_cast<uint16_t>((*current_parent_directory).name_of_entry[6]) == (enclosing_directory_names[j][6] & 0xFF)) &&
-                                                (static_cast<uint16_t>((*current_parent_directory).name_of_entry[7]) == (enclosing_directory_names[j][7] & 0xFF)) &&
-                                                (static_cast<uint16_t>((*current_parent_directory).name_of_entry[8]) == (enclosing_directory_names[j][8] & 0xFF)) &&
-                                                (static_cast<uint16_t>((*current_parent_directory).name_of_entry[9]) == (enclosing_directory_names[j][9] & 0xFF)) &&
-                                                (static_cast<uint16_t>((*current_parent_directory).name_of_entry[10]) == (enclosing_directory_names[j][10] & 0xFF));
-
-
-                    if (directory_name_match == true)
-                    {
-                        // file path so far matches so set current parent to the enclosing directory and continue verifying path
-                        current_parent_directory = current_parent_directory->parent_directory;
-                    }
-                    else 
-                    {
-                        // absolute path does not match, break out of inner loop and continue searching file_system_entrys[]
-                        absolute_path_match = false;
-                        break;
-                    }
-                }
-                else
-                {
-                    // absolute path does not match because a nullptr was found (if not an error it indicates root directory), break and continue searching file_system_entrys[]
-                    absolute_path_match = false;
-                    break;
-                }
-            }
+        entry_found = look_up_context.entry_found;
+    }
 
-            if (absolute_path_match == true && current_parent_directory == nullptr)
-            {
-                // file to delete has been found, break out of outer loop with entry index saved
-                entry_index = i;
-                break;
-            }
+    if (entry_found == -1)
+    {
+        return false;
+    }
 
-        }
-            
-        
+    for (uint16_t i = 0; i < 11; i++)
+    {
+        short_name[i] = get_entry_name_character(entry_found, i);
     }
 
-    if (entry_index == -1)
+    return true;
+}
+
+uint16_t FileSystem::get_long_name(const FAT32FileSystemEntry &entry, char *long_name, const uint16_t &max_length) const
+{
+    const uint16_t length = (entry.long_name_length < max_length) ? entry.long_name_length : max_length;
+
+    for (uint16_t i = 0; i < length; i++)
     {
-        // early return (that operation failed) if the file name is not found
-        return false;
+        long_name[i] = static_cast<char>(get_long_name_character(entry.long_name_offset + i));
     }
+    long_name[length] = '\0';
+
+    return length;
+}
+
+bool FileSystem::open(const uint16_t (&file_name)[11], const uint16_t &num_enclosing_directories, const uint16_t (&enclosing_directory_names)[10][11],
+                        File &file, const open_mode_t &open_mode)
+{
+    STATISTICS_TIME_OPERATION(statistics.open);
+
+    file.is_open = false;
 
-    // flag set to true when the file has been deleted from the fat table
-    bool file_deleted_from_fat_table = false;
+    const int16_t entry_index = find_entry(file_name, num_enclosing_directories, enclosing_directory_names);
 
-    // Deleting file from FAT is "easy" if the cluster number is zero BECAUSE that means the file 
-    // is created but it is empty and therefore has no clusters associated with it, additionally a sanity
-    // check of the other invalid cluster number is performed too, which is 0x1
-    if ((file_system_entrys[entry_index].starting_cluster_address[3] == 0x0 || file_system_entrys[entry_index].starting_cluster_address[3] == 0x1) &&
-        file_system_entrys[entry_index].starting_cluster_address[2] == 0x0 &&
-        file_system_entrys[entry_index].starting_cluster_address[1] == 0x0 &&
-        file_system_entrys[entry_index].starting_cluster_address[0] == 0x0)
+    if (entry_index == -1 || get_entry_type(entry_table.attributes[entry_index]) != directory_entry_t::FILE_ENTRY)
     {
-        file_deleted_from_fat_table = true;
+        return false;
     }
 
-    // set the current cluster number of interest to be the starting cluster address of the file
-    uint16_t current_cluster_number[4] = {0x0, 0x0, 0x0, 0x0};
-    current_cluster_number[3] = file_system_entrys[entry_index].starting_cluster_address[3];
-    current_cluster_number[2] = file_system_entrys[entry_index].starting_cluster_address[2];
-    current_cluster_number[1] = file_system_entrys[entry_index].starting_cluster_address[1];
-    current_cluster_number[0] = file_system_entrys[entry_index].starting_cluster_address[0];
+    file.writable = (open_mode == open_mode_t::APPEND);
+    file.entry_index = entry_index;
+    file.size = entry_table.sizes[entry_index];
+    file.position = Address32();
+    file.number_of_extents = 0U;
+    file.overflow_cluster = Address32();
+    file.window = FileExtent();
+    file.window_next_cluster = Address32();
+    file.first_cluster = Address32();
+    file.last_cluster = Address32();
+    file.allocated_clusters = Address32();
+    file.size_on_card = file.size;
+    file.size_update_interval = Address32();
+
+    // an empty file has no clusters at all
+    Address32 next_cluster = entry_table.first_clusters[entry_index];
+    if (next_cluster < Address32(0x0, 0x2))
+    {
+        next_cluster = Address32();
+    }
+    file.first_cluster = next_cluster;
 
-    while (!file_deleted_from_fat_table)
+    // resolve the chain once, so reads/ seeks never have to walk it from the start
+    while (!next_cluster.is_zero() && file.number_of_extents < extents_per_file)
     {
-        // Determine which sector of the FAT needs to be read in given the current cluster number,
-        // additionally find the index of the starting byte of a the 4 byte entry
-        uint16_t sector_number_offset_from_fat_begin[4] = {0x0, 0x0, 0x0, 0x0};
-        uint16_t cluster_index_in_sector = 0U;
-        calculate_fat_sector_offset_from_cluster_number(current_cluster_number, sector_number_offset_from_fat_begin, cluster_index_in_sector);
+        FileExtent &extent = file.extents[file.number_of_extents];
+
+        if (resolve_extent(next_cluster, file.allocated_clusters, extent, next_cluster) == false)
+        {
+            return false;
+        }
 
-        // read the fat table sector that contains cluster number of concern
-        // TODO optimize to only re-read the sector if needed
-        uint16_t current_fat_table_sector[512] = {};
-        add_4_byte_numbers(fat_begin_lba, sector_number_offset_from_fat_begin, sector_number_offset_from_fat_begin);
-        sd_card.send_cmd17(current_fat_table_sector, sector_number_offset_from_fat_begin);
+        file.allocated_clusters += extent.number_of_clusters;
+        file.last_cluster = extent.first_cluster + extent.number_of_clusters - Address32(0x0, 0x1);
+        file.number_of_extents++;
+    }
+
+    // the rest of a heavily fragmented file is resolved into the window when it's read
+    file.overflow_cluster = next_cluster;
+
+    if (file.writable)
+    {
+        // appending needs the end of the chain, walk the part past extents[] once
+        while (!next_cluster.is_zero())
+        {
+            FileExtent extent;
 
-        // read data stored at index, if EOF, hooray, if not then must follow the cluster chain
-        uint16_t data_stored_at_cluster_index[4] = {}; // stored as Big Endian, so make sure to "flip" incoming data
-        data_stored_at_cluster_index[3] = current_fat_table_sector[cluster_index_in_sector]; // LSB
-        data_stored_at_cluster_index[2] = current_fat_table_sector[cluster_index_in_sector+1];
-        data_stored_at_cluster_index[1] = current_fat_table_sector[cluster_index_in_sector+2];
-        data_stored_at_cluster_index[0] = current_fat_table_sector[cluster_index_in_sector+3]; // MSB
+            if (resolve_extent(next_cluster, file.allocated_clusters, extent, next_cluster) == false)
+            {
+                return false;
+            }
 
-        // whatever is stored in that cluster should now be deleted/ cleared/ freed by setting to 0's
-        current_fat_table_sector[cluster_index_in_sector] = 0x00; // LSB
-        current_fat_table_sector[cluster_index_in_sector+1] = 0x00;
-        current_fat_table_sector[cluster_index_in_sector+2] = 0x00;
-        current_fat_table_sector[cluster_index_in_sector+3] = 0x00; // MSB
+            file.allocated_clusters += extent.number_of_clusters;
+            file.last_cluster = extent.first_cluster + extent.number_of_clusters - Address32(0x0, 0x1);
+        }
 
-        // TODO optimize this as the sector only needs to be written to if a new sector will be read in
-        // TODO make sure to update FAT Table #2
-        // delete cluster entry by writing over value with 0x00000000 to indicate cluster is now free
-        sd_card.send_cmd24(current_fat_table_sector, sector_number_offset_from_fat_begin);
+        // sync() updates the directory entry in place, find where it is
+        DirectoryEntrySearchContext search_context;
+        search_context.file_system = this;
+        search_context.entry_to_find = entry_index;
 
-        // Check if data is another cluster number or EOF (?FFFFFF8h - ?FFFFFFFh indicates EOF on FAT32)
-        if (data_stored_at_cluster_index[0] >= 0xF && // MSB
-            data_stored_at_cluster_index[1] == 0xFF &&
-            data_stored_at_cluster_index[2] == 0xFF &&
-            data_stored_at_cluster_index[3] >= 0xF8) // LSB
+        if (read_directory_clusters(get_directory_first_cluster(entry_table.parents[entry_index]), find_directory_entry_callback,
+                &search_context, file.entry_sector_address) == false || search_context.entry_found == false)
         {
-            file_deleted_from_fat_table = true;
+            return false;
         }
-        else
+        file.entry_offset = search_context.entry_offset;
+
+        // the end of the file is appended to the partial last sector
+        if (file.size.low_bits(9) != 0U)
         {
-            // file is not deleted so update the the current_cluster_number to the next one in the chain
-            current_cluster_number[3] = data_stored_at_cluster_index[3];
-            current_cluster_number[2] = data_stored_at_cluster_index[2];
-            current_cluster_number[1] = data_stored_at_cluster_index[1];
-            current_cluster_number[0] = data_stored_at_cluster_index[0];
+            Address32 sector_address;
+            Address32 sectors_left_in_extent;
+
+            if (locate_file_sector(file, file.size, sector_address, sectors_left_in_extent) == false ||
+                block_device.read_block(file.tail_sector, sector_address) == false)
+            {
+                return false;
+            }
         }
     }
 
-    // Now update the root directory entries and "delete" the file by setting the first byte to 0xE5 & clearing the upper cluster byte addr
+    file.is_open = true;
+    return true;
+}
 
-    // Do this by looking at the entry, then look at the parent directory (be careful of a nullptr enclosing directory)
-    // read in the that directory, sector by secotr and look for the entry, once you find it, update and delete
+bool FileSystem::create(const uint16_t (&file_name)[11], const uint16_t &num_enclosing_directories, const uint16_t (&enclosing_directory_names)[10][11],
+                        File &file)
+{
+    STATISTICS_TIME_OPERATION(statistics.create);
 
-    // Constants that identify information about 32 byte directory entries
-    constexpr uint16_t bytes_per_entry = 32U; 
-    constexpr uint16_t attribute_byte_offset = 11U;
-    constexpr uint16_t file_size_offset = 28U;
-    // TODO assumes sector size of 512 bytes, update to be sector size/ bytes per entry
-    constexpr uint16_t directory_entrys_per_sector = 16U;
+    file.is_open = false;
 
-    // Find the most immediate enclosing directory, nullptr indicates file is in root directory
-    FAT32FileSystemEntry *files_enclosing_directory = file_system_entrys[entry_index].parent_directory;
-    uint16_t enclosing_directory_sector_address[4] = {};
+    uint16_t enclosing_directory = root_directory_index;
+    if (find_directory(num_enclosing_directories, enclosing_directory_names, enclosing_directory) == false)
+    {
+        return false;
+    }
 
-    // Calculate the starting sector address of the enclosing directory
-    if (files_enclosing_directory == nullptr)
+    if (look_up_entry(enclosing_directory, file_name) != -1)
     {
-        calculate_sector_address_from_cluster_number(fat_32_volume_id.root_directory_first_cluster, enclosing_directory_sector_address);
+        // file already exists
+        return false;
     }
-    else 
+
+    if (file_systems_entry_index >= total_directory_entries)
     {
-        calculate_sector_address_from_cluster_number(files_enclosing_directory->starting_cluster_address, enclosing_directory_sector_address);
+        // the entry could not be stored after it's created
+        return false;
     }
 
-    // flag set when the first byte of a directory entry is 0x00 (indicating no more entrys)
-    bool end_of_directory_found = false;
+    if (invalidate_directory_snapshot() == false)
+    {
+        return false;
+    }
 
-    // flag that indicates if the file was found and marked as deleted 
-    bool file_found_in_directory = false;
+    // find a free 32 byte entry in the enclosing directory, the search stops with the sector it
+    // is in left in sector_buffer
+    DirectoryEntrySearchContext search_context;
+    search_context.file_system = this;
 
-    // Read at minimum the first sector in the directory
-    uint16_t directory_sector[512] ={};
-    sd_card.send_cmd17(directory_sector, enclosing_directory_sector_address);
+    Address32 entry_sector_address;
+    if (read_directory_clusters(get_directory_first_cluster(enclosing_directory), find_free_directory_entry_callback,
+            &search_context, entry_sector_address) == false)
+    {
+        return false;
+    }
 
-    while (!end_of_directory_found)
-    {   
-        for (uint16_t i = 0; i < directory_entrys_per_sector; i++)
+    if (search_context.entry_found == false)
+    {
+        // every entry of the directory is in use, the new one goes in a new cluster
+        if (extend_directory(entry_sector_address, entry_sector_address) == false)
         {
-            // Check first byte in 32 byte entry for end of directory
-            if (directory_sector[i*bytes_per_entry] == 0x00)
-            {
-                end_of_directory_found = true;
-                break; 
-            }
+            return false;
+        }
+        search_context.entry_offset = 0U;
+    }
+
+    const uint16_t entry_offset = search_context.entry_offset;
+
+    // empty file entry, no clusters and a size of 0 (times and dates are left as 0)
+    for (uint16_t j = 0; j < 11; j++)
+    {
+        sector_buffer.set_byte(entry_offset + j, file_name[j]);
+    }
+    sector_buffer.set_byte(entry_offset + attribute_byte_offset, 0x20);
+    for (uint16_t j = attribute_byte_offset + 1U; j < bytes_per_entry; j++)
+    {
+        sector_buffer.set_byte(entry_offset + j, 0x00);
+    }
+
+    if (block_cache.write_block(sector_buffer, entry_sector_address) == false)
+    {
+        return false;
+    }
+
+    file.writable = true;
+    file.entry_index = store_directory_entry(sector_buffer, entry_offset, enclosing_directory);
+    file.size = Address32();
+    file.position = Address32();
+    file.number_of_extents = 0U;
+    file.overflow_cluster = Address32();
+    file.window = FileExtent();
+    file.window_next_cluster = Address32();
+    file.entry_sector_address = entry_sector_address;
+    file.entry_offset = entry_offset;
+    file.first_cluster = Address32();
+    file.last_cluster = Address32();
+    file.allocated_clusters = Address32();
+    file.size_on_card = Address32();
+    file.size_update_interval = Address32();
+
+    file.is_open = true;
+    return true;
+}
+
+bool FileSystem::append(File &file, const uint16_t *buffer, const uint16_t &num_bytes)
+{
+    STATISTICS_TIME_OPERATION(statistics.append);
+
+    if (file.is_open == false || file.writable == false)
+    {
+        return false;
+    }
+
+    const uint16_t bytes_per_cluster_shift = sectors_per_cluster_shift + 9U;
+    uint16_t bytes_written = 0U;
+
+    while (bytes_written < num_bytes)
+    {
+        const uint16_t bytes_remaining = num_bytes - bytes_written;
 
-            // ignore directory entries that are deleted (i.e., start with 0xE5)
-            if (directory_sector[i*bytes_per_entry] == 0xE5)
+        if ((file.size >> bytes_per_cluster_shift) >= file.allocated_clusters)
+        {
+            // out of clusters, allocate enough for the rest of this append in one go (at least a batch)
+            Address32 clusters_needed = (Address32(0x0, bytes_remaining) + (Address32(0x0, 0x1) << bytes_per_cluster_shift) -
+                                            Address32(0x0, 0x1)) >> bytes_per_cluster_shift;
+            if (clusters_needed < Address32(0x0, cluster_allocation_batch))
             {
-                continue;
+                clusters_needed = Address32(0x0, cluster_allocation_batch);
             }
 
-            // Ignore LFN entries
-            if (directory_sector[i*bytes_per_entry + attribute_byte_offset] == 0xF)
+            if (allocate_file_clusters(file, clusters_needed, false) == false)
             {
-                continue;
+                return false;
             }
+        }
+
+        Address32 sector_address;
+        Address32 sectors_left_in_extent;
+        if (locate_file_sector(file, file.size, sector_address, sectors_left_in_extent) == false)
+        {
+            return false;
+        }
+
+        const uint16_t byte_in_sector = file.size.low_bits(9);
+        uint16_t bytes_transferred = 0U;
 
-            // ignore system or hidden entrys
-            if ((directory_sector[i*bytes_per_entry + attribute_byte_offset] & 1<<1) || // 1<<1 = 0x2 (hidden)
-                 (directory_sector[i*bytes_per_entry + attribute_byte_offset] & 1<<2))  // 1<<2 = 0x4 (system)
+        if (byte_in_sector == 0U && (bytes_written & 0x1) == 0U && bytes_remaining >= PackedSector::bytes_per_sector)
+        {
+            // whole sectors, write as many as possible in one transfer straight from the callers buffer
+            uint16_t num_sectors = bytes_remaining >> 9;
+            if (sectors_left_in_extent < Address32(0x0, num_sectors))
             {
-                continue;
+                num_sectors = sectors_left_in_extent.low();
             }
 
-            // ignore an entry that is a directory that is named "." or ".." these two entries tell us info
-            // about the current directory and the enclosing directory but we do not care for this info
-            if (directory_sector[i*bytes_per_entry + attribute_byte_offset] & 1<<4 &&
-                directory_sector[i*bytes_per_entry] == 0x2E)
+            // and no further than the end of the AU, the pre-erase count never spans two
+            const Address32 sectors_left_in_allocation_unit = allocation_unit_mask + Address32(0x0, 0x1) - (sector_address & allocation_unit_mask);
+            if (!allocation_unit_mask.is_zero() && sectors_left_in_allocation_unit < Address32(0x0, num_sectors))
             {
-                // check for a second byte that is 0x2E "." OR 0x20 " "
-                if (directory_sector[i*bytes_per_entry+1] == 0x2E ||
-                        directory_sector[i*bytes_per_entry+1] == 0x20)
-                {
-                    bool non_space_found = false;
-
-                    // iterate over remainder of bytes in entry name
-                    for (uint16_t j = 2; j < 11; j++)
-                    {
-                        if (directory_sector[i*bytes_per_entry+j] != 0x20)
-                        {
-                            non_space_found = true;
-                            break;
-                        }
-                    }
-
-                    if (non_space_found == false)
-                    {
-                        continue;
-                    }
-                }
+                num_sectors = sectors_left_in_allocation_unit.low();
             }
 
-            // VALID ENTRY, check if the valid entry matches the entry we're trying to delete
-            if (directory_sector[i*bytes_per_entry + attribute_byte_offset] != file_system_entrys[entry_index].attribute_byte)
+            if (block_cache.write_contiguous_blocks(buffer + (bytes_written >> 1), sector_address, num_sectors) == false)
             {
-                // attribute byte does not match, skip rest of iteration and look at next entry
-                continue;
+                return false;
             }
 
-            for (uint16_t j = 0; j < 11; j++)
+            bytes_transferred = num_sectors << 9;
+        }
+        else
+        {
+            // part of a sector, collect it in the tail sector until the sector is full
+            bytes_transferred = PackedSector::bytes_per_sector - byte_in_sector;
+            if (bytes_remaining < bytes_transferred)
             {
-                if (directory_sector[i*bytes_per_entry + j] != file_system_entrys[entry_index].name_of_entry[j])
-                {
-                    // entry name does not match, skip rest of iteration and look at next entry
-                    continue;
-                }
+                bytes_transferred = bytes_remaining;
             }
 
-            if (directory_sector[i*bytes_per_entry + 21] != file_system_entrys[entry_index].starting_cluster_address[0] ||
-                directory_sector[i*bytes_per_entry + 20] != file_system_entrys[entry_index].starting_cluster_address[1] ||
-                directory_sector[i*bytes_per_entry + 27] != file_system_entrys[entry_index].starting_cluster_address[2] ||
-                directory_sector[i*bytes_per_entry + 26] != file_system_entrys[entry_index].starting_cluster_address[3])
+            for (uint16_t i = 0; i < bytes_transferred; i++)
             {
-                // cluster numbers do not match, skip reset of iteration and look at next entry
-                continue;
+                const uint16_t buffer_byte = bytes_written + i;
+                const uint16_t value = (buffer_byte & 0x1) ? (buffer[buffer_byte >> 1] >> 8) : (buffer[buffer_byte >> 1] & 0xFF);
+                file.tail_sector.set_byte(byte_in_sector + i, value);
             }
 
-            // ENTRYS MATCH, clear higher bytes of cluster number and set first byte to 0xE5 according to FAT32 spec to delete entry
-            directory_sector[i*bytes_per_entry + 21] = 0x00;
-            directory_sector[i*bytes_per_entry + 20] = 0x00;
-            directory_sector[i*bytes_per_entry] = 0xE5;
-
-            // Write updated sector back to SD card with "deleted" entry
-            sd_card.send_cmd24(directory_sector, enclosing_directory_sector_address);
-
-            file_found_in_directory = true;
-
-            // delete file from file system entries once it has been marked as deleted on the sd card
-            file_system_entrys[entry_index].entry_in_use = false;
-            file_system_entrys[entry_index].parent_directory = nullptr;
-            file_system_entrys[entry_index].attribute_byte = 0x00;
-            for (uint16_t k = 0; k < 11; k++)
+            if (byte_in_sector + bytes_transferred == PackedSector::bytes_per_sector &&
+                block_cache.write_block(file.tail_sector, sector_address) == false)
             {
-                file_system_entrys[entry_index].name_of_entry[k] = 0x0;
+                return false;
             }
-            file_system_entrys[entry_index].starting_cluster_address[3] = 0x0;
-            file_system_entrys[entry_index].starting_cluster_address[2] = 0x0;
-            file_system_entrys[entry_index].starting_cluster_address[1] = 0x0;
-            file_system_entrys[entry_index].starting_cluster_address[0] = 0x0;
-            file_system_entrys[entry_index].size_of_entry_in_bytes[3] = 0x0;
-            file_system_entrys[entry_index].size_of_entry_in_bytes[2] = 0x0;
-            file_system_entrys[entry_index].size_of_entry_in_bytes[1] = 0x0;
-            file_system_entrys[entry_index].size_of_entry_in_bytes[0] = 0x0;
-    
         }
 
-        if (file_found_in_directory == true)
-        {
-            break;
-        }
-
-        // only send another read command if the end of directory has not been found
-        if (!end_of_directory_found)
-        {
-            // An entire sector has been processed without finding end of directory so read next sector
-            uint16_t count_of_one[4] = {0x0, 0x0, 0x0, 0x1};
-            add_4_byte_numbers(count_of_one, enclosing_directory_sector_address, enclosing_directory_sector_address);
-
-            sd_card.send_cmd17(directory_sector, enclosing_directory_sector_address);
-            xpd_putc('\n');
-        }
+        bytes_written += bytes_transferred;
+        file.size += Address32(0x0, bytes_transferred);
+    }
 
+    if (!file.size_update_interval.is_zero() && file.size - file.size_on_card >= file.size_update_interval)
+    {
+        return sync(file);
     }
 
-    // should return true if file was found in its enclosing directory and it was marked as deleted
-    return file_found_in_directory;
+    return true;
 }
 
-bool FileSystem::read_fat32_master_boot_record()
+bool FileSystem::sync(File &file)
 {
-    uint16_t mbr_512_byte_sector[512];
-
-    sd_driver::SDCard::sd_card_command_response_t cmd17_response;
+    STATISTICS_TIME_OPERATION(statistics.sync);
 
-    uint16_t mbr_sector_address[4] = {0x00, 0x00, 0x00, 0x00};
-
-    cmd17_response = sd_card.send_cmd17(mbr_512_byte_sector, mbr_sector_address);
-
-    if(cmd17_response == sd_driver::SDCard::sd_card_command_response_t::SD_CARD_RESPONSE_ACCEPTED)
+    if (file.is_open == false)
     {
-        // const uint16_t partition_1_first_byte_index = 446U;
-        fat_32_master_boot_record.primary_partition_1.boot_flag = mbr_512_byte_sector[446];
-
-        fat_32_master_boot_record.primary_partition_1.chs_begin[2] = mbr_512_byte_sector[447];
-        fat_32_master_boot_record.primary_partition_1.chs_begin[1] = mbr_512_byte_sector[448];
-        fat_32_master_boot_record.primary_partition_1.chs_begin[0] = mbr_512_byte_sector[449];
-
-        fat_32_master_boot_record.primary_partition_1.type_code = mbr_512_byte_sector[450];
-
-        fat_32_master_boot_record.primary_partition_1.chs_end[2] = mbr_512_byte_sector[451];
-        fat_32_master_boot_record.primary_partition_1.chs_end[1] = mbr_512_byte_sector[452];
-        fat_32_master_boot_record.primary_partition_1.chs_end[0] = mbr_512_byte_sector[453];
+        return false;
+    }
 
-        fat_32_master_boot_record.primary_partition_1.lba_begin[3] = mbr_512_byte_sector[454];
-        fat_32_master_boot_record.primary_partition_1.lba_begin[2] = mbr_512_byte_sector[455];
-        fat_32_master_boot_record.primary_partition_1.lba_begin[1] = mbr_512_byte_sector[456];
-        fat_32_master_boot_record.primary_partition_1.lba_begin[0] = mbr_512_byte_sector[457];
+    if (file.writable == false)
+    {
+        return true;
+    }
 
-        fat_32_master_boot_record.primary_partition_1.number_of_sectors[3] = mbr_512_byte_sector[458];
-        fat_32_master_boot_record.primary_partition_1.number_of_sectors[2] = mbr_512_byte_sector[459];
-        fat_32_master_boot_record.primary_partition_1.number_of_sectors[1] = mbr_512_byte_sector[460];
-        fat_32_master_boot_record.primary_partition_1.number_of_sectors[0] = mbr_512_byte_sector[461];
+    return stage(file) && commit();
+}
 
-        fat_32_master_boot_record.mbr_signature[1] = mbr_512_byte_sector[510];
-        fat_32_master_boot_record.mbr_signature[0] = mbr_512_byte_sector[511];
+bool FileSystem::stage(File &file)
+{
+    if (file.is_open == false)
+    {
+        return false;
+    }
 
-        // verify signature, check both ordering since documentation is often mixed
-        const bool valid_signature = (fat_32_master_boot_record.mbr_signature[0] == 0x55 && fat_32_master_boot_record.mbr_signature[1] == 0xAA) ||
-                                    (fat_32_master_boot_record.mbr_signature[0] == 0xAA && fat_32_master_boot_record.mbr_signature[1] == 0x55);
+    if (file.writable == false)
+    {
+        return true;
+    }
 
-        // TODO read other 3 partitions
+    // the data is written now, the FAT and the directory entry at the commit
+    if (file.size.low_bits(9) != 0U)
+    {
+        Address32 sector_address;
+        Address32 sectors_left_in_extent;
 
-        // TODO check if its a guarantee that partition 1 is guarnteed to have FAT32
-        // Check that type code and signature are valid
-        if ((fat_32_master_boot_record.primary_partition_1.type_code == 0xB ||
-            fat_32_master_boot_record.primary_partition_1.type_code == 0xC) && 
-            valid_signature)
+        if (locate_file_sector(file, file.size, sector_address, sectors_left_in_extent) == false ||
+            block_cache.write_block(file.tail_sector, sector_address) == false)
         {
-            return true;    
+            return false;
         }
+    }
 
+    IntentLog::DirectoryUpdate directory_update;
+    directory_update.entry_sector_address = file.entry_sector_address;
+    directory_update.entry_offset = file.entry_offset;
+    directory_update.name_checksum = entry_name_checksum(file.entry_index);
+    directory_update.first_cluster = file.first_cluster;
+    directory_update.size = file.size;
+
+    if (intent_log.add_directory_update(directory_update) == false &&
+        (commit() == false || intent_log.add_directory_update(directory_update) == false))
+    {
+        return false;
     }
 
-    return false;
+    entry_table.first_clusters[file.entry_index] = file.first_cluster;
+    entry_table.sizes[file.entry_index] = file.size;
+    file.size_on_card = file.size;
+    return true;
 }
 
-bool FileSystem::read_fat_32_volume_id(const uint16_t (&block_address)[4])
+bool FileSystem::commit()
 {
-    uint16_t volume_id_sector[512];
-    sd_driver::SDCard::sd_card_command_response_t cmd17_response;
+    // changed FAT sectors to FAT #1, each one is in the intent record before it is written
+    if (fat_cache.flush() == false)
+    {
+        return false;
+    }
 
-    cmd17_response = sd_card.send_cmd17(volume_id_sector, block_address);
+    // a device that queues writes (e.g., a SectorPipeline) has not necessarily written them yet
+    if (intent_log.is_empty())
+    {
+        return block_cache.flush();
+    }
 
-    for (uint16_t i = 0; i<3; i++)
+    // the data and FAT #1 have to be on the card before anything refers to them
+    if (block_cache.flush() == false || invalidate_directory_snapshot() == false)
     {
-        fat_32_volume_id.jmp_to_boot_code[i] = volume_id_sector[i];
+        return false;
     }
 
-    for (uint16_t i = 3; i<11; i++)
+    // the free cluster count changes with every commit, rather than writing it each time it is
+    // marked unknown until unmount() (the next free cluster is only a hint, it can stay)
+    if (fs_info_valid && fs_info_count_unknown == false)
     {
-        fat_32_volume_id.oem_name_ascii[i] = volume_id_sector[i];
+        if (write_fs_info(ClusterAllocator::unknown_count(), cluster_allocator.get_next_free_cluster()) == false)
+        {
+            return false;
+        }
+        fs_info_count_unknown = true;
     }
 
-    // Together should be Byte0 + Byte1 == 512 bytes per sector
-    //be careful b/c bytes are 02 and 00 in decimal which needs to be converted to hex 0x200 which is then 512
-    fat_32_volume_id.bytes_per_sector[1] = volume_id_sector[11];
-    fat_32_volume_id.bytes_per_sector[0] = volume_id_sector[12];
+    // a single directory entry and no FAT change is one sector write, nothing to roll forward
+    if ((intent_log.get_number_of_fat_ranges() > 0U || intent_log.get_number_of_directory_updates() > 1U) &&
+        intent_log.begin_commit() == false)
+    {
+        return false;
+    }
 
-    fat_32_volume_id.sectors_per_cluster = volume_id_sector[13];
+    if (apply_intent_record() == false || block_cache.flush() == false)
+    {
+        return false;
+    }
 
-    fat_32_volume_id.size_of_reserved_area_sectors[1] = volume_id_sector[14];
-    fat_32_volume_id.size_of_reserved_area_sectors[0] = volume_id_sector[15];
+    return intent_log.clear();
+}
+bool FileSystem::preallocate(File &file, const Address32 &num_bytes)
+{
+    if (file.is_open == false || file.writable == false)
+    {
+        return false;
+    }
 
-    // usually 2 fats
-    fat_32_volume_id.number_of_fats = volume_id_sector[16];
+    const uint16_t bytes_per_cluster_shift = sectors_per_cluster_shift + 9U;
+    const Address32 clusters_needed = (file.size + num_bytes + (Address32(0x0, 0x1) << bytes_per_cluster_shift) -
+                                        Address32(0x0, 0x1)) >> bytes_per_cluster_shift;
 
-    // should be zero for FAT 32
-    fat_32_volume_id.max_num_files_in_root_dir[1] = volume_id_sector[17];
-    fat_32_volume_id.max_num_files_in_root_dir[0] = volume_id_sector[18];
+    // a single contiguous run if the card has one, otherwise as few runs as possible
+    while (file.allocated_clusters < clusters_needed)
+    {
+        if (allocate_file_clusters(file, clusters_needed - file.allocated_clusters, true) == false)
+        {
+            return false;
+        }
+    }
 
-    // if ZERO check the extended 4 byte field
-    fat_32_volume_id.number_of_sectors_in_file_system[1] = volume_id_sector[19];
-    fat_32_volume_id.number_of_sectors_in_file_system[0] = volume_id_sector[20];
+    return true;
+}
+
+bool FileSystem::read(File &file, uint16_t *buffer, const uint16_t &num_bytes, uint16_t &bytes_read)
+{
+    STATISTICS_TIME_OPERATION(statistics.read);
+
+    bytes_read = 0U;
 
-    if (volume_id_sector[21] == static_cast<uint16_t>(media_type_t::REMOVABLE_DISK))
+    if (file.is_open == false)
     {
-        fat_32_volume_id.media_type = media_type_t::REMOVABLE_DISK;
+        return false;
     }
-    else if (volume_id_sector[21] == static_cast<uint16_t>(media_type_t::FIXED_DISK))
+
+    // never read past the end of the file
+    uint16_t bytes_to_read = num_bytes;
+    const Address32 bytes_left_in_file = file.size - file.position;
+    if (bytes_left_in_file < Address32(0x0, num_bytes))
     {
-        fat_32_volume_id.media_type = media_type_t::FIXED_DISK;
+        bytes_to_read = bytes_left_in_file.low();
     }
 
-    // Should be 0 for FAT32
-    fat_32_volume_id.size_of_each_fat_in_sectors[1] = volume_id_sector[22];
-    fat_32_volume_id.size_of_each_fat_in_sectors[0] = volume_id_sector[23];
-        
-    fat_32_volume_id.sectors_per_track_in_storage_device[1] = volume_id_sector[24];
-    fat_32_volume_id.sectors_per_track_in_storage_device[0] = volume_id_sector[25];        
+    while (bytes_read < bytes_to_read)
+    {
+        Address32 sector_address;
+        Address32 sectors_left_in_extent;
+        if (locate_file_sector(file, file.position, sector_address, sectors_left_in_extent) == false)
+        {
+            // cluster chain is shorter than the file size says
+            return false;
+        }
 
-    fat_32_volume_id.num_heads_in_storage_device[1] = volume_id_sector[26];
-    fat_32_volume_id.num_heads_in_storage_device[0] = volume_id_sector[27];
+        const uint16_t byte_in_sector = file.position.low_bits(9);
+        const uint16_t bytes_remaining = bytes_to_read - bytes_read;
+        uint16_t bytes_transferred = 0U;
 
-    fat_32_volume_id.num_of_sectors_before_start_partition[3] = volume_id_sector[28];
-    fat_32_volume_id.num_of_sectors_before_start_partition[2] = volume_id_sector[29];
-    fat_32_volume_id.num_of_sectors_before_start_partition[1] = volume_id_sector[30];
-    fat_32_volume_id.num_of_sectors_before_start_partition[0] = volume_id_sector[31];
-        
+        if (byte_in_sector == 0U && (bytes_read & 0x1) == 0U && bytes_remaining >= PackedSector::bytes_per_sector)
+        {
+            // whole sectors, read the rest of the extent (or as much as requested) in one transfer
+            // straight into the callers buffer
+            uint16_t num_sectors = bytes_remaining >> 9;
+            if (sectors_left_in_extent < Address32(0x0, num_sectors))
+            {
+                num_sectors = sectors_left_in_extent.low();
+            }
+
+            // file data does not go through block_cache, it would push out the directory sectors
+            if (block_device.read_contiguous_blocks(buffer + (bytes_read >> 1), sector_address, num_sectors) == false)
+            {
+                return false;
+            }
+
+            bytes_transferred = num_sectors << 9;
+        }
+        else
+        {
+            // part of a sector, read it into sector_buffer and copy out the bytes that are needed
+            if (block_device.read_block(sector_buffer, sector_address) == false)
+            {
+                return false;
+            }
+
+            bytes_transferred = PackedSector::bytes_per_sector - byte_in_sector;
+            if (bytes_remaining < bytes_transferred)
+            {
+                bytes_transferred = bytes_remaining;
+            }
+
+            for (uint16_t i = 0; i < bytes_transferred; i++)
+            {
+                const uint16_t buffer_byte = bytes_read + i;
+                const uint16_t value = sector_buffer.get_byte(byte_in_sector + i);
+                uint16_t &word = buffer[buffer_byte >> 1];
+                word = (buffer_byte & 0x1) ? ((word & 0x00FF) | (value << 8)) : ((word & 0xFF00) | value);
+            }
+        }
+
+        bytes_read += bytes_transferred;
+        file.position += Address32(0x0, bytes_transferred);
+    }
+
+    return true;
+}
+
+bool FileSystem::seek(File &file, const Address32 &position)
+{
+    if (file.is_open == false || position > file.size)
+    {
+        return false;
+    }
+
+    file.position = position;
+    return true;
+}
+
+bool FileSystem::close(File &file)
+{
+    STATISTICS_TIME_OPERATION(statistics.close);
+
+    if (file.is_open == false)
+    {
+        return false;
+    }
+
+    if (file.writable == false)
+    {
+        file.is_open = false;
+        return true;
+    }
+
+    // release the clusters past the end of the file, a chain longer than the file is not valid FAT32
+    const uint16_t bytes_per_cluster_shift = sectors_per_cluster_shift + 9U;
+    const Address32 clusters_used = (file.size + (Address32(0x0, 0x1) << bytes_per_cluster_shift) - Address32(0x0, 0x1)) >> bytes_per_cluster_shift;
+
+    if (clusters_used < file.allocated_clusters)
+    {
+        Address32 first_unused_cluster;
+
+        if (clusters_used.is_zero())
+        {
+            first_unused_cluster = file.first_cluster;
+            file.first_cluster = Address32();
+        }
+        else
+        {
+            const Address32 last_used_file_cluster = clusters_used - Address32(0x0, 0x1);
+            const FileExtent *extent = find_extent(file, last_used_file_cluster);
+
+            if (extent == nullptr)
+            {
+                return false;
+            }
+
+            const Address32 last_used_cluster = extent->first_cluster + (last_used_file_cluster - extent->first_file_cluster);
+
+            if (fat_cache.read_entry(last_used_cluster, first_unused_cluster) == false ||
+                fat_cache.write_entry(last_used_cluster, Address32(0x0FFF, 0xFFFF)) == false)
+            {
+                return false;
+            }
+        }
+
+        if (free_cluster_chain(first_unused_cluster) == false)
+        {
+            return false;
+        }
+    }
+
+    const bool file_synced = sync(file);
+    file.is_open = false;
+    return file_synced;
+}
+
+bool FileSystem::unmount()
+{
+    if (commit() == false)
+    {
+        return false;
+    }
+
+    // nothing changes after the last commit, so the count is right again
+    if (write_fs_info(cluster_allocator.get_free_cluster_count(), cluster_allocator.get_next_free_cluster()) == false)
+    {
+        return false;
+    }
+
+    fs_info_count_unknown = false;
+
+    // after FSInfo, the snapshot is only current while FSInfo is as it was when it was saved
+    if (directory_snapshot_enabled && save_directory_snapshot() == false)
+    {
+        return false;
+    }
+
+    return block_device.flush();
+}
+
+Address32 FileSystem::get_free_cluster_count() const
+{
+    return cluster_allocator.get_free_cluster_count();
+}
+
+sd_driver::BlockCache::BlockCacheStatistics FileSystem::get_block_cache_statistics() const
+{
+    return block_cache.get_statistics();
+}
+
+FATCache::FATCacheStatistics FileSystem::get_fat_cache_statistics() const
+{
+    return fat_cache.get_statistics();
+}
+
+FileSystem::FileSystemStatistics FileSystem::get_statistics() const
+{
+    return statistics;
+}
+
+void FileSystem::reset_statistics()
+{
+    statistics = FileSystemStatistics();
+    block_cache.reset_statistics();
+    fat_cache.reset_statistics();
+}
+
+void FileSystem::dump_statistics() const
+{
+    const sd_driver::BlockCache::BlockCacheStatistics block_cache_statistics = block_cache.get_statistics();
+    sd_driver::xpd_echo_statistic("block cache hits", block_cache_statistics.hits);
+    sd_driver::xpd_echo_statistic("block cache misses", block_cache_statistics.misses);
+
+    if (sd_driver::statistics_enabled == false)
+    {
+        xpd_puts("file system statistics not compiled in (SD_FS_STATISTICS)\n");
+        return;
+    }
+
+    const FATCache::FATCacheStatistics fat_cache_statistics = fat_cache.get_statistics();
+    sd_driver::xpd_echo_statistic("fat cache hits", fat_cache_statistics.hits);
+    sd_driver::xpd_echo_statistic("fat cache misses", fat_cache_statistics.misses);
+    sd_driver::xpd_echo_statistic("fat cache write backs", fat_cache_statistics.write_backs);
+    sd_driver::xpd_echo_operation_statistics("mount", statistics.mount);
+    sd_driver::xpd_echo_operation_statistics("open", statistics.open);
+    sd_driver::xpd_echo_operation_statistics("create", statistics.create);
+    sd_driver::xpd_echo_operation_statistics("read", statistics.read);
+    sd_driver::xpd_echo_operation_statistics("append", statistics.append);
+    sd_driver::xpd_echo_operation_statistics("sync", statistics.sync);
+    sd_driver::xpd_echo_operation_statistics("close", statistics.close);
+    sd_driver::xpd_echo_operation_statistics("delete file", statistics.delete_file);
+}
+
+bool FileSystem::delete_file(const uint16_t (&file_name)[11], const uint16_t &num_enclosing_directories, const uint16_t (&enclosing_directory_names)[10][11])
+{
+    STATISTICS_TIME_OPERATION(statistics.delete_file);
+
+    // index of file to be deleted in entry_table IF it exists
+    const int16_t entry_index = find_entry(file_name, num_enclosing_directories, enclosing_directory_names);
+
+    if (entry_index == -1)
+    {
+        // early return (that operation failed) if the file name is not found
+        return false;
+    }
+
+    // Now update the root directory entries and "delete" the file by setting the first byte to 0xE5 & clearing the upper cluster byte addr
+
+    // Do this by looking at the entry, then look at the parent directory (be careful of the root as enclosing directory)
+    // read in the that directory, a cluster at a time, and look for the entry, once you find it, update and delete
+
+    if (invalidate_directory_snapshot() == false)
+    {
+        return false;
+    }
+
+    // Find the most immediate enclosing directory, root_directory_index indicates file is in root directory
+    const uint16_t files_enclosing_directory = entry_table.parents[entry_index];
+
+    DirectoryEntrySearchContext search_context;
+    search_context.file_system = this;
+    search_context.entry_to_find = entry_index;
+
+    // sector_buffer holds the sector the entry was found in once the search completes, the read
+    // is stopped as soon as the entry is found so the sector is not overwritten
+    Address32 enclosing_directory_sector_address;
+    if (read_directory_clusters(get_directory_first_cluster(files_enclosing_directory), find_directory_entry_callback,
+            &search_context, enclosing_directory_sector_address) == false)
+    {
+        return false;
+    }
+
+    if (search_context.entry_found == false)
+    {
+        return false;
+    }
+
+    // the chain the entry on the card points at, the clusters of a file staged but not committed
+    // since are only allocated in FAT #1 and are given back by the roll back anyway
+    const Address32 first_cluster_on_card = read_starting_cluster_address(sector_buffer, search_context.entry_offset);
+
+    if (intent_log.get_number_of_freed_chains() >= IntentLog::max_freed_chains)
+    {
+        // no room to record the chain, commit the earlier deletes (which needs sector_buffer)
+        if (commit() == false || block_cache.read_block(sector_buffer, enclosing_directory_sector_address) == false)
+        {
+            return false;
+        }
+    }
+
+    // a roll back restores FAT #1 from FAT #2, where the chain is still allocated, and frees it
+    // again unless the entry is still on the card
+    IntentLog::FreedChain freed_chain;
+    freed_chain.first_cluster = first_cluster_on_card;
+    freed_chain.entry_sector_address = enclosing_directory_sector_address;
+    freed_chain.entry_offset = search_context.entry_offset;
+
+    if (first_cluster_on_card >= Address32(0x0, 0x2) && intent_log.log_freed_chain(freed_chain) == false)
+    {
+        return false;
+    }
+
+    // ENTRYS MATCH, clear higher bytes of cluster number and set first byte to 0xE5 according to FAT32 spec to delete entry
+    sector_buffer.set_le16(search_context.entry_offset + 20, 0x0000);
+    sector_buffer.set_byte(search_context.entry_offset, 0xE5);
+
+    // and the LFN entries of its long name, those in an earlier sector are left as orphans (their
+    // checksum no longer matches a short entry so they are ignored)
+    for (uint16_t offset = search_context.long_name_entry_offset; offset < search_context.entry_offset; offset += bytes_per_entry)
+    {
+        sector_buffer.set_byte(offset, 0xE5);
+    }
+
+    // Write updated sector back to SD card with "deleted" entry, the entry is gone from the card
+    // before any of its clusters are freed so they are never free and in use at once
+    if (block_cache.write_block(sector_buffer, enclosing_directory_sector_address) == false ||
+        block_cache.flush() == false)
+    {
+        return false;
+    }
+
+    intent_log.remove_directory_update(enclosing_directory_sector_address, search_context.entry_offset);
+
+    // free every cluster of the file a FAT sector at a time, so a large mostly contiguous file
+    // costs one update per FAT sector rather than one per cluster
+    if (free_cluster_chain(entry_table.first_clusters[entry_index]) == false)
+    {
+        return false;
+    }
+
+    // without an intent record there is nothing to roll back with, write every FAT copy now
+    if (intent_log.is_enabled() == false && fat_cache.flush() == false)
+    {
+        return false;
+    }
+
+    // delete file from file system entries once it has been marked as deleted on the sd card
+    path_index_remove(entry_index);
+    entry_table.attributes[entry_index] = 0x00;
+    entry_table.parents[entry_index] = root_directory_index;
+    for (uint16_t k = 0; k < packed_name_words; k++)
+    {
+        entry_table.names[entry_index][k] = 0x0;
+    }
+    entry_table.first_clusters[entry_index] = Address32();
+    entry_table.sizes[entry_index] = Address32();
+    entry_table.long_name_lengths[entry_index] = 0U;
+
+    // file was found in its enclosing directory and it was marked as deleted
+    return true;
+}
+
+int16_t FileSystem::find_entry(const uint16_t (&file_name)[11], const uint16_t &num_enclosing_directories, const uint16_t (&enclosing_directory_names)[10][11])
+{
+    uint16_t directory = root_directory_index;
+    if (find_directory(num_enclosing_directories, enclosing_directory_names, directory) == false)
+    {
+        return -1;
+    }
+
+    return look_up_entry(directory, file_name);
+}
+
+bool FileSystem::find_directory(const uint16_t &num_enclosing_directories, const uint16_t (&enclosing_directory_names)[10][11],
+                                uint16_t &directory)
+{
+    // walk down from the root one path index look up per directory, in lazy mode directories along
+    // the path that are not loaded yet are read from the SD card
+    directory = root_directory_index;
+    for (uint16_t depth = num_enclosing_directories; depth > 0; depth--)
+    {
+        const int16_t entry_index = look_up_entry(directory, enclosing_directory_names[depth - 1]);
+
+        if (entry_index == -1 || is_directory(entry_index) == false)
+        {
+            return false;
+        }
+
+        directory = static_cast<uint16_t>(entry_index);
+    }
+
+    return true;
+}
+
+int16_t FileSystem::look_up_entry(const uint16_t &parent_directory, const uint16_t (&entry_name)[11])
+{
+    // already loaded by the full scan or a previous look up?
+    const int16_t entry_index = path_index_look_up(parent_directory, entry_name);
+
+    if (entry_index != -1)
+    {
+        return entry_index;
+    }
+
+    if (mount_mode != mount_mode_t::LAZY || directory_tree_complete)
+    {
+        // with a full scan every entry that exists is already loaded
+        return -1;
+    }
+
+    DirectoryLookupContext look_up_context;
+    look_up_context.file_system = this;
+    look_up_context.parent_directory = parent_directory;
+    look_up_context.entry_name = &entry_name;
+
+    Address32 last_sector_address;
+    if (read_directory_clusters(get_directory_first_cluster(parent_directory), look_up_entry_callback,
+            &look_up_context, last_sector_address) == false)
+    {
+        return -1;
+    }
+
+    return look_up_context.entry_found;
+}
+
+void FileSystem::pack_entry_name(const uint16_t (&entry_name)[11], uint16_t (&packed_name)[packed_name_words])
+{
+    // bitwise & since the upper 8 bits of the given name are not guaranteed to be zero
+    for (uint16_t i = 0; i < packed_name_words - 1U; i++)
+    {
+        packed_name[i] = (entry_name[i << 1] & 0xFF) | ((entry_name[(i << 1) + 1U] & 0xFF) << 8);
+    }
+    packed_name[packed_name_words - 1U] = entry_name[10] & 0xFF;
+}
+
+uint16_t FileSystem::get_entry_name_character(const uint16_t &entry_index, const uint16_t &position) const
+{
+    const uint16_t word = entry_table.names[entry_index][position >> 1];
+
+    return (position & 0x1) ? (word >> 8) : (word & 0xFF);
+}
+
+bool FileSystem::entry_name_matches(const uint16_t &entry_index, const uint16_t (&packed_name)[packed_name_words]) const
+{
+    // two characters per compare
+    for (uint16_t i = 0; i < packed_name_words; i++)
+    {
+        if (entry_table.names[entry_index][i] != packed_name[i])
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+uint16_t FileSystem::path_index_hash(const uint16_t &parent_directory, const uint16_t (&packed_name)[packed_name_words])
+{
+    // key is (parent, name), the root directory (root_directory_index) is key 0 and any other directory its index + 1
+    uint16_t hash = static_cast<uint16_t>(parent_directory + 1U);
+
+    // rotate and xor in every two characters, no multiply/ divide needed
+    for (uint16_t i = 0; i < packed_name_words; i++)
+    {
+        hash = ((hash << 5) | (hash >> 11)) ^ packed_name[i];
+    }
+
+    // fold the upper bits in since only the lower bits select the slot
+    return hash ^ (hash >> 8);
+}
+
+void FileSystem::path_index_insert(const uint16_t &entry_index)
+{
+    uint16_t slot = path_index_hash(entry_table.parents[entry_index], entry_table.names[entry_index]) & (path_index_slots - 1U);
+
+    // linear probing, there are more slots than entries so a free slot always exists
+    while (path_index[slot] != path_index_empty_slot && path_index[slot] != path_index_deleted_slot)
+    {
+        slot = (slot + 1U) & (path_index_slots - 1U);
+    }
+
+    path_index[slot] = entry_index;
+}
+
+void FileSystem::path_index_remove(const uint16_t &entry_index)
+{
+    for (uint16_t i = 0; i < path_index_slots; i++)
+    {
+        if (path_index[i] == entry_index)
+        {
+            // leave a marker so probing for entries further along the chain does not stop here
+            path_index[i] = path_index_deleted_slot;
+            return;
+        }
+    }
+}
+
+int16_t FileSystem::path_index_look_up(const uint16_t &parent_directory, const uint16_t (&entry_name)[11]) const
+{
+    uint16_t packed_name[packed_name_words];
+    pack_entry_name(entry_name, packed_name);
+
+    uint16_t slot = path_index_hash(parent_directory, packed_name) & (path_index_slots - 1U);
+
+    for (uint16_t probes = 0; probes < path_index_slots; probes++)
+    {
+        const uint16_t entry_index = path_index[slot];
+
+        if (entry_index == path_index_empty_slot)
+        {
+            break;
+        }
+
+        // only parents[] and names[] are touched until the entry is found
+        if (entry_index != path_index_deleted_slot && entry_table.parents[entry_index] == parent_directory &&
+            entry_name_matches(entry_index, packed_name) && (entry_table.attributes[entry_index] & entry_in_use_flag) != 0U)
+        {
+            return static_cast<int16_t>(entry_index);
+        }
+
+        slot = (slot + 1U) & (path_index_slots - 1U);
+    }
+
+    return -1;
+}
+
+FileSystem::directory_entry_t FileSystem::get_entry_type(const uint16_t &attribute_byte)
+{
+    if (attribute_byte & 1<<3) // 1<<3 = 0x8 (volume label)
+    {
+        return directory_entry_t::VOLUME_LABEL;
+    }
+    else if (attribute_byte & 1<<4) // 1<<4 = 0x10 (directory)
+    {
+        return directory_entry_t::DIRECTORY_ENTRY;
+    }
+
+    // 1<<5 = 0x20 (file), the archive bit is not always set for a file
+    return directory_entry_t::FILE_ENTRY;
+}
+
+bool FileSystem::is_directory(const uint16_t &entry_index) const
+{
+    return get_entry_type(entry_table.attributes[entry_index]) == directory_entry_t::DIRECTORY_ENTRY;
+}
+
+bool FileSystem::read_fat32_master_boot_record()
+{
+    PackedSector &mbr_512_byte_sector = sector_buffer;
+
+    const Address32 mbr_sector_address;
+
+    if (block_cache.read_block(mbr_512_byte_sector, mbr_sector_address) == false)
+    {
+        return false;
+    }
+
+    // the four 16 byte primary partition entries follow 446 bytes of boot code
+    for (uint16_t i = 0; i < number_of_primary_partitions; i++)
+    {
+        read_primary_partition(mbr_512_byte_sector, 446U + (i << 4), fat_32_master_boot_record.primary_partitions[i]);
+    }
+
+    fat_32_master_boot_record.mbr_signature[1] = mbr_512_byte_sector.get_byte(510);
+    fat_32_master_boot_record.mbr_signature[0] = mbr_512_byte_sector.get_byte(511);
+
+    // verify signature, check both ordering since documentation is often mixed
+    const bool valid_signature = (fat_32_master_boot_record.mbr_signature[0] == 0x55 && fat_32_master_boot_record.mbr_signature[1] == 0xAA) ||
+                                (fat_32_master_boot_record.mbr_signature[0] == 0xAA && fat_32_master_boot_record.mbr_signature[1] == 0x55);
+
+    const FAT32PrimaryPartition &partition = fat_32_master_boot_record.primary_partitions[partition_index];
+    partition_lba_begin = partition.lba_begin;
+
+    // Check that type code (of the partition this volume is on) and signature are valid
+    return (partition.type_code == 0xB || partition.type_code == 0xC) && valid_signature;
+}
+
+void FileSystem::read_primary_partition(const PackedSector &mbr_sector, const uint16_t &partition_offset,
+                                        FAT32PrimaryPartition &partition)
+{
+    partition.boot_flag = mbr_sector.get_byte(partition_offset);
+
+    partition.chs_begin[2] = mbr_sector.get_byte(partition_offset + 1U);
+    partition.chs_begin[1] = mbr_sector.get_byte(partition_offset + 2U);
+    partition.chs_begin[0] = mbr_sector.get_byte(partition_offset + 3U);
+
+    partition.type_code = mbr_sector.get_byte(partition_offset + 4U);
+
+    partition.chs_end[2] = mbr_sector.get_byte(partition_offset + 5U);
+    partition.chs_end[1] = mbr_sector.get_byte(partition_offset + 6U);
+    partition.chs_end[0] = mbr_sector.get_byte(partition_offset + 7U);
+
+    partition.lba_begin = mbr_sector.get_le32(partition_offset + 8U);
+
+    partition.number_of_sectors = mbr_sector.get_le32(partition_offset + 12U);
+}
+
+bool FileSystem::read_fat_32_volume_id(const Address32 &block_address)
+{
+    PackedSector &volume_id_sector = sector_buffer;
+
+    if (block_cache.read_block(volume_id_sector, block_address) == false)
+    {
+        return false;
+    }
+
+    for (uint16_t i = 0; i<3; i++)
+    {
+        fat_32_volume_id.jmp_to_boot_code[i] = volume_id_sector.get_byte(i);
+    }
+
+    for (uint16_t i = 3; i<11; i++)
+    {
+        fat_32_volume_id.oem_name_ascii[i-3] = volume_id_sector.get_byte(i);
+    }
+
+    // Together should be Byte0 + Byte1 == 512 bytes per sector
+    //be careful b/c bytes are 02 and 00 in decimal which needs to be converted to hex 0x200 which is then 512
+    fat_32_volume_id.bytes_per_sector = volume_id_sector.get_le16(11);
+
+    fat_32_volume_id.sectors_per_cluster = volume_id_sector.get_byte(13);
+
+    fat_32_volume_id.size_of_reserved_area_sectors = volume_id_sector.get_le16(14);
+
+    // usually 2 fats
+    fat_32_volume_id.number_of_fats = volume_id_sector.get_byte(16);
+
+    // should be zero for FAT 32
+    fat_32_volume_id.max_num_files_in_root_dir = volume_id_sector.get_le16(17);
+
+    // if ZERO check the extended 4 byte field
+    fat_32_volume_id.number_of_sectors_in_file_system = volume_id_sector.get_le16(19);
+
+    if (volume_id_sector.get_byte(21) == static_cast<uint16_t>(media_type_t::REMOVABLE_DISK))
+    {
+        fat_32_volume_id.media_type = media_type_t::REMOVABLE_DISK;
+    }
+    else if (volume_id_sector.get_byte(21) == static_cast<uint16_t>(media_type_t::FIXED_DISK))
+    {
+        fat_32_volume_id.media_type = media_type_t::FIXED_DISK;
+    }
+
+    // Should be 0 for FAT32
+    fat_32_volume_id.size_of_each_fat_in_sectors = volume_id_sector.get_le16(22);
+        
+    fat_32_volume_id.sectors_per_track_in_storage_device = volume_id_sector.get_le16(24);
+
+    fat_32_volume_id.num_heads_in_storage_device = volume_id_sector.get_le16(26);
+
+    fat_32_volume_id.num_of_sectors_before_start_partition = volume_id_sector.get_le32(28);
+        
     // Will be 0 if the 2 byte field above is non-zero (bytes 19-20)
-    fat_32_volume_id.num_of_sectors_in_file_system_extended[3] = volume_id_sector[32];
-    fat_32_volume_id.num_of_sectors_in_file_system_extended[2] = volume_id_sector[33];
-    fat_32_volume_id.num_of_sectors_in_file_system_extended[1] = volume_id_sector[34];
-    fat_32_volume_id.num_of_sectors_in_file_system_extended[0] = volume_id_sector[35];
+    fat_32_volume_id.num_of_sectors_in_file_system_extended = volume_id_sector.get_le32(32);
+
+    fat_32_volume_id.sectors_per_fat = volume_id_sector.get_le32(36);
+
+    // usually 2 
+    fat_32_volume_id.root_directory_first_cluster = volume_id_sector.get_le32(44);
+
+    fat_32_volume_id.fs_info_sector = volume_id_sector.get_le16(48);
+
+    fat_32_volume_id.backup_boot_sector = volume_id_sector.get_le16(50);
+    
+    // signature value should be 0x55AA or 0xAA55(if done backwards)
+    fat_32_volume_id.volume_id_signature[1] = volume_id_sector.get_byte(510);
+    fat_32_volume_id.volume_id_signature[0] = volume_id_sector.get_byte(511);
+
+    // verify signature, check both ordering since documentation is often mixed
+    const bool valid_signature = (fat_32_volume_id.volume_id_signature[0] == 0x55 && fat_32_volume_id.volume_id_signature[1] == 0xAA) ||
+                                    (fat_32_volume_id.volume_id_signature[0] == 0xAA && fat_32_volume_id.volume_id_signature[1] == 0x55);
+
+    // print all values
+    // xpd_puts("sectors per fat\n");
+    // for (uint16_t i=36; i<40;i++){
+    //     xpd_echo_int(volume_id_sector.get_byte(i), XPD_Flag_UnsignedDecimal); // 0x1 GOOD
+    // xpd_putc('\n');
+    // }
+    // xpd_putc('\n');
+
+    // xpd_puts("root directoy first cluster\n");
+    // for (uint16_t i=44; i<48;i++){
+    //     xpd_echo_int(volume_id_sector.get_byte(i), XPD_Flag_UnsignedDecimal); // 0x1 GOOD
+    // xpd_putc('\n');
+    // }
+
+    return valid_signature;
+}
+
+void FileSystem::read_fs_info()
+{
+    fs_info_valid = false;
+
+    // 0 and 0xFFFF both mean there is no FSInfo sector
+    if (fat_32_volume_id.fs_info_sector != 0x0 && fat_32_volume_id.fs_info_sector != 0xFFFF)
+    {
+        fs_info_sector_address = partition_lba_begin + Address32(0x0, fat_32_volume_id.fs_info_sector);
+
+        PackedSector &fs_info_sector = sector_buffer;
+
+        // lead signature "RRaA", structure signature "rrAa" and trail signature 0xAA550000
+        fs_info_valid = block_device.read_block(fs_info_sector, fs_info_sector_address) &&
+                        fs_info_sector.get_le32(0) == Address32(0x4161, 0x5252) &&
+                        fs_info_sector.get_le32(484) == Address32(0x6141, 0x7272) &&
+                        fs_info_sector.get_le32(508) == Address32(0xAA55, 0x0000);
+    }
+
+    if (fs_info_valid)
+    {
+        fs_info_count_unknown = sector_buffer.get_le32(fs_info_free_count_offset) == ClusterAllocator::unknown_count();
+        cluster_allocator.configure(number_of_clusters, sector_buffer.get_le32(fs_info_free_count_offset),
+                                    sector_buffer.get_le32(fs_info_next_free_offset));
+    }
+    else
+    {
+        cluster_allocator.configure(number_of_clusters, ClusterAllocator::unknown_count(), ClusterAllocator::unknown_count());
+    }
+}
+
+void FileSystem::configure_allocation_units()
+{
+    volume_alignment = VolumeAlignment();
+    volume_alignment.allocation_unit_sectors = block_device.get_allocation_unit_blocks();
+
+    if (volume_alignment.allocation_unit_sectors.is_zero())
+    {
+        return;
+    }
+
+    // the lowest set bit, a 12 MB AU lines up with whatever a 4 MB one does
+    const Address32 allocation_unit = volume_alignment.allocation_unit_sectors & (Address32() - volume_alignment.allocation_unit_sectors);
+    allocation_unit_mask = allocation_unit - Address32(0x0, 0x1);
+
+    volume_alignment.partition_aligned = (partition_lba_begin & allocation_unit_mask).is_zero();
+
+    const Address32 cluster_begin_offset = cluster_begin_lba & allocation_unit_mask;
+    volume_alignment.clusters_aligned = cluster_begin_offset.is_zero();
+
+    // sectors from the first cluster to the first AU boundary, AU boundaries fall between clusters
+    // if that is a whole number of clusters
+    const Address32 sectors_to_boundary = (allocation_unit - cluster_begin_offset) & allocation_unit_mask;
+    const Address32 clusters_per_allocation_unit = allocation_unit >> sectors_per_cluster_shift;
+
+    if (clusters_per_allocation_unit > Address32(0x0, 0x1) && sectors_to_boundary.low_bits(sectors_per_cluster_shift) == 0U)
+    {
+        volume_alignment.clusters_per_allocation_unit = clusters_per_allocation_unit;
+        cluster_allocator.set_allocation_unit(clusters_per_allocation_unit,
+                                                Address32(0x0, 0x2) + (sectors_to_boundary >> sectors_per_cluster_shift));
+    }
+}
+
+bool FileSystem::write_fs_info(const Address32 &free_cluster_count, const Address32 &next_free_cluster)
+{
+    if (fs_info_valid == false)
+    {
+        return true;
+    }
+
+    // FSInfo is not cached, it's only read at mount and written by commit()/ unmount()
+    if (block_device.read_block(sector_buffer, fs_info_sector_address) == false)
+    {
+        return false;
+    }
+
+    sector_buffer.set_le32(fs_info_free_count_offset, free_cluster_count);
+    sector_buffer.set_le32(fs_info_next_free_offset, next_free_cluster);
+
+    return block_device.write_block(sector_buffer, fs_info_sector_address);
+}
+
+bool FileSystem::recover_intent_log()
+{
+    const IntentLog::record_state_t state = intent_log.get_state();
+
+    if (state == IntentLog::record_state_t::CLEAN)
+    {
+        return true;
+    }
+
+    if (state == IntentLog::record_state_t::OPEN)
+    {
+        // FAT #1 back to FAT #2 wherever it changed
+        for (uint16_t i = 0; i < intent_log.get_number_of_fat_ranges(); i++)
+        {
+            Address32 fat_sector_offset;
+            Address32 number_of_sectors;
+            intent_log.get_fat_range(i, fat_sector_offset, number_of_sectors);
+
+            for (Address32 j; j < number_of_sectors; j += Address32(0x0, 0x1))
+            {
+                if (fat_cache.restore_sector(fat_sector_offset + j, sector_buffer) == false)
+                {
+                    return false;
+                }
+            }
+        }
+
+        // free the clusters of files deleted since again (in every FAT, no write back callback is
+        // set yet), unless the power went before the entry was
+        bool chain_freed = false;
+        for (uint16_t i = 0; i < intent_log.get_number_of_freed_chains(); i++)
+        {
+            const IntentLog::FreedChain freed_chain = intent_log.get_freed_chain(i);
+
+            if (block_cache.read_block(sector_buffer, freed_chain.entry_sector_address) == false)
+            {
+                return false;
+            }
+
+            const uint16_t first_byte = sector_buffer.get_byte(freed_chain.entry_offset);
+            if (first_byte != 0x00 && first_byte != 0xE5 &&
+                read_starting_cluster_address(sector_buffer, freed_chain.entry_offset) == freed_chain.first_cluster)
+            {
+                continue;
+            }
+
+            if (fat_cache.free_chain(freed_chain.first_cluster, number_of_clusters, nullptr, nullptr) == false)
+            {
+                return false;
+            }
+            chain_freed = true;
+        }
+
+        if (fat_cache.flush() == false)
+        {
+            return false;
+        }
+
+        if (chain_freed)
+        {
+            if (write_fs_info(ClusterAllocator::unknown_count(), cluster_allocator.get_next_free_cluster()) == false)
+            {
+                return false;
+            }
+            fs_info_count_unknown = fs_info_valid;
+        }
+    }
+    else if (apply_intent_record() == false)
+    {
+        // COMMITTING, FAT #1 is complete, finish the commit
+        return false;
+    }
+
+    // free extents noted from FAT sectors read before they were restored are not right, and the
+    // count is not either once chains were freed again
+    const Address32 free_cluster_count = fs_info_count_unknown ? ClusterAllocator::unknown_count() : cluster_allocator.get_free_cluster_count();
+    cluster_allocator.configure(number_of_clusters, free_cluster_count, cluster_allocator.get_next_free_cluster());
+
+    return block_cache.flush() && intent_log.clear();
+}
+
+bool FileSystem::apply_intent_record()
+{
+    // FAT #1 is complete, bring the other FATs up to date
+    for (uint16_t i = 0; i < intent_log.get_number_of_fat_ranges(); i++)
+    {
+        Address32 fat_sector_offset;
+        Address32 number_of_sectors;
+        intent_log.get_fat_range(i, fat_sector_offset, number_of_sectors);
+
+        for (Address32 j; j < number_of_sectors; j += Address32(0x0, 0x1))
+        {
+            if (fat_cache.mirror_sector(fat_sector_offset + j, sector_buffer) == false)
+            {
+                return false;
+            }
+        }
+    }
+
+    // then the directory entries can point at the clusters
+    for (uint16_t i = 0; i < intent_log.get_number_of_directory_updates(); i++)
+    {
+        const IntentLog::DirectoryUpdate directory_update = intent_log.get_directory_update(i);
+        const uint16_t entry_offset = directory_update.entry_offset;
+
+        if (block_cache.read_block(sector_buffer, directory_update.entry_sector_address) == false)
+        {
+            return false;
+        }
+
+        // an entry that was deleted (or is now another file) is left alone
+        const uint16_t first_byte = sector_buffer.get_byte(entry_offset);
+        if (first_byte == 0x00 || first_byte == 0xE5 || short_name_checksum(sector_buffer, entry_offset) != directory_update.name_checksum)
+        {
+            continue;
+        }
+
+        sector_buffer.set_le16(entry_offset + 20, directory_update.first_cluster.high());
+        sector_buffer.set_le16(entry_offset + 26, directory_update.first_cluster.low());
+        sector_buffer.set_le32(entry_offset + file_size_offset, directory_update.size);
+
+        if (block_cache.write_block(sector_buffer, directory_update.entry_sector_address) == false)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+FATCache::write_back_target_t FileSystem::fat_write_back_callback(const Address32 &fat_sector_offset, void *context)
+{
+    IntentLog &intent_log = static_cast<FileSystem *>(context)->intent_log;
+
+    if (intent_log.is_enabled() == false)
+    {
+        return FATCache::write_back_target_t::EVERY_FAT;
+    }
+
+    return intent_log.log_fat_sector(fat_sector_offset) ? FATCache::write_back_target_t::FAT_1_ONLY : FATCache::write_back_target_t::FAILED;
+}
+
+uint16_t FileSystem::entry_name_checksum(const uint16_t &entry_index) const
+{
+    uint16_t checksum = 0U;
+
+    // same as short_name_checksum(), from the name held in entry_table
+    for (uint16_t i = 0; i < 11; i++)
+    {
+        checksum = ((((checksum & 0x1) << 7) | (checksum >> 1)) + get_entry_name_character(entry_index, i)) & 0xFF;
+    }
+
+    return checksum;
+}
+
+bool FileSystem::load_directory_snapshot()
+{
+    if (directory_snapshot_address.is_zero() || intent_log.get_state() != IntentLog::record_state_t::CLEAN)
+    {
+        return false;
+    }
+
+    if (block_device.read_block(sector_buffer, directory_snapshot_address) == false)
+    {
+        return false;
+    }
+
+    const uint16_t number_of_entries = sector_buffer.get_le16(snapshot_number_of_entries_offset);
+    const uint16_t long_name_characters = sector_buffer.get_le16(snapshot_long_name_characters_offset);
+    const bool complete = sector_buffer.get_le16(snapshot_complete_offset) != 0U;
+    const uint16_t payload_sectors = sector_buffer.get_le16(snapshot_payload_sectors_offset);
+    const uint16_t payload_checksum = sector_buffer.get_le16(snapshot_payload_checksum_offset);
+    const uint16_t saved_directories_checksum = sector_buffer.get_le16(snapshot_directories_checksum_offset);
+
+    // saved by this build (same table sizes) for the volume as it is now: no FAT or directory
+    // change through the intent log and FSInfo untouched (the directories are checked once the
+    // entries say which they are)
+    if (sector_buffer.get_le32(snapshot_signature_offset) != directory_snapshot_signature() ||
+        sector_buffer.get_le16(snapshot_state_offset) == 0U ||
+        sector_buffer.get_le16(snapshot_total_entries_offset) != total_directory_entries ||
+        sector_buffer.get_le16(snapshot_long_name_pool_words_offset) != long_name_pool_words ||
+        number_of_entries > total_directory_entries || long_name_characters > (long_name_pool_words << 1) ||
+        payload_sectors >= directory_snapshot_sectors ||
+        (mount_mode != mount_mode_t::LAZY && complete == false) ||
+        sector_buffer.get_le32(snapshot_generation_offset) != intent_log.get_sequence() ||
+        sector_buffer.get_le32(snapshot_free_cluster_count_offset) != cluster_allocator.get_free_cluster_count() ||
+        sector_buffer.get_le32(snapshot_next_free_cluster_offset) != cluster_allocator.get_next_free_cluster())
+    {
+        return false;
+    }
+
+    DirectorySnapshotContext context;
+    context.file_system = this;
+    context.number_of_entries = number_of_entries;
+    context.number_of_long_name_words = (long_name_characters + 1U) >> 1;
+    settle_directory_snapshot_context(context);
+
+    // one multi block read of the entries straight into entry_table
+    if (payload_sectors != 0U && block_device.read_blocks(sector_buffer, directory_snapshot_address + Address32(0x0, 0x1),
+            payload_sectors, directory_snapshot_read_callback, &context) == false)
+    {
+        return false;
+    }
+
+    // entries past file_systems_entry_index are not looked at, what was read is simply dropped
+    if (context.section != directory_snapshot_end_section || context.checksum != payload_checksum)
+    {
+        return false;
+    }
+
+    // and the first cluster of every directory is as it was, another host that created, deleted,
+    // renamed or resized a file there changed it
+    uint16_t directories_checksum = 0U;
+    if (read_directories_checksum(number_of_entries, directories_checksum) == false || directories_checksum != saved_directories_checksum)
+    {
+        return false;
+    }
+
+    file_systems_entry_index = number_of_entries;
+    long_name_pool_used = long_name_characters;
+
+    // the snapshot holds the entries deleted in the session that saved it, drop them like a scan would
+    compact_entry_table();
+
+    for (uint16_t i = 0; i < file_systems_entry_index; i++)
+    {
+        path_index_insert(i);
+    }
+
+    directory_tree_complete = complete;
+    directory_snapshot_current = true;
+    directory_snapshot_entries = file_systems_entry_index;
+    return true;
+}
+
+void FileSystem::compact_entry_table()
+{
+    // an entry is stored after the directory it is in, so its parent is always at a lower index,
+    // every entry moves down (or stays) and the new index of its parent is already known
+    uint16_t new_indices[total_directory_entries];
+    uint16_t number_of_entries = 0U;
+    uint16_t number_of_long_name_characters = 0U;
+
+    for (uint16_t i = 0; i < file_systems_entry_index; i++)
+    {
+        const uint16_t parent_directory = entry_table.parents[i];
+        new_indices[i] = root_directory_index;
+
+        // entries in a deleted directory go with it
+        if ((entry_table.attributes[i] & entry_in_use_flag) == 0U ||
+            (parent_directory != root_directory_index && (parent_directory >= i || new_indices[parent_directory] == root_directory_index)))
+        {
+            continue;
+        }
+
+        const uint16_t entry_index = number_of_entries;
+        new_indices[i] = entry_index;
+        number_of_entries++;
+
+        for (uint16_t k = 0; k < packed_name_words; k++)
+        {
+            entry_table.names[entry_index][k] = entry_table.names[i][k];
+        }
+        entry_table.parents[entry_index] = (parent_directory == root_directory_index) ? root_directory_index : new_indices[parent_directory];
+        entry_table.attributes[entry_index] = entry_table.attributes[i];
+        entry_table.first_clusters[entry_index] = entry_table.first_clusters[i];
+        entry_table.sizes[entry_index] = entry_table.sizes[i];
+
+        // long names are in the pool in entry order too, so they also only move down
+        const uint16_t long_name_offset = entry_table.long_name_offsets[i];
+        const uint16_t long_name_length = entry_table.long_name_lengths[i];
+        for (uint16_t k = 0; k < long_name_length; k++)
+        {
+            set_long_name_character(number_of_long_name_characters + k, get_long_name_character(long_name_offset + k));
+        }
+        entry_table.long_name_offsets[entry_index] = number_of_long_name_characters;
+        entry_table.long_name_lengths[entry_index] = long_name_length;
+        number_of_long_name_characters += long_name_length;
+    }
+
+    file_systems_entry_index = number_of_entries;
+    long_name_pool_used = number_of_long_name_characters;
+}
+
+bool FileSystem::save_directory_snapshot()
+{
+    // a lazy mount may have loaded more entries since
+    if (directory_snapshot_address.is_zero() ||
+        (directory_snapshot_current && directory_snapshot_entries == file_systems_entry_index))
+    {
+        return true;
+    }
+
+    if (invalidate_directory_snapshot() == false)
+    {
+        return false;
+    }
+
+    uint16_t directories_checksum = 0U;
+    if (read_directories_checksum(file_systems_entry_index, directories_checksum) == false ||
+        block_device.read_block(sector_buffer, directory_snapshot_address) == false)
+    {
+        return false;
+    }
+
+    if (sector_buffer.get_le32(snapshot_signature_offset) == directory_snapshot_signature())
+    {
+        // the payload is rewritten below, the header must not vouch for it in the meantime
+        if (sector_buffer.get_le16(snapshot_state_offset) != 0U)
+        {
+            sector_buffer.set_le16(snapshot_state_offset, 0U);
+
+            if (block_device.write_block(sector_buffer, directory_snapshot_address) == false)
+            {
+                return false;
+            }
+        }
+    }
+    else
+    {
+        // first snapshot, the sectors must not hold anything yet
+        bool all_zero = true;
+        const uint16_t snapshot_sectors = directory_snapshot_sectors;
+        if (block_device.read_blocks(sector_buffer, directory_snapshot_address, snapshot_sectors, zero_sector_check_callback, &all_zero) == false)
+        {
+            return false;
+        }
+
+        if (all_zero == false)
+        {
+            directory_snapshot_address = Address32();
+            return true;
+        }
+    }
+
+    DirectorySnapshotContext context;
+    context.file_system = this;
+    context.number_of_entries = file_systems_entry_index;
+    context.number_of_long_name_words = (long_name_pool_used + 1U) >> 1;
+    settle_directory_snapshot_context(context);
+
+    const Address32 payload_words = Address32(0x0, file_systems_entry_index).multiply(directory_snapshot_entry_words) +
+                                    Address32(0x0, context.number_of_long_name_words);
+    const uint16_t payload_sectors = ((payload_words + Address32(0x0, PackedSector::words_per_sector - 1U)) >> 8).low();
+
+    // payload first, one multi block write
+    if (payload_sectors != 0U && block_device.write_blocks(sector_buffer, directory_snapshot_address + Address32(0x0, 0x1),
+            payload_sectors, directory_snapshot_write_callback, &context) == false)
+    {
+        return false;
+    }
+
+    // then the header that makes it current
+    sector_buffer.fill(0x00);
+    sector_buffer.set_le32(snapshot_signature_offset, directory_snapshot_signature());
+    sector_buffer.set_le16(snapshot_state_offset, 1U);
+    sector_buffer.set_le16(snapshot_total_entries_offset, total_directory_entries);
+    sector_buffer.set_le16(snapshot_long_name_pool_words_offset, long_name_pool_words);
+    sector_buffer.set_le16(snapshot_number_of_entries_offset, file_systems_entry_index);
+    sector_buffer.set_le16(snapshot_long_name_characters_offset, long_name_pool_used);
+    sector_buffer.set_le16(snapshot_complete_offset, directory_tree_complete ? 1U : 0U);
+    sector_buffer.set_le32(snapshot_generation_offset, intent_log.get_sequence());
+    sector_buffer.set_le32(snapshot_free_cluster_count_offset, cluster_allocator.get_free_cluster_count());
+    sector_buffer.set_le32(snapshot_next_free_cluster_offset, cluster_allocator.get_next_free_cluster());
+    sector_buffer.set_le16(snapshot_directories_checksum_offset, directories_checksum);
+    sector_buffer.set_le16(snapshot_payload_checksum_offset, context.checksum);
+    sector_buffer.set_le16(snapshot_payload_sectors_offset, payload_sectors);
+
+    if (block_device.write_block(sector_buffer, directory_snapshot_address) == false || block_device.flush() == false)
+    {
+        return false;
+    }
+
+    directory_snapshot_current = true;
+    directory_snapshot_entries = file_systems_entry_index;
+    return true;
+}
+
+bool FileSystem::invalidate_directory_snapshot()
+{
+    if (directory_snapshot_current == false)
+    {
+        return true;
+    }
+
+    // state 0, the rest of the header is left as it is so the sectors are still known to be ours
+    if (block_device.read_block(sector_buffer, directory_snapshot_address) == false)
+    {
+        return false;
+    }
+
+    sector_buffer.set_le16(snapshot_state_offset, 0U);
+
+    if (block_device.write_block(sector_buffer, directory_snapshot_address) == false || block_device.flush() == false)
+    {
+        return false;
+    }
+
+    directory_snapshot_current = false;
+    return true;
+}
+
+bool FileSystem::read_directories_checksum(const uint16_t &number_of_entries, uint16_t &checksum)
+{
+    checksum = 0U;
+
+    // the root directory first, then the directories in entry order
+    for (uint16_t i = 0; i <= number_of_entries; i++)
+    {
+        const uint16_t directory = (i == 0U) ? root_directory_index : i - 1U;
+
+        if (directory != root_directory_index &&
+            ((entry_table.attributes[directory] & entry_in_use_flag) == 0U || (entry_table.attributes[directory] & 0x10) == 0U ||
+             entry_table.first_clusters[directory] < Address32(0x0, 0x2)))
+        {
+            continue;
+        }
+
+        if (block_cache.read_blocks(sector_buffer, calculate_sector_address_from_cluster_number(get_directory_first_cluster(directory)),
+                fat_32_volume_id.sectors_per_cluster, directory_checksum_callback, &checksum) == false)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool FileSystem::directory_checksum_callback(const PackedSector &block, const uint16_t &block_index, void *context)
+{
+    (void)block_index;
+    uint16_t &checksum = *static_cast<uint16_t *>(context);
+
+    // rotated before each word so entries that only moved change it too
+    for (uint16_t i = 0; i < PackedSector::words_per_sector; i++)
+    {
+        checksum = ((checksum << 1) | (checksum >> 15)) + block.words[i];
+    }
+
+    return true;
+}
+
+uint16_t FileSystem::next_directory_snapshot_word(DirectorySnapshotContext &context) const
+{
+    const uint16_t element = context.element;
+    uint16_t value = 0U;
+
+    if (context.section == 0U)
+    {
+        value = entry_table.names[element][context.word];
+    }
+    else if (context.section == 1U)
+    {
+        value = entry_table.parents[element];
+    }
+    else if (context.section == 2U)
+    {
+        value = entry_table.attributes[element];
+    }
+    else if (context.section == 3U)
+    {
+        value = (context.word == 0U) ? entry_table.first_clusters[element].high() : entry_table.first_clusters[element].low();
+    }
+    else if (context.section == 4U)
+    {
+        value = (context.word == 0U) ? entry_table.sizes[element].high() : entry_table.sizes[element].low();
+    }
+    else if (context.section == 5U)
+    {
+        value = entry_table.long_name_offsets[element];
+    }
+    else if (context.section == 6U)
+    {
+        value = entry_table.long_name_lengths[element];
+    }
+    else
+    {
+        value = long_name_pool[element];
+    }
+
+    advance_directory_snapshot_context(context);
+    return value;
+}
+
+void FileSystem::set_next_directory_snapshot_word(DirectorySnapshotContext &context, const uint16_t &value)
+{
+    const uint16_t element = context.element;
+
+    if (context.section == 0U)
+    {
+        entry_table.names[element][context.word] = value;
+    }
+    else if (context.section == 1U)
+    {
+        entry_table.parents[element] = value;
+    }
+    else if (context.section == 2U)
+    {
+        entry_table.attributes[element] = value;
+    }
+    else if (context.section == 3U)
+    {
+        const Address32 &first_cluster = entry_table.first_clusters[element];
+        entry_table.first_clusters[element] = (context.word == 0U) ? Address32(value, first_cluster.low()) : Address32(first_cluster.high(), value);
+    }
+    else if (context.section == 4U)
+    {
+        const Address32 &size = entry_table.sizes[element];
+        entry_table.sizes[element] = (context.word == 0U) ? Address32(value, size.low()) : Address32(size.high(), value);
+    }
+    else if (context.section == 5U)
+    {
+        entry_table.long_name_offsets[element] = value;
+    }
+    else if (context.section == 6U)
+    {
+        entry_table.long_name_lengths[element] = value;
+    }
+    else
+    {
+        long_name_pool[element] = value;
+    }
+
+    advance_directory_snapshot_context(context);
+}
+
+void FileSystem::advance_directory_snapshot_context(DirectorySnapshotContext &context)
+{
+    // words per element of each array, names[] take packed_name_words and the Address32 arrays two
+    static const uint16_t words_per_element[directory_snapshot_end_section] = {packed_name_words, 1U, 1U, 2U, 2U, 1U, 1U, 1U};
+
+    context.word++;
+    if (context.word >= words_per_element[context.section])
+    {
+        context.word = 0U;
+        context.element++;
+        settle_directory_snapshot_context(context);
+    }
+}
+
+void FileSystem::settle_directory_snapshot_context(DirectorySnapshotContext &context)
+{
+    // the entry_table arrays hold number_of_entries elements, long_name_pool[] the rest
+    while (context.section < directory_snapshot_end_section &&
+           context.element >= ((context.section < directory_snapshot_end_section - 1U) ? context.number_of_entries : context.number_of_long_name_words))
+    {
+        context.section++;
+        context.element = 0U;
+    }
+}
+
+bool FileSystem::directory_snapshot_write_callback(PackedSector &block, const uint16_t &block_index, void *context)
+{
+    (void)block_index;
+    DirectorySnapshotContext *snapshot_context = static_cast<DirectorySnapshotContext *>(context);
+
+    if (snapshot_context->section == directory_snapshot_end_section)
+    {
+        return false;
+    }
+
+    // the end of the last sector is padded with zeros
+    for (uint16_t i = 0; i < PackedSector::words_per_sector; i++)
+    {
+        uint16_t value = 0U;
+        if (snapshot_context->section != directory_snapshot_end_section)
+        {
+            value = snapshot_context->file_system->next_directory_snapshot_word(*snapshot_context);
+            snapshot_context->checksum += value;
+        }
+        block.words[i] = value;
+    }
+
+    return true;
+}
+
+bool FileSystem::directory_snapshot_read_callback(const PackedSector &block, const uint16_t &block_index, void *context)
+{
+    (void)block_index;
+    DirectorySnapshotContext *snapshot_context = static_cast<DirectorySnapshotContext *>(context);
+
+    for (uint16_t i = 0; i < PackedSector::words_per_sector && snapshot_context->section != directory_snapshot_end_section; i++)
+    {
+        snapshot_context->checksum += block.words[i];
+        snapshot_context->file_system->set_next_directory_snapshot_word(*snapshot_context, block.words[i]);
+    }
+
+    return true;
+}
+
+bool FileSystem::zero_sector_check_callback(const PackedSector &block, const uint16_t &block_index, void *context)
+{
+    (void)block_index;
+
+    for (uint16_t i = 0; i < PackedSector::words_per_sector; i++)
+    {
+        if (block.words[i] != 0x0)
+        {
+            *static_cast<bool *>(context) = false;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool FileSystem::read_directory_tree()
+{
+    // Directories are explored breadth first, starting with the root every sub directory found is
+    // queued (by its index in entry_table) and read once the directory it was found in has been
+    // read completely. A directory can only be queued once since it's an entry in entry_table, so
+    // the queue can never hold more than total_directory_entries (and the root) and memory use does
+    // not depend on depth
+    uint16_t directory_queue[total_directory_entries + 1U];
+    directory_queue[0] = root_directory_index;
+    uint16_t queue_head = 0U;
+    uint16_t queue_tail = 1U;
+
+    bool every_directory_read = true;
+
+    // index of the first entry in entry_table that has not been checked for a sub directory yet
+    uint16_t next_unqueued_entry_index = 0U;
+
+    while (queue_head != queue_tail)
+    {
+        if (read_directory(directory_queue[queue_head]) == false)
+        {
+            every_directory_read = false;
+        }
+        queue_head++;
+
+        // queue sub directories found by the read
+        for (; next_unqueued_entry_index < file_systems_entry_index; next_unqueued_entry_index++)
+        {
+            // skip directories with an invalid cluster, reading one would re-read the root or garbage
+            if (is_directory(next_unqueued_entry_index) &&
+                entry_table.first_clusters[next_unqueued_entry_index] >= Address32(0x0, 0x2))
+            {
+                directory_queue[queue_tail] = next_unqueued_entry_index;
+                queue_tail++;
+            }
+        }
+    }
+
+    return every_directory_read;
+}
+
+bool FileSystem::read_directory(const uint16_t &parent_directory)
+{
+    DirectoryReadContext read_context;
+    read_context.file_system = this;
+    read_context.parent_directory = parent_directory;
+
+    Address32 last_sector_address;
+    return read_directory_clusters(get_directory_first_cluster(parent_directory), read_directory_sector_callback,
+                                    &read_context, last_sector_address);
+}
+
+bool FileSystem::read_directory_clusters(const Address32 &first_cluster, sd_driver::BlockDevice::block_read_callback_t block_callback,
+                                            void *context, Address32 &last_sector_address)
+{
+    DirectoryClusterReadContext cluster_read_context;
+    cluster_read_context.block_callback = block_callback;
+    cluster_read_context.context = context;
+
+    // a long name never carries over from another directory
+    long_name_assembly = LongNameAssembly();
+
+    ClusterChainIterator cluster_chain(fat_cache, first_cluster, number_of_clusters);
+
+    for (; cluster_chain.is_valid(); cluster_chain.next())
+    {
+        cluster_read_context.cluster_sector_address = calculate_sector_address_from_cluster_number(cluster_chain.get_cluster());
+
+        // stream an entire cluster of the directory in a single multi block read, each sector
+        // is handed to block_callback out of sector_buffer before the next is read
+        if (block_cache.read_blocks(sector_buffer, cluster_read_context.cluster_sector_address,
+                fat_32_volume_id.sectors_per_cluster, directory_cluster_callback, &cluster_read_context) == false)
+        {
+            return false;
+        }
+
+        if (cluster_read_context.stopped)
+        {
+            break;
+        }
+
+#ifdef SD_FS_DEBUG_DIRECTORY_SCAN
+        xpd_putc('\n');
+#endif
+    }
+
+    last_sector_address = cluster_read_context.last_sector_address;
+
+    // the chain must end normally, not on a FAT read error
+    return cluster_chain.fat_read_failed() == false;
+}
+
+bool FileSystem::directory_cluster_callback(const PackedSector &block, const uint16_t &block_index, void *context)
+{
+    DirectoryClusterReadContext *cluster_read_context = static_cast<DirectoryClusterReadContext *>(context);
+
+    cluster_read_context->last_sector_address = cluster_read_context->cluster_sector_address + Address32(0x0, block_index);
+
+    if (cluster_read_context->block_callback(block, block_index, cluster_read_context->context) == false)
+    {
+        cluster_read_context->stopped = true;
+        return false;
+    }
+
+    return true;
+}
+
+bool FileSystem::resolve_extent(const Address32 &first_cluster, const Address32 &first_file_cluster, FileExtent &extent, Address32 &next_cluster)
+{
+    // copies, the outputs may alias the inputs (e.g., when the window is moved along the chain)
+    const Address32 extent_first_cluster = first_cluster;
+    const Address32 extent_first_file_cluster = first_file_cluster;
+
+    ClusterChainIterator cluster_chain(fat_cache, extent_first_cluster, number_of_clusters);
+
+    if (cluster_chain.is_valid() == false)
+    {
+        return false;
+    }
+
+    Address32 last_cluster = extent_first_cluster;
+    Address32 extent_length(0x0, 0x1);
+
+    // grow the extent while the next cluster of the chain is the next cluster on the card
+    while (cluster_chain.next() && cluster_chain.get_cluster() == last_cluster + Address32(0x0, 0x1))
+    {
+        last_cluster = cluster_chain.get_cluster();
+        extent_length += Address32(0x0, 0x1);
+    }
+
+    if (cluster_chain.fat_read_failed())
+    {
+        return false;
+    }
+
+    extent.first_file_cluster = extent_first_file_cluster;
+    extent.first_cluster = extent_first_cluster;
+    extent.number_of_clusters = extent_length;
+    next_cluster = cluster_chain.is_valid() ? cluster_chain.get_cluster() : Address32();
+    return true;
+}
+
+const FileSystem::FileExtent *FileSystem::find_extent(File &file, const Address32 &file_cluster)
+{
+    for (uint16_t i = 0; i < file.number_of_extents; i++)
+    {
+        const FileExtent &extent = file.extents[i];
+
+        if (file_cluster >= extent.first_file_cluster && file_cluster - extent.first_file_cluster < extent.number_of_clusters)
+        {
+            return &extent;
+        }
+    }
 
-    fat_32_volume_id.sectors_per_fat[3] = volume_id_sector[36];
-    fat_32_volume_id.sectors_per_fat[2] = volume_id_sector[37];
-    fat_32_volume_id.sectors_per_fat[1] = volume_id_sector[38];
-    fat_32_volume_id.sectors_per_fat[0] = volume_id_sector[39];
+    if (file.overflow_cluster.is_zero())
+    {
+        // extents[] covers the whole chain
+        return nullptr;
+    }
 
-    // usually 2 
-    fat_32_volume_id.root_directory_first_cluster[3] = volume_id_sector[44];
-    fat_32_volume_id.root_directory_first_cluster[2] = volume_id_sector[45];
-    fat_32_volume_id.root_directory_first_cluster[1] = volume_id_sector[46];
-    fat_32_volume_id.root_directory_first_cluster[0] = volume_id_sector[47];
-    
-    // signature value should be 0x55AA or 0xAA55(if done backwards)
-    fat_32_volume_id.volume_id_signature[1] = volume_id_sector[510];
-    fat_32_volume_id.volume_id_signature[0] = volume_id_sector[511];
+    // a position before the window means starting over from the end of extents[], this only walks
+    // the part of the chain past extents[]
+    if (file.window.number_of_clusters.is_zero() || file_cluster < file.window.first_file_cluster)
+    {
+        const FileExtent &last_extent = file.extents[file.number_of_extents - 1U];
 
-    // verify signature, check both ordering since documentation is often mixed
-    const bool valid_signature = (fat_32_volume_id.volume_id_signature[0] == 0x55 && fat_32_volume_id.volume_id_signature[1] == 0xAA) ||
-                                    (fat_32_volume_id.volume_id_signature[0] == 0xAA && fat_32_volume_id.volume_id_signature[1] == 0x55);
+        if (resolve_extent(file.overflow_cluster, last_extent.first_file_cluster + last_extent.number_of_clusters,
+                file.window, file.window_next_cluster) == false)
+        {
+            file.window = FileExtent();
+            return nullptr;
+        }
+    }
 
-    // print all values
-    // xpd_puts("sectors per fat\n");
-    // for (uint16_t i=36; i<40;i++){
-    //     xpd_echo_int(volume_id_sector[i], XPD_Flag_UnsignedDecimal); // 0x1 GOOD
-    // xpd_putc('\n');
-    // }
-    // xpd_putc('\n');
+    while (file_cluster - file.window.first_file_cluster >= file.window.number_of_clusters)
+    {
+        if (file.window_next_cluster.is_zero() ||
+            resolve_extent(file.window_next_cluster, file.window.first_file_cluster + file.window.number_of_clusters,
+                file.window, file.window_next_cluster) == false)
+        {
+            file.window = FileExtent();
+            return nullptr;
+        }
+    }
 
-    // xpd_puts("root directoy first cluster\n");
-    // for (uint16_t i=44; i<48;i++){
-    //     xpd_echo_int(volume_id_sector[i], XPD_Flag_UnsignedDecimal); // 0x1 GOOD
-    // xpd_putc('\n');
-    // }
+    return &file.window;
+}
 
-    return valid_signature;
+bool FileSystem::locate_file_sector(File &file, const Address32 &position, Address32 &sector_address, Address32 &sectors_left_in_extent)
+{
+    const FileExtent *extent = find_extent(file, position >> (sectors_per_cluster_shift + 9U));
+
+    if (extent == nullptr)
+    {
+        return false;
+    }
+
+    const Address32 sector_in_extent = (position >> 9) - (extent->first_file_cluster << sectors_per_cluster_shift);
+    sector_address = calculate_sector_address_from_cluster_number(extent->first_cluster) + sector_in_extent;
+    sectors_left_in_extent = (extent->number_of_clusters << sectors_per_cluster_shift) - sector_in_extent;
+    return true;
 }
 
-void FileSystem::add_4_byte_numbers(const uint16_t (&number_1)[4], const uint16_t (&number_2)[4], uint16_t (&result)[4])
+bool FileSystem::allocate_file_clusters(File &file, const Address32 &max_clusters, const bool &whole_run)
 {
-    // TODO refactor to optimize 
+    // try to continue the last extent so the file stays contiguous
+    const Address32 preferred_cluster = file.last_cluster.is_zero() ? Address32() : file.last_cluster + Address32(0x0, 0x1);
 
-    uint16_t carry_byte4 = 0;
-    result[3] = number_1[3] + number_2[3];
+    Address32 first_cluster;
+    Address32 allocated_clusters;
+    if (cluster_allocator.allocate(preferred_cluster, max_clusters, whole_run, first_cluster, allocated_clusters, true) == false)
+    {
+        return false;
+    }
 
-    if (result[3] > 0xFF)
+    if (file.last_cluster.is_zero())
     {
-        result[3]-=256;
-        carry_byte4 = 1;
+        // first cluster of an empty file, the directory entry is updated by sync()
+        file.first_cluster = first_cluster;
+    }
+    else if (fat_cache.write_entry(file.last_cluster, first_cluster) == false)
+    {
+        return false;
     }
 
-    uint16_t carry_byte3 = 0;
-    result[2] = number_1[2] + number_2[2] + carry_byte4;
-    
-    if (result[2] > 0xFF)
+    FileExtent extent;
+    extent.first_file_cluster = file.allocated_clusters;
+    extent.first_cluster = first_cluster;
+    extent.number_of_clusters = allocated_clusters;
+
+    // while extents[] covers the whole chain the new clusters are added to it, otherwise they are
+    // found through the window like the rest of the chain past extents[]
+    if (file.overflow_cluster.is_zero())
     {
-        result[2]-=256;
-        carry_byte3 = 1;
+        FileExtent *last_extent = (file.number_of_extents > 0U) ? &file.extents[file.number_of_extents - 1U] : nullptr;
+
+        if (last_extent != nullptr && last_extent->first_cluster + last_extent->number_of_clusters == first_cluster)
+        {
+            last_extent->number_of_clusters += allocated_clusters;
+        }
+        else if (file.number_of_extents < extents_per_file)
+        {
+            file.extents[file.number_of_extents] = extent;
+            file.number_of_extents++;
+        }
+        else
+        {
+            file.overflow_cluster = first_cluster;
+        }
     }
 
-    uint16_t carry_byte2 = 0;
-    result[1] = number_1[1] + number_2[1] + carry_byte3;
-    
-    if (result[1] > 0xFF)
+    // the window may end where the chain used to end
+    file.window = FileExtent();
+
+    file.last_cluster = first_cluster + allocated_clusters - Address32(0x0, 0x1);
+    file.allocated_clusters += allocated_clusters;
+    return true;
+}
+
+bool FileSystem::free_cluster_chain(const Address32 &first_cluster)
+{
+    // an empty file (cluster 0, or the invalid cluster 1) has no chain, free_chain() does nothing
+    return fat_cache.free_chain(first_cluster, number_of_clusters, cluster_run_freed_callback, this);
+}
+
+void FileSystem::cluster_run_freed_callback(const Address32 &first_cluster, const Address32 &run_length, void *context)
+{
+    static_cast<FileSystem *>(context)->cluster_allocator.release(first_cluster, run_length);
+}
+
+bool FileSystem::extend_directory(const Address32 &last_sector_address, Address32 &new_sector_address)
+{
+    const Address32 last_cluster = ((last_sector_address - cluster_begin_lba) >> sectors_per_cluster_shift) + Address32(0x0, 0x2);
+
+    Address32 new_cluster;
+    Address32 allocated_clusters;
+    if (cluster_allocator.allocate(last_cluster + Address32(0x0, 0x1), Address32(0x0, 0x1), false, new_cluster, allocated_clusters) == false)
     {
-        result[1]-=256;
-        carry_byte2 = 1;
+        return false;
     }
 
-    
-    result[0] = number_1[0] + number_2[0] + carry_byte2;
+    // zero the new cluster before it is linked in, so the end of the directory is always found
+    const Address32 first_sector_address = calculate_sector_address_from_cluster_number(new_cluster);
+    if (block_cache.write_blocks(sector_buffer, first_sector_address, fat_32_volume_id.sectors_per_cluster,
+            zero_sector_callback, nullptr) == false)
+    {
+        return false;
+    }
 
-    if (result[0] > 0xFF)
+    if (fat_cache.write_entry(last_cluster, new_cluster) == false || fat_cache.flush() == false)
     {
-        // discard overflow
-        result[0]-=256;
+        return false;
     }
+
+    sector_buffer.fill(0x00);
+    new_sector_address = first_sector_address;
+    return true;
 }
 
-void FileSystem::subtract_4_byte_numbers(const uint16_t (&number_1)[4], const uint16_t (&number_2)[4], uint16_t (&result)[4])
+Address32 FileSystem::get_directory_first_cluster(const uint16_t &directory) const
 {
-    uint16_t borrow_byte4 = 0;
-    int16_t result_3 = number_1[3] - number_2[3];
+    // the root directory has no entry
+    return (directory == root_directory_index) ? fat_32_volume_id.root_directory_first_cluster : entry_table.first_clusters[directory];
+}
 
-    if (result_3 < 0)
+bool FileSystem::parse_directory_sector(const PackedSector &directory_sector, const uint16_t &parent_directory)
+{
+    for (uint16_t i = 0; i < directory_entrys_per_sector; i++)
     {
-        result_3 += 256;
-        borrow_byte4 = 1;
-    }
+        // Check first byte in 32 byte entry for end of directory
+        if (directory_sector.get_byte(i*bytes_per_entry) == 0x00)
+        {
+            return true;
+        }
+
+        if (is_valid_directory_entry(directory_sector, i*bytes_per_entry) == false)
+        {
+            assemble_long_name(directory_sector, i*bytes_per_entry);
+            continue;
+        }
 
-    result[3] = result_3;
+        if (file_systems_entry_index >= total_directory_entries)
+        {
+            // no room left in entry_table, treat as end of directory rather than overflow
+            return true;
+        }
 
+        store_directory_entry(directory_sector, i*bytes_per_entry, parent_directory);
+    }
 
-    uint16_t borrow_byte3 = 0;
-    int16_t result_2 = number_1[2] - number_2[2] - borrow_byte4;
-    
-    if (result_2 < 0)
+    return false;
+}
+
+int16_t FileSystem::store_directory_entry(const PackedSector &directory_sector, const uint16_t &entry_offset,
+                                            const uint16_t &parent_directory)
+{
+    if (file_systems_entry_index >= total_directory_entries)
     {
-        result_2 += 256;
-        borrow_byte3 = 1;
+        long_name_assembly = LongNameAssembly();
+        return -1;
     }
 
-    result[2] = result_2;
+    const uint16_t entry_index = file_systems_entry_index;
 
+    // VALID ENTRY, copy contents into the arrays of entry_table (the type is told by the attribute byte)
+    entry_table.attributes[entry_index] = directory_sector.get_byte(entry_offset + attribute_byte_offset) | entry_in_use_flag;
 
-    uint16_t borrow_byte2 = 0;
-    int16_t result_1 = number_1[1] - number_2[1] - borrow_byte3;
+    read_packed_entry_name(directory_sector, entry_offset, entry_table.names[entry_index]);
 
-    if (result_1 < 0)
+#ifdef SD_FS_DEBUG_DIRECTORY_SCAN
+    // printing every entry name found slows a scan down considerably
+    for (uint16_t j = 0; j < 11; j++)
     {
-        result_1 += 256;
-        borrow_byte2 = 1;
+        xpd_putc(get_entry_name_character(entry_index, j));
     }
+    xpd_putc('\n');
+#endif
 
-    result[1] = result_1;
+    // save index of parent directory
+    entry_table.parents[entry_index] = parent_directory;
 
+    // Cluster addr high order bytes stored at offset 0x14 in LITTLE ENDIAN
+    // while low order bytes are stored at offset 0x1A in LITTLE ENDIAN
+    entry_table.first_clusters[entry_index] = read_starting_cluster_address(directory_sector, entry_offset);
 
-    int16_t result_0 = number_1[0] - number_2[0] - borrow_byte2;
+    entry_table.sizes[entry_index] = directory_sector.get_le32(entry_offset + file_size_offset);
 
-    if (result_0 < 0)
+    // keep the long name assembled from the LFN entries before this one, if it's this entries
+    entry_table.long_name_offsets[entry_index] = long_name_pool_used;
+    entry_table.long_name_lengths[entry_index] = 0U;
+    if (is_long_name_assembled_for(directory_sector, entry_offset))
     {
-        // discard underflow
-        result_0 += 256;
+        entry_table.long_name_lengths[entry_index] = get_assembled_long_name_length();
+        long_name_pool_used += entry_table.long_name_lengths[entry_index];
     }
+    long_name_assembly = LongNameAssembly();
+
+    path_index_insert(entry_index);
 
-    result[0] = result_0;
+    // increment index as an entry has been added to entry_table
+    file_systems_entry_index++;
+
+    return static_cast<int16_t>(entry_index);
 }
 
-bool FileSystem::read_directory_recursive(const uint16_t (&directory_begin_sector_addr)[4], FAT32FileSystemEntry *parent_directory)
+bool FileSystem::is_valid_directory_entry(const PackedSector &directory_sector, const uint16_t &entry_offset) const
 {
-    // Constants that identify information about 32 byte directory entries
-    constexpr uint16_t bytes_per_entry = 32U; 
-    constexpr uint16_t attribute_byte_offset = 11U;
-    constexpr uint16_t file_size_offset = 28U;
-    // TODO assumes sector size of 512 bytes, update to be sector size/ bytes per entry
-    constexpr uint16_t directory_entrys_per_sector = 16U;
-
-    // Make a copy of given sector address so we can add to it for directories that span multiple sectors
-    uint16_t directory_sector_addr_lba[4] = {};
-    directory_sector_addr_lba[0] = directory_begin_sector_addr[0];
-    directory_sector_addr_lba[1] = directory_begin_sector_addr[1];
-    directory_sector_addr_lba[2] = directory_begin_sector_addr[2];
-    directory_sector_addr_lba[3] = directory_begin_sector_addr[3];
+    // ignore directory entries that are deleted (i.e., start with 0xE5)
+    if (directory_sector.get_byte(entry_offset) == 0xE5)
+    {
+        return false;
+    }
 
-    // Read at minimum the first sector in the directory
-    uint16_t directory_sector[512] ={};
-    sd_card.send_cmd17(directory_sector, directory_sector_addr_lba);
+    // Ignore LFN entries
+    if (directory_sector.get_byte(entry_offset + attribute_byte_offset) == 0xF)
+    {
+        return false;
+    }
 
-    // flag set when the first byte of a directory entry is 0x00 (indicating no more entrys)
-    bool end_of_directory_found = false;
+    // ignore system or hidden entrys
+    if ((directory_sector.get_byte(entry_offset + attribute_byte_offset) & 1<<1) || // 1<<1 = 0x2 (hidden)
+         (directory_sector.get_byte(entry_offset + attribute_byte_offset) & 1<<2))  // 1<<2 = 0x4 (system)
+    {
+        return false;
+    }
 
-    while (!end_of_directory_found)
-    {   
-        for (uint16_t i = 0; i < directory_entrys_per_sector; i++)
+    // ignore an entry that is a directory that is named "." or ".." these two entries tell us info
+    // about the current directory and the enclosing directory but we do not care for this info
+    if (directory_sector.get_byte(entry_offset + attribute_byte_offset) & 1<<4 &&
+        directory_sector.get_byte(entry_offset) == 0x2E)
+    {
+        // check for a second byte that is 0x2E "." OR 0x20 " "
+        if (directory_sector.get_byte(entry_offset+1) == 0x2E ||
+                directory_sector.get_byte(entry_offset+1) == 0x20)
         {
-            // Check first byte in 32 byte entry for end of directory
-            if (directory_sector[i*bytes_per_entry] == 0x00)
-            {
-                end_of_directory_found = true;
-                break; 
-            }
+            bool non_space_found = false;
 
-            // ignore directory entries that are deleted (i.e., start with 0xE5)
-            if (directory_sector[i*bytes_per_entry] == 0xE5)
+            // iterate over remainder of bytes in entry name
+            for (uint16_t j = 2; j < 11; j++)
             {
-                continue;
+                if (directory_sector.get_byte(entry_offset+j) != 0x20)
+                {
+                    non_space_found = true;
+                    break;
+                }
             }
 
-            // Ignore LFN entries
-            if (directory_sector[i*bytes_per_entry + attribute_byte_offset] == 0xF)
+            if (non_space_found == false)
             {
-                continue;
+                return false;
             }
+        }
+    }
 
-            // ignore system or hidden entrys
-            if ((directory_sector[i*bytes_per_entry + attribute_byte_offset] & 1<<1) || // 1<<1 = 0x2 (hidden)
-                 (directory_sector[i*bytes_per_entry + attribute_byte_offset] & 1<<2))  // 1<<2 = 0x4 (system)
-            {
-                continue;
-            }
+    return true;
+}
 
-            // ignore an entry that is a directory that is named "." or ".." these two entries tell us info
-            // about the current directory and the enclosing directory but we do not care for this info
-            if (directory_sector[i*bytes_per_entry + attribute_byte_offset] & 1<<4 &&
-                directory_sector[i*bytes_per_entry] == 0x2E)
-            {
-                // check for a second byte that is 0x2E "." OR 0x20 " "
-                if (directory_sector[i*bytes_per_entry+1] == 0x2E ||
-                        directory_sector[i*bytes_per_entry+1] == 0x20)
-                {
-                    bool non_space_found = false;
-
-                    // iterate over remainder of bytes in entry name
-                    for (uint16_t j = 2; j < 11; j++)
-                    {
-                        if (directory_sector[i*bytes_per_entry+j] != 0x20)
-                        {
-                            non_space_found = true;
-                            break;
-                        }
-                    }
-
-                    if (non_space_found == false)
-                    {
-                        continue;
-                    }
-                }
-            }
+bool FileSystem::read_directory_sector_callback(const PackedSector &block, const uint16_t &block_index, void *context)
+{
+    (void)block_index;
 
-            // VALID ENTRY, copy contents into entrys array
-            if (directory_sector[i*bytes_per_entry + attribute_byte_offset] & 1<<3) // 1<<3 = 0x8 (volume label)
-            {
-                file_system_entrys[file_systems_entry_index].entry_type = directory_entry_t::VOLUME_LABEL;
-            }
-            else if (directory_sector[i*bytes_per_entry + attribute_byte_offset] & 1<<4) // 1<<4 = 0x10 (directory)
-            {
-                file_system_entrys[file_systems_entry_index].entry_type = directory_entry_t::DIRECTORY_ENTRY;
-            }
-            else if (directory_sector[i*bytes_per_entry + attribute_byte_offset] & 1<<5) // 1<<5 = 0x20 (file)
-            {
-                file_system_entrys[file_systems_entry_index].entry_type = directory_entry_t::FILE_ENTRY;
-            }
+    DirectoryReadContext *read_context = static_cast<DirectoryReadContext *>(context);
 
-            file_system_entrys[file_systems_entry_index].entry_in_use = true;
-            file_system_entrys[file_systems_entry_index].attribute_byte = directory_sector[i*bytes_per_entry + attribute_byte_offset];
-            
-            for (uint16_t j = 0; j < 11; j++)
+    read_context->end_of_directory_found = read_context->file_system->parse_directory_sector(block, read_context->parent_directory);
+
+    // keep streaming sectors of the cluster until the end of directory is found
+    return !read_context->end_of_directory_found;
+}
+
+bool FileSystem::find_directory_entry_callback(const PackedSector &block, const uint16_t &block_index, void *context)
+{
+    (void)block_index;
+
+    DirectoryEntrySearchContext *search_context = static_cast<DirectoryEntrySearchContext *>(context);
+    const FileSystem *file_system = search_context->file_system;
+    const uint16_t entry_to_find = search_context->entry_to_find;
+
+    for (uint16_t i = 0; i < directory_entrys_per_sector; i++)
+    {
+        // Check first byte in 32 byte entry for end of directory
+        if (block.get_byte(i*bytes_per_entry) == 0x00)
+        {
+            search_context->end_of_directory_found = true;
+            return false;
+        }
+
+        if (file_system->is_valid_directory_entry(block, i*bytes_per_entry) == false)
+        {
+            continue;
+        }
+
+        // VALID ENTRY, check if the valid entry matches the entry we're trying to find
+        if (block.get_byte(i*bytes_per_entry + attribute_byte_offset) != (file_system->entry_table.attributes[entry_to_find] & 0xFF))
+        {
+            // attribute byte does not match, look at next entry
+            continue;
+        }
+
+        uint16_t packed_name[packed_name_words];
+        read_packed_entry_name(block, i*bytes_per_entry, packed_name);
+
+        // short names are unique within a directory, the first cluster is not compared as the one in
+        // entry_table is already the staged one (see stage()) while the card holds the committed one
+        if (file_system->entry_name_matches(entry_to_find, packed_name) == false)
+        {
+            // entry name does not match, look at next entry
+            continue;
+        }
+
+        // ENTRYS MATCH, save location and stop the transfer so the sector is left in the buffer
+        search_context->entry_found = true;
+        search_context->entry_offset = i*bytes_per_entry;
+
+        // the LFN entries of its long name are the ones right before it that carry its checksum
+        const uint16_t checksum = short_name_checksum(block, i*bytes_per_entry);
+        search_context->long_name_entry_offset = i*bytes_per_entry;
+        while (search_context->long_name_entry_offset > 0U)
+        {
+            const uint16_t previous_offset = search_context->long_name_entry_offset - bytes_per_entry;
+
+            if (block.get_byte(previous_offset) == 0xE5 || block.get_byte(previous_offset + attribute_byte_offset) != 0xF ||
+                block.get_byte(previous_offset + long_name_checksum_offset) != checksum)
             {
-                file_system_entrys[file_systems_entry_index].name_of_entry[j] = directory_sector[i*bytes_per_entry + j];   
-                xpd_putc(file_system_entrys[file_systems_entry_index].name_of_entry[j]); 
+                break;
             }
-            xpd_putc('\n');
 
-            // save reference to parent directory
-            file_system_entrys[file_systems_entry_index].parent_directory = parent_directory;
+            search_context->long_name_entry_offset = previous_offset;
+        }
+        return false;
+    }
 
-            // Cluster addr high order bytes stored at offset 0x14 in LITTLE ENDIAN
-            // while low order bytes are stored at offset 0x1A in LITTLE ENDIAN
-            file_system_entrys[file_systems_entry_index].starting_cluster_address[0] = directory_sector[i*bytes_per_entry + 21];//MSB
-            file_system_entrys[file_systems_entry_index].starting_cluster_address[1] = directory_sector[i*bytes_per_entry + 20];
-            file_system_entrys[file_systems_entry_index].starting_cluster_address[2] = directory_sector[i*bytes_per_entry + 27];
-            file_system_entrys[file_systems_entry_index].starting_cluster_address[3] = directory_sector[i*bytes_per_entry + 26];//LSB
+    return true;
+}
 
-            file_system_entrys[file_systems_entry_index].size_of_entry_in_bytes[0] = directory_sector[i*bytes_per_entry + file_size_offset + 3]; //MSB
-            file_system_entrys[file_systems_entry_index].size_of_entry_in_bytes[1] = directory_sector[i*bytes_per_entry + file_size_offset + 2];
-            file_system_entrys[file_systems_entry_index].size_of_entry_in_bytes[2] = directory_sector[i*bytes_per_entry + file_size_offset + 1];
-            file_system_entrys[file_systems_entry_index].size_of_entry_in_bytes[3] = directory_sector[i*bytes_per_entry + file_size_offset];     //LSB
+bool FileSystem::look_up_entry_callback(const PackedSector &block, const uint16_t &block_index, void *context)
+{
+    (void)block_index;
 
-            // increment index as an entry has been added to the entrys array
-            file_systems_entry_index++;
+    DirectoryLookupContext *look_up_context = static_cast<DirectoryLookupContext *>(context);
+    FileSystem *file_system = look_up_context->file_system;
 
+    for (uint16_t i = 0; i < directory_entrys_per_sector; i++)
+    {
+        // Check first byte in 32 byte entry for end of directory
+        if (block.get_byte(i*bytes_per_entry) == 0x00)
+        {
+            look_up_context->end_of_directory_found = true;
+            return false;
+        }
 
-            // recursively read directory when discovered
-            if (file_system_entrys[file_systems_entry_index-1].entry_type == directory_entry_t::DIRECTORY_ENTRY)
-            {
-                // convert cluster address to sector address!!!!!!!!!!!
-                uint16_t sector_address[4] = {0x0, 0x0, 0x0, 0x0};
+        if (file_system->is_valid_directory_entry(block, i*bytes_per_entry) == false)
+        {
+            file_system->assemble_long_name(block, i*bytes_per_entry);
+            continue;
+        }
 
-                calculate_sector_address_from_cluster_number(file_system_entrys[file_systems_entry_index-1].starting_cluster_address, sector_address);
+        bool entry_name_match = true;
+        if (look_up_context->long_name != nullptr)
+        {
+            // the long name being assembled is compared while it's still in the free end of the pool
+            entry_name_match = file_system->is_long_name_assembled_for(block, i*bytes_per_entry) &&
+                file_system->long_name_matches(file_system->long_name_pool_used, file_system->get_assembled_long_name_length(),
+                                                look_up_context->long_name);
+        }
+        else
+        {
+            const uint16_t (&entry_name)[11] = *look_up_context->entry_name;
 
-                read_directory_recursive(sector_address, &file_system_entrys[file_systems_entry_index-1]);
+            for (uint16_t j = 0; j < 11; j++)
+            {
+                if (block.get_byte(i*bytes_per_entry + j) != (entry_name[j] & 0xFF))
+                {
+                    entry_name_match = false;
+                    break;
+                }
             }
+        }
 
+        if (entry_name_match == false)
+        {
+            file_system->long_name_assembly = LongNameAssembly();
+            continue;
         }
 
-        // only send another read command if the end of directory has not been found
-        if (!end_of_directory_found)
+        if (look_up_context->long_name != nullptr)
         {
-            // An entire sector has been processed without finding end of directory so read next sector
-            uint16_t count_of_one[4] = {0x0, 0x0, 0x0, 0x1};
-            add_4_byte_numbers(count_of_one, directory_sector_addr_lba, directory_sector_addr_lba);
+            // found by its long name but it may already be loaded by its 8.3 name
+            uint16_t short_name[11];
+            for (uint16_t j = 0; j < 11; j++)
+            {
+                short_name[j] = block.get_byte(i*bytes_per_entry + j);
+            }
 
-            sd_card.send_cmd17(directory_sector, directory_sector_addr_lba);
-            xpd_putc('\n');
+            look_up_context->entry_found = file_system->path_index_look_up(look_up_context->parent_directory, short_name);
+            if (look_up_context->entry_found != -1)
+            {
+                look_up_context->end_of_directory_found = false;
+                return false;
+            }
         }
 
+        // only the entry that was looked up is stored, not the rest of the directory
+        look_up_context->entry_found = file_system->store_directory_entry(block, i*bytes_per_entry, look_up_context->parent_directory);
 
-
+        // stop even if entry_table is full, in which case the look up fails
+        look_up_context->end_of_directory_found = (look_up_context->entry_found == -1);
+        return false;
     }
 
+    return true;
+}
+
+bool FileSystem::find_free_directory_entry_callback(const PackedSector &block, const uint16_t &block_index, void *context)
+{
+    (void)block_index;
+
+    DirectoryEntrySearchContext *search_context = static_cast<DirectoryEntrySearchContext *>(context);
 
+    for (uint16_t i = 0; i < directory_entrys_per_sector; i++)
+    {
+        // the end of directory marker and deleted entries can both be reused
+        if (block.get_byte(i*bytes_per_entry) == 0x00 || block.get_byte(i*bytes_per_entry) == 0xE5)
+        {
+            search_context->entry_found = true;
+            search_context->entry_offset = i*bytes_per_entry;
+            return false;
+        }
+    }
 
-    // TODO check for too deep of recursion and return false
     return true;
+}
 
+bool FileSystem::zero_sector_callback(PackedSector &block, const uint16_t &block_index, void *context)
+{
+    (void)block_index;
+    (void)context;
 
+    block.fill(0x00);
+    return true;
 }
 
-void FileSystem::calculate_sector_address_from_cluster_number(const uint16_t (&cluster_number)[4], uint16_t (&resulting_sector_address)[4])
+Address32 FileSystem::read_starting_cluster_address(const PackedSector &directory_sector, const uint16_t &entry_offset)
 {
-    // lba_addr = cluster_begin_lba + (cluster_number - 2) * sectors_per_cluster;
+    // Cluster addr high order bytes stored at offset 0x14 in LITTLE ENDIAN
+    // while low order bytes are stored at offset 0x1A in LITTLE ENDIAN
+    return Address32(directory_sector.get_le16(entry_offset + 20), directory_sector.get_le16(entry_offset + 26));
+}
+
+void FileSystem::read_packed_entry_name(const PackedSector &directory_sector, const uint16_t &entry_offset,
+                                        uint16_t (&packed_name)[packed_name_words])
+{
+    // bytes 0-9 of the entry are the first five words, byte 10 (the last extension character) the sixth
+    for (uint16_t j = 0; j < packed_name_words - 1U; j++)
+    {
+        packed_name[j] = directory_sector.get_le16(entry_offset + (j << 1));
+    }
+    packed_name[packed_name_words - 1U] = directory_sector.get_byte(entry_offset + 10U);
+}
 
-    uint16_t lba_offset[4] = {0x00, 0x00, 0x00, 0x00}; 
-    uint16_t sectors_per_cluster_4_byte_addr[4] = {0x0, 0x0, 0x0, fat_32_volume_id.sectors_per_cluster};
+void FileSystem::assemble_long_name(const PackedSector &directory_sector, const uint16_t &entry_offset)
+{
+    // byte offsets of the 13 two byte characters of an LFN entry
+    static const uint16_t character_offsets[13] = {1U, 3U, 5U, 7U, 9U, 14U, 16U, 18U, 20U, 22U, 24U, 28U, 30U};
+    constexpr uint16_t characters_per_entry = 13U;
+    constexpr uint16_t max_long_name_entries = 20U;
+    constexpr uint16_t last_entry_flag = 0x40;
 
-    uint16_t cluster_number_minus_offset[4] = {0x0, 0x0, 0x0, 0x0};
-    uint16_t cluster_offset[4] = {0x0, 0x0, 0x0, 0x2};
+    const uint16_t first_byte = directory_sector.get_byte(entry_offset);
 
-    // assumes cluster_number >= 2
-    subtract_4_byte_numbers(cluster_number, cluster_offset, cluster_number_minus_offset);
+    if (first_byte == 0xE5 || directory_sector.get_byte(entry_offset + attribute_byte_offset) != 0xF)
+    {
+        long_name_assembly = LongNameAssembly();
+        return;
+    }
 
-    bool repeated_additions_left_to_perform = true;
+    const uint16_t sequence_number = first_byte & 0x1F;
+    const uint16_t checksum = directory_sector.get_byte(entry_offset + long_name_checksum_offset);
 
-    while (repeated_additions_left_to_perform)
+    if (first_byte & last_entry_flag)
     {
-        if (cluster_number_minus_offset[0] == 0x00 &&
-            cluster_number_minus_offset[1] == 0x00 &&
-            cluster_number_minus_offset[2] == 0x00 &&
-            cluster_number_minus_offset[3] == 0x00)
+        // the last part of the name comes first, it says how many entries the name takes
+        const uint16_t reserved_length = sequence_number * characters_per_entry;
+
+        // a name that does not fit in the rest of the pool is dropped, the entry keeps its 8.3 name
+        if (sequence_number == 0U || sequence_number > max_long_name_entries ||
+            reserved_length > (long_name_pool_words << 1) - long_name_pool_used)
         {
-            // no more multiplication to perform so set exit condition of loop
-            repeated_additions_left_to_perform = false;
-        }
-        else{
-            add_4_byte_numbers(sectors_per_cluster_4_byte_addr, lba_offset, lba_offset);
-            uint16_t one_loop_iteration[4] = {0x0, 0x0, 0x0, 0x1};
-            subtract_4_byte_numbers(cluster_number_minus_offset, one_loop_iteration, cluster_number_minus_offset);
+            long_name_assembly = LongNameAssembly();
+            return;
         }
+
+        long_name_assembly.next_sequence_number = sequence_number;
+        long_name_assembly.checksum = checksum;
+        long_name_assembly.reserved_length = reserved_length;
+        long_name_assembly.complete = false;
     }
+    else if (long_name_assembly.next_sequence_number == 0U || sequence_number != long_name_assembly.next_sequence_number ||
+                checksum != long_name_assembly.checksum)
+    {
+        // out of sequence or part of another name
+        long_name_assembly = LongNameAssembly();
+        return;
+    }
+
+    // characters are UCS-2, anything past Latin-1 is replaced. The null terminator and the 0xFFFF
+    // padding after it both end the name
+    const uint16_t first_position = long_name_pool_used + (sequence_number - 1U) * characters_per_entry;
+    for (uint16_t i = 0; i < characters_per_entry; i++)
+    {
+        const uint16_t character = directory_sector.get_le16(entry_offset + character_offsets[i]);
 
-    add_4_byte_numbers(cluster_begin_lba, lba_offset, resulting_sector_address);
+        set_long_name_character(first_position + i, (character == 0xFFFF) ? 0x0 : (character > 0xFF) ? '_' : character);
+    }
+
+    long_name_assembly.next_sequence_number = sequence_number - 1U;
+    long_name_assembly.complete = (sequence_number == 1U);
 }
 
-void FileSystem::calculate_fat_sector_offset_from_cluster_number(const uint16_t(&cluster_number)[4], uint16_t (&fat_sector_offset)[4], uint16_t &index)
+bool FileSystem::is_long_name_assembled_for(const PackedSector &directory_sector, const uint16_t &entry_offset) const
 {
-    /**
-     * @brief With a 512 byte sector, there are 128 cluster number entrys per sector
-     */
-    constexpr uint16_t num_cluster_entrys_per_fat_table_sector = 128U;
-    
-    // Make a copy of the cluster number so it can be decremented if needed
-    uint16_t copy_of_starting_cluster_number[4];
-    copy_of_starting_cluster_number[0] = cluster_number[0];
-    copy_of_starting_cluster_number[1] = cluster_number[1];
-    copy_of_starting_cluster_number[2] = cluster_number[2];
-    copy_of_starting_cluster_number[3] = cluster_number[3];
+    return long_name_assembly.complete && long_name_assembly.checksum == short_name_checksum(directory_sector, entry_offset);
+}
 
-    /**
-     * @brief This contains the offset, in sectors, from the beginning of a FAT table, where we are currently 
-     * looking at for reading a file clusterchain. E.g., if this offset is zero, the first sector of a FAT table 
-     * is what is being looked at
-     */
-    // uint16_t sector_number_offset_from_fat_begin[4] = {0x0, 0x0, 0x0, 0x0};
+uint16_t FileSystem::get_assembled_long_name_length() const
+{
+    uint16_t length = 0U;
+
+    while (length < long_name_assembly.reserved_length && get_long_name_character(long_name_pool_used + length) != 0x0)
+    {
+        length++;
+    }
 
-    bool calculating_sector_offset = true;
+    return length;
+}
 
-    while (calculating_sector_offset)
+bool FileSystem::long_name_matches(const uint16_t &offset, const uint16_t &length, const char *long_name) const
+{
+    for (uint16_t i = 0; i < length; i++)
     {
-        // check if remaining cluster number is <= 127, meaning our sector_number_offset[4] is correct
-        if (copy_of_starting_cluster_number[0] == 0x00 &&
-            copy_of_starting_cluster_number[1] == 0x00 &&
-            copy_of_starting_cluster_number[2] == 0x00 &&
-            copy_of_starting_cluster_number[3] <= 127U)
-        {
-            // No more subtraction needed, the sector offset is found
-            calculating_sector_offset = false;
+        uint16_t character = get_long_name_character(offset + i);
+        uint16_t other_character = static_cast<uint16_t>(long_name[i]) & 0xFF;
 
-            // A sector contains 128 cluster entries of 4 bytes each, so 
-            // multiply by 4 to actually get the index of a 512 byte sector where its stored
-            index = copy_of_starting_cluster_number[3] * 4;
+        // a shorter long_name ends with its null terminator, which never matches a character
+        if (character >= 'a' && character <= 'z')
+        {
+            character -= 'a' - 'A';
         }
-        else
+        if (other_character >= 'a' && other_character <= 'z')
         {
-            // sector offset is not yet found continue decrementing
-            uint16_t num_to_subtract[4] = {0x0, 0x0, 0x0, num_cluster_entrys_per_fat_table_sector};
+            other_character -= 'a' - 'A';
+        }
 
-            // copy_of_starting_cluster_address -= num_to_subtract(128)
-            subtract_4_byte_numbers(copy_of_starting_cluster_number, num_to_subtract, copy_of_starting_cluster_number);
+        if (character != other_character)
+        {
+            return false;
+        }
+    }
 
-            // sector_number_offset_from_fat_begin += 1
-            uint16_t num_to_add[4] = {0x0, 0x0, 0x0, 0x1};
-            add_4_byte_numbers(fat_sector_offset, num_to_add, fat_sector_offset);
+    return long_name[length] == '\0';
+}
 
-        }
+uint16_t FileSystem::short_name_checksum(const PackedSector &directory_sector, const uint16_t &entry_offset)
+{
+    uint16_t checksum = 0U;
+
+    // rotate right by one and add the next character, over all 11 characters of the 8.3 name
+    for (uint16_t i = 0; i < 11; i++)
+    {
+        checksum = ((((checksum & 0x1) << 7) | (checksum >> 1)) + directory_sector.get_byte(entry_offset + i)) & 0xFF;
     }
+
+    return checksum;
+}
+
+uint16_t FileSystem::get_long_name_character(const uint16_t &position) const
+{
+    const uint16_t word = long_name_pool[position >> 1];
+
+    return (position & 0x1) ? (word >> 8) : (word & 0xFF);
+}
+
+void FileSystem::set_long_name_character(const uint16_t &position, const uint16_t &character)
+{
+    uint16_t &word = long_name_pool[position >> 1];
+
+    word = (position & 0x1) ? ((word & 0x00FF) | ((character & 0xFF) << 8)) : ((word & 0xFF00) | (character & 0xFF));
+}
+
+Address32 FileSystem::calculate_sector_address_from_cluster_number(const Address32 &cluster_number) const
+{
+    // lba_addr = cluster_begin_lba + (cluster_number - 2) * sectors_per_cluster;
+    // assumes cluster_number >= 2
+    return cluster_begin_lba + ((cluster_number - Address32(0x0, 0x2)) << sectors_per_cluster_shift);
 }
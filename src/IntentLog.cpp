@@ -0,0 +1,527 @@
+/**
+ * @file IntentLog.cpp
+ * @author Mattheas Jamieson (mattheas@ualberta.ca)
+ * @brief Implementation of intent log, records uncommitted metadata changes in the reserved area
+ * @version 0.1
+ * @date 2024-03-03
+ */
+
+#include "../inc/IntentLog.h"
+
+using namespace file_system;
+
+namespace
+{
+/**
+ * @brief First reserved sector that may hold a record, sectors 0-2 are the boot sector, FSInfo
+ * and (on Windows formatted cards) more boot code
+ */
+constexpr uint16_t first_record_sector = 3U;
+
+/**
+ * @brief Windows keeps more boot code here
+ */
+constexpr uint16_t windows_boot_code_sector = 12U;
+
+/**
+ * @brief The boot sector, FSInfo and the third boot sector are backed up
+ */
+constexpr uint16_t backup_boot_sectors = 3U;
+} // namespace
+
+IntentLog::IntentLog(sd_driver::BlockDevice &_block_device) : block_device(_block_device)
+{
+}
+
+IntentLog::~IntentLog()
+{
+}
+
+bool IntentLog::configure(const Address32 &partition_lba_begin, const uint16_t &reserved_sectors, const uint16_t &fs_info_sector,
+                            const uint16_t &backup_boot_sector, const uint16_t &number_of_fats)
+{
+    enabled = false;
+    state = record_state_t::CLEAN;
+    record_on_card = true;
+    sequence = Address32();
+    reserved_area_begin = partition_lba_begin;
+    number_of_reserved_sectors = reserved_sectors;
+    fs_info_sector_number = fs_info_sector;
+    backup_boot_sector_number = (backup_boot_sector != 0x0 && backup_boot_sector != 0xFFFF) ? backup_boot_sector : 0x0;
+    number_of_fat_ranges = 0U;
+    number_of_directory_updates = 0U;
+    number_of_freed_chains = 0U;
+
+    // without a second FAT there is nothing to roll back from
+    if (number_of_fats < 2U)
+    {
+        return false;
+    }
+
+    // the record sectors are validated as they are found, so only an older current record is read again
+    bool records_valid[2] = {false, false};
+    Address32 record_sequences[2];
+
+    uint16_t sectors_found = 0U;
+    for (uint16_t sector = first_record_sector; sector < reserved_sectors && sectors_found < 2U; sector++)
+    {
+        if (is_used_reserved_sector(sector))
+        {
+            continue;
+        }
+
+        const Address32 sector_address = partition_lba_begin + Address32(0x0, sector);
+        if (block_device.read_block(record, sector_address) == false)
+        {
+            return false;
+        }
+
+        bool zero_sector = true;
+        for (uint16_t i = 0; i < PackedSector::words_per_sector && zero_sector; i++)
+        {
+            zero_sector = record.words[i] == 0x0;
+        }
+
+        // anything else belongs to someone else
+        if (zero_sector || record.get_le32(signature_offset) == record_signature())
+        {
+            record_sector_addresses[sectors_found] = sector_address;
+            records_valid[sectors_found] = is_valid_record();
+            record_sequences[sectors_found] = record.get_le32(sequence_offset);
+            sectors_found++;
+        }
+    }
+
+    if (sectors_found < 2U)
+    {
+        return false;
+    }
+
+    // the valid record with the higher sequence number is current, the other one is the record
+    // before it. The second sector is still in record
+    const bool first_valid = records_valid[0];
+    const bool second_valid = records_valid[1];
+
+    if (first_valid && (second_valid == false || record_sequences[0] > record_sequences[1]))
+    {
+        if (read_record(record_sector_addresses[0]) == false)
+        {
+            return false;
+        }
+    }
+    else if (second_valid == false)
+    {
+        // no record yet (or neither survived), start from a clean one
+        record.fill(0x0);
+    }
+
+    if (first_valid || second_valid)
+    {
+        state = static_cast<record_state_t>(record.get_le16(state_offset));
+        sequence = record.get_le32(sequence_offset);
+        number_of_fat_ranges = record.get_le16(number_of_fat_ranges_offset);
+        number_of_directory_updates = record.get_le16(number_of_directory_updates_offset);
+        number_of_freed_chains = record.get_le16(number_of_freed_chains_offset);
+    }
+
+    enabled = true;
+    return true;
+}
+
+bool IntentLog::is_enabled() const
+{
+    return enabled;
+}
+
+Address32 IntentLog::get_sequence() const
+{
+    return sequence;
+}
+
+bool IntentLog::find_free_reserved_sectors(const uint16_t &number_of_sectors, Address32 &first_sector_address) const
+{
+    if (enabled == false)
+    {
+        return false;
+    }
+
+    // after the second record sector, the record sectors are the first two free ones
+    uint16_t run_length = 0U;
+    for (uint16_t sector = (record_sector_addresses[1] - reserved_area_begin).low() + 1U; sector < number_of_reserved_sectors; sector++)
+    {
+        run_length = is_used_reserved_sector(sector) ? 0U : run_length + 1U;
+
+        if (run_length == number_of_sectors)
+        {
+            first_sector_address = reserved_area_begin + Address32(0x0, sector + 1U - number_of_sectors);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+IntentLog::record_state_t IntentLog::get_state() const
+{
+    return state;
+}
+
+bool IntentLog::is_empty() const
+{
+    return number_of_fat_ranges == 0U && number_of_directory_updates == 0U && number_of_freed_chains == 0U;
+}
+
+bool IntentLog::log_fat_sector(const Address32 &fat_sector_offset)
+{
+    if (enabled == false)
+    {
+        return false;
+    }
+
+    // ranges are sorted, find the first one that starts after the sector
+    uint16_t range_index = 0U;
+    Address32 first;
+    Address32 count;
+    for (; range_index < number_of_fat_ranges; range_index++)
+    {
+        get_fat_range(range_index, first, count);
+
+        if (fat_sector_offset < first)
+        {
+            break;
+        }
+
+        if (fat_sector_offset < first + count)
+        {
+            // already in the record, FAT #1 may be written straight away once the record is on the card
+            return record_on_card || write_record(record_state_t::OPEN);
+        }
+    }
+
+    Address32 previous_first;
+    Address32 previous_count;
+    if (range_index > 0U)
+    {
+        get_fat_range(range_index - 1U, previous_first, previous_count);
+    }
+
+    const bool extends_previous = range_index > 0U && previous_first + previous_count == fat_sector_offset;
+    const bool extends_next = range_index < number_of_fat_ranges && fat_sector_offset + Address32(0x0, 0x1) == first;
+
+    if (extends_previous && extends_next)
+    {
+        // the sector closes the gap between two ranges
+        set_fat_range(range_index - 1U, previous_first, previous_count + Address32(0x0, 0x1) + count);
+        remove_fat_range(range_index);
+    }
+    else if (extends_previous)
+    {
+        set_fat_range(range_index - 1U, previous_first, previous_count + Address32(0x0, 0x1));
+    }
+    else if (extends_next)
+    {
+        set_fat_range(range_index, fat_sector_offset, count + Address32(0x0, 0x1));
+    }
+    else
+    {
+        if (number_of_fat_ranges >= max_fat_ranges)
+        {
+            // the merged range may now cover the sector, it is added either way
+            merge_closest_fat_ranges();
+            range_index = 0U;
+            while (range_index < number_of_fat_ranges)
+            {
+                get_fat_range(range_index, first, count);
+                if (fat_sector_offset < first + count)
+                {
+                    break;
+                }
+                range_index++;
+            }
+        }
+
+        if (range_index >= number_of_fat_ranges || fat_sector_offset < first)
+        {
+            insert_fat_range(range_index);
+            set_fat_range(range_index, fat_sector_offset, Address32(0x0, 0x1));
+        }
+    }
+
+    // the record must be on the card before the sector is, so a brown-out can always roll back
+    return write_record(record_state_t::OPEN);
+}
+
+bool IntentLog::log_freed_chain(const FreedChain &freed_chain)
+{
+    if (enabled == false)
+    {
+        return true;
+    }
+
+    if (number_of_freed_chains >= max_freed_chains)
+    {
+        return false;
+    }
+
+    const uint16_t offset = freed_chains_offset + number_of_freed_chains * bytes_per_freed_chain;
+    record.set_le32(offset, freed_chain.first_cluster);
+    record.set_le32(offset + 4U, freed_chain.entry_sector_address);
+    record.set_le16(offset + 8U, freed_chain.entry_offset);
+    number_of_freed_chains++;
+
+    return write_record(record_state_t::OPEN);
+}
+
+bool IntentLog::add_directory_update(const DirectoryUpdate &directory_update)
+{
+    uint16_t update_index = 0U;
+    while (update_index < number_of_directory_updates)
+    {
+        const DirectoryUpdate pending_update = get_directory_update(update_index);
+        if (pending_update.entry_sector_address == directory_update.entry_sector_address &&
+            pending_update.entry_offset == directory_update.entry_offset)
+        {
+            break;
+        }
+        update_index++;
+    }
+
+    if (update_index >= max_directory_updates)
+    {
+        return false;
+    }
+
+    const uint16_t offset = directory_updates_offset + update_index * bytes_per_directory_update;
+    record.set_le32(offset, directory_update.entry_sector_address);
+    record.set_le16(offset + 4U, directory_update.entry_offset);
+    record.set_le16(offset + 6U, directory_update.name_checksum);
+    record.set_le32(offset + 8U, directory_update.first_cluster);
+    record.set_le32(offset + 12U, directory_update.size);
+
+    if (update_index == number_of_directory_updates)
+    {
+        number_of_directory_updates++;
+    }
+
+    return true;
+}
+
+void IntentLog::remove_directory_update(const Address32 &entry_sector_address, const uint16_t &entry_offset)
+{
+    for (uint16_t update_index = 0; update_index < number_of_directory_updates; update_index++)
+    {
+        const DirectoryUpdate pending_update = get_directory_update(update_index);
+        if (pending_update.entry_sector_address != entry_sector_address || pending_update.entry_offset != entry_offset)
+        {
+            continue;
+        }
+
+        // the last update takes its place, the order does not matter
+        number_of_directory_updates--;
+        const uint16_t offset = directory_updates_offset + update_index * bytes_per_directory_update;
+        const uint16_t last_offset = directory_updates_offset + number_of_directory_updates * bytes_per_directory_update;
+        for (uint16_t i = 0; i < bytes_per_directory_update; i += 2U)
+        {
+            record.set_le16(offset + i, record.get_le16(last_offset + i));
+        }
+        return;
+    }
+}
+
+uint16_t IntentLog::get_number_of_directory_updates() const
+{
+    return number_of_directory_updates;
+}
+
+IntentLog::DirectoryUpdate IntentLog::get_directory_update(const uint16_t &update_index) const
+{
+    const uint16_t offset = directory_updates_offset + update_index * bytes_per_directory_update;
+
+    DirectoryUpdate directory_update;
+    directory_update.entry_sector_address = record.get_le32(offset);
+    directory_update.entry_offset = record.get_le16(offset + 4U);
+    directory_update.name_checksum = record.get_le16(offset + 6U);
+    directory_update.first_cluster = record.get_le32(offset + 8U);
+    directory_update.size = record.get_le32(offset + 12U);
+    return directory_update;
+}
+
+uint16_t IntentLog::get_number_of_freed_chains() const
+{
+    return number_of_freed_chains;
+}
+
+IntentLog::FreedChain IntentLog::get_freed_chain(const uint16_t &chain_index) const
+{
+    const uint16_t offset = freed_chains_offset + chain_index * bytes_per_freed_chain;
+
+    FreedChain freed_chain;
+    freed_chain.first_cluster = record.get_le32(offset);
+    freed_chain.entry_sector_address = record.get_le32(offset + 4U);
+    freed_chain.entry_offset = record.get_le16(offset + 8U);
+    return freed_chain;
+}
+
+uint16_t IntentLog::get_number_of_fat_ranges() const
+{
+    return number_of_fat_ranges;
+}
+
+void IntentLog::get_fat_range(const uint16_t &range_index, Address32 &first_fat_sector_offset, Address32 &number_of_sectors) const
+{
+    const uint16_t offset = fat_ranges_offset + range_index * bytes_per_fat_range;
+    first_fat_sector_offset = record.get_le32(offset);
+    number_of_sectors = record.get_le32(offset + 4U);
+}
+
+bool IntentLog::begin_commit()
+{
+    if (enabled == false)
+    {
+        return true;
+    }
+
+    return write_record(record_state_t::COMMITTING);
+}
+
+bool IntentLog::clear()
+{
+    number_of_fat_ranges = 0U;
+    number_of_directory_updates = 0U;
+    number_of_freed_chains = 0U;
+
+    if (enabled == false || state == record_state_t::CLEAN)
+    {
+        return true;
+    }
+
+    return write_record(record_state_t::CLEAN);
+}
+
+bool IntentLog::is_used_reserved_sector(const uint16_t &sector) const
+{
+    return sector == fs_info_sector_number || sector == windows_boot_code_sector ||
+           (backup_boot_sector_number != 0x0 && sector >= backup_boot_sector_number && sector < backup_boot_sector_number + backup_boot_sectors);
+}
+
+bool IntentLog::write_record(const record_state_t &_state)
+{
+    const Address32 next_sequence = sequence + Address32(0x0, 0x1);
+
+    record.set_le32(signature_offset, record_signature());
+    record.set_le16(state_offset, static_cast<uint16_t>(_state));
+    record.set_le32(sequence_offset, next_sequence);
+    record.set_le16(number_of_fat_ranges_offset, number_of_fat_ranges);
+    record.set_le16(number_of_directory_updates_offset, number_of_directory_updates);
+    record.set_le16(number_of_freed_chains_offset, number_of_freed_chains);
+    record.set_le16(checksum_offset, record_checksum());
+
+    // the other sector still holds the record before this one if the write is torn
+    if (block_device.write_block(record, record_sector_addresses[next_sequence.low() & 0x1]) == false ||
+        block_device.flush() == false)
+    {
+        record_on_card = false;
+        return false;
+    }
+
+    record_on_card = true;
+    sequence = next_sequence;
+    state = _state;
+    return true;
+}
+
+bool IntentLog::read_record(const Address32 &sector_address)
+{
+    return block_device.read_block(record, sector_address) && is_valid_record();
+}
+
+bool IntentLog::is_valid_record() const
+{
+    return record.get_le32(signature_offset) == record_signature() &&
+           record.get_le16(checksum_offset) == record_checksum() &&
+           record.get_le16(state_offset) <= static_cast<uint16_t>(record_state_t::COMMITTING) &&
+           record.get_le16(number_of_fat_ranges_offset) <= max_fat_ranges &&
+           record.get_le16(number_of_directory_updates_offset) <= max_directory_updates &&
+           record.get_le16(number_of_freed_chains_offset) <= max_freed_chains;
+}
+
+uint16_t IntentLog::record_checksum() const
+{
+    uint16_t checksum = 0U;
+    for (uint16_t i = 0; i < PackedSector::words_per_sector; i++)
+    {
+        if (i != (checksum_offset >> 1))
+        {
+            checksum += record.words[i];
+        }
+    }
+
+    // a sector of zeros does not pass
+    return checksum ^ 0xFFFF;
+}
+
+void IntentLog::merge_closest_fat_ranges()
+{
+    uint16_t closest_index = 0U;
+    Address32 closest_gap(0xFFFF, 0xFFFF);
+
+    for (uint16_t i = 0; i + 1U < number_of_fat_ranges; i++)
+    {
+        Address32 first;
+        Address32 count;
+        Address32 next_first;
+        Address32 next_count;
+        get_fat_range(i, first, count);
+        get_fat_range(i + 1U, next_first, next_count);
+
+        const Address32 gap = next_first - (first + count);
+        if (gap < closest_gap)
+        {
+            closest_gap = gap;
+            closest_index = i;
+        }
+    }
+
+    // the sectors in the gap are covered too, they are identical in every FAT
+    Address32 first;
+    Address32 count;
+    Address32 next_first;
+    Address32 next_count;
+    get_fat_range(closest_index, first, count);
+    get_fat_range(closest_index + 1U, next_first, next_count);
+    set_fat_range(closest_index, first, next_first + next_count - first);
+    remove_fat_range(closest_index + 1U);
+}
+
+void IntentLog::set_fat_range(const uint16_t &range_index, const Address32 &first_fat_sector_offset, const Address32 &number_of_sectors)
+{
+    const uint16_t offset = fat_ranges_offset + range_index * bytes_per_fat_range;
+    record.set_le32(offset, first_fat_sector_offset);
+    record.set_le32(offset + 4U, number_of_sectors);
+}
+
+void IntentLog::insert_fat_range(const uint16_t &range_index)
+{
+    for (uint16_t i = number_of_fat_ranges; i > range_index; i--)
+    {
+        Address32 first;
+        Address32 count;
+        get_fat_range(i - 1U, first, count);
+        set_fat_range(i, first, count);
+    }
+
+    number_of_fat_ranges++;
+}
+
+void IntentLog::remove_fat_range(const uint16_t &range_index)
+{
+    for (uint16_t i = range_index + 1U; i < number_of_fat_ranges; i++)
+    {
+        Address32 first;
+        Address32 count;
+        get_fat_range(i, first, count);
+        set_fat_range(i - 1U, first, count);
+    }
+
+    number_of_fat_ranges--;
+}
@@ -0,0 +1,117 @@
+/**
+ * @file MountManager.cpp
+ * @author Mattheas Jamieson (mattheas@ualberta.ca)
+ * @brief Implementation of mount manager, shares a block cache and I/O worker between volumes
+ * @version 0.1
+ * @date 2024-03-03
+ */
+
+#include "../inc/MountManager.h"
+#include "../inc/FileSystem.h"
+
+using namespace file_system;
+
+MountManager::MountManager() : block_pool(cached_blocks, block_cache_blocks)
+{
+    for (uint16_t i = 0; i < max_volumes; i++)
+    {
+        volumes[i] = nullptr;
+        io_queues[i] = nullptr;
+    }
+}
+
+MountManager::~MountManager()
+{
+}
+
+bool MountManager::add_io_queue(sd_driver::AsyncBlockDevice &io_queue)
+{
+    if (number_of_io_queues >= max_volumes)
+    {
+        return false;
+    }
+
+    io_queues[number_of_io_queues] = &io_queue;
+    number_of_io_queues++;
+    return true;
+}
+
+bool MountManager::poll()
+{
+    // one request of each queue at a time, so a long run of writes to one card does not starve the others
+    bool request_carried_out = false;
+    for (uint16_t i = 0; i < number_of_io_queues; i++)
+    {
+        if (io_queues[i]->poll())
+        {
+            request_carried_out = true;
+        }
+    }
+
+    return request_carried_out;
+}
+
+void MountManager::run()
+{
+    while (true)
+    {
+        poll();
+    }
+}
+
+uint16_t MountManager::get_number_of_volumes() const
+{
+    return number_of_volumes;
+}
+
+FileSystem *MountManager::get_volume(const uint16_t &volume_index) const
+{
+    return (volume_index < number_of_volumes) ? volumes[volume_index] : nullptr;
+}
+
+bool MountManager::unmount_all()
+{
+    bool every_volume_unmounted = true;
+    for (uint16_t i = 0; i < number_of_volumes; i++)
+    {
+        if (volumes[i]->unmount() == false)
+        {
+            every_volume_unmounted = false;
+        }
+    }
+
+    return every_volume_unmounted;
+}
+
+bool MountManager::attach(FileSystem &volume)
+{
+    if (number_of_volumes >= max_volumes)
+    {
+        return false;
+    }
+
+    volumes[number_of_volumes] = &volume;
+    number_of_volumes++;
+    return true;
+}
+
+void MountManager::detach(FileSystem &volume)
+{
+    for (uint16_t i = 0; i < number_of_volumes; i++)
+    {
+        if (volumes[i] != &volume)
+        {
+            continue;
+        }
+
+        // keep the rest in the order they were mounted
+        for (uint16_t j = i + 1U; j < number_of_volumes; j++)
+        {
+            volumes[j - 1U] = volumes[j];
+        }
+
+        number_of_volumes--;
+        volumes[number_of_volumes] = nullptr;
+        return;
+    }
+}
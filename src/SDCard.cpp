@@ -11,23 +11,127 @@
 
 using namespace sd_driver;
 
-SDCard::SDCard(const bool &configure_spi1)
+namespace
 {
-    if (configure_spi1 == true)
+/**
+ * @brief CRC7 (x^7 + x^3 + 1) of every 4 bit value, kept in the upper 7 bits of a byte so a
+ * nibble is processed with one look up (16 words rather than a 256 entry table)
+ */
+const uint16_t crc7_nibble_table[16] = {0x00, 0x12, 0x24, 0x36, 0x48, 0x5A, 0x6C, 0x7E,
+                                        0x90, 0x82, 0xB4, 0xA6, 0xD8, 0xCA, 0xFC, 0xEE};
+
+/**
+ * @brief CRC16-CCITT (x^16 + x^12 + x^5 + 1) of every 4 bit value
+ */
+const uint16_t crc16_nibble_table[16] = {0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+                                         0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF};
+
+/**
+ * @brief Adds a byte to a CRC7 kept in the upper 7 bits of crc_7
+ */
+inline uint16_t update_crc7(uint16_t crc_7, const uint16_t &byte)
+{
+    crc_7 = ((crc_7 << 4) & 0xFF) ^ crc7_nibble_table[(crc_7 >> 4) ^ ((byte >> 4) & 0xF)];
+    return ((crc_7 << 4) & 0xFF) ^ crc7_nibble_table[(crc_7 >> 4) ^ (byte & 0xF)];
+}
+
+/**
+ * @brief Adds a byte to a CRC16-CCITT
+ */
+inline uint16_t update_crc16(uint16_t crc_16, const uint16_t &byte)
+{
+    crc_16 = (crc_16 << 4) ^ crc16_nibble_table[(crc_16 >> 12) ^ ((byte >> 4) & 0xF)];
+    return (crc_16 << 4) ^ crc16_nibble_table[(crc_16 >> 12) ^ (byte & 0xF)];
+}
+} // namespace
+
+SDCard::SDCard(const bool &configure_spi1) : SDCard(SDCardSlot(), configure_spi1)
+{
+}
+
+SDCard::SDCard(const SDCardSlot &_slot, const bool &configure_spi)
+    : spi_port(_slot.spi_port), cs_port(_slot.cs_port), CS_INACTIVE_HIGH(_slot.cs_port_high_mask | _slot.cs_pin_mask),
+    CS_ACTIVE_LOW(_slot.cs_port_high_mask & ~_slot.cs_pin_mask)
+{
+    if (configure_spi == true)
     {
-        SPI_set_config_optimal(_49_152_MHz, SPI1);
+        SPI_set_config_optimal(_49_152_MHz, spi_port);
     }
 
-    // Set pin PD3 as an output, it is the Chip Select(CS) for the SD cards SPI
+    // Set the CS pin (e.g., PD3) as an output, it is the Chip Select(CS) for the SD cards SPI
     // interface. Pins are set as an output by setting a 1 in the position N+8,
     // where N is the GPIO pin number
-    gpio_set_config((0x03 << 8), GPIO_D);
+    gpio_set_config(_slot.cs_port_config, cs_port);
 }
 
 SDCard::~SDCard()
 {
 }
 
+bool SDCard::set_crc_mode(const bool &enable)
+{
+    constexpr uint16_t command_59 = 0x7B;
+
+    if (wait_until_ready() == false)
+    {
+        return false;
+    }
+
+    // assert CS to start communication
+    gpio_write(CS_ACTIVE_LOW, cs_port);
+    send_dummy_spi_bytes();
+
+    // Send 6-byte CMD59 command “0x7B 00 00 00 01 83” (on) or “0x7B 00 00 00 00 91” (off)
+    const uint16_t command_argument[4] = {0x0, 0x0, 0x0, static_cast<uint16_t>(enable ? 0x1 : 0x0)};
+    send_command(command_59, command_argument);
+
+    bool valid_r1_reponse = false;
+    for (uint16_t i = 0; i < NUM_INVALID_RESPONSE_LIMIT_SPI_READ; i++)
+    {
+        if (SPI_read(spi_port) == static_cast<uint16_t>(sd_card_command_response_t::SD_CARD_NOT_IN_IDLE_MODE_RESPONSE))
+        {
+            valid_r1_reponse = true;
+            break;
+        }
+    }
+
+    // de-assert CS to end communication
+    gpio_write(CS_INACTIVE_HIGH, cs_port);
+    SPI_write(0xFF, spi_port);
+
+    if (valid_r1_reponse)
+    {
+        crc_mode = enable;
+    }
+
+    return valid_r1_reponse;
+}
+
+bool SDCard::get_crc_mode() const
+{
+    return crc_mode;
+}
+
+void SDCard::set_spi_clock_callback(spi_clock_callback_t _spi_clock_callback, void *_spi_clock_context)
+{
+    spi_clock_callback = _spi_clock_callback;
+    spi_clock_context = _spi_clock_context;
+}
+
+bool SDCard::optimal_spi_clock_callback(const uint16_t &clock_khz, uint16_t &chosen_clock_khz, void *context)
+{
+    const OptimalSPIClock *optimal_spi_clock = static_cast<const OptimalSPIClock *>(context);
+
+    if (clock_khz < optimal_spi_clock->spi_clock_khz)
+    {
+        return false;
+    }
+
+    SPI_set_config_optimal(optimal_spi_clock->system_clock, optimal_spi_clock->spi_port);
+    chosen_clock_khz = optimal_spi_clock->spi_clock_khz;
+    return true;
+}
+
 SDCard::initialization_result_t SDCard::get_initialization_result() const
 {
     return initialization_result;
@@ -35,24 +139,62 @@ SDCard::initialization_result_t SDCard::get_initialization_result() const
 
 SDCard::SDCardInformation SDCard::get_sd_card_information() const
 {
-    return sd_card_information;
+    SDCardInformation information = sd_card_information;
+    information.longest_busy_bytes = longest_busy_bytes;
+    information.crc_retries = crc_retries;
+
+    return information;
+}
+
+SDCard::SDCardStatistics SDCard::get_statistics() const
+{
+    return statistics;
+}
+
+void SDCard::reset_statistics()
+{
+    statistics = SDCardStatistics();
+}
+
+void SDCard::dump_statistics() const
+{
+    if (statistics_enabled == false)
+    {
+        xpd_puts("sd card statistics not compiled in (SD_FS_STATISTICS)\n");
+        return;
+    }
+
+    xpd_echo_statistic("cmd17", statistics.cmd17_commands);
+    xpd_echo_statistic("cmd18", statistics.cmd18_commands);
+    xpd_echo_statistic("cmd24", statistics.cmd24_commands);
+    xpd_echo_statistic("cmd25", statistics.cmd25_commands);
+    xpd_echo_statistic("token polls", statistics.token_polls);
+    xpd_echo_statistic("busy spins", statistics.busy_spins);
+    xpd_echo_statistic("timeouts", statistics.timeouts);
+    xpd_echo_operation_statistics("single block reads", statistics.single_block_reads);
+    xpd_echo_operation_statistics("multiple block reads", statistics.multiple_block_reads);
+    xpd_echo_operation_statistics("single block writes", statistics.single_block_writes);
+    xpd_echo_operation_statistics("multiple block writes", statistics.multiple_block_writes);
 }
 
 SDCard::initialization_result_t SDCard::initialize_sd_card()
 {
     const uint16_t max_number_cmd0_commands_sent = 100U;
 
+    // identify the card at the slow clock every card has to support
+    set_spi_clock(identification_clock_khz);
+
     // write dummy value to SPI while CS is inactive/HIGH for at least 74 clock cycles
-    gpio_write(CS_INACTIVE_HIGH, GPIO_D);
+    gpio_write(CS_INACTIVE_HIGH, cs_port);
     for (uint16_t i = 0; i < 20; i++)
     {
-        SPI_write(0xFF, SPI1);
+        SPI_write(0xFF, spi_port);
     }
 
     // CMD0
     //================================================================================================================
     // assert CS to start communication
-    gpio_write(CS_ACTIVE_LOW, GPIO_D);
+    gpio_write(CS_ACTIVE_LOW, cs_port);
 
     bool valid_cmd0_response = false;
     for (int i = 0; i < max_number_cmd0_commands_sent; i++)
@@ -66,8 +208,8 @@ SDCard::initialization_result_t SDCard::initialize_sd_card()
     }
 
     // de-assert CS to end communication
-    gpio_write(CS_INACTIVE_HIGH, GPIO_D);
-    SPI_write(0xFF, SPI1);
+    gpio_write(CS_INACTIVE_HIGH, cs_port);
+    SPI_write(0xFF, spi_port);
 
     // Stop initialization process if no or invalid response is received from CMD0
     if (valid_cmd0_response == false)
@@ -81,7 +223,7 @@ SDCard::initialization_result_t SDCard::initialize_sd_card()
     // CMD8
     //================================================================================================================
     // assert CS to start communication
-    gpio_write(CS_ACTIVE_LOW, GPIO_D);
+    gpio_write(CS_ACTIVE_LOW, cs_port);
 
     sd_card_command_response_t cmd8_response = send_cmd8();
 
@@ -103,14 +245,14 @@ SDCard::initialization_result_t SDCard::initialize_sd_card()
     }
 
     // de-assert CS to end communication
-    gpio_write(CS_INACTIVE_HIGH, GPIO_D);
-    SPI_write(0xFF, SPI1);
+    gpio_write(CS_INACTIVE_HIGH, cs_port);
+    SPI_write(0xFF, spi_port);
     //================================================================================================================
     
     // CMD58
     //================================================================================================================
     // assert CS to start communication
-    gpio_write(CS_ACTIVE_LOW, GPIO_D);
+    gpio_write(CS_ACTIVE_LOW, cs_port);
 
     sd_card_command_response_t cmd58_response = send_cmd58(true); // card should be in idle
 
@@ -135,8 +277,8 @@ SDCard::initialization_result_t SDCard::initialize_sd_card()
     }
 
     // de-assert CS to end communication
-    gpio_write(CS_INACTIVE_HIGH, GPIO_D);
-    SPI_write(0xFF, SPI1);
+    gpio_write(CS_INACTIVE_HIGH, cs_port);
+    SPI_write(0xFF, spi_port);
     //================================================================================================================
 
     // CMD55 & ACMD41
@@ -145,7 +287,7 @@ SDCard::initialization_result_t SDCard::initialize_sd_card()
     
     do{
         // assert CS to start communication
-        gpio_write(CS_ACTIVE_LOW, GPIO_D);
+        gpio_write(CS_ACTIVE_LOW, cs_port);
 
         sd_card_command_response_t cmd55_response = send_cmd55();
 
@@ -157,11 +299,11 @@ SDCard::initialization_result_t SDCard::initialize_sd_card()
         }
 
         // de-assert CS to end communication
-        gpio_write(CS_INACTIVE_HIGH, GPIO_D);
-        SPI_write(0xFF, SPI1);
+        gpio_write(CS_INACTIVE_HIGH, cs_port);
+        SPI_write(0xFF, spi_port);
 
         // assert CS to start communication
-        gpio_write(CS_ACTIVE_LOW, GPIO_D);
+        gpio_write(CS_ACTIVE_LOW, cs_port);
 
         sd_card_command_response_t acmd41_response = send_acmd41();
 
@@ -177,8 +319,8 @@ SDCard::initialization_result_t SDCard::initialize_sd_card()
         }
 
         // de-assert CS to end communication
-        gpio_write(CS_INACTIVE_HIGH, GPIO_D);
-        SPI_write(0xFF, SPI1);
+        gpio_write(CS_INACTIVE_HIGH, cs_port);
+        SPI_write(0xFF, spi_port);
 
     } while (sd_card_in_idle_state);
     //================================================================================================================
@@ -195,7 +337,7 @@ SDCard::initialization_result_t SDCard::initialize_sd_card()
         sd_card_information.sd_card_version = sd_card_version_t::VER_2;
 
         // assert CS to start communication
-        gpio_write(CS_ACTIVE_LOW, GPIO_D);
+        gpio_write(CS_ACTIVE_LOW, cs_port);
 
         sd_card_command_response_t cmd58_response = send_cmd58(false); // card should no longer be in idle
 
@@ -220,8 +362,8 @@ SDCard::initialization_result_t SDCard::initialize_sd_card()
         }
 
         // de-assert CS to end communication
-        gpio_write(CS_INACTIVE_HIGH, GPIO_D);
-        SPI_write(0xFF, SPI1);
+        gpio_write(CS_INACTIVE_HIGH, cs_port);
+        SPI_write(0xFF, spi_port);
 
         // check CCS bit of OCR register to determine sd card standard  of V2.00 or later card
         if (sd_card_information.ocr_register_contents[0] & (1 << 6))
@@ -233,6 +375,30 @@ SDCard::initialization_result_t SDCard::initialize_sd_card()
         }
     }
     //================================================================================================================
+
+    // CMD9, then switch to the fastest data clock the card supports
+    //================================================================================================================
+    sd_card_information.maximum_clock_khz = default_speed_clock_khz;
+    if (send_cmd9() == sd_card_command_response_t::SD_CARD_RESPONSE_ACCEPTED)
+    {
+        const uint16_t maximum_clock_khz = tran_speed_to_khz(sd_card_information.csd_register_contents[3]);
+        if (maximum_clock_khz != 0U)
+        {
+            sd_card_information.maximum_clock_khz = maximum_clock_khz;
+        }
+    }
+
+    set_spi_clock(sd_card_information.maximum_clock_khz);
+    //================================================================================================================
+
+    // at the data clock so the latencies are in the units the driver polls in
+    measure_card_timing();
+    size_busy_poll_limit();
+
+    // the allocation unit is only a hint for where to place data, a card without it still works
+    sd_card_information.allocation_unit_blocks = Address32();
+    send_acmd13();
+
     initialization_result = initialization_result_t::INIT_SUCCESS;
     return initialization_result_t::INIT_SUCCESS;
 }
@@ -243,16 +409,16 @@ SDCard::sd_card_command_response_t SDCard::send_cmd0() const
     const uint16_t crc_7 = 0x95; // crc7 of bytes 1-5 of command
 
     // Send 6-byte CMD0 command “40 00 00 00 00 95” to put the card in SPI mode
-    SPI_write(command_0, SPI1);
-    SPI_write(0x0, SPI1);
-    SPI_write(0x0, SPI1);
-    SPI_write(0x0, SPI1);
-    SPI_write(0x0, SPI1);
-    SPI_write(crc_7, SPI1); // CRC7
+    SPI_write(command_0, spi_port);
+    SPI_write(0x0, spi_port);
+    SPI_write(0x0, spi_port);
+    SPI_write(0x0, spi_port);
+    SPI_write(0x0, spi_port);
+    SPI_write(crc_7, spi_port); // CRC7
 
     for (uint16_t i = 0; i < NUM_INVALID_RESPONSE_LIMIT_SPI_READ; i++)
     {
-        const uint16_t spi_read_value = SPI_read(SPI1);
+        const uint16_t spi_read_value = SPI_read(spi_port);
 
         if (spi_read_value == static_cast<uint16_t>(sd_card_command_response_t::SD_CARD_IN_IDLE_MODE_RESPONSE))
         {
@@ -271,25 +437,25 @@ SDCard::sd_card_command_response_t SDCard::send_cmd8() const
     const uint16_t crc_7 = 0x87; // crc7 of bytes 1-5 of command
 
     // Send 6-byte CMD8 command “48 00 00 01 AA 95” to tell the SD card which voltages it must accept
-    SPI_write(command_8, SPI1);
-    SPI_write(0x0, SPI1);
-    SPI_write(0x0, SPI1);
-    SPI_write(supported_voltage_range, SPI1);
-    SPI_write(check_pattern, SPI1);
-    SPI_write(crc_7, SPI1);
+    SPI_write(command_8, spi_port);
+    SPI_write(0x0, spi_port);
+    SPI_write(0x0, spi_port);
+    SPI_write(supported_voltage_range, spi_port);
+    SPI_write(check_pattern, spi_port);
+    SPI_write(crc_7, spi_port);
 
     for (uint16_t i = 0; i < NUM_INVALID_RESPONSE_LIMIT_SPI_READ; i++)
     {
-        const uint16_t spi_read_value = SPI_read(SPI1);
+        const uint16_t spi_read_value = SPI_read(spi_port);
 
         if (spi_read_value == static_cast<uint16_t>(sd_card_command_response_t::SD_CARD_IN_IDLE_MODE_RESPONSE))
         {
             // discard two unused bytes of response which should both be 0
-            SPI_read(SPI1);
-            SPI_read(SPI1);
+            SPI_read(spi_port);
+            SPI_read(spi_port);
 
-            const uint16_t spi_read_voltage_range_supported = SPI_read(SPI1);
-            const uint16_t spi_read_repeated_check_pattern = SPI_read(SPI1);
+            const uint16_t spi_read_voltage_range_supported = SPI_read(spi_port);
+            const uint16_t spi_read_repeated_check_pattern = SPI_read(spi_port);
 
             if (spi_read_voltage_range_supported != supported_voltage_range)
             {
@@ -322,16 +488,16 @@ SDCard::sd_card_command_response_t SDCard::send_cmd58(const bool &expected_in_id
     const uint16_t crc_7 = 0xFD; // crc7 of bytes 1-5 of command
 
     // Send 6-byte CMD0 command “7A 00 00 00 00 FD” to read the OCR register
-    SPI_write(command_0, SPI1);
-    SPI_write(0x0, SPI1);
-    SPI_write(0x0, SPI1);
-    SPI_write(0x0, SPI1);
-    SPI_write(0x0, SPI1);
-    SPI_write(crc_7, SPI1);
+    SPI_write(command_0, spi_port);
+    SPI_write(0x0, spi_port);
+    SPI_write(0x0, spi_port);
+    SPI_write(0x0, spi_port);
+    SPI_write(0x0, spi_port);
+    SPI_write(crc_7, spi_port);
 
     for (uint16_t i = 0; i < NUM_INVALID_RESPONSE_LIMIT_SPI_READ; i++)
     {
-        const uint16_t spi_read_value = SPI_read(SPI1);
+        const uint16_t spi_read_value = SPI_read(spi_port);
 
         if(spi_read_value == static_cast<uint16_t>(sd_card_command_response_t::SD_CARD_ILLEGAL_COMMAND) 
                 && sd_card_information.sd_card_version == sd_card_version_t::VER_1)
@@ -349,16 +515,16 @@ SDCard::sd_card_command_response_t SDCard::send_cmd58(const bool &expected_in_id
             // the 4 bytes after idle more response are the contents of the OCR register
 
             // bits 31-24, contains CCS and power up status bit, not important yet
-            const uint16_t ocr_register_byte1 = SPI_read(SPI1);
+            const uint16_t ocr_register_byte1 = SPI_read(spi_port);
 
             // bits 23-16, all bits must be set, indicates voltage 2.8-3.6V supported
-            const uint16_t ocr_register_byte2 = SPI_read(SPI1);
+            const uint16_t ocr_register_byte2 = SPI_read(spi_port);
 
             //bits 15-8, bit 15 must be set as that indicates voltage 2.7-2.8V supported
-            const uint16_t ocr_register_byte3 = SPI_read(SPI1);
+            const uint16_t ocr_register_byte3 = SPI_read(spi_port);
 
             // bits 7-0, mostly reserved, of no importance
-            const uint16_t ocr_register_byte4 = SPI_read(SPI1);
+            const uint16_t ocr_register_byte4 = SPI_read(spi_port);
 
             // save OCR register contents
             sd_card_information.ocr_register_contents[0] = ocr_register_byte1;
@@ -390,18 +556,13 @@ SDCard::sd_card_command_response_t SDCard::send_cmd58(const bool &expected_in_id
 SDCard::sd_card_command_response_t SDCard::send_cmd55() const
 {
     const uint16_t command_55 = 0x77;
-    const uint16_t crc_7 = 0x65; // crc7 of bytes 1-5 of command
 
-    SPI_write(command_55, SPI1);
-    SPI_write(0x0, SPI1);
-    SPI_write(0x0, SPI1);
-    SPI_write(0x0, SPI1);
-    SPI_write(0x0, SPI1);
-    SPI_write(crc_7, SPI1);
+    const uint16_t command_argument[4] = {0x0, 0x0, 0x0, 0x0};
+    send_command(command_55, command_argument);
 
     for (uint16_t i = 0; i < NUM_INVALID_RESPONSE_LIMIT_SPI_READ; i++)
     {
-        const uint16_t spi_read_value = SPI_read(SPI1);
+        const uint16_t spi_read_value = SPI_read(spi_port);
 
         if (spi_read_value == static_cast<uint16_t>(sd_card_command_response_t::SD_CARD_IN_IDLE_MODE_RESPONSE) || 
             spi_read_value == static_cast<uint16_t>(sd_card_command_response_t::SD_CARD_NOT_IN_IDLE_MODE_RESPONSE))
@@ -420,16 +581,16 @@ SDCard::sd_card_command_response_t SDCard::send_acmd41() const
     const uint16_t crc_7 = 0x77; // crc7 of bytes 1-5 of command
 
     // Send 6-byte ACMD41 command “0x69  40 00 00 00  77” to send host capacity support information and activate the card initialization process.
-    SPI_write(application_specific_command_41, SPI1);
-    SPI_write(support_sdhc_sdxc_cards, SPI1);
-    SPI_write(0x0, SPI1);
-    SPI_write(0x0, SPI1);
-    SPI_write(0x0, SPI1);
-    SPI_write(crc_7, SPI1);
+    SPI_write(application_specific_command_41, spi_port);
+    SPI_write(support_sdhc_sdxc_cards, spi_port);
+    SPI_write(0x0, spi_port);
+    SPI_write(0x0, spi_port);
+    SPI_write(0x0, spi_port);
+    SPI_write(crc_7, spi_port);
 
     for (uint16_t i = 0; i < NUM_INVALID_RESPONSE_LIMIT_SPI_READ; i++)
     {
-        const uint16_t spi_read_value = SPI_read(SPI1);
+        const uint16_t spi_read_value = SPI_read(spi_port);
 
         if (spi_read_value == static_cast<uint16_t>(sd_card_command_response_t::SD_CARD_IN_IDLE_MODE_RESPONSE))
         {
@@ -444,215 +605,1120 @@ SDCard::sd_card_command_response_t SDCard::send_acmd41() const
     return sd_card_command_response_t::SD_CARD_NO_RESPONSE;
 }
 
-void SDCard::send_dummy_spi_bytes() const
+SDCard::sd_card_command_response_t SDCard::send_cmd9()
 {
-    for (uint16_t i = 0; i < 20; i++)
+    constexpr uint16_t command_9 = 0x49;
+    constexpr uint16_t csd_register_bytes = 16U;
+
+    gpio_write(CS_ACTIVE_LOW, cs_port);
+    send_dummy_spi_bytes();
+
+    // Send 6-byte CMD9 command “0x49 00 00 00 00 AF”, the CSD is sent as a 16 byte data block
+    const uint16_t command_argument[4] = {0x0, 0x0, 0x0, 0x0};
+    send_command(command_9, command_argument);
+
+    sd_card_command_response_t cmd9_response = sd_card_command_response_t::SD_CARD_NO_RESPONSE;
+
+    if (wait_for_start_block_token())
     {
-        SPI_write(0xFF, SPI1);
+        for (uint16_t i = 0; i < csd_register_bytes; i++)
+        {
+            sd_card_information.csd_register_contents[i] = SPI_read(spi_port) & 0xFF;
+        }
+
+        // discard the two CRC16 bytes
+        SPI_read(spi_port);
+        SPI_read(spi_port);
+
+        cmd9_response = sd_card_command_response_t::SD_CARD_RESPONSE_ACCEPTED;
     }
+
+    // de-assert CS to end communication
+    gpio_write(CS_INACTIVE_HIGH, cs_port);
+    SPI_write(0xFF, spi_port);
+
+    return cmd9_response;
 }
 
-SDCard::sd_card_command_response_t SDCard::send_cmd17(uint16_t (&block)[512], const uint16_t (&block_address)[4]) const
+SDCard::sd_card_command_response_t SDCard::send_acmd13()
 {
-    const uint16_t block_size_bytes = 512U;
-    const uint16_t command_17 = 0x51;
-    const uint16_t crc_7 = 0x00; // TODO calculate crc7 of bytes 1-5 of command
+    constexpr uint16_t application_specific_command_13 = 0x4D;
+    constexpr uint16_t sd_status_bytes = 64U;
 
-    // assert CS to start communication
-    gpio_write(CS_ACTIVE_LOW, GPIO_D);
+    // AU_SIZE is bits 431-428 of the 512 bit SD Status (sent MSB first), the upper 4 bits of byte 10
+    constexpr uint16_t au_size_byte = 10U;
+
+    gpio_write(CS_ACTIVE_LOW, cs_port);
     send_dummy_spi_bytes();
 
-    // Send 6-byte CMD17 command “0x51  XX XX XX XX 00” to read a block from sd card
-    SPI_write(command_17, SPI1);
-    SPI_write(block_address[0], SPI1);
-    SPI_write(block_address[1], SPI1);
-    SPI_write(block_address[2], SPI1);
-    SPI_write(block_address[3], SPI1);
-    SPI_write(crc_7, SPI1);
+    sd_card_command_response_t acmd13_response = sd_card_command_response_t::SD_CARD_NO_RESPONSE;
 
-    bool waiting_for_data = true;
-    uint16_t num_invalid_reads = 0U;
-    do{
-        const uint16_t spi_read_value = SPI_read(SPI1);
+    if (send_cmd55() == sd_card_command_response_t::SD_CARD_RESPONSE_ACCEPTED)
+    {
+        // Send 6-byte ACMD13 command “0x4D 00 00 00 00 CC”, the response is R2 (R1 followed by a
+        // second status byte) and then the SD Status as a 64 byte data block
+        const uint16_t command_argument[4] = {0x0, 0x0, 0x0, 0x0};
+        send_command(application_specific_command_13, command_argument);
 
-        if (spi_read_value == 0xFE)
+        uint16_t r1_response = 0xFF;
+        for (uint16_t i = 0; i < NUM_INVALID_RESPONSE_LIMIT_SPI_READ && (r1_response & 0x80) != 0x0; i++)
         {
-            // exit loop when 0xFE is read, this indicates next byte is start of block
-            waiting_for_data = false;
+            r1_response = SPI_read(spi_port) & 0xFF;
         }
-        else
+
+        if (r1_response == static_cast<uint16_t>(sd_card_command_response_t::SD_CARD_NOT_IN_IDLE_MODE_RESPONSE))
         {
-            num_invalid_reads++;
-            if (num_invalid_reads > 1000)
-            {
-                // de-assert CS to end communication
-                gpio_write(CS_INACTIVE_HIGH, GPIO_D);
-                SPI_write(0xFF, SPI1);
+            // second byte of the R2 response
+            SPI_read(spi_port);
 
-                // return early if num invalid read threshold is reached
-                return sd_card_command_response_t::SD_CARD_NO_RESPONSE;
+            if (wait_for_start_block_token())
+            {
+                uint16_t au_size = 0U;
+                for (uint16_t i = 0; i < sd_status_bytes; i++)
+                {
+                    const uint16_t sd_status_byte = SPI_read(spi_port) & 0xFF;
+                    if (i == au_size_byte)
+                    {
+                        au_size = sd_status_byte >> 4;
+                    }
+                }
+
+                // discard the two CRC16 bytes
+                SPI_read(spi_port);
+                SPI_read(spi_port);
+
+                sd_card_information.allocation_unit_blocks = au_size_to_blocks(au_size);
+                acmd13_response = sd_card_command_response_t::SD_CARD_RESPONSE_ACCEPTED;
             }
         }
+    }
+
+    // de-assert CS to end communication
+    gpio_write(CS_INACTIVE_HIGH, cs_port);
+    SPI_write(0xFF, spi_port);
+
+    return acmd13_response;
+}
 
-    }while(waiting_for_data);
+Address32 SDCard::au_size_to_blocks(const uint16_t &au_size)
+{
+    // 16 KB, 32 KB, ... 8 MB, 12 MB, 16 MB, 24 MB, 32 MB, 64 MB in 16 KB (32 block) units, 0 is not defined
+    constexpr uint16_t au_sizes_16_kb[16] = {0U, 1U, 2U, 4U, 8U, 16U, 32U, 64U, 128U, 256U, 512U, 768U, 1024U, 1536U, 2048U, 4096U};
+
+    return Address32(0x0, au_sizes_16_kb[au_size & 0xF]) << 5;
+}
+
+uint16_t SDCard::tran_speed_to_khz(const uint16_t &tran_speed)
+{
+    // time values 1.0 - 8.0 (x10) and rate units 100 kbit/s - 100 Mbit/s (/10, in kHz)
+    constexpr uint16_t time_values[16] = {0U, 10U, 12U, 13U, 15U, 20U, 25U, 30U, 35U, 40U, 45U, 50U, 55U, 60U, 70U, 80U};
+    constexpr uint16_t rate_units_khz[4] = {10U, 100U, 1000U, 10000U};
+
+    const uint16_t time_value = time_values[(tran_speed >> 3) & 0xF];
+    const uint16_t rate_unit = tran_speed & 0x7;
 
-    for (uint16_t i = 0;  i < block_size_bytes; i++)
+    if (rate_unit > 3U)
     {
-        block[i] = SPI_read(SPI1);
+        // reserved
+        return 0U;
     }
 
-    // de-assert CS to end communication
-    gpio_write(CS_INACTIVE_HIGH, GPIO_D);
-    SPI_write(0xFF, SPI1);
+    // 100 MHz or more, or 70/ 80 MHz (70 x 1000 kHz does not fit in 16 bits), far faster than
+    // SPI1 will run anyway
+    if ((rate_unit == 3U && time_value != 0U) || (rate_unit == 2U && time_value > 65U))
+    {
+        return 0xFFFF;
+    }
+
+    return time_value * rate_units_khz[rate_unit];
+}
+
+void SDCard::set_spi_clock(const uint16_t clock_khz)
+{
+    if (spi_clock_callback == nullptr)
+    {
+        return;
+    }
 
-    return sd_card_command_response_t::SD_CARD_RESPONSE_ACCEPTED;
+    uint16_t chosen_clock_khz = 0U;
+    if (spi_clock_callback(clock_khz, chosen_clock_khz, spi_clock_context))
+    {
+        sd_card_information.spi_clock_khz = chosen_clock_khz;
+    }
 }
 
-SDCard::sd_card_command_response_t SDCard::send_cmd24(const uint16_t (&block)[512], const uint16_t (&block_address)[4]) const
+void SDCard::measure_card_timing()
 {
+    constexpr uint16_t command_13 = 0x4D;
+    constexpr uint16_t command_17 = 0x51;
+    constexpr uint16_t start_block_token = 0xFE; // sent by SD card
     constexpr uint16_t block_size_bytes = 512U;
-    constexpr uint16_t command_24 = 0x58;
-    constexpr uint16_t crc_7 = 0x00; // TODO calculate crc7 of bytes 1-5 of command
-    constexpr uint16_t start_block_token = 0xFE; // sent to SD card
-    constexpr uint16_t busy_wait_token = 0x00; // sent by SD card
 
-    // assert CS to start communication
-    gpio_write(CS_ACTIVE_LOW, GPIO_D);
+    // Ncr, send 6-byte CMD13 (SEND_STATUS) command “0x4D 00 00 00 00 0D”, the R1 response is the
+    // first byte with the top bit clear
+    //================================================================================================================
+    gpio_write(CS_ACTIVE_LOW, cs_port);
     send_dummy_spi_bytes();
 
-    // Send 6-byte CMD24 command “0x58 XX XX XX XX 00” to read a block from sd card
-    SPI_write(command_24, SPI1);
-    SPI_write(block_address[0], SPI1);
-    SPI_write(block_address[1], SPI1);
-    SPI_write(block_address[2], SPI1);
-    SPI_write(block_address[3], SPI1);
-    SPI_write(crc_7, SPI1);
-
-    bool valid_r1_reponse = false;
+    const uint16_t status_command_argument[4] = {0x0, 0x0, 0x0, 0x0};
+    send_command(command_13, status_command_argument);
 
-    // wait for a valid response back
+    uint16_t command_response_bytes = 0U;
+    bool valid_r2_response = false;
     for (uint16_t i = 0; i < NUM_INVALID_RESPONSE_LIMIT_SPI_READ; i++)
     {
-        const uint16_t spi_read_value = SPI_read(SPI1);
-
-        if (spi_read_value == static_cast<uint16_t>(sd_card_command_response_t::SD_CARD_NOT_IN_IDLE_MODE_RESPONSE))
+        if ((SPI_read(spi_port) & 0x80) == 0x0)
         {
-            valid_r1_reponse = true;
+            valid_r2_response = true;
             break;
         }
+        command_response_bytes++;
     }
 
-    if (valid_r1_reponse == false)
-    {
-        // de-assert CS to end communication
-        gpio_write(CS_INACTIVE_HIGH, GPIO_D);
-        SPI_write(0xFF, SPI1);
-        
-        // return early because of no response from SD card
-        return sd_card_command_response_t::SD_CARD_NO_RESPONSE;
-    }
+    // second byte of the R2 response
+    SPI_read(spi_port);
 
-    // send start block token to notify SD card that block is starting
-    SPI_write(start_block_token, SPI1);
+    // de-assert CS to end communication
+    gpio_write(CS_INACTIVE_HIGH, cs_port);
+    SPI_write(0xFF, spi_port);
 
-    // Send 512 bytes of data
-    for (uint16_t i = 0; i < block_size_bytes; i++)
+    if (valid_r2_response == false)
     {
-        SPI_write(block[i], SPI1);
+        return;
     }
-    
-    // Write two bytes crc (16?), doesnt actually 
-    // SPI_write(0x00, SPI1);
-    // SPI_write(0x00, SPI1);
-    
-    bool waiting_for_data_response_token = true;
+    //================================================================================================================
 
-    /*
-        structure of data response token: 0bxxx0RRR1
-        xxx -> dont care bits
-        0   -> should be zero?
-        RRR -> Status of write operation
-        1   -> should be one?
+    // Nac, read block 0 (the MBR) allowing far longer than the default start block token limit
+    //================================================================================================================
+    uint16_t command_argument[4];
+    block_address_to_command_argument(Address32(), command_argument);
 
-        RRR has 3 valid forms outlined below:
-        010 -> Data accepted
-        101 -> Data rejected due to CRC error
-        110 -> Data rejected due to a write error
-    */
-    uint16_t data_response_token = 0U;
-    uint16_t num_invalid_reads = 0U;
+    gpio_write(CS_ACTIVE_LOW, cs_port);
+    send_dummy_spi_bytes();
 
-    do{
-        const uint16_t spi_read_value = SPI_read(SPI1);
+    send_command(command_17, command_argument);
+    STATISTICS_COUNT(statistics.cmd17_commands);
 
-        if (spi_read_value == 0xFF)
+    uint16_t read_access_bytes = 0U;
+    bool start_block_token_received = false;
+    while (read_access_bytes < 0xFFFF)
+    {
+        if (SPI_read(spi_port) == start_block_token)
         {
-            num_invalid_reads++;
-            if (num_invalid_reads > 1000)
-            {
-                // de-assert CS to end communication
-                gpio_write(CS_INACTIVE_HIGH, GPIO_D);
-                SPI_write(0xFF, SPI1);
-
-                // return early if num invalid read threshold is reached
-                return sd_card_command_response_t::SD_CARD_NO_RESPONSE;
-            }
+            start_block_token_received = true;
+            break;
         }
-        else 
-        {
-            data_response_token = spi_read_value;
+        read_access_bytes++;
+    }
 
-            // exit loop when 0xFE is read, this indicates next byte is start of block
-            waiting_for_data_response_token = false;
+    if (start_block_token_received)
+    {
+        // discard the block and its two CRC16 bytes
+        for (uint16_t i = 0; i < block_size_bytes + 2U; i++)
+        {
+            SPI_read(spi_port);
         }
+    }
 
-    }while(waiting_for_data_response_token);
+    // de-assert CS to end communication
+    gpio_write(CS_INACTIVE_HIGH, cs_port);
+    SPI_write(0xFF, spi_port);
 
-    // Check if the data was accepted
-    if ((data_response_token & 0x1F) == 0x5)
+    if (start_block_token_received == false)
     {
-        // data accepted now simply busy wait while sd card sends busy tokens
-        bool receiving_busy_wait_token = true;
-        do{
-            uint16_t spi_read_value = SPI_read(SPI1);
+        return;
+    }
+    //================================================================================================================
 
-            if (spi_read_value != busy_wait_token)
-            {
-                receiving_busy_wait_token = false;
-            }
+    sd_card_information.command_response_bytes = command_response_bytes;
+    sd_card_information.read_access_bytes = read_access_bytes;
+
+    // a couple of bytes more than the card needs to answer a command
+    sd_card_information.command_preamble_bytes = command_response_bytes + 2U;
+    if (sd_card_information.command_preamble_bytes > MAX_COMMAND_PREAMBLE_BYTES)
+    {
+        sd_card_information.command_preamble_bytes = MAX_COMMAND_PREAMBLE_BYTES;
+    }
 
-        } while (receiving_busy_wait_token);
+    // 8 times the measured read access time (saturating), never less than the fixed default
+    const uint16_t start_block_token_read_limit = (read_access_bytes > (0xFFFF >> 3)) ? 0xFFFF : (read_access_bytes << 3);
+    if (start_block_token_read_limit > NUM_INVALID_READS_LIMIT_START_BLOCK_TOKEN)
+    {
+        sd_card_information.start_block_token_read_limit = start_block_token_read_limit;
+    }
+}
 
-        // de-assert CS to end communication
-        gpio_write(CS_INACTIVE_HIGH, GPIO_D);
-        SPI_write(0xFF, SPI1);
+void SDCard::size_busy_poll_limit()
+{
+    constexpr uint16_t minimum_busy_poll_limit = 16U;
 
-        return sd_card_command_response_t::SD_CARD_RESPONSE_ACCEPTED;
-    } 
-    else if((data_response_token & 0x1F) == 0xB)
+    // the data clock, without a clock callback the card's maximum is an upper bound of the clock
+    // the constructor set, so the limit only comes out longer in time
+    const uint16_t clock_khz = (sd_card_information.spi_clock_khz != 0U) ? sd_card_information.spi_clock_khz : sd_card_information.maximum_clock_khz;
+
+    // 250 ms in bytes is clock_khz * 250 / 8, clock_khz * 250 = (clock_khz << 8) - (clock_khz << 2) - (clock_khz << 1)
+    const Address32 clock = Address32(0x0, clock_khz);
+    Address32 write_timeout_bytes = ((clock << 8) - (clock << 2) - (clock << 1)) >> 3;
+
+    if (sd_card_information.sd_card_standard == sd_card_standard_t::SDSC)
     {
-        // de-assert CS to end communication
-        gpio_write(CS_INACTIVE_HIGH, GPIO_D);
-        SPI_write(0xFF, SPI1);
+        // 100 x R2W_FACTOR x the read access time, never more than 250 ms. The read access time
+        // measured by measure_card_timing() stands in for TAAC + NSAC of the CSD
+        const uint16_t r2w_factor = (sd_card_information.csd_register_contents[12] >> 2) & 0x7;
+        const Address32 read_access = Address32(0x0, sd_card_information.read_access_bytes);
+        const Address32 typical_write_timeout_bytes = ((read_access << 6) + (read_access << 5) + (read_access << 2)) << r2w_factor;
 
-        // data rejecetd due to CRC error
-        return sd_card_command_response_t::SD_CARD_DATA_REJECTED_CRC_ERROR;
+        if (read_access.is_zero() == false && typical_write_timeout_bytes < write_timeout_bytes)
+        {
+            write_timeout_bytes = typical_write_timeout_bytes;
+        }
     }
-    else if((data_response_token & 0x1F) == 0xD)
+    else if ((sd_card_information.csd_register_contents[7] & 0x3F) != 0x0)
     {
-        // de-assert CS to end communication
-        gpio_write(CS_INACTIVE_HIGH, GPIO_D);
-        SPI_write(0xFF, SPI1);
+        // C_SIZE of 0x10000 or more is an SDXC card (over 32 GB), its write timeout is 500 ms
+        write_timeout_bytes <<= 1;
+    }
+
+    // twice the timeout in polls of NUM_BUSY_READS_PER_POLL (512 = 2^9) reads, saturating
+    const Address32 busy_polls = write_timeout_bytes >> 8;
+    sd_card_information.busy_poll_limit = (busy_polls.high() != 0x0) ? 0xFFFF : busy_polls.low();
+    if (sd_card_information.busy_poll_limit < minimum_busy_poll_limit)
+    {
+        sd_card_information.busy_poll_limit = minimum_busy_poll_limit;
+    }
+}
+
+void SDCard::send_dummy_spi_bytes() const
+{
+    for (uint16_t i = 0; i < sd_card_information.command_preamble_bytes; i++)
+    {
+        SPI_write(0xFF, spi_port);
+    }
+}
 
-        // data rejected due to write error
-        return sd_card_command_response_t::SD_CARD_DATA_REJECTED_WRITE_ERROR;
+void SDCard::block_address_to_command_argument(const Address32 &block_address, uint16_t (&command_argument)[4]) const
+{
+    if (sd_card_information.sd_card_standard == sd_card_standard_t::SDSC)
+    {
+        // SDSC cards take a byte address, block length is 512 bytes (2^9)
+        (block_address << 9).to_big_endian(command_argument);
     }
     else
     {
-        // de-assert CS to end communication
-        gpio_write(CS_INACTIVE_HIGH, GPIO_D);
-        SPI_write(0xFF, SPI1);
+        block_address.to_big_endian(command_argument);
+    }
+}
+
+SDCard::sd_card_command_response_t SDCard::send_cmd12() const
+{
+    const uint16_t command_12 = 0x4C;
+
+    // Send 6-byte CMD12 command “4C 00 00 00 00 61” to stop a multiple block read
+    const uint16_t command_argument[4] = {0x0, 0x0, 0x0, 0x0};
+    send_command(command_12, command_argument);
+
+    // the byte immediately following CMD12 is a stuff byte and must be discarded
+    SPI_read(spi_port);
+
+    for (uint16_t i = 0; i < NUM_INVALID_RESPONSE_LIMIT_SPI_READ; i++)
+    {
+        const uint16_t spi_read_value = SPI_read(spi_port);
+
+        if (spi_read_value == static_cast<uint16_t>(sd_card_command_response_t::SD_CARD_NOT_IN_IDLE_MODE_RESPONSE))
+        {
+            // card may signal busy (0x00) after CMD12, wait until it releases the line
+            uint16_t num_busy_reads = 0U;
+            while (SPI_read(spi_port) == 0x00)
+            {
+                num_busy_reads++;
+                if (num_busy_reads > NUM_INVALID_READS_LIMIT_START_BLOCK_TOKEN)
+                {
+                    return sd_card_command_response_t::SD_CARD_NO_RESPONSE;
+                }
+            }
+
+            return sd_card_command_response_t::SD_CARD_RESPONSE_ACCEPTED;
+        }
+    }
+
+    return sd_card_command_response_t::SD_CARD_NO_RESPONSE;
+}
+
+bool SDCard::wait_for_start_block_token() const
+{
+    const uint16_t start_block_token = 0xFE; // sent by SD card
+
+    for (uint16_t i = 0; i < sd_card_information.start_block_token_read_limit; i++)
+    {
+        // exit when 0xFE is read, this indicates next byte is start of block
+        if (SPI_read(spi_port) == start_block_token)
+        {
+            STATISTICS_ADD(statistics.token_polls, i + 1U);
+            return true;
+        }
+    }
 
+    STATISTICS_ADD(statistics.token_polls, sd_card_information.start_block_token_read_limit);
+    STATISTICS_COUNT(statistics.timeouts);
+    return false;
+}
+
+SDCard::sd_card_command_response_t SDCard::send_acmd23(const uint16_t &num_blocks) const
+{
+    const uint16_t application_specific_command_23 = 0x57;
+
+    if (send_cmd55() != sd_card_command_response_t::SD_CARD_RESPONSE_ACCEPTED)
+    {
         return sd_card_command_response_t::SD_CARD_NO_RESPONSE;
     }
+
+    // Send 6-byte ACMD23 command “0x57 00 00 XX XX CC”, number of blocks occupies bits 22-0
+    const uint16_t command_argument[4] = {0x0, 0x0, static_cast<uint16_t>((num_blocks >> 8) & 0xFF),
+                                          static_cast<uint16_t>(num_blocks & 0xFF)};
+    send_command(application_specific_command_23, command_argument);
+
+    for (uint16_t i = 0; i < NUM_INVALID_RESPONSE_LIMIT_SPI_READ; i++)
+    {
+        const uint16_t spi_read_value = SPI_read(spi_port);
+
+        if (spi_read_value == static_cast<uint16_t>(sd_card_command_response_t::SD_CARD_NOT_IN_IDLE_MODE_RESPONSE))
+        {
+            return sd_card_command_response_t::SD_CARD_RESPONSE_ACCEPTED;
+        }
+        else if (spi_read_value != 0xFF)
+        {
+            return sd_card_command_response_t::SD_CARD_NO_RESPONSE;
+        }
+    }
+
+    return sd_card_command_response_t::SD_CARD_NO_RESPONSE;
+}
+
+SDCard::sd_card_command_response_t SDCard::read_data_response_token() const
+{
+    /*
+        structure of data response token: 0bxxx0RRR1
+        RRR has 3 valid forms outlined below:
+        010 -> Data accepted
+        101 -> Data rejected due to CRC error
+        110 -> Data rejected due to a write error
+    */
+    for (uint16_t i = 0; i <= NUM_INVALID_READS_LIMIT_START_BLOCK_TOKEN; i++)
+    {
+        const uint16_t spi_read_value = SPI_read(spi_port);
+
+        if (spi_read_value == 0xFF)
+        {
+            continue;
+        }
+
+        if ((spi_read_value & 0x1F) == 0x5)
+        {
+            return sd_card_command_response_t::SD_CARD_RESPONSE_ACCEPTED;
+        }
+        else if ((spi_read_value & 0x1F) == 0xB)
+        {
+            return sd_card_command_response_t::SD_CARD_DATA_REJECTED_CRC_ERROR;
+        }
+        else if ((spi_read_value & 0x1F) == 0xD)
+        {
+            return sd_card_command_response_t::SD_CARD_DATA_REJECTED_WRITE_ERROR;
+        }
+
+        return sd_card_command_response_t::SD_CARD_NO_RESPONSE;
+    }
+
+    STATISTICS_COUNT(statistics.timeouts);
+    return sd_card_command_response_t::SD_CARD_NO_RESPONSE;
+}
+
+bool SDCard::wait_until_ready() const
+{
+    for (uint16_t i = 0; i < sd_card_information.busy_poll_limit; i++)
+    {
+        if (poll_write_completion(NUM_BUSY_READS_PER_POLL))
+        {
+            return true;
+        }
+    }
+
+    // give up on the write, the next command finds out if the card is still there
+    STATISTICS_COUNT(statistics.timeouts);
+    write_in_progress = false;
+    return false;
+}
+
+bool SDCard::poll_write_completion(const uint16_t &poll_budget) const
+{
+    constexpr uint16_t busy_wait_token = 0x00; // sent by SD card
+
+    if (write_in_progress == false)
+    {
+        return true;
+    }
+
+    // the card only drives its busy signal while CS is asserted
+    gpio_write(CS_ACTIVE_LOW, cs_port);
+
+    for (uint16_t i = 0; i < poll_budget; i++)
+    {
+        if (SPI_read(spi_port) != busy_wait_token)
+        {
+            write_in_progress = false;
+
+            if (busy_bytes_of_write > longest_busy_bytes)
+            {
+                longest_busy_bytes = busy_bytes_of_write;
+            }
+            busy_bytes_of_write = 0U;
+            break;
+        }
+
+        STATISTICS_COUNT(statistics.busy_spins);
+        if (busy_bytes_of_write < 0xFFFF)
+        {
+            busy_bytes_of_write++;
+        }
+    }
+
+    // de-assert CS to end communication
+    gpio_write(CS_INACTIVE_HIGH, cs_port);
+    SPI_write(0xFF, spi_port);
+
+    return write_in_progress == false;
+}
+
+bool SDCard::is_busy() const
+{
+    return poll_write_completion(1U) == false;
+}
+
+void SDCard::send_command(const uint16_t &command, const uint16_t (&command_argument)[4]) const
+{
+    uint16_t crc_7 = update_crc7(0x0, command);
+
+    SPI_write(command, spi_port);
+    for (uint16_t i = 0; i < 4U; i++)
+    {
+        SPI_write(command_argument[i], spi_port);
+        crc_7 = update_crc7(crc_7, command_argument[i]);
+    }
+
+    // CRC7 in the upper 7 bits, the end bit is always 1
+    SPI_write(crc_7 | 0x1, spi_port);
+}
+
+bool SDCard::read_data_block(uint16_t *words) const
+{
+    if (crc_mode == false)
+    {
+        read_packed_data_block(words);
+
+        // discard the two CRC16 bytes that follow every data block
+        SPI_read(spi_port);
+        SPI_read(spi_port);
+        return true;
+    }
+
+    const uint16_t computed_crc_16 = read_packed_data_block_with_crc(words);
+
+    // CRC16 is sent MSB first
+    const uint16_t crc_16_high_byte = SPI_read(spi_port) & 0xFF;
+    const uint16_t received_crc_16 = (crc_16_high_byte << 8) | (SPI_read(spi_port) & 0xFF);
+
+    return computed_crc_16 == received_crc_16;
+}
+
+void SDCard::write_data_block(const uint16_t *words) const
+{
+    if (crc_mode == false)
+    {
+        write_packed_data_block(words);
+
+        // two CRC16 bytes, ignored by the card unless CRC checking has been turned on
+        SPI_write(0xFF, spi_port);
+        SPI_write(0xFF, spi_port);
+        return;
+    }
+
+    const uint16_t crc_16 = write_packed_data_block_with_crc(words);
+
+    // CRC16 is sent MSB first
+    SPI_write(crc_16 >> 8, spi_port);
+    SPI_write(crc_16 & 0xFF, spi_port);
+}
+
+uint16_t SDCard::read_packed_data_block_with_crc(uint16_t *words) const
+{
+    // same packing as read_packed_data_block(), the CRC is updated as each byte comes off SPI so
+    // the block is never gone over a second time
+    uint16_t crc_16 = 0x0;
+
+    for (uint16_t i = 0; i < PackedSector::words_per_sector; i++)
+    {
+        const uint16_t low_byte = SPI_read(spi_port) & 0xFF;
+        crc_16 = update_crc16(crc_16, low_byte);
+
+        const uint16_t high_byte = SPI_read(spi_port) & 0xFF;
+        crc_16 = update_crc16(crc_16, high_byte);
+
+        words[i] = (high_byte << 8) | low_byte;
+    }
+
+    return crc_16;
+}
+
+uint16_t SDCard::write_packed_data_block_with_crc(const uint16_t *words) const
+{
+    uint16_t crc_16 = 0x0;
+
+    for (uint16_t i = 0; i < PackedSector::words_per_sector; i++)
+    {
+        const uint16_t low_byte = words[i] & 0xFF;
+        SPI_write(low_byte, spi_port);
+        crc_16 = update_crc16(crc_16, low_byte);
+
+        const uint16_t high_byte = words[i] >> 8;
+        SPI_write(high_byte, spi_port);
+        crc_16 = update_crc16(crc_16, high_byte);
+    }
+
+    return crc_16;
+}
+
+void SDCard::read_packed_data_block(uint16_t *words) const
+{
+    // byte 2n goes in the lower 8 bits of word n and byte 2n+1 in the upper 8 bits, the shift
+    // drops anything above the 8 bits of the high byte so only the low byte is masked. Unrolled by
+    // hand (SXC_UNROLL_THRESHOLD is too low for the compiler to) so the loop overhead is paid
+    // every 16 bytes rather than every 2
+    constexpr uint16_t words_per_step = 8U; // written out below, divides words_per_sector
+
+    for (uint16_t i = 0; i < PackedSector::words_per_sector; i += words_per_step)
+    {
+        uint16_t *step_words = words + i;
+        uint16_t low_byte = 0U;
+
+        low_byte = SPI_read(spi_port) & 0xFF;
+        step_words[0] = (SPI_read(spi_port) << 8) | low_byte;
+        low_byte = SPI_read(spi_port) & 0xFF;
+        step_words[1] = (SPI_read(spi_port) << 8) | low_byte;
+        low_byte = SPI_read(spi_port) & 0xFF;
+        step_words[2] = (SPI_read(spi_port) << 8) | low_byte;
+        low_byte = SPI_read(spi_port) & 0xFF;
+        step_words[3] = (SPI_read(spi_port) << 8) | low_byte;
+        low_byte = SPI_read(spi_port) & 0xFF;
+        step_words[4] = (SPI_read(spi_port) << 8) | low_byte;
+        low_byte = SPI_read(spi_port) & 0xFF;
+        step_words[5] = (SPI_read(spi_port) << 8) | low_byte;
+        low_byte = SPI_read(spi_port) & 0xFF;
+        step_words[6] = (SPI_read(spi_port) << 8) | low_byte;
+        low_byte = SPI_read(spi_port) & 0xFF;
+        step_words[7] = (SPI_read(spi_port) << 8) | low_byte;
+    }
+}
+
+void SDCard::write_packed_data_block(const uint16_t *words) const
+{
+    // unrolled by hand, see read_packed_data_block()
+    constexpr uint16_t words_per_step = 8U; // written out below, divides words_per_sector
+
+    for (uint16_t i = 0; i < PackedSector::words_per_sector; i += words_per_step)
+    {
+        const uint16_t *step_words = words + i;
+
+        SPI_write(step_words[0] & 0xFF, spi_port);
+        SPI_write(step_words[0] >> 8, spi_port);
+        SPI_write(step_words[1] & 0xFF, spi_port);
+        SPI_write(step_words[1] >> 8, spi_port);
+        SPI_write(step_words[2] & 0xFF, spi_port);
+        SPI_write(step_words[2] >> 8, spi_port);
+        SPI_write(step_words[3] & 0xFF, spi_port);
+        SPI_write(step_words[3] >> 8, spi_port);
+        SPI_write(step_words[4] & 0xFF, spi_port);
+        SPI_write(step_words[4] >> 8, spi_port);
+        SPI_write(step_words[5] & 0xFF, spi_port);
+        SPI_write(step_words[5] >> 8, spi_port);
+        SPI_write(step_words[6] & 0xFF, spi_port);
+        SPI_write(step_words[6] >> 8, spi_port);
+        SPI_write(step_words[7] & 0xFF, spi_port);
+        SPI_write(step_words[7] >> 8, spi_port);
+    }
+}
+
+SDCard::sd_card_command_response_t SDCard::send_cmd17(uint16_t (&block)[512], const Address32 &block_address) const
+{
+    // same read as the packed overload, so the CRC16 is checked (and the block read again) too
+    PackedSector sector;
+    const sd_card_command_response_t read_response = send_cmd17(sector, block_address);
+
+    if (read_response == sd_card_command_response_t::SD_CARD_RESPONSE_ACCEPTED)
+    {
+        sector.unpack(block);
+    }
+
+    return read_response;
+}
+
+SDCard::sd_card_command_response_t SDCard::send_cmd24(const uint16_t (&block)[512], const Address32 &block_address) const
+{
+    // same write as the packed overload, so the CRC16 is sent (and the block sent again if the card
+    // rejects it) and the busy wait is bounded too
+    PackedSector sector;
+    sector.pack(block);
+
+    return send_cmd24(sector, block_address);
+}
+
+SDCard::sd_card_command_response_t SDCard::send_cmd17(PackedSector &sector, const Address32 &block_address) const
+{
+    const uint16_t command_17 = 0x51;
+
+    uint16_t command_argument[4];
+    block_address_to_command_argument(block_address, command_argument);
+
+    // a block that fails its CRC check is read again
+    for (uint16_t attempt = 0; ; attempt++)
+    {
+        // the card ignores commands while it is still programming an earlier write
+        if (wait_until_ready() == false)
+        {
+            return sd_card_command_response_t::SD_CARD_NO_RESPONSE;
+        }
+
+        // assert CS to start communication
+        gpio_write(CS_ACTIVE_LOW, cs_port);
+        send_dummy_spi_bytes();
+
+        // Send 6-byte CMD17 command “0x51  XX XX XX XX CC” to read a block from sd card
+        send_command(command_17, command_argument);
+        STATISTICS_COUNT(statistics.cmd17_commands);
+
+        if (wait_for_start_block_token() == false)
+        {
+            // de-assert CS to end communication
+            gpio_write(CS_INACTIVE_HIGH, cs_port);
+            SPI_write(0xFF, spi_port);
+
+            // return early if num invalid read threshold is reached
+            return sd_card_command_response_t::SD_CARD_NO_RESPONSE;
+        }
+
+        const bool block_valid = read_data_block(sector.words);
+
+        // de-assert CS to end communication
+        gpio_write(CS_INACTIVE_HIGH, cs_port);
+        SPI_write(0xFF, spi_port);
+
+        if (block_valid)
+        {
+            return sd_card_command_response_t::SD_CARD_RESPONSE_ACCEPTED;
+        }
+
+        if (attempt == NUM_CRC_RETRIES)
+        {
+            return sd_card_command_response_t::SD_CARD_NO_RESPONSE;
+        }
+
+        crc_retries++;
+    }
+}
+
+SDCard::sd_card_command_response_t SDCard::send_cmd24(const PackedSector &sector, const Address32 &block_address) const
+{
+    const sd_card_command_response_t write_response = issue_cmd24(sector, block_address);
+
+    // data accepted now simply wait until the card has programmed it
+    wait_until_ready();
+
+    return write_response;
+}
+
+SDCard::sd_card_command_response_t SDCard::issue_cmd24(const PackedSector &sector, const Address32 &block_address) const
+{
+    constexpr uint16_t command_24 = 0x58;
+    constexpr uint16_t start_block_token = 0xFE; // sent to SD card
+
+    uint16_t command_argument[4];
+    block_address_to_command_argument(block_address, command_argument);
+
+    // a block the card rejects because of a CRC error is sent again
+    for (uint16_t attempt = 0; ; attempt++)
+    {
+        // the card ignores commands while it is still programming an earlier write
+        if (wait_until_ready() == false)
+        {
+            return sd_card_command_response_t::SD_CARD_NO_RESPONSE;
+        }
+
+        // assert CS to start communication
+        gpio_write(CS_ACTIVE_LOW, cs_port);
+        send_dummy_spi_bytes();
+
+        // Send 6-byte CMD24 command “0x58 XX XX XX XX CC” to write a block to sd card
+        send_command(command_24, command_argument);
+        STATISTICS_COUNT(statistics.cmd24_commands);
+
+        bool valid_r1_reponse = false;
+
+        // wait for a valid response back
+        for (uint16_t i = 0; i < NUM_INVALID_RESPONSE_LIMIT_SPI_READ; i++)
+        {
+            const uint16_t spi_read_value = SPI_read(spi_port);
+
+            if (spi_read_value == static_cast<uint16_t>(sd_card_command_response_t::SD_CARD_NOT_IN_IDLE_MODE_RESPONSE))
+            {
+                valid_r1_reponse = true;
+                break;
+            }
+        }
+
+        if (valid_r1_reponse == false)
+        {
+            STATISTICS_COUNT(statistics.timeouts);
+
+            // de-assert CS to end communication
+            gpio_write(CS_INACTIVE_HIGH, cs_port);
+            SPI_write(0xFF, spi_port);
+
+            // return early because of no response from SD card
+            return sd_card_command_response_t::SD_CARD_NO_RESPONSE;
+        }
+
+        // send start block token to notify SD card that block is starting
+        SPI_write(start_block_token, spi_port);
+
+        // Send 512 bytes of data and the CRC16
+        write_data_block(sector.words);
+
+        const sd_card_command_response_t write_response = read_data_response_token();
+
+        // data accepted, the card keeps programming it after CS is de-asserted
+        if (write_response == sd_card_command_response_t::SD_CARD_RESPONSE_ACCEPTED)
+        {
+            write_in_progress = true;
+        }
+
+        // de-assert CS to end communication
+        gpio_write(CS_INACTIVE_HIGH, cs_port);
+        SPI_write(0xFF, spi_port);
+
+        if (write_response != sd_card_command_response_t::SD_CARD_DATA_REJECTED_CRC_ERROR || crc_mode == false ||
+            attempt == NUM_CRC_RETRIES)
+        {
+            return write_response;
+        }
+
+        crc_retries++;
+    }
+}
+
+SDCard::sd_card_command_response_t SDCard::send_cmd18(PackedSector &block, const Address32 &block_address, const uint16_t &num_blocks,
+                                                        block_read_callback_t block_callback, void *context) const
+{
+    return read_multiple_blocks(block.words, &block, block_address, num_blocks, block_callback, context);
+}
+
+SDCard::sd_card_command_response_t SDCard::send_cmd18(uint16_t *words, const Address32 &block_address, const uint16_t &num_blocks) const
+{
+    return read_multiple_blocks(words, nullptr, block_address, num_blocks, nullptr, nullptr);
+}
+
+SDCard::sd_card_command_response_t SDCard::read_multiple_blocks(uint16_t *words, PackedSector *callback_block, const Address32 &block_address,
+                                                        const uint16_t &num_blocks, block_read_callback_t block_callback, void *context) const
+{
+    const uint16_t command_18 = 0x52;
+
+    if (num_blocks == 0U)
+    {
+        return sd_card_command_response_t::SD_CARD_RESPONSE_ACCEPTED;
+    }
+
+    uint16_t block_index = 0U;
+    uint16_t attempts_left = NUM_CRC_RETRIES;
+
+    // a block that fails its CRC check ends the transfer, which is restarted at that block (the
+    // callback has not seen it yet)
+    while (true)
+    {
+        uint16_t command_argument[4];
+        block_address_to_command_argument(block_address + Address32(0x0, block_index), command_argument);
+
+        // the card ignores commands while it is still programming an earlier write
+        if (wait_until_ready() == false)
+        {
+            return sd_card_command_response_t::SD_CARD_NO_RESPONSE;
+        }
+
+        // assert CS to start communication
+        gpio_write(CS_ACTIVE_LOW, cs_port);
+        send_dummy_spi_bytes();
+
+        // Send 6-byte CMD18 command “0x52  XX XX XX XX CC” to read multiple blocks from sd card
+        send_command(command_18, command_argument);
+        STATISTICS_COUNT(statistics.cmd18_commands);
+
+        bool all_blocks_received = true;
+        bool block_invalid = false;
+
+        // the card keeps sending blocks (each preceded by a start block token) until CMD12 is sent
+        for (; block_index < num_blocks; block_index++)
+        {
+            if (wait_for_start_block_token() == false)
+            {
+                all_blocks_received = false;
+                break;
+            }
+
+            // without a callback every block goes straight into the next 256 words of the callers buffer
+            if (read_data_block(words) == false)
+            {
+                block_invalid = true;
+                break;
+            }
+
+            if (callback_block == nullptr)
+            {
+                words += PackedSector::words_per_sector;
+            }
+            else if (block_callback(*callback_block, block_index, context) == false)
+            {
+                // caller does not need the remaining blocks
+                break;
+            }
+        }
+
+        const sd_card_command_response_t cmd12_response = send_cmd12();
+
+        // de-assert CS to end communication
+        gpio_write(CS_INACTIVE_HIGH, cs_port);
+        SPI_write(0xFF, spi_port);
+
+        if (block_invalid && attempts_left > 0U)
+        {
+            attempts_left--;
+            crc_retries++;
+            continue;
+        }
+
+        if (block_invalid || all_blocks_received == false || cmd12_response != sd_card_command_response_t::SD_CARD_RESPONSE_ACCEPTED)
+        {
+            return sd_card_command_response_t::SD_CARD_NO_RESPONSE;
+        }
+
+        return sd_card_command_response_t::SD_CARD_RESPONSE_ACCEPTED;
+    }
+}
+
+SDCard::sd_card_command_response_t SDCard::send_cmd25(PackedSector &block, const Address32 &block_address, const uint16_t &num_blocks,
+                                                        block_write_callback_t block_callback, void *context) const
+{
+    return write_multiple_blocks(block.words, &block, block_address, num_blocks, block_callback, context);
+}
+
+SDCard::sd_card_command_response_t SDCard::send_cmd25(const uint16_t *words, const Address32 &block_address, const uint16_t &num_blocks) const
+{
+    return write_multiple_blocks(words, nullptr, block_address, num_blocks, nullptr, nullptr);
+}
+
+SDCard::sd_card_command_response_t SDCard::write_multiple_blocks(const uint16_t *words, PackedSector *callback_block, const Address32 &block_address,
+                                                        const uint16_t &num_blocks, block_write_callback_t block_callback, void *context) const
+{
+    constexpr uint16_t command_25 = 0x59;
+    constexpr uint16_t start_block_token = 0xFC; // sent to SD card before each block
+    constexpr uint16_t stop_tran_token = 0xFD; // sent to SD card to end the transfer
+
+    if (num_blocks == 0U)
+    {
+        return sd_card_command_response_t::SD_CARD_RESPONSE_ACCEPTED;
+    }
+
+    uint16_t block_index = 0U;
+    uint16_t attempts_left = NUM_CRC_RETRIES;
+
+    // set once block_callback has produced the block at block_index, so a block rejected because
+    // of a CRC error is sent again from callback_block rather than produced twice
+    bool block_produced = false;
+
+    sd_card_command_response_t write_response = sd_card_command_response_t::SD_CARD_RESPONSE_ACCEPTED;
+
+    // a block rejected because of a CRC error ends the transfer, which is restarted at that block
+    while (true)
+    {
+        uint16_t command_argument[4];
+        block_address_to_command_argument(block_address + Address32(0x0, block_index), command_argument);
+
+        // the card ignores commands while it is still programming an earlier write
+        if (wait_until_ready() == false)
+        {
+            return sd_card_command_response_t::SD_CARD_NO_RESPONSE;
+        }
+
+        // assert CS to start communication
+        gpio_write(CS_ACTIVE_LOW, cs_port);
+        send_dummy_spi_bytes();
+
+        // tell the card how many blocks are coming so it can erase them ahead of time, this is
+        // only an optimization so failure is not fatal to the write
+        send_acmd23(num_blocks - block_index);
+        send_dummy_spi_bytes();
+
+        // Send 6-byte CMD25 command “0x59 XX XX XX XX CC” to write multiple blocks to sd card
+        send_command(command_25, command_argument);
+        STATISTICS_COUNT(statistics.cmd25_commands);
+
+        bool valid_r1_reponse = false;
+
+        // wait for a valid response back
+        for (uint16_t i = 0; i < NUM_INVALID_RESPONSE_LIMIT_SPI_READ; i++)
+        {
+            const uint16_t spi_read_value = SPI_read(spi_port);
+
+            if (spi_read_value == static_cast<uint16_t>(sd_card_command_response_t::SD_CARD_NOT_IN_IDLE_MODE_RESPONSE))
+            {
+                valid_r1_reponse = true;
+                break;
+            }
+        }
+
+        if (valid_r1_reponse == false)
+        {
+            STATISTICS_COUNT(statistics.timeouts);
+
+            // de-assert CS to end communication
+            gpio_write(CS_INACTIVE_HIGH, cs_port);
+            SPI_write(0xFF, spi_port);
+
+            // return early because of no response from SD card
+            return sd_card_command_response_t::SD_CARD_NO_RESPONSE;
+        }
+
+        for (; block_index < num_blocks; block_index++)
+        {
+            if (callback_block != nullptr && block_produced == false)
+            {
+                if (block_callback(*callback_block, block_index, context) == false)
+                {
+                    // producer has no more data, end the transfer early
+                    break;
+                }
+                block_produced = true;
+            }
+
+            // send start block token to notify SD card that the next block is starting
+            SPI_write(start_block_token, spi_port);
+
+            // Send 512 bytes of data and the CRC16, without a callback straight from the next 256
+            // words of the callers buffer
+            write_data_block(words);
+
+            write_response = read_data_response_token();
+
+            if (write_response != sd_card_command_response_t::SD_CARD_RESPONSE_ACCEPTED)
+            {
+                // block was rejected, the remaining blocks are not sent
+                break;
+            }
+
+            block_produced = false;
+            if (callback_block == nullptr)
+            {
+                words += PackedSector::words_per_sector;
+            }
+
+            // data accepted, wait for the card to finish programming the block (CS is released
+            // between polls, the card keeps its place in the transfer)
+            write_in_progress = true;
+            if (wait_until_ready() == false)
+            {
+                // the card never finished, abort the transfer rather than send it more blocks
+                gpio_write(CS_ACTIVE_LOW, cs_port);
+                SPI_write(stop_tran_token, spi_port);
+                SPI_read(spi_port);
+
+                // de-assert CS to end communication
+                gpio_write(CS_INACTIVE_HIGH, cs_port);
+                SPI_write(0xFF, spi_port);
+
+                return sd_card_command_response_t::SD_CARD_NO_RESPONSE;
+            }
+            gpio_write(CS_ACTIVE_LOW, cs_port);
+        }
+
+        // end the transfer, the byte after the stop tran token is a stuff byte and then the card
+        // goes busy while it finishes programming, which is left to the next command/ poll
+        SPI_write(stop_tran_token, spi_port);
+        SPI_read(spi_port);
+        write_in_progress = true;
+
+        // de-assert CS to end communication
+        gpio_write(CS_INACTIVE_HIGH, cs_port);
+        SPI_write(0xFF, spi_port);
+
+        if (write_response == sd_card_command_response_t::SD_CARD_DATA_REJECTED_CRC_ERROR && crc_mode && attempts_left > 0U)
+        {
+            attempts_left--;
+            crc_retries++;
+            write_response = sd_card_command_response_t::SD_CARD_RESPONSE_ACCEPTED;
+            continue;
+        }
+
+        return write_response;
+    }
+}
+
+bool SDCard::read_block(PackedSector &block, const Address32 &block_address)
+{
+    STATISTICS_TIME_OPERATION(statistics.single_block_reads);
+
+    return send_cmd17(block, block_address) == sd_card_command_response_t::SD_CARD_RESPONSE_ACCEPTED;
+}
+
+bool SDCard::write_block(const PackedSector &block, const Address32 &block_address)
+{
+    STATISTICS_TIME_OPERATION(statistics.single_block_writes);
+
+    return issue_cmd24(block, block_address) == sd_card_command_response_t::SD_CARD_RESPONSE_ACCEPTED;
+}
+
+bool SDCard::read_blocks(PackedSector &block, const Address32 &block_address, const uint16_t &num_blocks,
+                            block_read_callback_t block_callback, void *context)
+{
+    STATISTICS_TIME_OPERATION(statistics.multiple_block_reads);
+
+    return send_cmd18(block, block_address, num_blocks, block_callback, context) ==
+                sd_card_command_response_t::SD_CARD_RESPONSE_ACCEPTED;
+}
+
+bool SDCard::write_blocks(PackedSector &block, const Address32 &block_address, const uint16_t &num_blocks,
+                            block_write_callback_t block_callback, void *context)
+{
+    STATISTICS_TIME_OPERATION(statistics.multiple_block_writes);
+
+    return send_cmd25(block, block_address, num_blocks, block_callback, context) ==
+                sd_card_command_response_t::SD_CARD_RESPONSE_ACCEPTED;
+}
+
+bool SDCard::read_contiguous_blocks(uint16_t *words, const Address32 &block_address, const uint16_t &num_blocks)
+{
+    STATISTICS_TIME_OPERATION(statistics.multiple_block_reads);
+
+    return send_cmd18(words, block_address, num_blocks) == sd_card_command_response_t::SD_CARD_RESPONSE_ACCEPTED;
+}
+
+bool SDCard::write_contiguous_blocks(const uint16_t *words, const Address32 &block_address, const uint16_t &num_blocks)
+{
+    STATISTICS_TIME_OPERATION(statistics.multiple_block_writes);
+
+    return send_cmd25(words, block_address, num_blocks) == sd_card_command_response_t::SD_CARD_RESPONSE_ACCEPTED;
+}
+
+bool SDCard::flush()
+{
+    return wait_until_ready();
+}
+
+Address32 SDCard::get_allocation_unit_blocks() const
+{
+    return sd_card_information.allocation_unit_blocks;
 }
@@ -0,0 +1,272 @@
+/**
+ * @file SectorPipeline.cpp
+ * @author Mattheas Jamieson (mattheas@ualberta.ca)
+ * @brief Implementation of double buffered (ping-pong) sector write pipeline
+ * @version 0.1
+ * @date 2024-03-03
+ */
+
+#include "../inc/SectorPipeline.h"
+
+using namespace sd_driver;
+
+SectorPipeline::SectorPipeline(AsyncBlockDevice &_io_worker, PipelineSector *_sectors, const uint16_t _number_of_sectors,
+                                const bool &_poll_io_worker)
+    : io_worker(_io_worker), sectors(_sectors), number_of_sectors(_number_of_sectors), poll_io_worker(_poll_io_worker)
+{
+    for (uint16_t i = 0; i < number_of_sectors; i++)
+    {
+        sectors[i].request.status = block_request_status_t::DONE;
+        sectors[i].request.completed_callback = nullptr;
+    }
+}
+
+SectorPipeline::~SectorPipeline()
+{
+    flush();
+}
+
+bool SectorPipeline::read_block(PackedSector &block, const Address32 &block_address)
+{
+    return read_contiguous_blocks(block.words, block_address, 1U);
+}
+
+bool SectorPipeline::write_block(const PackedSector &block, const Address32 &block_address)
+{
+    PipelineSector &sector = acquire_sector();
+
+    sector.data = block;
+    submit_write(sector, block_address);
+
+    return write_failed == false;
+}
+
+bool SectorPipeline::read_blocks(PackedSector &block, const Address32 &block_address, const uint16_t &num_blocks,
+                                    block_read_callback_t block_callback, void *context)
+{
+    // sector buffer holding block_index, the reads are queued in the order acquire_sector() hands out buffers
+    uint16_t reading_sector = next_sector;
+    uint16_t blocks_queued = 0U;
+
+    for (uint16_t block_index = 0; block_index < num_blocks; block_index++)
+    {
+        // keep every sector buffer busy reading ahead of the callback
+        while (blocks_queued < num_blocks && blocks_queued - block_index < number_of_sectors)
+        {
+            PipelineSector &sector = acquire_sector();
+
+            sector.request.type = block_request_type_t::READ;
+            sector.request.read_words = sector.data.words;
+            sector.request.write_words = nullptr;
+            sector.request.block_address = block_address + Address32(0x0, blocks_queued);
+            sector.request.num_blocks = 1U;
+            submit(sector.request);
+
+            blocks_queued++;
+        }
+
+        PipelineSector &sector = sectors[reading_sector];
+        reading_sector++;
+        if (reading_sector >= number_of_sectors)
+        {
+            reading_sector = 0U;
+        }
+
+        // reads still queued when this returns early are left to complete, their buffers are
+        // reused once they have
+        wait_for(sector.request, false);
+        if (sector.request.status == block_request_status_t::FAILED)
+        {
+            return false;
+        }
+
+        block = sector.data;
+        if (block_callback(block, block_index, context) == false)
+        {
+            return true;
+        }
+    }
+
+    return true;
+}
+
+bool SectorPipeline::write_blocks(PackedSector &block, const Address32 &block_address, const uint16_t &num_blocks,
+                                    block_write_callback_t block_callback, void *context)
+{
+    (void)block;
+
+    for (uint16_t block_index = 0; block_index < num_blocks; block_index++)
+    {
+        PipelineSector &sector = acquire_sector();
+
+        if (block_callback(sector.data, block_index, context) == false)
+        {
+            break;
+        }
+
+        submit_write(sector, block_address + Address32(0x0, block_index));
+    }
+
+    return write_failed == false;
+}
+
+bool SectorPipeline::read_contiguous_blocks(uint16_t *words, const Address32 &block_address, const uint16_t &num_blocks)
+{
+    // queued behind any writes still in flight, so the data read is never older than them
+    read_request.type = block_request_type_t::READ;
+    read_request.read_words = words;
+    read_request.write_words = nullptr;
+    read_request.block_address = block_address;
+    read_request.num_blocks = num_blocks;
+    submit(read_request);
+
+    wait_for(read_request, false);
+    return read_request.status == block_request_status_t::DONE;
+}
+
+bool SectorPipeline::write_contiguous_blocks(const uint16_t *words, const Address32 &block_address, const uint16_t &num_blocks)
+{
+    for (uint16_t block_index = 0; block_index < num_blocks; block_index++)
+    {
+        PipelineSector &sector = acquire_sector();
+
+        const uint16_t *block_words = words + (block_index << 8);
+        for (uint16_t i = 0; i < PackedSector::words_per_sector; i++)
+        {
+            sector.data.words[i] = block_words[i];
+        }
+
+        submit_write(sector, block_address + Address32(0x0, block_index));
+    }
+
+    return write_failed == false;
+}
+
+bool SectorPipeline::flush()
+{
+    for (uint16_t i = 0; i < number_of_sectors; i++)
+    {
+        wait_for(sectors[i].request, false);
+        check_write_result(sectors[i]);
+    }
+
+    const bool writes_succeeded = write_failed == false;
+    write_failed = false;
+
+    return writes_succeeded;
+}
+
+Address32 SectorPipeline::get_allocation_unit_blocks() const
+{
+    return io_worker.get_allocation_unit_blocks();
+}
+
+uint16_t SectorPipeline::get_sectors_in_flight() const
+{
+    uint16_t sectors_in_flight = 0U;
+
+    for (uint16_t i = 0; i < number_of_sectors; i++)
+    {
+        if (sectors[i].request.status == block_request_status_t::PENDING)
+        {
+            sectors_in_flight++;
+        }
+    }
+
+    return sectors_in_flight;
+}
+
+SectorPipeline::PipelineStatistics SectorPipeline::get_statistics() const
+{
+    return statistics;
+}
+
+void SectorPipeline::reset_statistics()
+{
+    statistics = PipelineStatistics();
+}
+
+SectorPipeline::PipelineSector &SectorPipeline::acquire_sector()
+{
+    PipelineSector &sector = sectors[next_sector];
+
+    next_sector++;
+    if (next_sector >= number_of_sectors)
+    {
+        next_sector = 0U;
+    }
+
+    if (sector.request.status == block_request_status_t::PENDING)
+    {
+        // the card has not kept up with the producer
+        statistics.producer_stalls += Address32(0x0, 0x1);
+        wait_for(sector.request, true);
+    }
+
+    check_write_result(sector);
+    return sector;
+}
+
+void SectorPipeline::wait_for(const BlockRequest &request, const bool &stalled)
+{
+    while (request.status == block_request_status_t::PENDING)
+    {
+        if (stalled)
+        {
+            statistics.stall_polls += Address32(0x0, 0x1);
+        }
+
+        if (poll_io_worker)
+        {
+            io_worker.poll();
+        }
+    }
+}
+
+void SectorPipeline::check_write_result(PipelineSector &sector)
+{
+    if (sector.request.type == block_request_type_t::WRITE && sector.request.status == block_request_status_t::FAILED)
+    {
+        write_failed = true;
+        statistics.failed_writes += Address32(0x0, 0x1);
+
+        // only counted the first time the buffer is checked
+        sector.request.status = block_request_status_t::DONE;
+    }
+}
+
+void SectorPipeline::submit(BlockRequest &request)
+{
+    if (io_worker.submit(request) == false)
+    {
+        statistics.producer_stalls += Address32(0x0, 0x1);
+
+        while (io_worker.submit(request) == false)
+        {
+            statistics.stall_polls += Address32(0x0, 0x1);
+
+            if (poll_io_worker)
+            {
+                io_worker.poll();
+            }
+        }
+    }
+
+    const uint16_t requests_in_flight = io_worker.get_number_of_pending_requests();
+    if (requests_in_flight > statistics.max_requests_in_flight)
+    {
+        statistics.max_requests_in_flight = requests_in_flight;
+    }
+}
+
+void SectorPipeline::submit_write(PipelineSector &sector, const Address32 &block_address)
+{
+    sector.request.type = block_request_type_t::WRITE;
+    sector.request.read_words = nullptr;
+    sector.request.write_words = sector.data.words;
+    sector.request.block_address = block_address;
+    sector.request.num_blocks = 1U;
+    submit(sector.request);
+
+    statistics.blocks_written += Address32(0x0, 0x1);
+}
@@ -0,0 +1,73 @@
+/**
+ * @file Statistics.cpp
+ * @author Mattheas Jamieson (mattheas@ualberta.ca)
+ * @brief Implementation of compile time optional hot path statistics (counters and operation timing)
+ * @version 0.1
+ * @date 2024-03-03
+ */
+
+#include "../inc/Statistics.h"
+#include <XPD.h>
+
+using namespace sd_driver;
+
+namespace
+{
+/**
+ * @brief Prints a 32 bit value as 8 hex digits, a 32 bit decimal conversion would need division
+ */
+void xpd_echo_hex(const Address32 &value)
+{
+    xpd_puts("0x");
+
+    for (uint16_t shift = 28U; ; shift -= 4U)
+    {
+        const uint16_t nibble = (value >> shift).low() & 0xF;
+        xpd_putc(nibble < 10U ? '0' + nibble : 'A' + (nibble - 10U));
+
+        if (shift == 0U)
+        {
+            break;
+        }
+    }
+}
+} // namespace
+
+StatisticsClock::tick_source_t StatisticsClock::tick_source = nullptr;
+
+void OperationStatistics::record(const uint16_t &start_ticks)
+{
+    // unsigned subtraction gives the elapsed ticks even if the counter wrapped
+    const uint16_t elapsed_ticks = StatisticsClock::read_ticks() - start_ticks;
+
+    count += Address32(0x0, 0x1);
+    ticks += Address32(0x0, elapsed_ticks);
+}
+
+void StatisticsClock::set_tick_source(tick_source_t _tick_source)
+{
+    tick_source = _tick_source;
+}
+
+uint16_t StatisticsClock::read_ticks()
+{
+    return (tick_source != nullptr) ? tick_source() : 0U;
+}
+
+void sd_driver::xpd_echo_statistic(const char *name, const Address32 &value)
+{
+    xpd_puts(name);
+    xpd_puts(": ");
+    xpd_echo_hex(value);
+    xpd_putc('\n');
+}
+
+void sd_driver::xpd_echo_operation_statistics(const char *name, const OperationStatistics &operation)
+{
+    xpd_puts(name);
+    xpd_puts(": count ");
+    xpd_echo_hex(operation.count);
+    xpd_puts(" ticks ");
+    xpd_echo_hex(operation.ticks);
+    xpd_putc('\n');
+}
@@ -29,13 +29,19 @@ void short_wait()
 int main(void)
 {
     SDCard my_sdcard(true);
+
+    // the board only has SPI_set_config_optimal(), the data clock is still set (and reported) through the ramp
+    SDCard::OptimalSPIClock optimal_spi_clock;
+    my_sdcard.set_spi_clock_callback(SDCard::optimal_spi_clock_callback, &optimal_spi_clock);
+
     xpd_putc('\n');
     xpd_putc('\n');
     xpd_echo_int(static_cast<uint16_t>(my_sdcard.initialize_sd_card()), XPD_Flag_UnsignedDecimal);
     xpd_putc('\n');
     xpd_putc('\n');
 
-    FileSystem my_filesystem(my_sdcard, FileSystem::file_system_t::FAT32);
+    MountManager my_mount_manager;
+    FileSystem my_filesystem(my_mount_manager, my_sdcard, FileSystem::file_system_t::FAT32);
     xpd_putc('\n');
     xpd_putc('\n');
 